@@ -0,0 +1,277 @@
+/**
+ * @file futex_lock_bench.c
+ * @brief Futex mutex and reader-writer lock throughput under contention
+ *
+ * Runs 1 to 64 threads over one shared lock guarding a small table. The
+ * mutex workload compares the previous fixed-spin futex mutex, kept here
+ * as a baseline, with the adaptive-spin futex_mutex; every operation takes
+ * the lock. The read-heavy workload has READ_PERCENT% of operations read
+ * the table and the rest update it, and compares the adaptive mutex, which
+ * serialises the readers too, with futex_rwlock and pthread_rwlock.
+ *
+ * A fixed TOTAL_OPS is split across the threads so every run does the same
+ * work. Threads do a little private work between operations, as real
+ * callers do.
+ *
+ * Usage: futex_lock_bench [total ops]
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "utils/futex_mutex_wrapper.h"
+
+#define TOTAL_OPS 2000000
+#define READ_PERCENT 95
+#define TABLE_WORDS 16
+#define PRIVATE_WORK 32
+#define MAX_THREADS 64
+#define MILLION 1000000.0
+
+static const int thread_counts[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+enum lock_kind { LOCK_FIXED, LOCK_ADAPTIVE, LOCK_RWLOCK, LOCK_PTHREAD_RW };
+static const char *const lock_names[] = {
+	"fixed-spin mutex", "adaptive mutex", "futex rwlock", "pthread rwlock"
+};
+
+static long long
+get_time_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* futex_mutex_lock() as it was before spinning adapted */
+static void
+fixed_mutex_lock(futex_mutex_t *lock)
+{
+	uint_fast32_t c = 0;
+
+	if (atomic_compare_exchange_strong_explicit(
+		lock, &c, 1, memory_order_acquire, memory_order_relaxed))
+		return;
+
+	for (int i = 0; i < FUTEX_SPIN_LIMIT; i++) {
+		CPU_RELAX();
+		if (atomic_load_explicit(lock, memory_order_relaxed) == 0) {
+			c = 0;
+			if (atomic_compare_exchange_weak_explicit(
+				lock, &c, 1, memory_order_acquire,
+				memory_order_relaxed))
+				return;
+		}
+	}
+
+	if (c != 2)
+		c = atomic_exchange_explicit(lock, 2, memory_order_acquire);
+	while (c != 0) {
+		sys_futex(lock, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+		c = atomic_exchange_explicit(lock, 2, memory_order_acquire);
+	}
+}
+
+struct shared {
+	enum lock_kind kind;
+	int read_percent;
+	futex_mutex_t mutex;
+	futex_rwlock_t rwlock;
+	pthread_rwlock_t pthread_rwlock;
+	uint64_t table[TABLE_WORDS];
+};
+
+struct worker {
+	pthread_t tid;
+	struct shared *sh;
+	uint64_t ops;
+	uint64_t seed;
+	uint64_t sink;
+};
+
+static void
+lock_read(struct shared *sh)
+{
+	switch (sh->kind) {
+	case LOCK_FIXED:
+		fixed_mutex_lock(&sh->mutex);
+		break;
+	case LOCK_ADAPTIVE:
+		futex_mutex_lock(&sh->mutex);
+		break;
+	case LOCK_RWLOCK:
+		futex_rwlock_rdlock(&sh->rwlock);
+		break;
+	case LOCK_PTHREAD_RW:
+		pthread_rwlock_rdlock(&sh->pthread_rwlock);
+		break;
+	}
+}
+
+static void
+unlock_read(struct shared *sh)
+{
+	switch (sh->kind) {
+	case LOCK_FIXED:
+	case LOCK_ADAPTIVE:
+		futex_mutex_unlock(&sh->mutex);
+		break;
+	case LOCK_RWLOCK:
+		futex_rwlock_rdunlock(&sh->rwlock);
+		break;
+	case LOCK_PTHREAD_RW:
+		pthread_rwlock_unlock(&sh->pthread_rwlock);
+		break;
+	}
+}
+
+static void
+lock_write(struct shared *sh)
+{
+	switch (sh->kind) {
+	case LOCK_FIXED:
+		fixed_mutex_lock(&sh->mutex);
+		break;
+	case LOCK_ADAPTIVE:
+		futex_mutex_lock(&sh->mutex);
+		break;
+	case LOCK_RWLOCK:
+		futex_rwlock_wrlock(&sh->rwlock);
+		break;
+	case LOCK_PTHREAD_RW:
+		pthread_rwlock_wrlock(&sh->pthread_rwlock);
+		break;
+	}
+}
+
+static void
+unlock_write(struct shared *sh)
+{
+	switch (sh->kind) {
+	case LOCK_FIXED:
+	case LOCK_ADAPTIVE:
+		futex_mutex_unlock(&sh->mutex);
+		break;
+	case LOCK_RWLOCK:
+		futex_rwlock_wrunlock(&sh->rwlock);
+		break;
+	case LOCK_PTHREAD_RW:
+		pthread_rwlock_unlock(&sh->pthread_rwlock);
+		break;
+	}
+}
+
+static void *
+run_worker(void *p)
+{
+	struct worker *w = p;
+	struct shared *sh = w->sh;
+	uint64_t seed = w->seed;
+	uint64_t sink = 0;
+
+	for (uint64_t i = 0; i < w->ops; i++) {
+		int read;
+
+		for (int j = 0; j < PRIVATE_WORK; j++)
+			seed = seed * 6364136223846793005ULL
+			       + 1442695040888963407ULL;
+		read = (int)((seed >> 33) % 100) < sh->read_percent;
+
+		if (read) {
+			lock_read(sh);
+			for (int j = 0; j < TABLE_WORDS; j++)
+				sink += sh->table[j];
+			unlock_read(sh);
+		} else {
+			lock_write(sh);
+			for (int j = 0; j < TABLE_WORDS; j++)
+				sh->table[j] += seed >> 40;
+			unlock_write(sh);
+		}
+	}
+	w->sink = sink;
+	return NULL;
+}
+
+static double
+bench_lock(enum lock_kind kind, int read_percent, int threads,
+	   uint64_t total_ops)
+{
+	static struct worker workers[MAX_THREADS];
+	struct shared sh = { .kind = kind, .read_percent = read_percent };
+	uint64_t ops = total_ops / (uint64_t)threads;
+	long long start;
+	double sec;
+
+	futex_mutex_init(&sh.mutex);
+	futex_rwlock_init(&sh.rwlock);
+	pthread_rwlock_init(&sh.pthread_rwlock, NULL);
+
+	start = get_time_nsec();
+	for (int t = 0; t < threads; t++) {
+		workers[t] = (struct worker){
+			.sh = &sh,
+			.ops = ops,
+			.seed = 0x243f6a8885a308d3ULL * (uint64_t)(t + 1),
+		};
+		pthread_create(&workers[t].tid, NULL, run_worker, &workers[t]);
+	}
+	for (int t = 0; t < threads; t++)
+		pthread_join(workers[t].tid, NULL);
+	sec = (get_time_nsec() - start) / 1e9;
+
+	pthread_rwlock_destroy(&sh.pthread_rwlock);
+	return (double)ops * threads / sec / MILLION;
+}
+
+static void
+bench_workload(const char *title, int read_percent,
+	       const enum lock_kind *kinds, int nkinds, uint64_t total_ops)
+{
+	printf("%s:\n  %-8s", title, "threads");
+	for (int k = 0; k < nkinds; k++)
+		printf("  %18s", lock_names[kinds[k]]);
+	printf("\n");
+
+	for (size_t i = 0; i < sizeof(thread_counts) / sizeof(*thread_counts);
+	     i++) {
+		printf("  %-8d", thread_counts[i]);
+		for (int k = 0; k < nkinds; k++)
+			printf("  %11.2f Mops/s",
+			       bench_lock(kinds[k], read_percent,
+					  thread_counts[i], total_ops));
+		printf("\n");
+	}
+	printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	static const enum lock_kind mutexes[] = { LOCK_FIXED, LOCK_ADAPTIVE };
+	static const enum lock_kind read_heavy[] = { LOCK_ADAPTIVE, LOCK_RWLOCK,
+						     LOCK_PTHREAD_RW };
+	uint64_t total_ops = TOTAL_OPS;
+	char title[64];
+
+	if (argc > 1)
+		total_ops = strtoull(argv[1], NULL, 10);
+	if (total_ops < MAX_THREADS) {
+		fprintf(stderr, "usage: %s [total ops (>= %d)]\n", argv[0],
+			MAX_THREADS);
+		return 1;
+	}
+
+	printf("===== Futex Lock Benchmark =====\n");
+	printf("%llu operations split across the threads, %d-word table\n\n",
+	       (unsigned long long)total_ops, TABLE_WORDS);
+
+	bench_workload("Mutex, every operation locks", 0, mutexes, 2,
+		       total_ops);
+	snprintf(title, sizeof(title), "Read-heavy, %d%% reads", READ_PERCENT);
+	bench_workload(title, READ_PERCENT, read_heavy, 3, total_ops);
+	return 0;
+}
@@ -0,0 +1,394 @@
+/**
+ * @file hash_cache_bench.c
+ * @brief Cache-mode hit ratio and throughput against plain LRU
+ *
+ * Replays Zipfian get-or-put traces over a key space of KEYS 8-byte keys
+ * with VALUE_SIZE-byte values: each operation looks its key up and puts it
+ * on a miss. The engine runs in cache mode with CLOCK and with TinyLFU
+ * eviction; the baseline is a classic LRU, a chained hash table and a
+ * doubly linked recency list behind one mutex. All three hold the same
+ * budget of key and value bytes, given as a share of the whole key space.
+ *
+ * Traces are generated up front, one per thread, so only the cache
+ * operations are timed. Keys are scrambled so that popular ones are not
+ * also neighbours.
+ *
+ * Usage: hash_cache_bench [threads] [keys]
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "storage/hash_engine.h"
+
+#define DEFAULT_THREADS 4
+#define MAX_THREADS 64
+#define DEFAULT_KEYS 1000000
+#define OPS_PER_THREAD 1000000
+#define VALUE_SIZE 64
+#define ENTRY_BYTES (sizeof(uint64_t) + VALUE_SIZE)
+#define CACHE_SHARDS 16
+#define MILLION 1000000.0
+
+static const double zipf_thetas[] = { 0.8, 0.99, 1.2 };
+static const double cache_percents[] = { 1, 5, 10 };
+
+enum policy { POLICY_CLOCK, POLICY_TINYLFU, POLICY_LRU };
+static const char *const policy_names[] = { "clock", "tinylfu", "lru" };
+
+static long long
+get_time_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t
+scramble(uint64_t i)
+{
+	i ^= i >> 31;
+	i *= 0x9e3779b97f4a7c15ULL;
+	return i ^ (i >> 29);
+}
+
+/* Zipfian ranks as in YCSB (Gray et al., "Quickly generating ...") */
+struct zipf {
+	uint64_t n;
+	double theta;
+	double alpha;
+	double zetan;
+	double eta;
+};
+
+static void
+zipf_init(struct zipf *z, uint64_t n, double theta)
+{
+	double zeta2 = 1 + pow(0.5, theta);
+
+	z->n = n;
+	z->theta = theta;
+	z->zetan = 0;
+	for (uint64_t i = 1; i <= n; i++)
+		z->zetan += 1 / pow((double)i, theta);
+	z->alpha = 1 / (1 - theta);
+	z->eta = (1 - pow(2.0 / (double)n, 1 - theta)) / (1 - zeta2 / z->zetan);
+}
+
+static uint64_t
+zipf_next(const struct zipf *z, uint64_t *seed)
+{
+	double u;
+	double uz;
+	uint64_t rank;
+
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	u = (double)(*seed >> 11) / (double)(1ULL << 53);
+	uz = u * z->zetan;
+	if (uz < 1)
+		return 0;
+	if (uz < 1 + pow(0.5, z->theta))
+		return 1;
+	rank = (uint64_t)((double)z->n
+			  * pow(z->eta * u - z->eta + 1, z->alpha));
+	return rank < z->n ? rank : z->n - 1;
+}
+
+/* The LRU baseline */
+struct lru_node {
+	uint64_t key;
+	unsigned char value[VALUE_SIZE];
+	struct lru_node *prev;
+	struct lru_node *next;
+	struct lru_node *chain;
+};
+
+struct lru {
+	pthread_mutex_t lock;
+	struct lru_node **heads;
+	uint64_t mask;
+	/* Most recent at head.next, least recent at head.prev */
+	struct lru_node head;
+	uint64_t count;
+	uint64_t capacity;
+};
+
+static int
+lru_init(struct lru *lru, uint64_t capacity)
+{
+	uint64_t size = 16;
+
+	while (size < capacity * 2)
+		size <<= 1;
+	lru->heads = calloc(size, sizeof(*lru->heads));
+	if (!lru->heads)
+		return -1;
+	lru->mask = size - 1;
+	lru->head.prev = &lru->head;
+	lru->head.next = &lru->head;
+	lru->count = 0;
+	lru->capacity = capacity ? capacity : 1;
+	pthread_mutex_init(&lru->lock, NULL);
+	return 0;
+}
+
+static void
+lru_destroy(struct lru *lru)
+{
+	struct lru_node *node = lru->head.next;
+
+	while (node != &lru->head) {
+		struct lru_node *next = node->next;
+
+		free(node);
+		node = next;
+	}
+	free(lru->heads);
+	pthread_mutex_destroy(&lru->lock);
+}
+
+static void
+lru_unlink(struct lru_node *node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+}
+
+static void
+lru_push_front(struct lru *lru, struct lru_node *node)
+{
+	node->prev = &lru->head;
+	node->next = lru->head.next;
+	lru->head.next->prev = node;
+	lru->head.next = node;
+}
+
+static struct lru_node **
+lru_slot(struct lru *lru, uint64_t key)
+{
+	struct lru_node **slot = &lru->heads[scramble(key) & lru->mask];
+
+	while (*slot && (*slot)->key != key)
+		slot = &(*slot)->chain;
+	return slot;
+}
+
+static int
+lru_get(struct lru *lru, uint64_t key, unsigned char *value)
+{
+	struct lru_node *node;
+
+	pthread_mutex_lock(&lru->lock);
+	node = *lru_slot(lru, key);
+	if (node) {
+		memcpy(value, node->value, VALUE_SIZE);
+		lru_unlink(node);
+		lru_push_front(lru, node);
+	}
+	pthread_mutex_unlock(&lru->lock);
+	return node ? 0 : -1;
+}
+
+static void
+lru_put(struct lru *lru, uint64_t key, const unsigned char *value)
+{
+	struct lru_node **slot;
+	struct lru_node *node;
+
+	pthread_mutex_lock(&lru->lock);
+	slot = lru_slot(lru, key);
+	if (*slot) {
+		node = *slot;
+		lru_unlink(node);
+	} else {
+		if (lru->count == lru->capacity) {
+			struct lru_node *victim = lru->head.prev;
+
+			lru_unlink(victim);
+			*lru_slot(lru, victim->key) = victim->chain;
+			node = victim;
+			/* Unlinking the victim may have moved our slot */
+			slot = lru_slot(lru, key);
+		} else {
+			node = malloc(sizeof(*node));
+			if (!node) {
+				pthread_mutex_unlock(&lru->lock);
+				return;
+			}
+			lru->count++;
+		}
+		node->key = key;
+		node->chain = NULL;
+		*slot = node;
+	}
+	memcpy(node->value, value, VALUE_SIZE);
+	lru_push_front(lru, node);
+	pthread_mutex_unlock(&lru->lock);
+}
+
+struct run {
+	enum policy policy;
+	struct hash_engine *engine;
+	struct lru *lru;
+	const uint64_t *trace;
+	uint64_t ops;
+	uint64_t hits;
+};
+
+static void *
+run_trace(void *p)
+{
+	struct run *run = p;
+	unsigned char value[VALUE_SIZE];
+	size_t value_len;
+
+	for (uint64_t i = 0; i < run->ops; i++) {
+		uint64_t key = run->trace[i];
+		int rc;
+
+		if (run->policy == POLICY_LRU)
+			rc = lru_get(run->lru, key, value);
+		else
+			rc = hash_get_copy(run->engine, &key, sizeof(key),
+					   value, sizeof(value), &value_len);
+		if (rc == 0) {
+			run->hits++;
+			continue;
+		}
+		memset(value, (int)key, sizeof(value));
+		if (run->policy == POLICY_LRU)
+			lru_put(run->lru, key, value);
+		else
+			hash_put(run->engine, &key, sizeof(key), value,
+				 sizeof(value));
+	}
+	return NULL;
+}
+
+static int
+bench_policy(enum policy policy, uint64_t budget, uint64_t **traces,
+	     int threads)
+{
+	/* Sized for the budget up front so the timing is not of resizes */
+	struct hash_engine_config config = {
+		.bucket_count = budget / ENTRY_BYTES * 2,
+		.shard_count = CACHE_SHARDS,
+		.memory_limit = budget,
+		.evict_policy = policy == POLICY_TINYLFU ? HASH_EVICT_TINYLFU
+							 : HASH_EVICT_CLOCK,
+	};
+	pthread_t tids[MAX_THREADS];
+	struct run runs[MAX_THREADS];
+	struct hash_engine engine;
+	struct lru lru;
+	uint64_t memory = 0;
+	uint64_t hits = 0;
+	long long start;
+	double sec;
+	int rc;
+
+	if (policy == POLICY_LRU)
+		rc = lru_init(&lru, budget / ENTRY_BYTES);
+	else
+		rc = hash_engine_init_config(&engine, &config);
+	if (rc != 0) {
+		fprintf(stderr, "  %s: init failed (%d)\n",
+			policy_names[policy], rc);
+		return -1;
+	}
+
+	start = get_time_nsec();
+	for (int t = 0; t < threads; t++) {
+		runs[t] = (struct run){
+			.policy = policy,
+			.engine = &engine,
+			.lru = &lru,
+			.trace = traces[t],
+			.ops = OPS_PER_THREAD,
+		};
+		pthread_create(&tids[t], NULL, run_trace, &runs[t]);
+	}
+	for (int t = 0; t < threads; t++) {
+		pthread_join(tids[t], NULL);
+		hits += runs[t].hits;
+	}
+	sec = (get_time_nsec() - start) / 1e9;
+
+	if (policy == POLICY_LRU) {
+		memory = lru.count * ENTRY_BYTES;
+		lru_destroy(&lru);
+	} else {
+		hash_engine_get_stats(&engine, NULL, NULL, &memory);
+		hash_engine_destroy(&engine);
+	}
+	printf("    %-8s hit ratio %6.2f%%  %7.2f Mops/s  held %6.2f%% of "
+	       "budget\n",
+	       policy_names[policy],
+	       100.0 * (double)hits / ((double)threads * OPS_PER_THREAD),
+	       (double)threads * OPS_PER_THREAD / sec / MILLION,
+	       100.0 * (double)memory / (double)budget);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+	uint64_t keys = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_KEYS;
+	uint64_t **traces;
+
+	if (threads < 1 || threads > MAX_THREADS || keys < 1000) {
+		fprintf(stderr, "usage: %s [threads (1-%d)] [keys (>= 1000)]\n",
+			argv[0], MAX_THREADS);
+		return 1;
+	}
+	traces = calloc((size_t)threads, sizeof(*traces));
+	if (!traces)
+		return 1;
+	for (int t = 0; t < threads; t++) {
+		traces[t] = malloc(OPS_PER_THREAD * sizeof(**traces));
+		if (!traces[t])
+			return 1;
+	}
+
+	printf("===== Cache Hit Ratio Benchmark =====\n");
+	printf("%d threads, %llu keys, %d ops per thread, %d-byte values\n\n",
+	       threads, (unsigned long long)keys, OPS_PER_THREAD, VALUE_SIZE);
+
+	for (size_t z = 0; z < sizeof(zipf_thetas) / sizeof(*zipf_thetas);
+	     z++) {
+		struct zipf zipf;
+
+		zipf_init(&zipf, keys, zipf_thetas[z]);
+		for (int t = 0; t < threads; t++) {
+			uint64_t seed = 0x243f6a8885a308d3ULL * (uint64_t)(t + 1);
+
+			for (uint64_t i = 0; i < OPS_PER_THREAD; i++)
+				traces[t][i] = scramble(zipf_next(&zipf, &seed));
+		}
+
+		for (size_t c = 0;
+		     c < sizeof(cache_percents) / sizeof(*cache_percents);
+		     c++) {
+			uint64_t budget = (uint64_t)((double)keys * ENTRY_BYTES
+						     * cache_percents[c] / 100);
+
+			printf("  zipf %.2f, cache %.0f%% of keys:\n",
+			       zipf_thetas[z], cache_percents[c]);
+			for (int p = POLICY_CLOCK; p <= POLICY_LRU; p++)
+				bench_policy((enum policy)p, budget, traces,
+					     threads);
+		}
+		printf("\n");
+	}
+
+	for (int t = 0; t < threads; t++)
+		free(traces[t]);
+	free(traces);
+	return 0;
+}
@@ -0,0 +1,214 @@
+/**
+ * @file hash_pages_bench.c
+ * @brief Random lookup throughput and dTLB misses under each page policy
+ *
+ * Fills engines of 2^22 to 2^24 slots (or up to the power of two given as
+ * the first argument) to 70% under each page mode, then times random
+ * lookups. dTLB load misses per lookup come from perf_event_open() and
+ * read "n/a" where the counter is unavailable; huge pages actually backing
+ * the process are read from /proc/self/smaps_rollup after each fill.
+ *
+ * Usage: hash_pages_bench [max_slot_bits]
+ */
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "storage/hash/pages.h"
+#include "storage/hash_engine.h"
+
+#define MIN_SLOT_BITS 22
+#define DEFAULT_MAX_SLOT_BITS 24
+#define MAX_SLOT_BITS 30
+#define FILL_PERCENT 70
+#define LOOKUPS 4000000
+#define MILLION 1000000.0
+
+static const struct {
+	int mode;
+	int numa;
+	const char *name;
+} policies[] = {
+	{ PAGES_DEFAULT, PAGES_NUMA_DEFAULT, "default" },
+	{ PAGES_THP, PAGES_NUMA_DEFAULT, "thp" },
+	{ PAGES_HUGETLB, PAGES_NUMA_DEFAULT, "hugetlb" },
+	{ PAGES_THP, PAGES_NUMA_INTERLEAVE, "thp+interleave" },
+	{ PAGES_THP, PAGES_NUMA_LOCAL, "thp+local" },
+};
+
+static long long
+get_time_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t
+pages_key(uint64_t i)
+{
+	i ^= i >> 31;
+	i *= 0x9e3779b97f4a7c15ULL;
+	return i ^ (i >> 29);
+}
+
+/* User-space dTLB load misses for this thread, or -1 */
+static int
+dtlb_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB
+		      | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Huge page usage in KiB, summed over THP and hugetlbfs mappings */
+static long
+huge_kib(void)
+{
+	char line[256];
+	long total = 0;
+	long kib;
+	FILE *f;
+
+	f = fopen("/proc/self/smaps_rollup", "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "AnonHugePages: %ld kB", &kib) == 1
+		    || sscanf(line, "Private_Hugetlb: %ld kB", &kib) == 1
+		    || sscanf(line, "Shared_Hugetlb: %ld kB", &kib) == 1)
+			total += kib;
+	}
+	fclose(f);
+	return total;
+}
+
+static int
+bench_policy(uint64_t slots, int p, int dtlb_fd)
+{
+	struct hash_engine_config config = {
+		.bucket_count = slots,
+		.page_mode = policies[p].mode,
+		.numa_policy = policies[p].numa,
+	};
+	struct hash_engine engine;
+	uint64_t keys = slots / 100 * FILL_PERCENT;
+	uint64_t seed = 0x243f6a8885a308d3ULL;
+	uint64_t found = 0;
+	uint64_t misses = 0;
+	long long start;
+	double get_sec;
+	long huge;
+	int rc;
+
+	rc = hash_engine_init_config(&engine, &config);
+	if (rc != 0) {
+		fprintf(stderr, "  %s: init failed (%d)\n", policies[p].name,
+			rc);
+		return rc;
+	}
+	for (uint64_t i = 0; i < keys; i++) {
+		uint64_t key = pages_key(i);
+
+		rc = hash_put(&engine, &key, sizeof(key), &i, sizeof(i));
+		if (rc != 0) {
+			fprintf(stderr, "  put %llu failed (%d)\n",
+				(unsigned long long)i, rc);
+			hash_engine_destroy(&engine);
+			return rc;
+		}
+	}
+	huge = huge_kib();
+
+	if (dtlb_fd >= 0) {
+		ioctl(dtlb_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(dtlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	start = get_time_nsec();
+	for (uint64_t i = 0; i < LOOKUPS; i++) {
+		uint64_t key;
+		uint64_t value;
+		size_t value_len;
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = pages_key((seed >> 16) % keys);
+		if (hash_get_copy(&engine, &key, sizeof(key), &value,
+				  sizeof(value), &value_len)
+		    == 0)
+			found++;
+	}
+	get_sec = (get_time_nsec() - start) / 1e9;
+	if (dtlb_fd >= 0) {
+		ioctl(dtlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(dtlb_fd, &misses, sizeof(misses)) != sizeof(misses))
+			dtlb_fd = -1;
+	}
+
+	printf("    %-15s get %6.2f M/s  dTLB miss/get ", policies[p].name,
+	       LOOKUPS / get_sec / MILLION);
+	if (dtlb_fd >= 0)
+		printf("%5.2f", (double)misses / LOOKUPS);
+	else
+		printf("  n/a");
+	if (huge >= 0)
+		printf("  huge pages %6ld MiB", huge / 1024);
+	printf("%s\n", found == LOOKUPS ? "" : "  MISMATCH");
+
+	hash_engine_destroy(&engine);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_bits = DEFAULT_MAX_SLOT_BITS;
+	int dtlb_fd;
+
+	if (argc > 1)
+		max_bits = atoi(argv[1]);
+	if (max_bits < MIN_SLOT_BITS || max_bits > MAX_SLOT_BITS) {
+		fprintf(stderr, "usage: %s [max_slot_bits (%d-%d)]\n", argv[0],
+			MIN_SLOT_BITS, MAX_SLOT_BITS);
+		return 1;
+	}
+
+	dtlb_fd = dtlb_open();
+
+	printf("===== Hash Page Placement Benchmarks =====\n\n");
+	printf("  %d%% full, 8-byte keys and values, %d random lookups, "
+	       "%d NUMA node(s)\n",
+	       FILL_PERCENT, LOOKUPS, pages_numa_nodes());
+	if (dtlb_fd < 0)
+		printf("  dTLB counter unavailable (perf_event_paranoid?)\n");
+
+	for (int bits = MIN_SLOT_BITS; bits <= max_bits; bits++) {
+		printf("\n  2^%d slots\n", bits);
+		for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]);
+		     p++) {
+			if (bench_policy(1ULL << bits, (int)p, dtlb_fd) != 0)
+				break;
+		}
+	}
+
+	if (dtlb_fd >= 0)
+		close(dtlb_fd);
+	printf("\n========================================\n");
+	printf("Benchmarks complete\n");
+	return 0;
+}
@@ -0,0 +1,175 @@
+/**
+ * @file hash_scaling_bench.c
+ * @brief Insert and lookup throughput as tables grow to billions of slots
+ *
+ * Doubles a pre-sized engine from 2^16 slots up to 2^30 (or the power of two
+ * given as the first argument), fills it to 70% and reports put and get
+ * throughput along with slot memory and the engine's own counters. Sizes
+ * that would not fit in about 80% of physical memory are skipped.
+ *
+ * Usage: hash_scaling_bench [max_slot_bits]
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "storage/hash_engine.h"
+
+#define MIN_SLOT_BITS 16
+#define DEFAULT_MAX_SLOT_BITS 30
+/* MAX_BUCKET_COUNT in each of SCALING_SHARDS shards */
+#define MAX_SLOT_BITS 36
+#define SCALING_SHARDS 16
+#define FILL_PERCENT 70
+#define MAX_LOOKUPS 4000000
+#define MILLION 1000000.0
+#define GIB (1024.0 * 1024.0 * 1024.0)
+
+static long long
+get_time_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Keys are distinct 8-byte mixes of their index */
+static uint64_t
+scaling_key(uint64_t i)
+{
+	i ^= i >> 31;
+	i *= 0x9e3779b97f4a7c15ULL;
+	return i ^ (i >> 29);
+}
+
+/* Slot array and control bytes for a table of slots buckets */
+static double
+slot_bytes(uint64_t slots)
+{
+	return (double)slots * (sizeof(struct hash_bucket) + 1);
+}
+
+static double
+phys_bytes(void)
+{
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	if (pages <= 0 || page_size <= 0)
+		return 0;
+	return (double)pages * (double)page_size;
+}
+
+static int
+bench_size(uint64_t slots)
+{
+	struct hash_engine_config config = {
+		.bucket_count = slots,
+		.shard_count = SCALING_SHARDS,
+	};
+	struct hash_engine engine;
+	uint64_t keys = slots / 100 * FILL_PERCENT;
+	uint64_t lookups = keys < MAX_LOOKUPS ? keys : MAX_LOOKUPS;
+	uint64_t seed = 0x243f6a8885a308d3ULL;
+	uint64_t items;
+	uint64_t buckets;
+	uint64_t memory;
+	uint64_t found = 0;
+	long long start;
+	double put_sec;
+	double get_sec;
+	int rc;
+
+	start = get_time_nsec();
+	rc = hash_engine_init_config(&engine, &config);
+	if (rc != 0) {
+		fprintf(stderr, "  2^%d slots: init failed (%d)\n",
+			__builtin_ctzll(slots), rc);
+		return rc;
+	}
+	printf("  2^%-2d slots  init %6.2f s", __builtin_ctzll(slots),
+	       (get_time_nsec() - start) / 1e9);
+	fflush(stdout);
+
+	start = get_time_nsec();
+	for (uint64_t i = 0; i < keys; i++) {
+		uint64_t key = scaling_key(i);
+
+		rc = hash_put(&engine, &key, sizeof(key), &i, sizeof(i));
+		if (rc != 0) {
+			fprintf(stderr, "\n  put %llu failed (%d)\n",
+				(unsigned long long)i, rc);
+			hash_engine_destroy(&engine);
+			return rc;
+		}
+	}
+	put_sec = (get_time_nsec() - start) / 1e9;
+
+	/* Random lookups, so large tables miss in cache and TLB */
+	start = get_time_nsec();
+	for (uint64_t i = 0; i < lookups; i++) {
+		uint64_t key;
+		uint64_t value;
+		size_t value_len;
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = scaling_key((seed >> 16) % keys);
+		if (hash_get_copy(&engine, &key, sizeof(key), &value,
+				  sizeof(value), &value_len)
+		    == 0)
+			found++;
+	}
+	get_sec = (get_time_nsec() - start) / 1e9;
+
+	hash_engine_get_stats(&engine, &items, &buckets, &memory);
+	printf("  put %6.2f M/s  get %6.2f M/s  items %llu  "
+	       "buckets %llu  slots %.2f GiB  payload %.2f GiB%s\n",
+	       keys / put_sec / MILLION, lookups / get_sec / MILLION,
+	       (unsigned long long)items, (unsigned long long)buckets,
+	       slot_bytes(buckets) / GIB, memory / GIB,
+	       found == lookups && items == keys ? "" : "  MISMATCH");
+
+	hash_engine_destroy(&engine);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_bits = DEFAULT_MAX_SLOT_BITS;
+	double budget = phys_bytes() * 0.8;
+
+	if (argc > 1)
+		max_bits = atoi(argv[1]);
+	if (max_bits < MIN_SLOT_BITS || max_bits > MAX_SLOT_BITS) {
+		fprintf(stderr, "usage: %s [max_slot_bits (%d-%d)]\n", argv[0],
+			MIN_SLOT_BITS, MAX_SLOT_BITS);
+		return 1;
+	}
+
+	printf("===== Hash Scaling Benchmarks =====\n\n");
+	printf("  %d shards, %d%% full, 8-byte keys and values, "
+	       "%.1f GiB usable memory\n\n",
+	       SCALING_SHARDS, FILL_PERCENT, budget / GIB);
+
+	for (int bits = MIN_SLOT_BITS; bits <= max_bits; bits++) {
+		uint64_t slots = 1ULL << bits;
+
+		if (slot_bytes(slots) > budget) {
+			printf("  2^%-2d slots  skipped: needs %.1f GiB\n",
+			       bits, slot_bytes(slots) / GIB);
+			continue;
+		}
+		if (bench_size(slots) != 0)
+			break;
+	}
+
+	printf("\n========================================\n");
+	printf("Benchmarks complete\n");
+	return 0;
+}
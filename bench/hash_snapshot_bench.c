@@ -0,0 +1,168 @@
+/**
+ * @file hash_snapshot_bench.c
+ * @brief Restart time from a snapshot against rebuilding the engine
+ *
+ * Fills an engine with the given number of keys (2M by default), one in
+ * SNAPSHOT_LONG_VALUE with a value too long to keep inline, and saves it.
+ * Then times loading the snapshot, the first random lookups into the
+ * loaded engine, which fault its pages in, and a load that verifies every
+ * checksum. The fill time is what a restart without a snapshot costs.
+ *
+ * Usage: hash_snapshot_bench [keys]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "storage/hash_engine.h"
+
+#define DEFAULT_KEYS 2000000ULL
+#define SNAPSHOT_LONG_VALUE 16
+#define LONG_VALUE_SIZE 256
+#define LOOKUPS 1000000
+#define MILLION 1000000.0
+
+static long long
+get_time_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t
+snapshot_key(uint64_t i)
+{
+	i ^= i >> 31;
+	i *= 0x9e3779b97f4a7c15ULL;
+	return i ^ (i >> 29);
+}
+
+static int
+fill(struct hash_engine *engine, uint64_t keys)
+{
+	static unsigned char value[LONG_VALUE_SIZE];
+
+	for (uint64_t i = 0; i < keys; i++) {
+		uint64_t key = snapshot_key(i);
+		size_t len = i % SNAPSHOT_LONG_VALUE == 0 ? sizeof(value)
+							  : sizeof(i);
+
+		*(uint64_t *)value = i;
+		if (hash_put(engine, &key, sizeof(key), value, len) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Random lookups; returns the number found */
+static uint64_t
+lookups(struct hash_engine *engine, uint64_t keys, int count)
+{
+	static unsigned char value[LONG_VALUE_SIZE];
+	uint64_t seed = 0x243f6a8885a308d3ULL;
+	uint64_t found = 0;
+
+	for (int i = 0; i < count; i++) {
+		uint64_t key;
+		size_t value_len;
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = snapshot_key((seed >> 16) % keys);
+		if (hash_get_copy(engine, &key, sizeof(key), value,
+				  sizeof(value), &value_len)
+		    == 0)
+			found++;
+	}
+	return found;
+}
+
+static int
+bench_load(const char *path, uint64_t keys, int flags, const char *name)
+{
+	struct hash_engine engine;
+	long long start;
+	double load_ms;
+	double get_sec;
+	uint64_t found;
+	int rc;
+
+	start = get_time_nsec();
+	rc = hash_engine_load(&engine, path, NULL, flags);
+	load_ms = (get_time_nsec() - start) / 1e6;
+	if (rc != 0) {
+		fprintf(stderr, "  %s failed (%d)\n", name, rc);
+		return rc;
+	}
+
+	start = get_time_nsec();
+	found = lookups(&engine, keys, LOOKUPS);
+	get_sec = (get_time_nsec() - start) / 1e9;
+	printf("  %-12s %9.1f ms   first %d gets %6.2f M/s%s\n", name,
+	       load_ms, LOOKUPS, LOOKUPS / get_sec / MILLION,
+	       found == LOOKUPS ? "" : "  MISMATCH");
+	hash_engine_destroy(&engine);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct hash_engine engine;
+	uint64_t keys = DEFAULT_KEYS;
+	char path[64];
+	struct stat st;
+	long long start;
+	double fill_ms;
+	double save_ms;
+	int rc;
+
+	if (argc > 1)
+		keys = strtoull(argv[1], NULL, 10);
+	if (keys == 0) {
+		fprintf(stderr, "usage: %s [keys]\n", argv[0]);
+		return 1;
+	}
+	snprintf(path, sizeof(path), "/tmp/hash_snapshot_bench_%d",
+		 (int)getpid());
+
+	printf("===== Hash Snapshot Benchmarks =====\n\n");
+	printf("  %llu 8-byte keys, 1 in %d values %d bytes, the rest 8\n\n",
+	       (unsigned long long)keys, SNAPSHOT_LONG_VALUE, LONG_VALUE_SIZE);
+
+	if (hash_engine_init(&engine, 1024) != 0)
+		return 1;
+	start = get_time_nsec();
+	rc = fill(&engine, keys);
+	fill_ms = (get_time_nsec() - start) / 1e6;
+	if (rc != 0) {
+		fprintf(stderr, "  fill failed\n");
+		hash_engine_destroy(&engine);
+		return 1;
+	}
+	start = get_time_nsec();
+	rc = hash_engine_save(&engine, path);
+	save_ms = (get_time_nsec() - start) / 1e6;
+	hash_engine_destroy(&engine);
+	if (rc != 0 || stat(path, &st) != 0) {
+		fprintf(stderr, "  save failed (%d)\n", rc);
+		return 1;
+	}
+
+	printf("  %-12s %9.1f ms\n", "fill", fill_ms);
+	printf("  %-12s %9.1f ms   %lld MiB\n", "save", save_ms,
+	       (long long)st.st_size >> 20);
+	/* The first load reads from the page cache save left warm */
+	rc = bench_load(path, keys, 0, "load");
+	if (rc == 0)
+		rc = bench_load(path, keys, HASH_LOAD_VERIFY, "load+verify");
+	unlink(path);
+
+	printf("\n========================================\n");
+	printf("Benchmarks complete\n");
+	return rc == 0 ? 0 : 1;
+}
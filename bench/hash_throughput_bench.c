@@ -7,12 +7,14 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include "storage/hash_engine.h"
+#include "utils/futex_stats.h"
 
 #define MILLION 1000000
 #define THOUSAND 1000
@@ -26,6 +28,14 @@ get_time_usec(void)
 	return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
 }
 
+static long long
+get_time_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 /* Benchmark: Insert throughput */
 static void
 bench_insert_throughput(void)
@@ -410,7 +420,7 @@ bench_load_factor_impact(void)
 	char value_buf[128];
 	const void *retrieved_value;
 	size_t retrieved_len;
-	uint32_t bucket_count;
+	uint64_t bucket_count;
 	long long start;
 	long long end;
 	double elapsed_sec;
@@ -467,8 +477,9 @@ bench_load_factor_impact(void)
 		elapsed_sec = (end - start) / 1000000.0;
 		ops_per_sec = NUM_LOOKUPS / elapsed_sec;
 
-		printf("  Load factor: %.2f (items=%d, buckets=%u)\n",
-		       load_factor, num_items, bucket_count);
+		printf("  Load factor: %.2f (items=%d, buckets=%llu)\n",
+		       load_factor, num_items,
+		       (unsigned long long)bucket_count);
 		printf("    GET throughput: %.0f ops/sec\n", ops_per_sec);
 
 		hash_engine_destroy(&engine);
@@ -476,11 +487,695 @@ bench_load_factor_impact(void)
 	printf("\n");
 }
 
+#define HEALTH_BUCKETS 262144
+#define HEALTH_KEYS 180000
+#define HEALTH_CHURN 100000
+#define HEALTH_ROUNDS 4
+#define HEALTH_SAMPLE 4096
+
+static void
+print_table_health(const char *when, struct hash_engine *engine)
+{
+	struct hash_table_stats full;
+	struct hash_table_stats sampled;
+	long long start;
+	double full_us;
+	double sampled_us;
+
+	start = get_time_usec();
+	hash_engine_get_table_stats(engine, 0, &full);
+	full_us = (double)(get_time_usec() - start);
+	start = get_time_usec();
+	hash_engine_get_table_stats(engine, HEALTH_SAMPLE, &sampled);
+	sampled_us = (double)(get_time_usec() - start);
+
+	printf("  %-14s load %.2f tomb %.2f probe p50/p99/max %u/%u/%llu "
+	       "cluster avg/max %.1f/%llu\n",
+	       when, full.load_factor, full.tombstone_ratio, full.p50_probe,
+	       full.p99_probe, (unsigned long long)full.max_probe,
+	       full.avg_cluster, (unsigned long long)full.longest_cluster);
+	printf("  %-14s sampled: load %.2f tomb %.2f p99 %u "
+	       "(%.0f us full walk, %.0f us sampled)\n",
+	       "", sampled.load_factor, sampled.tombstone_ratio,
+	       sampled.p99_probe, full_us, sampled_us);
+	/* Entries still in a draining table are not in the walk */
+	if (full.resizing_shards)
+		printf("  %-14s resizing: %.0f%% migrated, %llu buckets left\n",
+		       "", full.resize_progress * 100.0,
+		       (unsigned long long)full.resize_remaining);
+}
+
+/*
+ * With HASH_QUALITY_JSON set, write the filled table's probe figures there
+ * for metrics.json's hash_quality (make hash-quality), with the run they
+ * came from.
+ */
+static void
+dump_hash_quality(struct hash_engine *engine)
+{
+	const char *path = getenv("HASH_QUALITY_JSON");
+	struct hash_table_stats stats;
+	FILE *out;
+
+	if (!path)
+		return;
+	if (hash_engine_get_table_stats(engine, 0, &stats) != 0) {
+		fprintf(stderr, "table stats unavailable\n");
+		return;
+	}
+	out = fopen(path, "w");
+	if (!out) {
+		perror(path);
+		return;
+	}
+	fprintf(out,
+		"{\n  \"probe_p99\": %u,\n  \"probe_max\": %llu,\n"
+		"  \"avg_chain_length\": %.2f,\n  \"run\": {\n"
+		"    \"bench\": \"hash_throughput_bench table health\",\n"
+		"    \"buckets\": %llu,\n    \"keys\": %d,\n"
+		"    \"load_factor\": %.2f\n  }\n}\n",
+		stats.p99_probe, (unsigned long long)stats.max_probe,
+		stats.avg_cluster, (unsigned long long)stats.slots,
+		HEALTH_KEYS, stats.load_factor);
+	fclose(out);
+	printf("Hash quality written to %s\n", path);
+}
+
+/*
+ * Churn at a steady item count: every round deletes keys and puts as many
+ * new ones, so group-mode tombstones build up until the shard rehashes.
+ */
+static void
+bench_table_health(void)
+{
+	struct hash_engine engine;
+	char key_buf[64];
+	int next = 0;
+	int oldest = 0;
+	int round;
+	int i;
+
+	printf("Table health under churn (%d buckets, %d keys)...\n",
+	       HEALTH_BUCKETS, HEALTH_KEYS);
+	if (hash_engine_init(&engine, HEALTH_BUCKETS) != 0) {
+		fprintf(stderr, "Init failed\n");
+		return;
+	}
+
+	for (; next < HEALTH_KEYS; next++) {
+		snprintf(key_buf, sizeof(key_buf), "health_key_%d", next);
+		hash_put(&engine, key_buf, strlen(key_buf), &next,
+			 sizeof(next));
+	}
+	print_table_health("filled", &engine);
+	dump_hash_quality(&engine);
+
+	for (round = 1; round <= HEALTH_ROUNDS; round++) {
+		char when[32];
+
+		for (i = 0; i < HEALTH_CHURN; i++, oldest++, next++) {
+			snprintf(key_buf, sizeof(key_buf), "health_key_%d",
+				 oldest);
+			hash_delete(&engine, key_buf, strlen(key_buf));
+			snprintf(key_buf, sizeof(key_buf), "health_key_%d",
+				 next);
+			hash_put(&engine, key_buf, strlen(key_buf), &next,
+				 sizeof(next));
+		}
+		snprintf(when, sizeof(when), "churn round %d", round);
+		print_table_health(when, &engine);
+	}
+
+	hash_engine_destroy(&engine);
+	printf("\n");
+}
+
+#define READ_MOSTLY_KEYS 50000
+#define READ_MOSTLY_OPS 200000
+
+struct read_mostly_args {
+	struct hash_engine *engine;
+	unsigned int seed;
+};
+
+static void *
+read_mostly_worker(void *arg)
+{
+	struct read_mostly_args *args = arg;
+	char key_buf[64];
+	char value_buf[128];
+	const void *retrieved_value;
+	size_t retrieved_len;
+	int i;
+
+	for (i = 0; i < READ_MOSTLY_OPS; i++) {
+		int key_id = rand_r(&args->seed) % READ_MOSTLY_KEYS;
+
+		snprintf(key_buf, sizeof(key_buf), "bench_rm_key_%d", key_id);
+		if (rand_r(&args->seed) % 100 < 95) {
+			hash_get(args->engine, key_buf, strlen(key_buf),
+				 &retrieved_value, &retrieved_len);
+		} else {
+			snprintf(value_buf, sizeof(value_buf),
+				 "bench_rm_value_%d", i);
+			hash_put(args->engine, key_buf, strlen(key_buf),
+				 value_buf, strlen(value_buf));
+		}
+	}
+	return NULL;
+}
+
+/* Benchmark: 95% reads / 5% overwrites across threads */
+static void
+bench_read_mostly_scaling(void)
+{
+	static const int thread_counts[] = { 1, 2, 4, 8 };
+	struct hash_engine engine;
+	pthread_t threads[8];
+	struct read_mostly_args args[8];
+	char key_buf[64];
+	char value_buf[128];
+	long long start;
+	long long end;
+	double elapsed_sec;
+	int rc;
+	int i;
+	int t;
+
+	printf("Benchmarking READ-MOSTLY scaling (%d ops per thread)...\n",
+	       READ_MOSTLY_OPS);
+	printf("  95%% reads, 5%% overwrites\n");
+
+	rc = hash_engine_init(&engine, DEFAULT_BUCKET_COUNT);
+	if (rc != 0) {
+		fprintf(stderr, "Init failed\n");
+		return;
+	}
+
+	for (i = 0; i < READ_MOSTLY_KEYS; i++) {
+		snprintf(key_buf, sizeof(key_buf), "bench_rm_key_%d", i);
+		snprintf(value_buf, sizeof(value_buf), "bench_rm_value_%d", i);
+		rc = hash_put(&engine, key_buf, strlen(key_buf), value_buf,
+			      strlen(value_buf));
+		if (rc != 0) {
+			fprintf(stderr, "Setup insert failed\n");
+			hash_engine_destroy(&engine);
+			return;
+		}
+	}
+
+	for (t = 0; t < (int)(sizeof(thread_counts) / sizeof(thread_counts[0]));
+	     t++) {
+		int nthreads = thread_counts[t];
+
+		start = get_time_usec();
+		for (i = 0; i < nthreads; i++) {
+			args[i].engine = &engine;
+			args[i].seed = 42 + i;
+			pthread_create(&threads[i], NULL, read_mostly_worker,
+				       &args[i]);
+		}
+		for (i = 0; i < nthreads; i++)
+			pthread_join(threads[i], NULL);
+		end = get_time_usec();
+
+		elapsed_sec = (end - start) / 1000000.0;
+		printf("  Threads: %d  Throughput: %.0f ops/sec\n", nthreads,
+		       (double)nthreads * READ_MOSTLY_OPS / elapsed_sec);
+	}
+	printf("\n");
+
+	hash_engine_destroy(&engine);
+}
+
+#define PROBE_HASHES 4096
+#define PROBE_STEPS 8
+#define PROBE_ROUNDS 2000
+
+/*
+ * Benchmark: Cost of turning a hash and probe step into a slot. Modulo is
+ * what the engine did before table sizes were powers of two; the mask is
+ * what it does now. The bucket count is read through a volatile so the
+ * compiler cannot strength-reduce the division, and each probe sequence
+ * starts from the previous one's result, as dependent loads would.
+ */
+static void
+bench_probe_index_cost(void)
+{
+	static const uint32_t sizes[] = { 1024, 65536, 1048576 };
+	volatile uint32_t runtime_count;
+	uint64_t *hashes;
+	uint64_t seed = 0x9e3779b97f4a7c15ULL;
+	uint64_t sink = 0;
+	long long start;
+	long long end;
+	double probes;
+	int s;
+	int r;
+	int i;
+	int j;
+
+	printf("Benchmarking per-probe index cost (%d probes per size)...\n",
+	       PROBE_HASHES * PROBE_STEPS * PROBE_ROUNDS);
+
+	hashes = malloc(PROBE_HASHES * sizeof(*hashes));
+	if (!hashes) {
+		fprintf(stderr, "Allocation failed\n");
+		return;
+	}
+	for (i = 0; i < PROBE_HASHES; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		hashes[i] = seed;
+	}
+	probes = (double)PROBE_HASHES * PROBE_STEPS * PROBE_ROUNDS;
+
+	for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+		uint32_t count;
+		uint32_t mask;
+		double mod_ns;
+		double mask_ns;
+
+		runtime_count = sizes[s];
+		count = runtime_count;
+		start = get_time_usec();
+		for (r = 0; r < PROBE_ROUNDS; r++) {
+			for (i = 0; i < PROBE_HASHES; i++) {
+				uint32_t pos
+				    = (uint32_t)((hashes[i] ^ sink) % count);
+
+				for (j = 0; j < PROBE_STEPS; j++) {
+					sink += pos;
+					pos = (pos + GROUP_WIDTH) % count;
+				}
+			}
+		}
+		end = get_time_usec();
+		mod_ns = (end - start) * 1000.0 / probes;
+
+		mask = runtime_count - 1;
+		start = get_time_usec();
+		for (r = 0; r < PROBE_ROUNDS; r++) {
+			for (i = 0; i < PROBE_HASHES; i++) {
+				uint32_t pos
+				    = (uint32_t)(hashes[i] ^ sink) & mask;
+
+				for (j = 0; j < PROBE_STEPS; j++) {
+					sink += pos;
+					pos = (pos + GROUP_WIDTH) & mask;
+				}
+			}
+		}
+		end = get_time_usec();
+		mask_ns = (end - start) * 1000.0 / probes;
+
+		printf("  Buckets: %-8u modulo: %.2f ns/probe  "
+		       "mask: %.2f ns/probe\n",
+		       sizes[s], mod_ns, mask_ns);
+	}
+	printf("  (checksum %llu)\n\n", (unsigned long long)sink);
+
+	free(hashes);
+}
+
+#define SHARD_PUT_OPS 50000
+
+struct shard_put_args {
+	struct hash_engine *engine;
+	int id;
+};
+
+static void *
+shard_put_worker(void *arg)
+{
+	struct shard_put_args *args = arg;
+	char key_buf[64];
+	int i;
+
+	for (i = 0; i < SHARD_PUT_OPS; i++) {
+		snprintf(key_buf, sizeof(key_buf), "bench_shard_%d_%d",
+			 args->id, i);
+		hash_put(args->engine, key_buf, strlen(key_buf), &i,
+			 sizeof(i));
+	}
+	return NULL;
+}
+
+/* Benchmark: Concurrent inserts, one shard vs many, growing from empty */
+static void
+bench_sharded_put_scaling(void)
+{
+	static const uint32_t shard_counts[] = { 1, 16 };
+	static const int thread_counts[] = { 1, 2, 4, 8 };
+	const int num_shard_counts
+	    = (int)(sizeof(shard_counts) / sizeof(shard_counts[0]));
+	const int num_thread_counts
+	    = (int)(sizeof(thread_counts) / sizeof(thread_counts[0]));
+	struct shard_put_args args[8];
+	pthread_t threads[8];
+	long long start;
+	long long end;
+	double elapsed_sec;
+	int s;
+	int t;
+	int i;
+
+	printf("Benchmarking sharded PUT scaling (%d ops per thread)...\n",
+	       SHARD_PUT_OPS);
+
+	for (s = 0; s < num_shard_counts; s++) {
+		for (t = 0; t < num_thread_counts; t++) {
+			struct hash_engine_config config = {
+				.bucket_count = DEFAULT_BUCKET_COUNT,
+				.shard_count = shard_counts[s],
+			};
+			struct hash_engine engine;
+			int nthreads = thread_counts[t];
+
+			if (hash_engine_init_config(&engine, &config) != 0) {
+				fprintf(stderr, "Init failed\n");
+				return;
+			}
+
+			start = get_time_usec();
+			for (i = 0; i < nthreads; i++) {
+				args[i].engine = &engine;
+				args[i].id = i;
+				pthread_create(&threads[i], NULL,
+					       shard_put_worker, &args[i]);
+			}
+			for (i = 0; i < nthreads; i++)
+				pthread_join(threads[i], NULL);
+			end = get_time_usec();
+
+			elapsed_sec = (end - start) / 1000000.0;
+			printf("  Shards: %-3u Threads: %d  Throughput: %.0f "
+			       "ops/sec\n",
+			       shard_counts[s], nthreads,
+			       (double)nthreads * SHARD_PUT_OPS / elapsed_sec);
+			hash_engine_destroy(&engine);
+		}
+	}
+	printf("\n");
+}
+
+/* Enough keys to grow one shard from 16 to 2^20 buckets */
+#define RESIZE_LATENCY_KEYS 700000
+
+static int
+compare_latency(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Benchmark: Per-put tail latency while the table grows, by resize mode */
+static void
+bench_resize_tail_latency(void)
+{
+	static const char *const mode_names[] = { "inline", "background" };
+	uint32_t *latency;
+	uint64_t buckets;
+	char key[32];
+	long long start;
+	int mode;
+	int i;
+
+	latency = malloc(RESIZE_LATENCY_KEYS * sizeof(*latency));
+	if (!latency) {
+		fprintf(stderr, "Allocation failed\n");
+		return;
+	}
+
+	printf("Benchmarking PUT latency while growing from %d buckets "
+	       "(%d puts)...\n",
+	       MIN_BUCKET_COUNT, RESIZE_LATENCY_KEYS);
+
+	for (mode = HASH_RESIZE_INLINE; mode <= HASH_RESIZE_BACKGROUND;
+	     mode++) {
+		struct hash_engine_config config = {
+			.bucket_count = MIN_BUCKET_COUNT,
+			.resize_mode = mode,
+		};
+		struct hash_engine engine;
+
+		if (hash_engine_init_config(&engine, &config) != 0) {
+			fprintf(stderr, "Init failed\n");
+			break;
+		}
+
+		for (i = 0; i < RESIZE_LATENCY_KEYS; i++) {
+			snprintf(key, sizeof(key), "grow_%d", i);
+			start = get_time_nsec();
+			hash_put(&engine, key, strlen(key), &i, sizeof(i));
+			latency[i] = (uint32_t)(get_time_nsec() - start);
+		}
+		hash_engine_get_stats(&engine, NULL, &buckets, NULL);
+
+		qsort(latency, RESIZE_LATENCY_KEYS, sizeof(*latency),
+		      compare_latency);
+		printf("  %-10s p50: %u ns  p99: %u ns  p99.9: %u ns  "
+		       "max: %.2f ms  (buckets: %llu)\n",
+		       mode_names[mode], latency[RESIZE_LATENCY_KEYS / 2],
+		       latency[RESIZE_LATENCY_KEYS / 100 * 99],
+		       latency[RESIZE_LATENCY_KEYS / 1000 * 999],
+		       latency[RESIZE_LATENCY_KEYS - 1] / 1e6,
+		       (unsigned long long)buckets);
+		hash_engine_destroy(&engine);
+	}
+	free(latency);
+	printf("\n");
+}
+
+#define MULTI_LOOKUPS 2000000
+#define MULTI_GROUP 64
+#define MULTI_KEY_LEN 16
+
+/* Benchmark: Batched vs single-key GET and PUT, in and beyond the LLC */
+static void
+bench_multi_get_put(void)
+{
+	/* 64K keys fit in cache; 2M keys spread over ~512 MB of buckets */
+	static const uint32_t key_counts[] = { 65536, 2000000 };
+	const int num_sizes
+	    = (int)(sizeof(key_counts) / sizeof(key_counts[0]));
+	const void *keys[MULTI_GROUP];
+	size_t key_lens[MULTI_GROUP];
+	const void *values[MULTI_GROUP];
+	size_t value_lens[MULTI_GROUP];
+	int results[MULTI_GROUP];
+	unsigned int seed = 42;
+	uint32_t *order;
+	char *names;
+	long long start;
+	double single_sec;
+	double batch_sec;
+	int s;
+	int i;
+	int j;
+
+	names = malloc((size_t)key_counts[num_sizes - 1] * MULTI_KEY_LEN);
+	order = malloc(MULTI_LOOKUPS * sizeof(*order));
+	if (!names || !order) {
+		fprintf(stderr, "Allocation failed\n");
+		free(names);
+		free(order);
+		return;
+	}
+
+	printf("Benchmarking batched vs single-key operations "
+	       "(%d random keys, groups of %d)...\n",
+	       MULTI_LOOKUPS, MULTI_GROUP);
+
+	for (s = 0; s < num_sizes; s++) {
+		struct hash_engine_config config = {
+			.bucket_count = DEFAULT_BUCKET_COUNT,
+			.shard_count = 4,
+		};
+		struct hash_engine engine;
+		uint32_t nkeys = key_counts[s];
+		uint64_t buckets;
+		const void *value;
+		size_t value_len;
+
+		if (hash_engine_init_config(&engine, &config) != 0) {
+			fprintf(stderr, "Init failed\n");
+			break;
+		}
+		for (i = 0; i < (int)nkeys; i++) {
+			char *name = names + (size_t)i * MULTI_KEY_LEN;
+
+			snprintf(name, MULTI_KEY_LEN, "mk_%011d", i);
+			hash_put(&engine, name, MULTI_KEY_LEN - 1, &i,
+				 sizeof(i));
+		}
+		for (i = 0; i < MULTI_LOOKUPS; i++)
+			order[i] = (uint32_t)rand_r(&seed) % nkeys;
+		hash_engine_get_stats(&engine, NULL, &buckets, NULL);
+
+		start = get_time_usec();
+		for (i = 0; i < MULTI_LOOKUPS; i++)
+			hash_get(&engine,
+				 names + (size_t)order[i] * MULTI_KEY_LEN,
+				 MULTI_KEY_LEN - 1, &value, &value_len);
+		single_sec = (get_time_usec() - start) / 1000000.0;
+
+		start = get_time_usec();
+		for (i = 0; i < MULTI_LOOKUPS; i += MULTI_GROUP) {
+			for (j = 0; j < MULTI_GROUP; j++) {
+				keys[j] = names
+					  + (size_t)order[i + j]
+						* MULTI_KEY_LEN;
+				key_lens[j] = MULTI_KEY_LEN - 1;
+			}
+			hash_multi_get(&engine, MULTI_GROUP, keys, key_lens,
+				       values, value_lens, results);
+		}
+		batch_sec = (get_time_usec() - start) / 1000000.0;
+
+		printf("  Keys: %-8u Buckets: %-8llu GET single: %.2f M/s  "
+		       "batched: %.2f M/s\n",
+		       nkeys, (unsigned long long)buckets,
+		       MULTI_LOOKUPS / single_sec / MILLION,
+		       MULTI_LOOKUPS / batch_sec / MILLION);
+
+		/* Overwrites keep the table size fixed */
+		start = get_time_usec();
+		for (i = 0; i < MULTI_LOOKUPS; i++)
+			hash_put(&engine,
+				 names + (size_t)order[i] * MULTI_KEY_LEN,
+				 MULTI_KEY_LEN - 1, &i, sizeof(i));
+		single_sec = (get_time_usec() - start) / 1000000.0;
+
+		start = get_time_usec();
+		for (i = 0; i < MULTI_LOOKUPS; i += MULTI_GROUP) {
+			for (j = 0; j < MULTI_GROUP; j++) {
+				keys[j] = names
+					  + (size_t)order[i + j]
+						* MULTI_KEY_LEN;
+				key_lens[j] = MULTI_KEY_LEN - 1;
+				values[j] = &order[i + j];
+				value_lens[j] = sizeof(order[i + j]);
+			}
+			hash_multi_put(&engine, MULTI_GROUP, keys, key_lens,
+				       values, value_lens, results);
+		}
+		batch_sec = (get_time_usec() - start) / 1000000.0;
+
+		printf("  Keys: %-8u Buckets: %-8llu PUT single: %.2f M/s  "
+		       "batched: %.2f M/s\n",
+		       nkeys, (unsigned long long)buckets,
+		       MULTI_LOOKUPS / single_sec / MILLION,
+		       MULTI_LOOKUPS / batch_sec / MILLION);
+		hash_engine_destroy(&engine);
+	}
+	free(names);
+	free(order);
+	printf("\n");
+}
+
+#define RMW_KEYS 10000
+#define RMW_OPS 2000000
+
+/* Benchmark: counter updates as get-then-put against hash_incr() */
+static void
+bench_read_modify_write(void)
+{
+	struct hash_engine engine;
+	long long start;
+	double get_put_sec;
+	double incr_sec;
+	uint64_t seed = 1;
+	int64_t count;
+	size_t len;
+	int i;
+
+	printf("Benchmarking read-modify-write (%d increments over %d "
+	       "keys)...\n",
+	       RMW_OPS, RMW_KEYS);
+
+	if (hash_engine_init(&engine, RMW_KEYS * 2) != 0) {
+		fprintf(stderr, "Init failed\n");
+		return;
+	}
+	start = get_time_usec();
+	for (i = 0; i < RMW_OPS; i++) {
+		uint64_t key;
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = (seed >> 33) % RMW_KEYS;
+		if (hash_get_copy(&engine, &key, sizeof(key), &count,
+				  sizeof(count), &len)
+		    != 0)
+			count = 0;
+		count++;
+		hash_put(&engine, &key, sizeof(key), &count, sizeof(count));
+	}
+	get_put_sec = (get_time_usec() - start) / 1000000.0;
+	hash_engine_destroy(&engine);
+
+	if (hash_engine_init(&engine, RMW_KEYS * 2) != 0) {
+		fprintf(stderr, "Init failed\n");
+		return;
+	}
+	seed = 1;
+	start = get_time_usec();
+	for (i = 0; i < RMW_OPS; i++) {
+		uint64_t key;
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = (seed >> 33) % RMW_KEYS;
+		hash_incr(&engine, &key, sizeof(key), 1, NULL);
+	}
+	incr_sec = (get_time_usec() - start) / 1000000.0;
+	hash_engine_destroy(&engine);
+
+	printf("  get + put:  %.0f ops/sec\n", RMW_OPS / get_put_sec);
+	printf("  hash_incr:  %.0f ops/sec (%.2fx)\n\n", RMW_OPS / incr_sec,
+	       get_put_sec / incr_sec);
+}
+
+/*
+ * With FUTEX_STATS_JSON set, write the run's lock contention there; only a
+ * -DFUTEX_STATS build (make lock-stats) has any to write.
+ */
+static void
+dump_lock_stats(void)
+{
+	const char *path = getenv("FUTEX_STATS_JSON");
+	FILE *out;
+	int rc;
+
+	if (!path)
+		return;
+	out = fopen(path, "w");
+	if (!out) {
+		perror(path);
+		return;
+	}
+	rc = futex_stats_dump_json(out);
+	fclose(out);
+	if (rc != 0) {
+		fprintf(stderr, "lock stats unavailable: %s\n", strerror(-rc));
+		remove(path);
+	} else {
+		printf("Lock contention written to %s\n", path);
+	}
+}
+
 int
 main(void)
 {
 	printf("===== Hash Table Throughput Benchmarks =====\n\n");
 
+	/* Only the table health run feeds hash_quality */
+	if (getenv("HASH_QUALITY_JSON")) {
+		bench_table_health();
+		return 0;
+	}
 	bench_insert_throughput();
 	bench_get_throughput();
 	bench_delete_throughput();
@@ -488,9 +1183,17 @@ main(void)
 	bench_mixed_workload();
 	bench_varying_value_sizes();
 	bench_load_factor_impact();
+	bench_table_health();
+	bench_read_mostly_scaling();
+	bench_probe_index_cost();
+	bench_sharded_put_scaling();
+	bench_resize_tail_latency();
+	bench_multi_get_put();
+	bench_read_modify_write();
 
 	printf("========================================\n");
 	printf("Benchmarks complete\n");
 
+	dump_lock_stats();
 	return 0;
 }
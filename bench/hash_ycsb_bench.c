@@ -0,0 +1,709 @@
+/**
+ * @file hash_ycsb_bench.c
+ * @brief YCSB core workloads A-F against the hash engine, multi-threaded
+ *
+ * Loads record_count records, then runs each workload for a fixed time
+ * across the given number of threads, each pinned to one of the CPUs the
+ * process may run on:
+ *
+ *   A  50% read, 50% update               zipfian
+ *   B  95% read, 5% update                zipfian
+ *   C  100% read                          zipfian
+ *   D  95% read, 5% insert                latest
+ *   E  95% scan, 5% insert                zipfian
+ *   F  50% read, 50% read-modify-write    zipfian
+ *
+ * -d replaces each workload's own distribution with uniform, zipfian
+ * (scrambled, theta 0.99, as YCSB's) or latest (zipfian over recency).
+ * Keys are "user" followed by a hash of the record number, as in YCSB.
+ * A hash table has no key order, so a scan reads the next 1 to
+ * YCSB_MAX_SCAN record numbers with one hash_multi_get(). Reads copy the
+ * value out with hash_get_copy(); a read-modify-write changes the value
+ * in place with one hash_upsert().
+ * Workloads run in order on the same engine, so D and E's inserts grow it
+ * for the workloads after them.
+ *
+ * Every operation is timed; the report gives throughput, p50/p99/p999
+ * latency per operation type from log-linear histograms (within 1/16 of
+ * the true value), and how evenly the threads shared the work: the
+ * slowest and fastest thread's operation counts and Jain's fairness index,
+ * 1.0 when every thread did the same.
+ *
+ * Usage: hash_ycsb_bench [-t threads] [-r records] [-s seconds]
+ *                        [-v value bytes] [-d distribution] [-w workloads]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "storage/hash_engine.h"
+
+#define DEFAULT_THREADS 8
+#define DEFAULT_RECORDS 1000000
+#define DEFAULT_SECONDS 2
+#define DEFAULT_VALUE_BYTES 100
+#define MAX_THREADS 256
+#define MAX_VALUE_BYTES 4096
+#define YCSB_SHARDS 16
+#define YCSB_MAX_SCAN 100
+#define ZIPFIAN_THETA 0.99
+/* "user" and up to 20 digits */
+#define KEY_BYTES 24
+#define MILLION 1000000.0
+
+/* 16 linear sub-buckets per power of two of nanoseconds */
+#define LAT_SUB_BITS 4
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+enum ycsb_op { OP_READ, OP_UPDATE, OP_INSERT, OP_SCAN, OP_RMW, OP_COUNT };
+static const char *const op_names[OP_COUNT] = { "read", "update", "insert",
+						"scan", "rmw" };
+
+enum ycsb_dist { DIST_UNIFORM, DIST_ZIPFIAN, DIST_LATEST, DIST_DEFAULT };
+static const char *const dist_names[] = { "uniform", "zipfian", "latest" };
+
+struct ycsb_workload {
+	char name;
+	/* Percent of operations of each type */
+	int mix[OP_COUNT];
+	enum ycsb_dist dist;
+};
+
+static const struct ycsb_workload workloads[] = {
+	{ 'A', { [OP_READ] = 50, [OP_UPDATE] = 50 }, DIST_ZIPFIAN },
+	{ 'B', { [OP_READ] = 95, [OP_UPDATE] = 5 }, DIST_ZIPFIAN },
+	{ 'C', { [OP_READ] = 100 }, DIST_ZIPFIAN },
+	{ 'D', { [OP_READ] = 95, [OP_INSERT] = 5 }, DIST_LATEST },
+	{ 'E', { [OP_SCAN] = 95, [OP_INSERT] = 5 }, DIST_ZIPFIAN },
+	{ 'F', { [OP_READ] = 50, [OP_RMW] = 50 }, DIST_ZIPFIAN },
+};
+
+/* Gray et al.'s generator over [0, items), as YCSB's ZipfianGenerator */
+struct zipfian {
+	uint64_t items;
+	double theta;
+	double alpha;
+	double zetan;
+	double eta;
+	double half_pow_theta;
+};
+
+struct ycsb_run {
+	struct hash_engine *engine;
+	const struct ycsb_workload *workload;
+	enum ycsb_dist dist;
+	struct zipfian zipf;
+	uint64_t records;
+	size_t value_bytes;
+	/* Next record number to insert; all below it were loaded or claimed */
+	_Atomic uint64_t insert_next;
+	/*
+	 * Records loaded or inserted so far, which the other operations
+	 * choose from. An insert still in progress can leave a gap below it,
+	 * which shows as a not-found read.
+	 */
+	_Atomic uint64_t inserted;
+	pthread_barrier_t start;
+	_Atomic int stop;
+};
+
+struct ycsb_thread {
+	pthread_t tid;
+	struct ycsb_run *run;
+	int cpu;
+	uint64_t seed;
+	uint64_t ops;
+	uint64_t not_found;
+	uint64_t op_count[OP_COUNT];
+	uint64_t lat[OP_COUNT][LAT_BUCKETS];
+	unsigned char value[MAX_VALUE_BYTES];
+	unsigned char copy[MAX_VALUE_BYTES];
+};
+
+static long long
+get_time_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline uint64_t
+next_random(uint64_t *seed)
+{
+	uint64_t x = *seed;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*seed = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+/* Uniform double in [0, 1) */
+static inline double
+next_double(uint64_t *seed)
+{
+	return (double)(next_random(seed) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t
+fnv1a_64(uint64_t v)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (int i = 0; i < 8; i++) {
+		h ^= v & 0xff;
+		h *= 0x100000001b3ULL;
+		v >>= 8;
+	}
+	return h;
+}
+
+/* YCSB's key for record number id; returns its length */
+static size_t
+ycsb_key(char *buf, uint64_t id)
+{
+	char digits[20];
+	uint64_t h = fnv1a_64(id);
+	size_t n = 0;
+
+	do {
+		digits[n++] = (char)('0' + h % 10);
+		h /= 10;
+	} while (h);
+	memcpy(buf, "user", 4);
+	for (size_t i = 0; i < n; i++)
+		buf[4 + i] = digits[n - 1 - i];
+	return 4 + n;
+}
+
+static void
+zipfian_init(struct zipfian *z, uint64_t items, double theta)
+{
+	double zeta2 = 1.0 + pow(0.5, theta);
+
+	z->items = items;
+	z->theta = theta;
+	z->zetan = 0;
+	for (uint64_t i = 1; i <= items; i++)
+		z->zetan += 1.0 / pow((double)i, theta);
+	z->alpha = 1.0 / (1.0 - theta);
+	z->eta = (1.0 - pow(2.0 / (double)items, 1.0 - theta))
+		 / (1.0 - zeta2 / z->zetan);
+	z->half_pow_theta = pow(0.5, theta);
+}
+
+/* Rank from 0, the most popular, to items - 1 */
+static uint64_t
+zipfian_next(const struct zipfian *z, uint64_t *seed)
+{
+	double u = next_double(seed);
+	double uz = u * z->zetan;
+	uint64_t rank;
+
+	if (uz < 1.0)
+		return 0;
+	if (uz < 1.0 + z->half_pow_theta)
+		return 1;
+	rank = (uint64_t)((double)z->items
+			  * pow(z->eta * u - z->eta + 1.0, z->alpha));
+	return rank < z->items ? rank : z->items - 1;
+}
+
+/* Record number for the next read, update, scan or read-modify-write */
+static uint64_t
+choose_record(struct ycsb_run *run, uint64_t *seed)
+{
+	uint64_t count = atomic_load_explicit(&run->inserted,
+					      memory_order_relaxed);
+	uint64_t rank;
+
+	switch (run->dist) {
+	case DIST_UNIFORM:
+		return next_random(seed) % count;
+	case DIST_LATEST:
+		/* The newest record is the most popular */
+		rank = zipfian_next(&run->zipf, seed);
+		return rank < count ? count - 1 - rank : 0;
+	default:
+		/* Scrambled, so the popular records are spread out */
+		rank = zipfian_next(&run->zipf, seed);
+		return fnv1a_64(rank) % count;
+	}
+}
+
+static inline unsigned int
+lat_bucket(uint64_t ns)
+{
+	unsigned int e;
+
+	if (ns < LAT_SUB)
+		return (unsigned int)ns;
+	e = 63 - (unsigned int)__builtin_clzll(ns);
+	return (e - LAT_SUB_BITS + 1) * LAT_SUB
+	       + (unsigned int)((ns >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/* Largest latency bucket b holds */
+static uint64_t
+lat_bucket_max(unsigned int b)
+{
+	unsigned int e;
+	uint64_t m;
+
+	if (b < LAT_SUB)
+		return b;
+	e = b / LAT_SUB + LAT_SUB_BITS - 1;
+	m = b % LAT_SUB;
+	return ((LAT_SUB + m + 1) << (e - LAT_SUB_BITS)) - 1;
+}
+
+static uint64_t
+lat_quantile(const uint64_t *hist, uint64_t total, double q)
+{
+	uint64_t rank = (uint64_t)((double)(total - 1) * q) + 1;
+	uint64_t seen = 0;
+
+	for (unsigned int b = 0; b < LAT_BUCKETS; b++) {
+		seen += hist[b];
+		if (seen >= rank)
+			return lat_bucket_max(b);
+	}
+	return lat_bucket_max(LAT_BUCKETS - 1);
+}
+
+/* Read-modify-write: bump the first byte of a copy of the current value */
+static int
+rmw_value(void *ctx, const void *value, size_t value_len,
+	  const void **new_value, size_t *new_len)
+{
+	struct ycsb_thread *t = ctx;
+
+	if (!value)
+		return -ENOENT;
+	if (value_len > sizeof(t->copy) || value_len == 0)
+		return -EINVAL;
+	memcpy(t->copy, value, value_len);
+	t->copy[0]++;
+	*new_value = t->copy;
+	*new_len = value_len;
+	return 0;
+}
+
+static int
+do_op(struct ycsb_thread *t, enum ycsb_op op)
+{
+	struct ycsb_run *run = t->run;
+	struct hash_engine *engine = run->engine;
+	char key[KEY_BYTES];
+	size_t key_len;
+	size_t len;
+	uint64_t id;
+	int rc;
+
+	if (op == OP_INSERT)
+		id = atomic_fetch_add(&run->insert_next, 1);
+	else
+		id = choose_record(run, &t->seed);
+	key_len = ycsb_key(key, id);
+
+	switch (op) {
+	case OP_READ:
+		return hash_get_copy(engine, key, key_len, t->copy,
+				     sizeof(t->copy), &len);
+	case OP_UPDATE:
+		memcpy(t->value, &id, sizeof(id));
+		return hash_put(engine, key, key_len, t->value,
+				run->value_bytes);
+	case OP_INSERT:
+		memcpy(t->value, &id, sizeof(id));
+		rc = hash_put(engine, key, key_len, t->value,
+			      run->value_bytes);
+		atomic_fetch_add(&run->inserted, 1);
+		return rc;
+	case OP_RMW:
+		return hash_upsert(engine, key, key_len, rmw_value, t);
+	default:
+		break;
+	}
+
+	/* Scan: the next 1 to YCSB_MAX_SCAN record numbers in one batch */
+	{
+		char keys[YCSB_MAX_SCAN][KEY_BYTES];
+		const void *key_ptrs[YCSB_MAX_SCAN];
+		size_t key_lens[YCSB_MAX_SCAN];
+		const void *values[YCSB_MAX_SCAN];
+		size_t value_lens[YCSB_MAX_SCAN];
+		int results[YCSB_MAX_SCAN];
+		size_t count = 1 + next_random(&t->seed) % YCSB_MAX_SCAN;
+
+		for (size_t i = 0; i < count; i++) {
+			key_lens[i] = ycsb_key(keys[i], id + i);
+			key_ptrs[i] = keys[i];
+		}
+		return hash_multi_get(engine, count, key_ptrs, key_lens,
+				      values, value_lens, results);
+	}
+}
+
+static enum ycsb_op
+choose_op(const struct ycsb_workload *w, uint64_t *seed)
+{
+	int pick = (int)(next_random(seed) % 100);
+	int op;
+
+	for (op = 0; op < OP_COUNT - 1; op++) {
+		if (pick < w->mix[op])
+			break;
+		pick -= w->mix[op];
+	}
+	return (enum ycsb_op)op;
+}
+
+static void *
+ycsb_worker(void *p)
+{
+	struct ycsb_thread *t = p;
+	struct ycsb_run *run = t->run;
+
+	pthread_barrier_wait(&run->start);
+	while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+		enum ycsb_op op = choose_op(run->workload, &t->seed);
+		long long start = get_time_nsec();
+		int rc = do_op(t, op);
+		long long ns = get_time_nsec() - start;
+
+		if (rc == -ENOENT)
+			t->not_found++;
+		t->lat[op][lat_bucket((uint64_t)ns)]++;
+		t->op_count[op]++;
+		t->ops++;
+	}
+	return NULL;
+}
+
+/* Pin to the CPU given, if it is one the process may use */
+static void
+pin_attr(pthread_attr_t *attr, int cpu)
+{
+	cpu_set_t set;
+
+	pthread_attr_init(attr);
+	if (cpu < 0)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+/* The CPUs this process may run on, in order; returns how many */
+static int
+allowed_cpus(int *cpus, int max)
+{
+	cpu_set_t set;
+	int n = 0;
+
+	if (sched_getaffinity(0, sizeof(set), &set) != 0)
+		return 0;
+	for (int cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++)
+		if (CPU_ISSET(cpu, &set))
+			cpus[n++] = cpu;
+	return n;
+}
+
+struct load_args {
+	struct hash_engine *engine;
+	uint64_t first;
+	uint64_t last;
+	size_t value_bytes;
+	int failed;
+};
+
+static void *
+load_worker(void *p)
+{
+	struct load_args *a = p;
+	unsigned char value[MAX_VALUE_BYTES] = { 0 };
+	char key[KEY_BYTES];
+
+	for (uint64_t id = a->first; id < a->last; id++) {
+		size_t key_len = ycsb_key(key, id);
+
+		memcpy(value, &id, sizeof(id));
+		if (hash_put(a->engine, key, key_len, value, a->value_bytes)
+		    != 0)
+			a->failed = 1;
+	}
+	return NULL;
+}
+
+static int
+load_records(struct hash_engine *engine, uint64_t records, size_t value_bytes,
+	     int threads, const int *cpus, int ncpus)
+{
+	static struct load_args args[MAX_THREADS];
+	pthread_t tids[MAX_THREADS];
+	long long start = get_time_nsec();
+	double sec;
+	int failed = 0;
+
+	for (int i = 0; i < threads; i++) {
+		pthread_attr_t attr;
+
+		args[i] = (struct load_args){
+			.engine = engine,
+			.first = records * (uint64_t)i / (uint64_t)threads,
+			.last = records * (uint64_t)(i + 1) / (uint64_t)threads,
+			.value_bytes = value_bytes,
+		};
+		pin_attr(&attr, ncpus ? cpus[i % ncpus] : -1);
+		pthread_create(&tids[i], &attr, load_worker, &args[i]);
+		pthread_attr_destroy(&attr);
+	}
+	for (int i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+		failed |= args[i].failed;
+	}
+	sec = (get_time_nsec() - start) / 1e9;
+	printf("  load: %llu records in %.2f s (%.2f Mops/s)\n\n",
+	       (unsigned long long)records, sec,
+	       (double)records / sec / MILLION);
+	return failed ? -1 : 0;
+}
+
+static void
+report(const struct ycsb_run *run, struct ycsb_thread *threads, int nthreads,
+       double sec)
+{
+	static uint64_t hist[LAT_BUCKETS];
+	uint64_t total = 0;
+	uint64_t not_found = 0;
+	uint64_t min_ops = UINT64_MAX;
+	uint64_t max_ops = 0;
+	double sum_sq = 0;
+	double jain;
+
+	for (int i = 0; i < nthreads; i++) {
+		uint64_t ops = threads[i].ops;
+
+		total += ops;
+		not_found += threads[i].not_found;
+		sum_sq += (double)ops * (double)ops;
+		if (ops < min_ops)
+			min_ops = ops;
+		if (ops > max_ops)
+			max_ops = ops;
+	}
+	jain = sum_sq > 0 ? (double)total * (double)total
+				    / ((double)nthreads * sum_sq)
+			  : 0;
+
+	printf("Workload %c (%s): %.3f Mops/s, %llu ops in %.2f s",
+	       run->workload->name, dist_names[run->dist],
+	       (double)total / sec / MILLION, (unsigned long long)total, sec);
+	if (not_found)
+		printf(", %llu not found", (unsigned long long)not_found);
+	printf("\n");
+
+	for (int op = 0; op < OP_COUNT; op++) {
+		uint64_t count = 0;
+
+		memset(hist, 0, sizeof(hist));
+		for (int i = 0; i < nthreads; i++) {
+			count += threads[i].op_count[op];
+			for (int b = 0; b < LAT_BUCKETS; b++)
+				hist[b] += threads[i].lat[op][b];
+		}
+		if (count == 0)
+			continue;
+		printf("  %-7s %10llu ops  p50 %7llu ns  p99 %7llu ns  "
+		       "p999 %8llu ns\n",
+		       op_names[op], (unsigned long long)count,
+		       (unsigned long long)lat_quantile(hist, count, 0.50),
+		       (unsigned long long)lat_quantile(hist, count, 0.99),
+		       (unsigned long long)lat_quantile(hist, count, 0.999));
+	}
+	printf("  fairness: per-thread ops min %llu max %llu, Jain index "
+	       "%.3f\n\n",
+	       (unsigned long long)min_ops, (unsigned long long)max_ops, jain);
+}
+
+static int
+run_workload(struct ycsb_run *run, struct ycsb_thread *threads, int nthreads,
+	     const int *cpus, int ncpus, int seconds)
+{
+	long long start;
+	double sec;
+
+	atomic_store(&run->stop, 0);
+	if (pthread_barrier_init(&run->start, NULL, (unsigned)nthreads + 1)
+	    != 0)
+		return -1;
+
+	for (int i = 0; i < nthreads; i++) {
+		struct ycsb_thread *t = &threads[i];
+		pthread_attr_t attr;
+
+		memset(t, 0, offsetof(struct ycsb_thread, value));
+		t->run = run;
+		t->cpu = ncpus ? cpus[i % ncpus] : -1;
+		t->seed = 0x243f6a8885a308d3ULL * (uint64_t)(i + 1)
+			  ^ (uint64_t)(unsigned char)run->workload->name;
+		pin_attr(&attr, t->cpu);
+		pthread_create(&t->tid, &attr, ycsb_worker, t);
+		pthread_attr_destroy(&attr);
+	}
+
+	pthread_barrier_wait(&run->start);
+	start = get_time_nsec();
+	sleep((unsigned)seconds);
+	atomic_store(&run->stop, 1);
+	for (int i = 0; i < nthreads; i++)
+		pthread_join(threads[i].tid, NULL);
+	sec = (get_time_nsec() - start) / 1e9;
+	pthread_barrier_destroy(&run->start);
+
+	report(run, threads, nthreads, sec);
+	return 0;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t threads (1-%d)] [-r records] [-s seconds]\n"
+		"       [-v value bytes (8-%d)] [-d uniform|zipfian|latest]\n"
+		"       [-w workloads, e.g. ABCDEF]\n",
+		prog, MAX_THREADS, MAX_VALUE_BYTES);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct hash_engine_config config = { .shard_count = YCSB_SHARDS };
+	static struct ycsb_run run;
+	static int cpus[CPU_SETSIZE];
+	struct ycsb_thread *threads;
+	struct hash_engine engine;
+	enum ycsb_dist dist = DIST_DEFAULT;
+	const char *names = "ABCDEF";
+	long nthreads = DEFAULT_THREADS;
+	long long records = DEFAULT_RECORDS;
+	long seconds = DEFAULT_SECONDS;
+	long value_bytes = DEFAULT_VALUE_BYTES;
+	int ncpus;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:r:s:v:d:w:")) != -1) {
+		switch (opt) {
+		case 't':
+			nthreads = strtol(optarg, NULL, 10);
+			break;
+		case 'r':
+			records = strtoll(optarg, NULL, 10);
+			break;
+		case 's':
+			seconds = strtol(optarg, NULL, 10);
+			break;
+		case 'v':
+			value_bytes = strtol(optarg, NULL, 10);
+			break;
+		case 'd':
+			for (dist = DIST_UNIFORM; dist < DIST_DEFAULT; dist++)
+				if (strcmp(optarg, dist_names[dist]) == 0)
+					break;
+			if (dist == DIST_DEFAULT) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'w':
+			names = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (nthreads < 1 || nthreads > MAX_THREADS || records < 2
+	    || seconds < 1 || value_bytes < 8
+	    || value_bytes > MAX_VALUE_BYTES) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	threads = calloc((size_t)nthreads, sizeof(*threads));
+	if (!threads) {
+		fprintf(stderr, "Allocation failed\n");
+		return 1;
+	}
+	ncpus = allowed_cpus(cpus, CPU_SETSIZE);
+
+	printf("===== YCSB Hash Benchmark =====\n\n");
+	printf("  %ld threads pinned round-robin to %d CPU%s, %lld records, "
+	       "%ld-byte values, %ld s per workload\n",
+	       nthreads, ncpus, ncpus == 1 ? "" : "s", records, value_bytes,
+	       seconds);
+
+	/* Pre-sized to stay under the grow threshold while loading */
+	config.bucket_count = (uint64_t)records * 2;
+	if (hash_engine_init_config(&engine, &config) != 0) {
+		fprintf(stderr, "Init failed\n");
+		free(threads);
+		return 1;
+	}
+	if (load_records(&engine, (uint64_t)records, (size_t)value_bytes,
+			 (int)nthreads, cpus, ncpus)
+	    != 0) {
+		fprintf(stderr, "Load failed\n");
+		hash_engine_destroy(&engine);
+		free(threads);
+		return 1;
+	}
+
+	run.engine = &engine;
+	run.records = (uint64_t)records;
+	run.value_bytes = (size_t)value_bytes;
+	atomic_init(&run.insert_next, (uint64_t)records);
+	atomic_init(&run.inserted, (uint64_t)records);
+	zipfian_init(&run.zipf, (uint64_t)records, ZIPFIAN_THETA);
+
+	for (const char *c = names; *c; c++) {
+		const struct ycsb_workload *w = NULL;
+
+		for (size_t i = 0; i < sizeof(workloads) / sizeof(*workloads);
+		     i++)
+			if (workloads[i].name == *c)
+				w = &workloads[i];
+		if (!w) {
+			fprintf(stderr, "No workload %c\n", *c);
+			continue;
+		}
+		run.workload = w;
+		run.dist = dist == DIST_DEFAULT ? w->dist : dist;
+		if (run_workload(&run, threads, (int)nthreads, cpus, ncpus,
+				 (int)seconds)
+		    != 0)
+			break;
+	}
+
+	hash_engine_destroy(&engine);
+	free(threads);
+
+	printf("========================================\n");
+	printf("Benchmarks complete\n");
+	return 0;
+}
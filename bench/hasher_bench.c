@@ -0,0 +1,221 @@
+/**
+ * @file hasher_bench.c
+ * @brief Speed and quality benchmarks for the selectable hash functions
+ *
+ * Reports ns/hash and ns/byte across key lengths, the worst avalanche bias
+ * over all input/output bit pairs, and how evenly sequential keys spread
+ * over table slots (low bits) and control-byte tags (top seven bits). Also
+ * compares scalar SipHash with the multi-lane siphash_batch() kernel.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "storage/hash/hasher.h"
+#include "storage/hash/siphash.h"
+
+#define SPEED_BYTES (64 * 1024 * 1024)
+#define AVALANCHE_KEY_LEN 16
+#define AVALANCHE_SAMPLES 20000
+#define SPREAD_KEYS 1000000
+#define SPREAD_SLOT_BITS 16
+#define TAG_BINS 128
+#define LANE_BATCH 64
+#define LANE_ROUNDS 50000
+
+static volatile uint64_t hash_sink;
+
+static long long
+get_time_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Throughput at one key length, chaining hashes so calls cannot overlap */
+static void
+bench_speed(hasher_fn fn, const unsigned char *buf, size_t len)
+{
+	size_t iters = SPEED_BYTES / len;
+	uint64_t sink = 0;
+	long long start;
+	double ns;
+
+	if (iters > 4000000)
+		iters = 4000000;
+
+	start = get_time_nsec();
+	for (size_t i = 0; i < iters; i++)
+		sink += fn(buf + (sink & 7), len, 1, 2);
+	ns = (double)(get_time_nsec() - start) / iters;
+
+	hash_sink = sink;
+
+	printf("    len %-5zu %7.2f ns/hash  %6.3f ns/byte\n", len, ns,
+	       ns / len);
+}
+
+/*
+ * Flip every input bit of random keys and record how often each output
+ * bit flips; an ideal hash flips each with probability 1/2.
+ */
+static double
+avalanche_bias(hasher_fn fn)
+{
+	static uint32_t flips[AVALANCHE_KEY_LEN * 8][64];
+	unsigned char key[AVALANCHE_KEY_LEN];
+	unsigned int seed = 11;
+	double worst = 0;
+
+	memset(flips, 0, sizeof(flips));
+	for (int s = 0; s < AVALANCHE_SAMPLES; s++) {
+		uint64_t base;
+
+		for (int i = 0; i < AVALANCHE_KEY_LEN; i++)
+			key[i] = (unsigned char)rand_r(&seed);
+		base = fn(key, sizeof(key), 1, 2);
+
+		for (int bit = 0; bit < AVALANCHE_KEY_LEN * 8; bit++) {
+			uint64_t diff;
+
+			key[bit / 8] ^= (unsigned char)(1U << (bit % 8));
+			diff = base ^ fn(key, sizeof(key), 1, 2);
+			key[bit / 8] ^= (unsigned char)(1U << (bit % 8));
+			for (int out = 0; out < 64; out++)
+				flips[bit][out] += (diff >> out) & 1;
+		}
+	}
+
+	for (int bit = 0; bit < AVALANCHE_KEY_LEN * 8; bit++) {
+		for (int out = 0; out < 64; out++) {
+			double p = (double)flips[bit][out] / AVALANCHE_SAMPLES;
+			double bias = p > 0.5 ? p - 0.5 : 0.5 - p;
+
+			if (bias > worst)
+				worst = bias;
+		}
+	}
+	return worst;
+}
+
+/* Chi-square over bins divided by its degrees of freedom; ~1.0 is ideal */
+static double
+chi_square_ratio(const uint32_t *bins, uint32_t nbins, uint32_t total)
+{
+	double expected = (double)total / nbins;
+	double chi = 0;
+
+	for (uint32_t i = 0; i < nbins; i++) {
+		double d = bins[i] - expected;
+
+		chi += d * d / expected;
+	}
+	return chi / (nbins - 1);
+}
+
+static void
+bench_spread(hasher_fn fn)
+{
+	uint32_t *slots = calloc(1U << SPREAD_SLOT_BITS, sizeof(*slots));
+	uint32_t tags[TAG_BINS] = { 0 };
+	char key[32];
+
+	if (!slots) {
+		fprintf(stderr, "Allocation failed\n");
+		return;
+	}
+	for (int i = 0; i < SPREAD_KEYS; i++) {
+		int len = snprintf(key, sizeof(key), "key_%d", i);
+		uint64_t h = fn(key, (size_t)len, 1, 2);
+
+		slots[h & ((1U << SPREAD_SLOT_BITS) - 1)]++;
+		tags[h >> 57]++;
+	}
+	printf("    sequential keys: slot chi2/df %.3f  tag chi2/df %.3f\n",
+	       chi_square_ratio(slots, 1U << SPREAD_SLOT_BITS, SPREAD_KEYS),
+	       chi_square_ratio(tags, TAG_BINS, SPREAD_KEYS));
+	free(slots);
+}
+
+/* Scalar vs multi-lane SipHash over batches of distinct keys */
+static void
+bench_siphash_lanes(const unsigned char *buf, size_t len)
+{
+	const void *data[LANE_BATCH];
+	size_t lens[LANE_BATCH];
+	uint64_t out[LANE_BATCH];
+	uint64_t sink = 0;
+	long long start;
+	double scalar_ns;
+	double batch_ns;
+
+	for (int i = 0; i < LANE_BATCH; i++) {
+		data[i] = buf + i;
+		lens[i] = len;
+	}
+
+	start = get_time_nsec();
+	for (int r = 0; r < LANE_ROUNDS; r++) {
+		for (int i = 0; i < LANE_BATCH; i++)
+			sink += siphash(data[i], lens[i], r, 2);
+	}
+	scalar_ns = (double)(get_time_nsec() - start)
+		    / ((double)LANE_ROUNDS * LANE_BATCH);
+
+	start = get_time_nsec();
+	for (int r = 0; r < LANE_ROUNDS; r++) {
+		siphash_batch(data, lens, LANE_BATCH, r, 2, out);
+		sink += out[r % LANE_BATCH];
+	}
+	batch_ns = (double)(get_time_nsec() - start)
+		   / ((double)LANE_ROUNDS * LANE_BATCH);
+	hash_sink = sink;
+
+	printf("    len %-5zu scalar %6.2f ns/hash  lanes %6.2f ns/hash  "
+	       "(%.2fx)\n",
+	       len, scalar_ns, batch_ns, scalar_ns / batch_ns);
+}
+
+int
+main(void)
+{
+	static const size_t lens[] = { 8, 16, 32, 64, 256, 1024 };
+	unsigned char *buf = malloc(1024 + 8);
+
+	if (!buf) {
+		fprintf(stderr, "Allocation failed\n");
+		return 1;
+	}
+	for (int i = 0; i < 1024 + 8; i++)
+		buf[i] = (unsigned char)(i * 131);
+
+	printf("===== Hasher Benchmarks =====\n\n");
+
+	for (int kind = 0; kind < HASHER_COUNT; kind++) {
+		hasher_fn fn = hasher_get(kind);
+
+		printf("  %s\n", hasher_name(kind));
+		for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+			bench_speed(fn, buf, lens[i]);
+		printf("    avalanche: worst bias %.4f\n", avalanche_bias(fn));
+		bench_spread(fn);
+		printf("\n");
+	}
+
+	printf("  siphash-2-4, %d keys per siphash_batch() call\n",
+	       LANE_BATCH);
+	for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		if (lens[i] + LANE_BATCH <= 1024 + 8)
+			bench_siphash_lanes(buf, lens[i]);
+	}
+	printf("\n");
+
+	free(buf);
+	printf("========================================\n");
+	printf("Benchmarks complete\n");
+	return 0;
+}
@@ -1,6 +1,12 @@
 /**
  * @file bucket.h
  * @brief Public API for bucket state management in open addressing.
+ *
+ * Keys and values are stored inline in the bucket when they fit in
+ * BUCKET_INLINE_SIZE bytes together, so the common put/get does no
+ * allocation and stays within the bucket's two cache lines. Larger keys or
+ * values fall back to an out-of-line allocation each; the inline area then
+ * holds the pointer instead of the bytes.
  */
 
 #ifndef STORAGE_HASH_BUCKET_H
@@ -9,30 +15,167 @@
 #include "utils/futex_mutex_wrapper.h"
 #include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 #define BUCKET_EMPTY 0
 #define BUCKET_OCCUPIED 1
 #define BUCKET_TOMBSTONE 2
 
+/* Storage flags: set when the key/value lives outside the bucket */
+#define BUCKET_F_KEY_EXT 0x1
+#define BUCKET_F_VALUE_EXT 0x2
+/*
+ * Set along with the matching _EXT flag when the bucket does not own the
+ * part: it lives in a mapped snapshot (storage/hash/snapshot.h), or
+ * bucket_adopt_unlocked() handed it on to another bucket.
+ */
+#define BUCKET_F_KEY_MAPPED 0x4
+#define BUCKET_F_VALUE_MAPPED 0x8
+
+/*
+ * Inline capacity for key + value bytes. Sized so a key of up to 32 bytes
+ * and a value of up to 64 bytes fit; with the header this fills 128 bytes,
+ * which is the pair of lines the adjacent-line prefetcher pulls in
+ * together. Buckets carry no lock: the table locks slots through a striped
+ * lock array (see struct hash_table).
+ */
+#define BUCKET_INLINE_SIZE 96
+#define BUCKET_ALIGN 128
+
+/* Largest key or value length a bucket can record */
+#define BUCKET_MAX_LEN UINT32_MAX
+
 struct hash_bucket {
 	_Atomic int state;
-	const void *key;
-	size_t key_len;
-	const void *value;
-	size_t value_len;
-	futex_mutex_t lock_futex;
-};
+	/* Odd while a writer holding the slot's lock is changing the bucket */
+	_Atomic uint32_t seq;
+	uint32_t flags;
+	uint32_t key_len;
+	uint32_t value_len;
+	/* Second on the engine's TTL clock the entry expires at; 0 never */
+	uint32_t expires;
+	/* Full key hash; readable without the lock to filter probes */
+	_Atomic uint64_t hash;
+	unsigned char data[BUCKET_INLINE_SIZE];
+} __attribute__((aligned(BUCKET_ALIGN)));
+
+/*
+ * Sequence counter protocol: writers wrap every change to state, lengths,
+ * flags, hash or data[] in bucket_write_begin/end while holding the lock.
+ * Lock-free readers take a snapshot between bucket_read_begin and
+ * bucket_read_retry and discard it if the counter moved.
+ */
+static inline void
+bucket_write_begin(struct hash_bucket *bucket)
+{
+	atomic_store_explicit(
+	    &bucket->seq,
+	    atomic_load_explicit(&bucket->seq, memory_order_relaxed) + 1,
+	    memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static inline void
+bucket_write_end(struct hash_bucket *bucket)
+{
+	atomic_store_explicit(
+	    &bucket->seq,
+	    atomic_load_explicit(&bucket->seq, memory_order_relaxed) + 1,
+	    memory_order_release);
+}
+
+static inline uint32_t
+bucket_read_begin(const struct hash_bucket *bucket)
+{
+	uint32_t seq;
+
+	while ((seq = atomic_load_explicit(&bucket->seq, memory_order_acquire))
+	       & 1)
+		CPU_RELAX();
+	return seq;
+}
+
+static inline int
+bucket_read_retry(const struct hash_bucket *bucket, uint32_t seq)
+{
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&bucket->seq, memory_order_relaxed) != seq;
+}
+
+/* Offset of the value part inside data[] */
+static inline size_t
+bucket_value_offset(const struct hash_bucket *bucket)
+{
+	return (bucket->flags & BUCKET_F_KEY_EXT) ? sizeof(void *)
+						  : bucket->key_len;
+}
+
+static inline uint64_t
+bucket_hash(const struct hash_bucket *bucket)
+{
+	return atomic_load_explicit(&bucket->hash, memory_order_relaxed);
+}
+
+static inline const void *
+bucket_key(const struct hash_bucket *bucket)
+{
+	const void *ptr;
+
+	if (!(bucket->flags & BUCKET_F_KEY_EXT))
+		return bucket->data;
+	memcpy(&ptr, bucket->data, sizeof(ptr));
+	return ptr;
+}
+
+static inline const void *
+bucket_value(const struct hash_bucket *bucket)
+{
+	const unsigned char *slot = bucket->data + bucket_value_offset(bucket);
+	const void *ptr;
+
+	if (!(bucket->flags & BUCKET_F_VALUE_EXT))
+		return slot;
+	memcpy(&ptr, slot, sizeof(ptr));
+	return ptr;
+}
 
 int bucket_state(struct hash_bucket *bucket);
 int bucket_is_empty(struct hash_bucket *bucket);
 int bucket_is_tombstone(struct hash_bucket *bucket);
-int bucket_make_tombstone(struct hash_bucket *bucket);
 int bucket_make_tombstone_unlocked(struct hash_bucket *bucket);
+/* Neither may race with any other access to the bucket */
 int bucket_init(struct hash_bucket *bucket);
 int bucket_destroy(struct hash_bucket *bucket);
-int bucket_set(struct hash_bucket *bucket, const void *key, size_t key_len,
-	       const void *value, size_t value_len);
-int bucket_set_replace_value(struct hash_bucket *bucket, const void *value,
-			     size_t value_len, size_t *old_value_len);
+
+/*
+ * Unlocked variants; the caller holds the slot's lock. bucket_store
+ * fills an empty or tombstone bucket with a key of the given hash and marks
+ * it occupied; on -ENOMEM the bucket is left untouched. Both set the
+ * entry's expiry along with its value.
+ */
+int bucket_store_unlocked(struct hash_bucket *bucket, uint64_t hash,
+			  const void *key, size_t key_len, const void *value,
+			  size_t value_len, uint32_t expires);
+int bucket_replace_value_unlocked(struct hash_bucket *bucket,
+				  const void *value, size_t value_len,
+				  uint32_t expires);
+
+/*
+ * bucket_clear empties the bucket without leaving a tombstone. bucket_move
+ * transfers an occupied src, out-of-line parts included, into an empty dst
+ * and leaves src empty; both buckets must be held by the caller.
+ */
+int bucket_clear_unlocked(struct hash_bucket *bucket);
+int bucket_move_unlocked(struct hash_bucket *dst, struct hash_bucket *src);
+
+/*
+ * bucket_adopt fills an empty or tombstone dst with occupied src's entry,
+ * as a resize does when it moves an entry between tables. dst takes over
+ * the out-of-line parts src owns and copies the ones src does not; src
+ * reads the same afterwards but owns nothing. On -ENOMEM neither bucket
+ * changes.
+ */
+int bucket_adopt_unlocked(struct hash_bucket *dst, struct hash_bucket *src);
 
 #endif /* STORAGE_HASH_BUCKET_H */
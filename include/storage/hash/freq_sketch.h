@@ -0,0 +1,52 @@
+/**
+ * @file freq_sketch.h
+ * @brief Count-min frequency sketch for TinyLFU admission
+ *
+ * Estimates how often a hash was seen recently. Each hash maps to one
+ * 64-byte block and to one counter in each of the block's four 16-byte
+ * rows, so an update or estimate touches a single cache line; the estimate
+ * is the smallest of the four. Counters saturate at FREQ_SKETCH_MAX.
+ *
+ * Once the sketch has taken a sample's worth of additions, every counter
+ * is halved, so old popularity fades and a key that used to be hot has to
+ * keep being asked for to stay that way.
+ *
+ * Counters are updated with relaxed loads and stores rather than atomic
+ * read-modify-writes: concurrent additions of one hash may count once, and
+ * an addition may race a halving. Either only blurs an estimate.
+ */
+
+#ifndef STORAGE_HASH_FREQ_SKETCH_H
+#define STORAGE_HASH_FREQ_SKETCH_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define FREQ_SKETCH_MAX 15
+#define FREQ_SKETCH_MIN_WIDTH 1024
+#define FREQ_SKETCH_MAX_WIDTH (1U << 26)
+
+struct freq_sketch {
+	uint8_t *counters;
+	/* Power of two, a multiple of 64 */
+	uint32_t width;
+	uint32_t block_mask;
+	/* Additions between halvings */
+	uint64_t sample;
+	_Atomic uint64_t additions;
+};
+
+/*
+ * Size the sketch for width counters, rounded up to a power of two within
+ * FREQ_SKETCH_MIN_WIDTH and FREQ_SKETCH_MAX_WIDTH. Returns 0 or -ENOMEM.
+ */
+int freq_sketch_init(struct freq_sketch *sketch, uint64_t width);
+void freq_sketch_destroy(struct freq_sketch *sketch);
+
+/* Count one sighting of hash */
+void freq_sketch_add(struct freq_sketch *sketch, uint64_t hash);
+
+/* Estimated sightings of hash since it was last halved, at most 15 */
+uint32_t freq_sketch_estimate(const struct freq_sketch *sketch, uint64_t hash);
+
+#endif /* STORAGE_HASH_FREQ_SKETCH_H */
@@ -0,0 +1,134 @@
+/**
+ * @file group.h
+ * @brief Control-byte groups for SIMD probing of the bucket array.
+ *
+ * Every slot has one control byte in a dense array next to the buckets:
+ * CTRL_EMPTY, CTRL_DELETED, or a 7-bit tag taken from the top of the key's
+ * hash when the slot is occupied. Probes load GROUP_WIDTH control bytes at
+ * once and compare them against a tag with one vector compare (SSE2 on
+ * x86-64, NEON on AArch64, a scalar loop elsewhere), so mismatching and
+ * empty slots are skipped without touching their buckets.
+ *
+ * Compare results are bit masks with one set bit per matching slot, at bit
+ * position (slot << GROUP_MASK_SHIFT); iterate them with group_mask_next().
+ */
+
+#ifndef STORAGE_HASH_GROUP_H
+#define STORAGE_HASH_GROUP_H
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define GROUP_WIDTH 16
+
+#define CTRL_EMPTY ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xFE)
+
+#if defined(__aarch64__) && defined(__ARM_NEON) && !defined(__SSE2__)
+/* NEON has no movemask; narrowing shifts leave one nibble per byte */
+#define GROUP_MASK_SHIFT 2
+#else
+#define GROUP_MASK_SHIFT 0
+#endif
+
+typedef uint64_t group_mask_t;
+
+static inline uint8_t
+ctrl_tag(uint64_t hash)
+{
+	return (uint8_t)(hash >> 57);
+}
+
+static inline int
+ctrl_is_full(uint8_t ctrl)
+{
+	return (ctrl & 0x80) == 0;
+}
+
+#if defined(__SSE2__)
+
+static inline group_mask_t
+group_match_byte(const uint8_t *ctrl, uint8_t byte)
+{
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	__m128i cmp = _mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte));
+
+	return (group_mask_t)(uint32_t)_mm_movemask_epi8(cmp);
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+static inline group_mask_t
+group_match_byte(const uint8_t *ctrl, uint8_t byte)
+{
+	uint8x16_t cmp = vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(byte));
+	uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+
+	return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0)
+	       & 0x8888888888888888ULL;
+}
+
+#else
+
+static inline group_mask_t
+group_match_byte(const uint8_t *ctrl, uint8_t byte)
+{
+	group_mask_t mask = 0;
+
+	for (int i = 0; i < GROUP_WIDTH; i++) {
+		if (ctrl[i] == byte)
+			mask |= (group_mask_t)1 << i;
+	}
+	return mask;
+}
+
+#endif
+
+static inline group_mask_t
+group_match_tag(const uint8_t *ctrl, uint8_t tag)
+{
+	return group_match_byte(ctrl, tag);
+}
+
+static inline group_mask_t
+group_match_empty(const uint8_t *ctrl)
+{
+	return group_match_byte(ctrl, CTRL_EMPTY);
+}
+
+static inline group_mask_t
+group_match_deleted(const uint8_t *ctrl)
+{
+	return group_match_byte(ctrl, CTRL_DELETED);
+}
+
+/* Slot offset of the lowest set bit; mask must be non-zero */
+static inline uint32_t
+group_mask_first(group_mask_t mask)
+{
+	return (uint32_t)__builtin_ctzll(mask) >> GROUP_MASK_SHIFT;
+}
+
+/* Pop the lowest match and return its slot offset; mask must be non-zero */
+static inline uint32_t
+group_mask_next(group_mask_t *mask)
+{
+	uint32_t slot = group_mask_first(*mask);
+
+	*mask &= *mask - 1;
+	return slot;
+}
+
+/* Bits for all slots strictly before the lowest set bit of mask */
+static inline group_mask_t
+group_mask_below_first(group_mask_t mask)
+{
+	return mask ? (mask & -mask) - 1 : ~(group_mask_t)0;
+}
+
+#endif /* STORAGE_HASH_GROUP_H */
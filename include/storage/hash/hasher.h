@@ -0,0 +1,67 @@
+/**
+ * @file hasher.h
+ * @brief Selectable 64-bit key hash functions
+ *
+ * SipHash-2-4 resists hash flooding and stays the default. The others are
+ * much cheaper but only suitable for keys an attacker cannot choose.
+ */
+
+#ifndef STORAGE_HASH_HASHER_H
+#define STORAGE_HASH_HASHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASHER_SIPHASH 0
+#define HASHER_WYHASH 1
+#define HASHER_CRC32C 2
+#define HASHER_COUNT 3
+
+/* Every hasher takes the engine's two 64-bit secret keys */
+typedef uint64_t (*hasher_fn)(const void *data, size_t len, uint64_t k0,
+			      uint64_t k1);
+
+/**
+ * Resolve a hasher to its fastest implementation on this CPU
+ *
+ * @param kind One of the HASHER_* constants
+ * @return Function pointer, or NULL for an unknown kind
+ */
+hasher_fn hasher_get(int kind);
+
+/**
+ * Describe a hasher and the implementation hasher_get() picks for it
+ *
+ * @param kind One of the HASHER_* constants
+ * @return Static string such as "crc32c/sse4.2", or NULL for an unknown kind
+ */
+const char *hasher_name(int kind);
+
+/**
+ * Compute a wyhash-style 64-bit hash
+ *
+ * @param data Input data to hash
+ * @param len Length of input data in bytes
+ * @param k0 First 64-bit key
+ * @param k1 Second 64-bit key
+ * @return 64-bit hash value
+ */
+uint64_t wyhash(const void *data, size_t len, uint64_t k0, uint64_t k1);
+
+/**
+ * Extend a CRC32C (Castagnoli) checksum, using SSE4.2 or ARMv8 CRC
+ * instructions when the CPU has them
+ *
+ * @param crc Running checksum; 0 to start
+ * @param data Input data
+ * @param len Length of input data in bytes
+ * @return Updated checksum
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+/**
+ * Table-driven CRC32C; same results as crc32c() on any CPU
+ */
+uint32_t crc32c_sw(uint32_t crc, const void *data, size_t len);
+
+#endif /* STORAGE_HASH_HASHER_H */
@@ -0,0 +1,60 @@
+/**
+ * @file pages.h
+ * @brief Page-size and NUMA placement for large table allocations
+ *
+ * Allocations of at least PAGES_HUGE_SIZE bytes can be mapped directly with
+ * huge pages, so random probes into multi-GB tables miss the TLB far less
+ * often, and bound to NUMA nodes before they are first touched. Smaller
+ * allocations, and everything under PAGES_DEFAULT with PAGES_NUMA_DEFAULT,
+ * come from the heap as before.
+ */
+
+#ifndef STORAGE_HASH_PAGES_H
+#define STORAGE_HASH_PAGES_H
+
+#include <stddef.h>
+
+#define PAGES_HUGE_SIZE ((size_t)2 << 20)
+
+/* Page backends */
+#define PAGES_DEFAULT 0
+/* Transparent huge pages requested with madvise(MADV_HUGEPAGE) */
+#define PAGES_THP 1
+/* Reserved hugetlbfs pages, falling back to PAGES_THP when none are free */
+#define PAGES_HUGETLB 2
+
+/* NUMA policies */
+#define PAGES_NUMA_DEFAULT 0
+/* Spread pages round-robin over every online node */
+#define PAGES_NUMA_INTERLEAVE 1
+/* Prefer pages on pages_policy.node */
+#define PAGES_NUMA_LOCAL 2
+
+struct pages_policy {
+	int mode;
+	int numa;
+	int node;
+};
+
+/**
+ * Allocate zeroed memory under a page policy
+ *
+ * @param size Bytes to allocate
+ * @param align Alignment for heap allocations; mappings are always
+ *        PAGES_HUGE_SIZE aligned
+ * @param policy Page backend and NUMA placement
+ * @return Memory to release with pages_free(), or NULL
+ */
+void *pages_alloc(size_t size, size_t align, const struct pages_policy *policy);
+
+/* Release memory from pages_alloc() with the same size and policy */
+void pages_free(void *ptr, size_t size, const struct pages_policy *policy);
+
+/**
+ * Count the online NUMA nodes
+ *
+ * @return Highest online node plus one; 1 when the system reports none
+ */
+int pages_numa_nodes(void);
+
+#endif /* STORAGE_HASH_PAGES_H */
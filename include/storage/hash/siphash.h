@@ -60,4 +60,28 @@ uint64_t siphash(const void *data, size_t len, uint64_t k0, uint64_t k1);
  */
 uint64_t siphash_key(const void *data, size_t len, const uint8_t key[16]);
 
+/**
+ * Compute SipHash-2-4 of 4 or 8 messages at once in SIMD lanes (AVX2 on
+ * x86-64 when the CPU has it, NEON on aarch64), otherwise one at a time
+ * with siphash(). Results are bit-identical to siphash() on each message;
+ * lengths may differ.
+ *
+ * @param data Input messages
+ * @param len Length of each message in bytes
+ * @param k0 First 64-bit key
+ * @param k1 Second 64-bit key
+ * @param out Hash of each message
+ */
+void siphash_x4(const void *const data[4], const size_t len[4], uint64_t k0,
+		uint64_t k1, uint64_t out[4]);
+void siphash_x8(const void *const data[8], const size_t len[8], uint64_t k0,
+		uint64_t k1, uint64_t out[8]);
+
+/**
+ * Hash n messages with the widest lane kernel the CPU supports, finishing
+ * any remainder with scalar siphash()
+ */
+void siphash_batch(const void *const *data, const size_t *len, size_t n,
+		   uint64_t k0, uint64_t k1, uint64_t *out);
+
 #endif /* STORAGE_HASH_SIPHASH_H */
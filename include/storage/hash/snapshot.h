@@ -0,0 +1,86 @@
+/**
+ * @file snapshot.h
+ * @brief On-disk layout of hash engine snapshots
+ *
+ * A snapshot is each shard's table written out as it sits in memory, so
+ * hash_engine_load() can map the file and use it as the tables in place,
+ * faulting pages in as lookups reach them. Offsets count from the start of
+ * the file, so the file is position independent. The only pointers in
+ * buckets are those to out-of-line keys and values; the file stores them
+ * as offsets into the shard's arena and lists the buckets holding them in
+ * a relocation section, which load patches.
+ *
+ * Sections start on SNAPSHOT_ALIGN boundaries:
+ *
+ *   header, followed by one struct snapshot_shard per shard
+ *   per shard: control bytes (bucket_count + GROUP_WIDTH)
+ *              buckets (struct hash_bucket images)
+ *              arena of out-of-line key and value bytes
+ *              relocations (uint64_t slot of each bucket with
+ *              out-of-line parts)
+ *              timers (struct snapshot_timer for each entry with a TTL,
+ *              reloaded into the shard's timer wheel)
+ *
+ * Bucket images have zero sequence counters. Files only load into builds
+ * with the same bucket layout and byte order, which the header records.
+ * Each section carries a CRC32C; the header's covers the header itself
+ * (with header_crc zero) and the shard records.
+ */
+
+#ifndef STORAGE_HASH_SNAPSHOT_H
+#define STORAGE_HASH_SNAPSHOT_H
+
+#include <stdint.h>
+
+#define SNAPSHOT_MAGIC "HSNAPSHT"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_ALIGN 4096
+/* Reads back differently on a host of the other byte order */
+#define SNAPSHOT_BYTE_ORDER 0x0102030405060708ULL
+
+struct snapshot_timer {
+	uint64_t hash;
+	uint32_t expires;
+	uint32_t reserved;
+};
+
+struct snapshot_shard {
+	uint64_t bucket_count;
+	uint64_t items;
+	/* Key plus value bytes, as counted by hash_engine_get_stats() */
+	uint64_t memory;
+	uint64_t ctrl_offset;
+	uint64_t buckets_offset;
+	uint64_t arena_offset;
+	uint64_t arena_size;
+	uint64_t reloc_offset;
+	uint64_t reloc_count;
+	uint64_t timer_offset;
+	uint64_t timer_count;
+	uint32_t ctrl_crc;
+	uint32_t buckets_crc;
+	uint32_t arena_crc;
+	uint32_t reloc_crc;
+	uint32_t timer_crc;
+	uint32_t reserved;
+};
+
+struct snapshot_header {
+	char magic[8];
+	uint64_t byte_order;
+	uint32_t version;
+	uint32_t bucket_size;
+	uint32_t inline_size;
+	uint32_t group_width;
+	uint32_t hasher;
+	uint32_t probe_mode;
+	uint32_t shard_count;
+	uint32_t header_crc;
+	/* Stored hashes are only valid under the key they were made with */
+	uint64_t hash_key_0;
+	uint64_t hash_key_1;
+	uint64_t file_size;
+	struct snapshot_shard shards[];
+};
+
+#endif /* STORAGE_HASH_SNAPSHOT_H */
@@ -0,0 +1,74 @@
+/**
+ * @file ttl_wheel.h
+ * @brief Hierarchical timer wheel for entry expiry
+ *
+ * Timers are (hash, expires) pairs in seconds. TTL_WHEEL_LEVELS levels of
+ * TTL_WHEEL_SLOTS slots each cover 2^6, 2^12, 2^18 and 2^24 seconds ahead;
+ * a timer goes into the level whose range holds its distance from the
+ * wheel's clock, and is moved down a level each time the clock reaches the
+ * start of its slot's span. Adding a timer and firing one are O(1); timers
+ * further out than the top level are parked in its farthest slot and
+ * placed again when that slot is reached.
+ *
+ * Timers are never cancelled. Whoever fires one checks that the entry it
+ * names is still due, so a key that was deleted or given a new TTL only
+ * leaves a stale timer behind; the engine sets a timer that fired early
+ * again rather than add one per refresh. The wheel does no locking of its
+ * own.
+ */
+
+#ifndef STORAGE_HASH_TTL_WHEEL_H
+#define STORAGE_HASH_TTL_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TTL_WHEEL_BITS 6
+#define TTL_WHEEL_SLOTS (1U << TTL_WHEEL_BITS)
+#define TTL_WHEEL_LEVELS 4
+
+struct ttl_timer {
+	uint64_t hash;
+	uint32_t expires;
+};
+
+struct ttl_slot {
+	struct ttl_timer *timers;
+	uint32_t count;
+	uint32_t cap;
+};
+
+struct ttl_wheel {
+	/* Next second to fire; every timer due before it has fired */
+	uint32_t clock;
+	/* Set once the slots reaching clock have been moved down */
+	int cascaded;
+	uint64_t count;
+	struct ttl_slot slots[TTL_WHEEL_LEVELS][TTL_WHEEL_SLOTS];
+};
+
+/* Start an empty wheel whose clock reads now */
+void ttl_wheel_init(struct ttl_wheel *wheel, uint32_t now);
+void ttl_wheel_destroy(struct ttl_wheel *wheel);
+
+/**
+ * Add a timer
+ *
+ * A timer already due is filed under the wheel's next second to fire.
+ *
+ * @return 0, or -ENOMEM with the wheel unchanged
+ */
+int ttl_wheel_add(struct ttl_wheel *wheel, uint64_t hash, uint32_t expires);
+
+/**
+ * Take up to max timers due at or before now
+ *
+ * The clock only moves past a second once all of its timers are taken, so
+ * a call that stops at max resumes where it left off.
+ *
+ * @return Number of timers stored in out
+ */
+size_t ttl_wheel_expire(struct ttl_wheel *wheel, uint32_t now,
+			struct ttl_timer *out, size_t max);
+
+#endif /* STORAGE_HASH_TTL_WHEEL_H */
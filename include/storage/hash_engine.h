@@ -7,38 +7,590 @@
 #define STORAGE_HASH_ENGINE_H
 
 #include "storage/hash/bucket.h"
+#include "storage/hash/freq_sketch.h"
+#include "storage/hash/group.h"
+#include "storage/hash/hasher.h"
+#include "storage/hash/pages.h"
+#include "storage/hash/ttl_wheel.h"
+#include "utils/epoch.h"
+#include <pthread.h>
 #include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #define MAX_LOAD_FACTOR 0.75
+/* With background resizing, writers only grow inline past this load */
+#define HARD_LOAD_FACTOR 0.875
 #define MIN_LOAD_FACTOR 0.2
 
 #define DEFAULT_BUCKET_COUNT 1024
 #define INITIAL_BUCKET_COUNT 16
-#define MAX_BUCKET_COUNT 1048576
+/* Per shard; slot index bits stay below the shard and tag bits */
+#define MAX_BUCKET_COUNT (1ULL << 32)
 #define MIN_BUCKET_COUNT 16
 #define MIGRATE_BATCH_SIZE 2
 
+/* Buckets are allocated in chunks of 2^BUCKET_CHUNK_SHIFT (8 MiB) */
+#define BUCKET_CHUNK_SHIFT 16
+#define BUCKET_CHUNK_SIZE (1ULL << BUCKET_CHUNK_SHIFT)
+#define BUCKET_CHUNK_MASK (BUCKET_CHUNK_SIZE - 1)
+
+/* Probing schemes, chosen per engine at init */
+#define HASH_PROBE_GROUP 0
+#define HASH_PROBE_ROBIN_HOOD 1
+
+#define HASH_MAX_SHARDS 256
+
+/* Keys hashed and prefetched ahead of their probes by the multi calls */
+#define HASH_MULTI_BATCH 32
+
+/* Who migrates entries into a resized table */
+#define HASH_RESIZE_INLINE 0
+#define HASH_RESIZE_BACKGROUND 1
+
+#define HASH_MAX_RESIZE_THREADS 64
+/* Buckets a resize worker claims at a time */
+#define HASH_RESIZE_CHUNK 256
+
+/* Per-CPU counter stripes per shard, and the drift that folds one */
+#define HASH_MAX_COUNTER_STRIPES 64
+#define HASH_COUNTER_BATCH 32
+
+/* Timers taken from a wheel at a time, and fired per put once some are due */
+#define HASH_EXPIRE_BATCH 16
+#define HASH_EXPIRE_ASSIST 4
+
+/* Eviction policies of engines given a memory_limit */
+#define HASH_EVICT_CLOCK 0
+#define HASH_EVICT_TINYLFU 1
+/* Slots the CLOCK hand may pass per put looking for victims */
+#define HASH_EVICT_SCAN 256
+/* Bytes a counter stripe's memory delta drifts before it is folded */
+#define HASH_MEMORY_BATCH 4096
+/* Slot locks of a whole engine when hash_engine_config leaves it 0 */
+#define HASH_LOCK_STRIPES 4096
+/* A table gets at most one slot lock per this many slots */
+#define HASH_LOCK_MIN_SLOTS 8
+
+/* A slot lock, on a cache line of its own so neighbours never contend */
+struct hash_slot_lock {
+	futex_mutex_t lock;
+} __attribute__((aligned(64)));
+
+/*
+ * A loaded snapshot's file mapping. The engine and each table mapped from
+ * it hold a reference, and the last to let go unmaps it: a mapped table
+ * retired by a resize may be freed by another thread's epoch reclaim
+ * after hash_engine_destroy() has returned.
+ */
+struct hash_snapshot_map {
+	void *base;
+	size_t len;
+	_Atomic uint32_t refs;
+};
+
+/*
+ * One bucket array with its control bytes. The engine swaps whole tables,
+ * so a reader always sees a bucket array together with its own size.
+ * ctrl has bucket_count + GROUP_WIDTH bytes; the tail mirrors the first
+ * GROUP_WIDTH bytes so a group load near the end wraps without branching.
+ * bucket_count is always a power of two and mask is bucket_count - 1.
+ * Slot i lives at chunks[i >> BUCKET_CHUNK_SHIFT][i & BUCKET_CHUNK_MASK],
+ * so even multi-GB tables are built from modest allocations; tables
+ * smaller than a chunk get a single chunk of their own size. Chunks and
+ * ctrl are allocated, and freed, under the table's page policy, except in
+ * mapped tables, whose chunks and ctrl point into a loaded snapshot.
+ *
+ * While a table drains into its successor it carries its own migration
+ * cursor, so a migrator still holding a finished table cannot disturb the
+ * next resize. Replaced tables are retired through the epoch layer.
+ *
+ * Group-mode writers hold a slot through locks[idx & lock_mask], one of a
+ * power-of-two array of stripes the table owns, so buckets carry no lock
+ * and a new table has only the stripes to initialize. Keys that share a
+ * stripe serialize; nothing holds two stripes of one table at once, and a
+ * resize only ever takes a new table's stripe while holding the old
+ * table's. Robin Hood tables move entries between slots on insert and
+ * delete, so their writers serialize on write_lock instead, bump seq
+ * around every move and have no stripes.
+ * Once draining is set a Robin Hood table only accepts deletes, which leave
+ * tombstones so the migration sweep never sees entries shift behind it.
+ *
+ * Group-mode deletes leave tombstones, so a table whose item count holds
+ * steady under churn, as a full cache's does, slowly runs out of empty
+ * slots and its misses probe ever further. Once used passes
+ * HARD_LOAD_FACTOR the shard rehashes into a table of the same size,
+ * which leaves the tombstones behind.
+ *
+ * Tables of cache-mode engines carry a reference byte per slot in ref,
+ * which lookups set on a hit and the CLOCK hand clears as it passes;
+ * other tables leave it NULL. Robin Hood moves carry the byte along with
+ * the entry, and an entry migrated by a resize starts unreferenced.
+ */
+struct hash_table {
+	struct hash_bucket **chunks;
+	uint8_t *ctrl;
+	uint8_t *ref;
+	struct hash_slot_lock *locks;
+	uint64_t lock_mask;
+	uint64_t bucket_count;
+	uint64_t mask;
+	int probe_mode;
+	struct pages_policy pages;
+	/* The mapping a loaded table's chunks and ctrl are in, else NULL */
+	struct hash_snapshot_map *snapshot;
+	_Atomic int draining;
+	futex_mutex_t write_lock;
+	_Atomic uint32_t seq;
+	_Atomic uint64_t migrate_index;
+	_Atomic uint64_t migrated;
+	/* Slots counted in migrated whose entry failed to move */
+	_Atomic uint64_t migrate_failed;
+	/* Group-mode slots ever claimed from empty: entries and tombstones */
+	_Atomic uint64_t used;
+	struct epoch_head epoch;
+};
+
+/*
+ * One CPU's share of a shard's counters, on a cache line of its own. The
+ * values are signed deltas: a key put on one CPU may be deleted on another.
+ */
+struct hash_counter {
+	_Atomic int64_t items;
+	_Atomic int64_t memory;
+	/* Cache-mode lookups, and entries evicted or turned away */
+	_Atomic int64_t hits;
+	_Atomic int64_t misses;
+	_Atomic int64_t evictions;
+	_Atomic int64_t rejections;
+} __attribute__((aligned(64)));
+
+/*
+ * An independent slice of the key space with its own table, counters and
+ * resize state. Cache-line aligned so writers in different shards never
+ * share a line.
+ *
+ * Writers only touch the counter stripe of the CPU they run on. A stripe's
+ * item delta is folded into item_count once it drifts HASH_COUNTER_BATCH
+ * from zero, so item_count is within one batch per stripe of the truth
+ * and resize checks rarely need to sum the stripes. Memory deltas fold
+ * into memory the same way, every HASH_MEMORY_BATCH bytes, for the cache
+ * mode's budget checks. The hit, miss and eviction counts are only ever
+ * summed. There is a stripe per CPU, rounded up to a power of two and
+ * capped at HASH_MAX_COUNTER_STRIPES.
+ *
+ * Entries put with a TTL get a timer in the shard's wheel, under
+ * wheel_lock. timers and expire_next mirror the wheel's count and clock so
+ * writers can tell without the lock whether any timer is due.
+ *
+ * In cache mode each shard gets an equal part of the memory limit. Writers
+ * that take it over the limit advance clock_hand over the table's slots,
+ * clearing reference bytes and evicting the first unreferenced entries
+ * they meet. TinyLFU shards also keep a frequency sketch of the hashes
+ * looked up and put.
+ */
+struct hash_shard {
+	_Atomic(struct hash_table *) table;
+	futex_mutex_t resize_lock;
+	_Atomic int64_t item_count;
+	struct hash_counter *counters;
+	uint32_t counter_mask;
+	_Atomic(struct hash_table *) old_table;
+	/* Applied to every table the shard allocates */
+	struct pages_policy pages;
+	/* Slot locks per table, before the table's own cap */
+	uint32_t lock_stripes;
+	struct ttl_wheel *wheel;
+	futex_mutex_t wheel_lock;
+	_Atomic uint64_t timers;
+	_Atomic uint32_t expire_next;
+	_Atomic int64_t memory;
+	/* 0 outside cache mode */
+	uint64_t memory_limit;
+	_Atomic uint64_t clock_hand;
+	struct freq_sketch *sketch;
+} __attribute__((aligned(64)));
+
 struct hash_engine {
-	_Atomic(struct hash_bucket *) hash_buckets;
-	_Atomic uint32_t bucket_count;
-	futex_mutex_t engine_lock;
-	_Atomic uint32_t item_count;
-	_Atomic uint32_t total_memory;
-	_Atomic(struct hash_bucket *) old_buckets;
-	_Atomic uint32_t old_bucket_count;
-	_Atomic uint32_t migrate_index;
-	_Atomic uint32_t migrate_workers;
+	/* Resolved from hash_engine_config.hasher at init */
+	hasher_fn hash_fn;
+	int hasher;
+	/* Process-wide at init; a loaded engine keeps its snapshot's */
+	uint64_t hash_key_0;
+	uint64_t hash_key_1;
+	struct hash_shard *shards;
+	uint32_t shard_count;
+	/* Shard index is (hash >> shard_shift) & (shard_count - 1) */
+	uint32_t shard_shift;
+	/* Buckets each foreground operation migrates during a resize */
+	uint32_t assist_budget;
+	void (*resize_done)(void *arg, uint32_t shard, uint64_t bucket_count);
+	void *resize_done_arg;
+	/* Background resize workers; none in HASH_RESIZE_INLINE mode */
+	pthread_t *resize_threads;
+	uint32_t resize_thread_count;
+	/* Bumped and futex-woken to send workers looking for work */
+	_Atomic uint32_t resize_seq;
+	_Atomic int resize_pending;
+	_Atomic int resize_stop;
+	/* File mapping behind a loaded engine's tables */
+	struct hash_snapshot_map *snapshot;
+	/* TTL clock; see hash_engine_config */
+	uint32_t (*clock)(void *arg);
+	void *clock_arg;
+	/* Set by the first entry given a TTL; lookups skip the clock before */
+	_Atomic int ttl_used;
+	/* Shard hash_expire() starts at, rotated between calls */
+	_Atomic uint32_t expire_shard;
+	/* Cache mode; see hash_engine_config */
+	uint64_t memory_limit;
+	int evict_policy;
+};
+
+struct hash_engine_config {
+	uint64_t bucket_count;
+	/* HASH_PROBE_GROUP (default) or HASH_PROBE_ROBIN_HOOD */
+	int probe_mode;
+	/*
+	 * Power of two up to HASH_MAX_SHARDS; 0 means 1. bucket_count is
+	 * split evenly between shards, which then resize independently.
+	 */
+	uint32_t shard_count;
+	/*
+	 * HASHER_SIPHASH (default) resists hash flooding; HASHER_WYHASH and
+	 * HASHER_CRC32C are faster but only for keys clients cannot choose.
+	 */
+	int hasher;
+	/*
+	 * HASH_RESIZE_INLINE (default) migrates a few buckets on every
+	 * operation. HASH_RESIZE_BACKGROUND hands grows, shrinks and
+	 * migration to resize_threads workers (0 means 1), which claim
+	 * HASH_RESIZE_CHUNK buckets at a time; writers only resize inline
+	 * once a shard passes HARD_LOAD_FACTOR.
+	 */
+	int resize_mode;
+	uint32_t resize_threads;
+	/*
+	 * Page backend for bucket chunks and control bytes of at least
+	 * PAGES_HUGE_SIZE: PAGES_DEFAULT (heap), PAGES_THP or PAGES_HUGETLB,
+	 * which falls back to THP when no huge pages are reserved.
+	 */
+	int page_mode;
+	/*
+	 * PAGES_NUMA_DEFAULT leaves placement to first touch.
+	 * PAGES_NUMA_INTERLEAVE spreads every table over all nodes;
+	 * PAGES_NUMA_LOCAL puts shard i's tables on node i % nodes, for
+	 * callers that route each shard's work to threads on that node.
+	 */
+	int numa_policy;
+	/*
+	 * Buckets each operation migrates while a resize is pending. 0 picks
+	 * the mode's default: MIGRATE_BATCH_SIZE inline, none in background.
+	 */
+	uint32_t assist_budget;
+	/*
+	 * Called once per finished resize with the shard index and its new
+	 * bucket count, from whichever thread completed the migration.
+	 */
+	void (*resize_done)(void *arg, uint32_t shard, uint64_t bucket_count);
+	void *resize_done_arg;
+	/*
+	 * Current time in seconds for TTLs. NULL reads CLOCK_REALTIME, so
+	 * expiry times stay meaningful across a save and load.
+	 */
+	uint32_t (*clock)(void *arg);
+	void *clock_arg;
+	/*
+	 * Nonzero turns the engine into a cache holding at most about this
+	 * many bytes of keys and values, as counted by hash_engine_get_stats().
+	 * Puts that go over evict entries by evict_policy:
+	 *
+	 * HASH_EVICT_CLOCK (default) evicts entries not looked up since the
+	 * CLOCK hand last passed them.
+	 * HASH_EVICT_TINYLFU picks victims the same way, but only lets a new
+	 * key in if it has been asked for more often lately than the victim
+	 * it would replace; others are turned away.
+	 *
+	 * Each shard holds an equal part of the limit, and may go over it by
+	 * the entries a put could not find victims for within HASH_EVICT_SCAN
+	 * slots, which the next puts then evict.
+	 */
+	uint64_t memory_limit;
+	int evict_policy;
+	/*
+	 * Locks group-mode writers take to hold a slot, split evenly between
+	 * shards like bucket_count; 0 means HASH_LOCK_STRIPES. Each table
+	 * gets its shard's part rounded up to a power of two, but no more
+	 * than one per HASH_LOCK_MIN_SLOTS slots. More stripes mean fewer
+	 * writers to different keys queueing on one lock, at 64 bytes each.
+	 */
+	uint32_t lock_stripes;
 };
 
-int hash_engine_init(struct hash_engine *engine, uint32_t bucket_count);
+/*
+ * Probe-length summary of the current table. A probe length is the number
+ * of slots from an entry's home slot to the slot holding it, inclusive.
+ * Tables being drained by a resize are not included. The figures are those
+ * of a full hash_engine_get_table_stats() walk, so p99_probe likewise tops
+ * out at HASH_PROBE_HIST_BINS.
+ */
+struct hash_probe_stats {
+	uint64_t max_probe;
+	uint32_t p99_probe;
+	double avg_probe;
+	uint64_t tombstones;
+};
+
+int hash_engine_init(struct hash_engine *engine, uint64_t bucket_count);
+int hash_engine_init_config(struct hash_engine *engine,
+			    const struct hash_engine_config *config);
+
+/*
+ * In cache mode a put may evict other entries of its shard, and under
+ * HASH_EVICT_TINYLFU a new key may be turned away. That still returns 0,
+ * as though the key had been stored and evicted at once.
+ */
 int hash_put(struct hash_engine *engine, const void *key, size_t key_len,
 	     const void *value, size_t value_len);
+
+/*
+ * hash_put() for an entry that expires ttl seconds from now on the engine
+ * clock; ttl 0 never expires. hash_put() clears any TTL the key had.
+ *
+ * Expired entries are invisible at once: lookups, scans and deletes treat
+ * them as absent without writing to the table. Each shard's timer wheel
+ * reclaims them, a few per put and in batches through hash_expire(); until
+ * then they still count in hash_engine_get_stats().
+ *
+ * A key keeps one timer however often its TTL is refreshed: a put that
+ * moves the expiry later adds none, and the old timer, on firing early,
+ * is set again for the expiry the entry has then. If a timer cannot be
+ * added the put still returns 0 and the entry only expires lazily.
+ */
+int hash_put_ttl(struct hash_engine *engine, const void *key, size_t key_len,
+		 const void *value, size_t value_len, uint32_t ttl);
+
+/*
+ * Called by hash_upsert() with the key's current value, or with NULL and 0
+ * if the key is absent or expired. value is only valid during the call.
+ * To store a new value, point *new_value at it and set *new_len, and
+ * return 0. *new_value must not point into value, and must stay valid
+ * until the callback returns. A nonzero return leaves the entry as it was
+ * and becomes hash_upsert()'s return.
+ *
+ * The callback runs with the key's slot locked (in Robin Hood mode, the
+ * whole table), so it must be short and must not call into the engine. If
+ * a resize gets in the way it may run again. Only the value from its last
+ * call is stored, so it should only write to ctx.
+ */
+typedef int (*hash_upsert_fn)(void *ctx, const void *value, size_t value_len,
+			      const void **new_value, size_t *new_len);
+
+/*
+ * Read-modify-write of one key in a single probe, atomic with respect to
+ * every other operation on that key. An updated entry keeps its TTL. A
+ * key created here never expires. In cache mode these may evict like
+ * hash_put(), but TinyLFU never turns them away.
+ */
+int hash_upsert(struct hash_engine *engine, const void *key, size_t key_len,
+		hash_upsert_fn fn, void *ctx);
+
+/*
+ * Replace the value with value if it is currently expected. An expected of
+ * NULL means the key must be absent. Returns 0 if the value was swapped,
+ * -ENOENT if the key is absent, -EEXIST if it is present but expected is
+ * NULL, and -ECANCELED if it holds something else.
+ */
+int hash_cas(struct hash_engine *engine, const void *key, size_t key_len,
+	     const void *expected, size_t expected_len, const void *value,
+	     size_t value_len);
+
+/*
+ * Add delta to a counter stored as a native-endian int64_t. An absent key
+ * counts from 0. *result, if set, gets the new value. Returns -EINVAL if
+ * the value is not 8 bytes long, or -ERANGE, leaving it unchanged, if the
+ * sum would overflow.
+ */
+int hash_incr(struct hash_engine *engine, const void *key, size_t key_len,
+	      int64_t delta, int64_t *result);
+
+/*
+ * hash_get() returns a pointer into the engine without copying. The memory
+ * stays valid until the caller's outermost epoch_exit(), so callers that use
+ * it after concurrent writes wrap the call and the use in
+ * epoch_enter()/epoch_exit(). Values longer than the inline area are never
+ * modified in place; inline values may be overwritten by a concurrent put,
+ * or in Robin Hood mode by a neighbour shifted into the slot, so
+ * hash_get_copy() is the way to read those consistently.
+ */
 int hash_get(struct hash_engine *engine, const void *key, size_t key_len,
 	     const void **value, size_t *value_len);
+
+/*
+ * Copy a consistent snapshot of the value into buf. *value_len is always
+ * set to the full length; returns -ENOSPC if buf_len is too small.
+ */
+int hash_get_copy(struct hash_engine *engine, const void *key, size_t key_len,
+		  void *buf, size_t buf_len, size_t *value_len);
+
+/*
+ * Batched hash_get()/hash_put() over count keys. Each batch of
+ * HASH_MULTI_BATCH keys is hashed and its home slots prefetched before any
+ * probe runs, so the cache misses of different keys overlap. results[i]
+ * gets the per-key return code that the single-key call would have
+ * returned; the call itself only fails with -EINVAL for missing arrays.
+ * values[] from hash_multi_get() follow the hash_get() lifetime rules.
+ */
+int hash_multi_get(struct hash_engine *engine, size_t count,
+		   const void *const *keys, const size_t *key_lens,
+		   const void **values, size_t *value_lens, int *results);
+int hash_multi_put(struct hash_engine *engine, size_t count,
+		   const void *const *keys, const size_t *key_lens,
+		   const void *const *values, const size_t *value_lens,
+		   int *results);
+
 int hash_delete(struct hash_engine *engine, const void *key, size_t key_len);
+
+/*
+ * Reclaim expired entries whose timers are due, firing up to budget timers
+ * (0 for all that are due) across the shards. Each timer costs a probe
+ * or two, so a periodic call replaces full-table expiry sweeps. *expired, if set,
+ * gets the number of entries removed.
+ */
+int hash_expire(struct hash_engine *engine, uint32_t budget,
+		uint64_t *expired);
+
+/*
+ * Called by hash_scan() for each entry. key and value point into a private
+ * copy or into immutable out-of-line memory and stay valid until the
+ * callback returns. The callback may call into the engine, including to
+ * delete the key it was given. A nonzero return stops the scan.
+ */
+typedef int (*hash_scan_fn)(void *arg, const void *key, size_t key_len,
+			    const void *value, size_t value_len);
+
+/*
+ * Resumable scan in the style of Redis SCAN. Start with cursor 0 and pass
+ * each *next_cursor to the next call until it comes back 0. Each call
+ * visits up to batch home slots, which may hold no entries at all.
+ *
+ * Every key present for the whole scan is reported at least once, even as
+ * shards resize between or during calls; keys added or deleted meanwhile
+ * may or may not be. A key may be reported more than once, mostly after a
+ * shrink. Buckets are read lock-free, so writers are never blocked.
+ *
+ * Returns 0, -EINVAL, or the callback's nonzero return, in which case
+ * *next_cursor resumes at the slot being visited.
+ */
+int hash_scan(struct hash_engine *engine, uint64_t cursor, uint32_t batch,
+	      hash_scan_fn fn, void *arg, uint64_t *next_cursor);
 int hash_engine_destroy(struct hash_engine *engine);
-int hash_engine_get_stats(struct hash_engine *engine, uint32_t *item_count,
-			  uint32_t *bucket_count, uint32_t *memory_usage);
+/*
+ * Sums every shard's counter stripes, so the totals are exact once writers
+ * are quiescent and otherwise reflect some recent point in their progress.
+ */
+int hash_engine_get_stats(struct hash_engine *engine, uint64_t *item_count,
+			  uint64_t *bucket_count, uint64_t *memory_usage);
+int hash_engine_get_probe_stats(struct hash_engine *engine,
+				struct hash_probe_stats *stats);
+
+/* probe_hist bins; the last also counts every longer probe */
+#define HASH_PROBE_HIST_BINS 64
+
+/*
+ * Health of the current tables, from a racy walk of their control bytes
+ * that never takes a lock. Counts and ratios cover the slots walked, so a
+ * sampled walk estimates the whole table's.
+ *
+ * A cluster is a run of occupied slots, entries or tombstones, between two
+ * empty ones: the most a miss may probe. Tombstones, and so clusters, only
+ * build up under churn; a rising tombstone_ratio or longest_cluster shows
+ * lookups slowing before their latency does.
+ *
+ * The resize fields cover shards still draining an old table.
+ */
+struct hash_table_stats {
+	uint64_t slots;
+	uint64_t entries;
+	uint64_t tombstones;
+	/* entries, and tombstones, over slots */
+	double load_factor;
+	double tombstone_ratio;
+	/* probe_hist[i] counts entries of probe length i + 1 */
+	uint64_t probe_hist[HASH_PROBE_HIST_BINS];
+	uint32_t p50_probe;
+	uint32_t p99_probe;
+	uint64_t max_probe;
+	double avg_probe;
+	uint64_t clusters;
+	uint64_t longest_cluster;
+	double avg_cluster;
+	uint32_t resizing_shards;
+	/* Old-table buckets left to migrate; progress is the share done */
+	uint64_t resize_remaining;
+	double resize_progress;
+};
+
+/*
+ * Walk sample slots of each shard's table, in windows of
+ * HASH_STATS_WINDOW spread evenly over it, or every slot if sample is 0
+ * or covers the table. A sample of a few thousand slots per shard
+ * costs tens of microseconds and can run periodically under load; a full
+ * walk reads every control byte and live bucket's hash.
+ */
+#define HASH_STATS_WINDOW 1024
+
+int hash_engine_get_table_stats(struct hash_engine *engine, uint64_t sample,
+				struct hash_table_stats *stats);
+
+/*
+ * Counts of a cache-mode engine, summed like hash_engine_get_stats().
+ * Every hash_get(), hash_get_copy() and hash_multi_get() key is a hit or a
+ * miss; hit_ratio is hits over both, or 0 before any lookup. rejections
+ * are new keys TinyLFU turned away.
+ */
+struct hash_cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t rejections;
+	double hit_ratio;
+};
+
+/* Returns -EINVAL unless the engine was given a memory_limit */
+int hash_engine_get_cache_stats(struct hash_engine *engine,
+				struct hash_cache_stats *stats);
+
+/* hash_engine_load() flags */
+/* Check every section's CRC32C, reading the whole file up front */
+#define HASH_LOAD_VERIFY 0x1
+
+/*
+ * Write the engine's tables to path (storage/hash/snapshot.h), via a
+ * temporary file renamed into place once it is complete and synced.
+ * Pending resizes are finished first, and no shard starts one while it is
+ * being written. Lookups may run concurrently, but writers must be
+ * quiesced for the snapshot to be a consistent image.
+ *
+ * The file holds the engine's hash key, so it needs the same protection
+ * as the data against clients able to choose keys.
+ */
+int hash_engine_save(struct hash_engine *engine, const char *path);
+
+/*
+ * Initialize engine from a snapshot written by hash_engine_save(). The
+ * file is mapped copy-on-write and its tables are used in place, so reads
+ * are served at once and pages are faulted in as they are reached; only
+ * buckets with out-of-line parts are touched up front. Shard count, probe
+ * mode and hasher come from the file; the remaining settings come from
+ * config, which may be NULL for the defaults. The mapping stays until
+ * hash_engine_destroy(). Without HASH_LOAD_VERIFY only the header, the
+ * section bounds and the relocations are checked; bucket contents are
+ * trusted.
+ *
+ * Returns 0, -EINVAL for a file of another version or bucket layout,
+ * -EBADMSG for a damaged one, or another negative errno.
+ */
+int hash_engine_load(struct hash_engine *engine, const char *path,
+		     const struct hash_engine_config *config, int flags);
 #endif /* STORAGE_HASH_ENGINE_H */
@@ -0,0 +1,52 @@
+/**
+ * @file epoch.h
+ * @brief Epoch-based memory reclamation for lock-free readers.
+ *
+ * Readers bracket every access to shared objects with epoch_enter() and
+ * epoch_exit(). Writers unlink an object and hand it to epoch_retire()
+ * instead of freeing it; the callback runs once every thread that was inside
+ * a read section at that point has left it. Sections nest, are per thread,
+ * and never block or take locks. Threads register on first use and are
+ * cleaned up when they exit.
+ *
+ * The global epoch only advances while every active reader has observed the
+ * current one, so an object retired at epoch e is unreachable once the
+ * global epoch reaches e + 2.
+ */
+
+#ifndef UTILS_EPOCH_H
+#define UTILS_EPOCH_H
+
+#include <stdint.h>
+
+/* Embedded in each object that is retired, like struct rcu_head */
+struct epoch_head {
+	struct epoch_head *next;
+	uint64_t epoch;
+	void (*func)(struct epoch_head *head);
+};
+
+void epoch_enter(void);
+void epoch_exit(void);
+
+/*
+ * Defer func(head) until all current readers are gone. May be called from
+ * inside a read section; never blocks.
+ */
+void epoch_retire(struct epoch_head *head,
+		  void (*func)(struct epoch_head *head));
+
+/*
+ * Polled grace periods: take a cookie now, and later ask whether every
+ * section that was active when it was taken has since exited.
+ */
+uint64_t epoch_get_state(void);
+int epoch_poll_state(uint64_t state);
+
+/*
+ * Wait for a full grace period and run every callback it made eligible on
+ * this thread and on exited threads. Must not be called inside a section.
+ */
+void epoch_synchronize(void);
+
+#endif /* UTILS_EPOCH_H */
@@ -1,6 +1,7 @@
 #ifndef FUTEX_MUTEX_H
 #define FUTEX_MUTEX_H
 
+#include "utils/futex_stats.h"
 #include <errno.h>
 #include <limits.h>
 #include <linux/futex.h>
@@ -19,11 +20,41 @@
 #define CPU_RELAX() ((void)0)
 #endif
 
+/*
+ * Spinning before sleeping only pays when the holder lets go within the
+ * spin, so lockers adapt how long they spin, as glibc's adaptive mutexes
+ * do. Each thread keeps an estimate of the spins it took to get a lock and
+ * spins up to twice that plus FUTEX_SPIN_MIN, at most FUTEX_SPIN_LIMIT.
+ * The estimate moves an eighth of the way towards each outcome, a locker
+ * that gave up and slept counting as the whole budget. Threads taking
+ * short critical sections settle on short spins and stop burning pauses
+ * the holder does not need; longer holds work back up to the full limit.
+ * The estimate is per thread, not per lock, so a lock stays a single
+ * word.
+ */
+#define FUTEX_SPIN_MIN 10
 #define FUTEX_SPIN_LIMIT 100
 
 /* States: 0=unlocked, 1=locked no waiters, 2=locked with waiters */
 typedef atomic_uint_fast32_t futex_mutex_t;
 
+/* Defined once, in futex_mutex.c, so a thread has one estimate in all */
+extern __thread int32_t futex_spin_estimate;
+
+__attribute__((unused)) static inline int32_t
+futex_spin_budget(int32_t estimate)
+{
+	int32_t budget = estimate * 2 + FUTEX_SPIN_MIN;
+
+	return budget < FUTEX_SPIN_LIMIT ? budget : FUTEX_SPIN_LIMIT;
+}
+
+__attribute__((unused)) static inline int32_t
+futex_spin_learn(int32_t estimate, int32_t spins)
+{
+	return estimate + (spins - estimate) / 8;
+}
+
 __attribute__((unused)) static inline long
 sys_futex(void *addr1, int op, int val1, const struct timespec *timeout,
 	  void *addr2, int val3)
@@ -38,28 +69,33 @@ futex_mutex_init(futex_mutex_t *lock)
 	atomic_init(lock, 0);
 }
 
-__attribute__((unused)) static inline void
-futex_mutex_lock(futex_mutex_t *lock)
+/*
+ * Spin, then sleep, for a lock the fast path found taken, holding c.
+ * Returns FUTEX_ACQ_SPUN if spinning got it, else the number of futex
+ * sleeps.
+ */
+__attribute__((unused)) static inline int
+futex_mutex_lock_contended(futex_mutex_t *lock, uint_fast32_t c)
 {
-	uint_fast32_t c;
-
-	c = 0;
-	if (atomic_compare_exchange_strong_explicit(
-		lock, &c, 1, memory_order_acquire, memory_order_relaxed)) {
-		return;
-	}
+	int32_t budget;
+	int32_t i;
+	int sleeps = 0;
 
-	for (int i = 0; i < FUTEX_SPIN_LIMIT; i++) {
+	budget = futex_spin_budget(futex_spin_estimate);
+	for (i = 0; i < budget; i++) {
 		CPU_RELAX();
 		if (atomic_load_explicit(lock, memory_order_relaxed) == 0) {
 			c = 0;
 			if (atomic_compare_exchange_weak_explicit(
 				lock, &c, 1, memory_order_acquire,
 				memory_order_relaxed)) {
-				return;
+				futex_spin_estimate = futex_spin_learn(
+				    futex_spin_estimate, i + 1);
+				return FUTEX_ACQ_SPUN;
 			}
 		}
 	}
+	futex_spin_estimate = futex_spin_learn(futex_spin_estimate, budget);
 
 	if (c != 2) {
 		c = atomic_exchange_explicit(lock, 2, memory_order_acquire);
@@ -67,13 +103,56 @@ futex_mutex_lock(futex_mutex_t *lock)
 
 	while (c != 0) {
 		sys_futex((void *)lock, FUTEX_WAIT, 2, NULL, NULL, 0);
+		sleeps++;
 		c = atomic_exchange_explicit(lock, 2, memory_order_acquire);
 	}
+	return sleeps;
+}
+
+/*
+ * cls, a FUTEX_CLASS_*, names the lock for FUTEX_STATS builds and is
+ * ignored otherwise.
+ */
+__attribute__((unused)) static inline void
+futex_mutex_lock_class(futex_mutex_t *lock, int cls)
+{
+	uint_fast32_t c;
+#ifdef FUTEX_STATS
+	uint64_t start;
+	int sleeps;
+#endif
+
+	c = 0;
+	if (atomic_compare_exchange_strong_explicit(
+		lock, &c, 1, memory_order_acquire, memory_order_relaxed)) {
+#ifdef FUTEX_STATS
+		futex_stats_acquired(lock, cls, FUTEX_ACQ_FREE, 0);
+#endif
+		return;
+	}
+
+#ifdef FUTEX_STATS
+	start = futex_stats_now();
+	sleeps = futex_mutex_lock_contended(lock, c);
+	futex_stats_acquired(lock, cls, sleeps, futex_stats_now() - start);
+#else
+	(void)cls;
+	futex_mutex_lock_contended(lock, c);
+#endif
+}
+
+__attribute__((unused)) static inline void
+futex_mutex_lock(futex_mutex_t *lock)
+{
+	futex_mutex_lock_class(lock, FUTEX_CLASS_OTHER);
 }
 
 __attribute__((unused)) static inline void
 futex_mutex_unlock(futex_mutex_t *lock)
 {
+#ifdef FUTEX_STATS
+	futex_stats_released(lock);
+#endif
 	if (atomic_fetch_sub_explicit(lock, 1, memory_order_release) == 1) {
 		return;
 	}
@@ -83,14 +162,299 @@ futex_mutex_unlock(futex_mutex_t *lock)
 }
 
 __attribute__((unused)) static inline int
-futex_mutex_trylock(futex_mutex_t *lock)
+futex_mutex_trylock_class(futex_mutex_t *lock, int cls)
 {
 	uint_fast32_t c = 0;
 	if (atomic_compare_exchange_strong_explicit(
 		lock, &c, 1, memory_order_acquire, memory_order_relaxed)) {
+#ifdef FUTEX_STATS
+		futex_stats_acquired(lock, cls, FUTEX_ACQ_FREE, 0);
+#else
+		(void)cls;
+#endif
 		return 0;
 	}
 	return EBUSY;
 }
 
+__attribute__((unused)) static inline int
+futex_mutex_trylock(futex_mutex_t *lock)
+{
+	return futex_mutex_trylock_class(lock, FUTEX_CLASS_OTHER);
+}
+
+/*
+ * Writer-preferring reader-writer lock. state holds the reader count, or
+ * FUTEX_RW_WRITE_LOCKED while a writer holds it, plus a bit each for
+ * sleeping readers and sleeping writers. Once a writer waits, new readers
+ * queue behind it, so a stream of readers cannot starve writers.
+ *
+ * Readers sleep on state and are woken all at once. Writers sleep on
+ * writer_seq, which every writer wakeup bumps so none is missed, and are
+ * woken one at a time; an unlock wakes a writer in preference to readers.
+ * Uncontended lock and unlock are one atomic each, and both sides spin
+ * like futex_mutex_lock() before sleeping.
+ */
+#define FUTEX_RW_READ_LOCKED 1U
+#define FUTEX_RW_MASK ((1U << 30) - 1)
+#define FUTEX_RW_WRITE_LOCKED FUTEX_RW_MASK
+/* Far beyond any thread count, so never reached */
+#define FUTEX_RW_MAX_READERS (FUTEX_RW_MASK - 1)
+#define FUTEX_RW_READERS_WAITING (1U << 30)
+#define FUTEX_RW_WRITERS_WAITING (1U << 31)
+
+typedef struct {
+	_Atomic uint32_t state;
+	_Atomic uint32_t writer_seq;
+} futex_rwlock_t;
+
+__attribute__((unused)) static inline void
+futex_rwlock_init(futex_rwlock_t *lock)
+{
+	atomic_init(&lock->state, 0);
+	atomic_init(&lock->writer_seq, 0);
+}
+
+__attribute__((unused)) static inline int
+futex_rw_unlocked(uint32_t state)
+{
+	return (state & FUTEX_RW_MASK) == 0;
+}
+
+__attribute__((unused)) static inline int
+futex_rw_write_locked(uint32_t state)
+{
+	return (state & FUTEX_RW_MASK) == FUTEX_RW_WRITE_LOCKED;
+}
+
+/* Readers queue behind anyone already sleeping */
+__attribute__((unused)) static inline int
+futex_rw_read_lockable(uint32_t state)
+{
+	return (state & FUTEX_RW_MASK) < FUTEX_RW_MAX_READERS
+	       && !(state
+		    & (FUTEX_RW_READERS_WAITING | FUTEX_RW_WRITERS_WAITING));
+}
+
+/*
+ * Spin until the lock could be taken, or sleeping is the only way on,
+ * or the spin budget runs out; returns the state last seen
+ */
+__attribute__((unused)) static inline uint32_t
+futex_rwlock_spin(futex_rwlock_t *lock, int for_write)
+{
+	int32_t budget = futex_spin_budget(futex_spin_estimate);
+	uint32_t state;
+	int32_t i;
+
+	for (i = 0;; i++) {
+		state = atomic_load_explicit(&lock->state,
+					     memory_order_relaxed);
+		if (for_write ? futex_rw_unlocked(state)
+				    || (state & FUTEX_RW_WRITERS_WAITING)
+			      : !futex_rw_write_locked(state)
+				    || (state
+					& (FUTEX_RW_READERS_WAITING
+					   | FUTEX_RW_WRITERS_WAITING)))
+			break;
+		if (i == budget)
+			break;
+		CPU_RELAX();
+	}
+	futex_spin_estimate = futex_spin_learn(futex_spin_estimate, i);
+	return state;
+}
+
+/* Returns whether a writer was actually asleep to be woken */
+__attribute__((unused)) static inline int
+futex_rwlock_wake_writer(futex_rwlock_t *lock)
+{
+	atomic_fetch_add_explicit(&lock->writer_seq, 1, memory_order_release);
+	return sys_futex((void *)&lock->writer_seq, FUTEX_WAKE, 1, NULL, NULL,
+			 0)
+	       > 0;
+}
+
+/*
+ * Wake sleepers of a lock just released to state. If it is taken again
+ * meanwhile, waking is left to its next unlock.
+ */
+__attribute__((unused)) static void
+futex_rwlock_wake(futex_rwlock_t *lock, uint32_t state)
+{
+	if (state == FUTEX_RW_WRITERS_WAITING) {
+		if (atomic_compare_exchange_strong_explicit(
+			&lock->state, &state, 0, memory_order_relaxed,
+			memory_order_relaxed)) {
+			futex_rwlock_wake_writer(lock);
+			return;
+		}
+	}
+
+	/* Both wait: wake a writer and leave the readers queued behind it */
+	if (state == (FUTEX_RW_READERS_WAITING | FUTEX_RW_WRITERS_WAITING)) {
+		if (!atomic_compare_exchange_strong_explicit(
+			&lock->state, &state, FUTEX_RW_READERS_WAITING,
+			memory_order_relaxed, memory_order_relaxed))
+			return;
+		if (futex_rwlock_wake_writer(lock))
+			return;
+		/* The writer had not gone to sleep yet; the readers go */
+		state = FUTEX_RW_READERS_WAITING;
+	}
+
+	if (state == FUTEX_RW_READERS_WAITING) {
+		if (atomic_compare_exchange_strong_explicit(
+			&lock->state, &state, 0, memory_order_relaxed,
+			memory_order_relaxed))
+			sys_futex((void *)&lock->state, FUTEX_WAKE, INT_MAX,
+				  NULL, NULL, 0);
+	}
+}
+
+__attribute__((unused)) static void
+futex_rwlock_rdlock_slow(futex_rwlock_t *lock)
+{
+	uint32_t state = futex_rwlock_spin(lock, 0);
+
+	for (;;) {
+		if (futex_rw_read_lockable(state)) {
+			if (atomic_compare_exchange_weak_explicit(
+				&lock->state, &state,
+				state + FUTEX_RW_READ_LOCKED,
+				memory_order_acquire, memory_order_relaxed))
+				return;
+			continue;
+		}
+		if (!(state & FUTEX_RW_READERS_WAITING)
+		    && !atomic_compare_exchange_strong_explicit(
+			&lock->state, &state,
+			state | FUTEX_RW_READERS_WAITING,
+			memory_order_relaxed, memory_order_relaxed))
+			continue;
+		sys_futex((void *)&lock->state, FUTEX_WAIT,
+			  (int)(state | FUTEX_RW_READERS_WAITING), NULL, NULL,
+			  0);
+		state = futex_rwlock_spin(lock, 0);
+	}
+}
+
+__attribute__((unused)) static inline void
+futex_rwlock_rdlock(futex_rwlock_t *lock)
+{
+	uint32_t state = atomic_load_explicit(&lock->state,
+					      memory_order_relaxed);
+
+	if (!futex_rw_read_lockable(state)
+	    || !atomic_compare_exchange_weak_explicit(
+		&lock->state, &state, state + FUTEX_RW_READ_LOCKED,
+		memory_order_acquire, memory_order_relaxed))
+		futex_rwlock_rdlock_slow(lock);
+}
+
+__attribute__((unused)) static inline int
+futex_rwlock_tryrdlock(futex_rwlock_t *lock)
+{
+	uint32_t state = atomic_load_explicit(&lock->state,
+					      memory_order_relaxed);
+
+	while (futex_rw_read_lockable(state)) {
+		if (atomic_compare_exchange_weak_explicit(
+			&lock->state, &state, state + FUTEX_RW_READ_LOCKED,
+			memory_order_acquire, memory_order_relaxed))
+			return 0;
+	}
+	return EBUSY;
+}
+
+__attribute__((unused)) static inline void
+futex_rwlock_rdunlock(futex_rwlock_t *lock)
+{
+	uint32_t state = atomic_fetch_sub_explicit(&lock->state,
+						   FUTEX_RW_READ_LOCKED,
+						   memory_order_release)
+			 - FUTEX_RW_READ_LOCKED;
+
+	/* Readers only sleep on a read-locked lock behind a writer */
+	if (futex_rw_unlocked(state) && (state & FUTEX_RW_WRITERS_WAITING))
+		futex_rwlock_wake(lock, state);
+}
+
+__attribute__((unused)) static void
+futex_rwlock_wrlock_slow(futex_rwlock_t *lock)
+{
+	uint32_t state = futex_rwlock_spin(lock, 1);
+	uint32_t other_writers = 0;
+	uint32_t seq;
+
+	for (;;) {
+		/* Keep the waiting bit for any writers still asleep */
+		if (futex_rw_unlocked(state)) {
+			if (atomic_compare_exchange_weak_explicit(
+				&lock->state, &state,
+				state | FUTEX_RW_WRITE_LOCKED | other_writers,
+				memory_order_acquire, memory_order_relaxed))
+				return;
+			continue;
+		}
+		if (!(state & FUTEX_RW_WRITERS_WAITING)
+		    && !atomic_compare_exchange_strong_explicit(
+			&lock->state, &state,
+			state | FUTEX_RW_WRITERS_WAITING,
+			memory_order_relaxed, memory_order_relaxed))
+			continue;
+		other_writers = FUTEX_RW_WRITERS_WAITING;
+
+		/* Read seq before rechecking state, so no wakeup is missed */
+		seq = atomic_load_explicit(&lock->writer_seq,
+					   memory_order_acquire);
+		state = atomic_load_explicit(&lock->state,
+					     memory_order_relaxed);
+		if (futex_rw_unlocked(state)
+		    || !(state & FUTEX_RW_WRITERS_WAITING))
+			continue;
+		sys_futex((void *)&lock->writer_seq, FUTEX_WAIT, (int)seq,
+			  NULL, NULL, 0);
+		state = futex_rwlock_spin(lock, 1);
+	}
+}
+
+__attribute__((unused)) static inline void
+futex_rwlock_wrlock(futex_rwlock_t *lock)
+{
+	uint32_t state = 0;
+
+	if (!atomic_compare_exchange_weak_explicit(
+		&lock->state, &state, FUTEX_RW_WRITE_LOCKED,
+		memory_order_acquire, memory_order_relaxed))
+		futex_rwlock_wrlock_slow(lock);
+}
+
+__attribute__((unused)) static inline int
+futex_rwlock_trywrlock(futex_rwlock_t *lock)
+{
+	uint32_t state = atomic_load_explicit(&lock->state,
+					      memory_order_relaxed);
+
+	while (futex_rw_unlocked(state)) {
+		if (atomic_compare_exchange_weak_explicit(
+			&lock->state, &state, state | FUTEX_RW_WRITE_LOCKED,
+			memory_order_acquire, memory_order_relaxed))
+			return 0;
+	}
+	return EBUSY;
+}
+
+__attribute__((unused)) static inline void
+futex_rwlock_wrunlock(futex_rwlock_t *lock)
+{
+	uint32_t state = atomic_fetch_sub_explicit(&lock->state,
+						   FUTEX_RW_WRITE_LOCKED,
+						   memory_order_release)
+			 - FUTEX_RW_WRITE_LOCKED;
+
+	if (state & (FUTEX_RW_READERS_WAITING | FUTEX_RW_WRITERS_WAITING))
+		futex_rwlock_wake(lock, state);
+}
+
 #endif
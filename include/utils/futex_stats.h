@@ -0,0 +1,93 @@
+/**
+ * @file futex_stats.h
+ * @brief Opt-in contention counters for futex mutexes.
+ *
+ * Built with -DFUTEX_STATS, every futex_mutex acquisition and release is
+ * counted against the lock class its caller names: how many acquisitions
+ * there were, how many found the lock taken, how many of those the spin
+ * phase won, how many futex sleeps the rest took, and log2 histograms of
+ * the time spent waiting for and holding the lock. Counters live in
+ * per-thread records, written only by their owner, so counting adds no
+ * shared cache traffic; records are reused by later threads rather than
+ * freed, so totals include threads that have exited.
+ *
+ * Without FUTEX_STATS the lock paths compile exactly as before and the
+ * functions below report -ENOTSUP, so callers need no #ifdefs of their own.
+ */
+
+#ifndef UTILS_FUTEX_STATS_H
+#define UTILS_FUTEX_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* The locks callers tell apart; plain futex_mutex_lock() counts as other */
+enum futex_lock_class {
+	FUTEX_CLASS_OTHER,
+	/* Hash engine: slot lock stripes, Robin Hood table write locks */
+	FUTEX_CLASS_HASH_SLOT,
+	FUTEX_CLASS_HASH_TABLE,
+	/* Hash engine: shard resize and TTL wheel locks, SipHash key setup */
+	FUTEX_CLASS_HASH_RESIZE,
+	FUTEX_CLASS_HASH_WHEEL,
+	FUTEX_CLASS_HASH_SIPHASH,
+	/* Callbacks handed over by exiting threads */
+	FUTEX_CLASS_EPOCH,
+	FUTEX_CLASS_COUNT
+};
+
+/*
+ * Bucket i > 0 of a histogram counts times in [2^(i - 1), 2^i) ns; bucket
+ * 0 counts zero and the last one everything from 2^30 ns up.
+ */
+#define FUTEX_STATS_BUCKETS 32
+
+/* Locks a thread may hold at once and still have their hold times taken */
+#define FUTEX_STATS_MAX_HELD 8
+
+struct futex_class_stats {
+	uint64_t acquisitions;
+	/* Acquisitions that found the lock held */
+	uint64_t contended;
+	/* Contended ones the spin phase won, without a futex sleep */
+	uint64_t spin_acquired;
+	/* FUTEX_WAIT calls, which a contended acquisition may make several of */
+	uint64_t sleeps;
+	/* Summed, and bucketed by log2 as above */
+	uint64_t wait_ns;
+	uint64_t hold_ns;
+	uint64_t wait_hist[FUTEX_STATS_BUCKETS];
+	uint64_t hold_hist[FUTEX_STATS_BUCKETS];
+};
+
+const char *futex_class_name(int cls);
+
+/*
+ * Fill stats[FUTEX_CLASS_COUNT] with every thread's counts since the last
+ * futex_stats_reset(). Threads keep counting meanwhile, so a read taken
+ * under load is close to, not exactly, a single instant.
+ */
+int futex_stats_read(struct futex_class_stats *stats);
+int futex_stats_reset(void);
+
+/*
+ * Write what futex_stats_read() returns to out as one JSON object keyed
+ * by class name, with p50/p99 bounds taken from each histogram; shaped to
+ * sit under "lock_contention" in metrics.json.
+ */
+int futex_stats_dump_json(FILE *out);
+
+/*
+ * Hooks for futex_mutex_wrapper.h; only FUTEX_STATS builds call them.
+ * sleeps is the number of futex sleeps a contended acquisition took, or
+ * one of these.
+ */
+#define FUTEX_ACQ_FREE (-2)
+#define FUTEX_ACQ_SPUN (-1)
+
+uint64_t futex_stats_now(void);
+void futex_stats_acquired(const void *lock, int cls, int sleeps,
+			  uint64_t wait_ns);
+void futex_stats_released(const void *lock);
+
+#endif /* UTILS_FUTEX_STATS_H */
@@ -3,12 +3,149 @@
  */
 
 #include "storage/hash/bucket.h"
-#include "utils/futex_mutex_wrapper.h"
+#include "utils/epoch.h"
 #include <errno.h>
 #include <stdatomic.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+/*
+ * Out-of-line key or value bytes. Blobs are never modified once published,
+ * and are retired through the epoch layer so lock-free readers can keep
+ * using them after a writer has replaced or deleted the entry.
+ */
+struct bucket_blob {
+	struct epoch_head epoch;
+	unsigned char data[];
+};
+
+static void *
+bucket_blob_alloc(const void *src, size_t len)
+{
+	struct bucket_blob *blob = malloc(sizeof(*blob) + len);
+
+	if (!blob)
+		return NULL;
+	memcpy(blob->data, src, len);
+	return blob->data;
+}
+
+static struct bucket_blob *
+bucket_blob_of(const void *data)
+{
+	return (struct bucket_blob *)((char *)data
+				      - offsetof(struct bucket_blob, data));
+}
+
+static void
+bucket_blob_free_rcu(struct epoch_head *head)
+{
+	free(head);
+}
+
+/* NULL-safe; data must come from bucket_blob_alloc() */
+static void
+bucket_blob_retire(const void *data)
+{
+	if (data)
+		epoch_retire(&bucket_blob_of(data)->epoch,
+			     bucket_blob_free_rcu);
+}
+
+static void
+bucket_blob_free(const void *data)
+{
+	if (data)
+		free(bucket_blob_of(data));
+}
+
+/* Out-of-line copies prepared for a key/value pair that does not fit inline */
+struct bucket_spill {
+	uint32_t flags;
+	void *key;
+	void *value;
+};
+
+static uint32_t
+bucket_layout(size_t key_len, size_t value_len)
+{
+	if (key_len + value_len <= BUCKET_INLINE_SIZE)
+		return 0;
+	/* Prefer keeping the key inline so compares avoid a pointer chase */
+	if (key_len + sizeof(void *) <= BUCKET_INLINE_SIZE)
+		return BUCKET_F_VALUE_EXT;
+	if (sizeof(void *) + value_len <= BUCKET_INLINE_SIZE)
+		return BUCKET_F_KEY_EXT;
+	return BUCKET_F_KEY_EXT | BUCKET_F_VALUE_EXT;
+}
+
+static int
+bucket_spill_prepare(struct bucket_spill *spill, const void *key,
+		     size_t key_len, const void *value, size_t value_len)
+{
+	spill->flags = bucket_layout(key_len, value_len);
+	spill->key = NULL;
+	spill->value = NULL;
+
+	if (spill->flags & BUCKET_F_KEY_EXT) {
+		spill->key = bucket_blob_alloc(key, key_len);
+		if (!spill->key)
+			return -ENOMEM;
+	}
+	if (spill->flags & BUCKET_F_VALUE_EXT) {
+		spill->value = bucket_blob_alloc(value, value_len);
+		if (!spill->value) {
+			bucket_blob_free(spill->key);
+			spill->key = NULL;
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static void
+bucket_write_unlocked(struct hash_bucket *bucket,
+		      const struct bucket_spill *spill, const void *key,
+		      size_t key_len, const void *value, size_t value_len)
+{
+	unsigned char *slot;
+
+	bucket->flags = spill->flags;
+	bucket->key_len = (uint32_t)key_len;
+	bucket->value_len = (uint32_t)value_len;
+
+	if (spill->flags & BUCKET_F_KEY_EXT)
+		memcpy(bucket->data, &spill->key, sizeof(spill->key));
+	else
+		memcpy(bucket->data, key, key_len);
+
+	slot = bucket->data + bucket_value_offset(bucket);
+	if (spill->flags & BUCKET_F_VALUE_EXT)
+		memcpy(slot, &spill->value, sizeof(spill->value));
+	else
+		memcpy(slot, value, value_len);
+}
+
+/* Drop the bucket's out-of-line parts, deferred past readers if asked */
+static void
+bucket_release_unlocked(struct hash_bucket *bucket, int deferred)
+{
+	void (*release)(const void *data)
+	    = deferred ? bucket_blob_retire : bucket_blob_free;
+
+	if ((bucket->flags & (BUCKET_F_KEY_EXT | BUCKET_F_KEY_MAPPED))
+	    == BUCKET_F_KEY_EXT)
+		release(bucket_key(bucket));
+	if ((bucket->flags & (BUCKET_F_VALUE_EXT | BUCKET_F_VALUE_MAPPED))
+	    == BUCKET_F_VALUE_EXT)
+		release(bucket_value(bucket));
+	bucket->flags = 0;
+	bucket->key_len = 0;
+	bucket->value_len = 0;
+	bucket->expires = 0;
+}
+
 int
 bucket_state(struct hash_bucket *bucket)
 {
@@ -30,22 +167,96 @@ bucket_is_tombstone(struct hash_bucket *bucket)
 int
 bucket_make_tombstone_unlocked(struct hash_bucket *bucket)
 {
-	free((void *)bucket->key);
-	free((void *)bucket->value);
-	bucket->key = NULL;
-	bucket->key_len = 0;
-	bucket->value = NULL;
-	bucket->value_len = 0;
+	bucket_write_begin(bucket);
+	bucket_release_unlocked(bucket, 1);
 	atomic_store(&bucket->state, BUCKET_TOMBSTONE);
+	bucket_write_end(bucket);
+	return 0;
+}
+
+int
+bucket_clear_unlocked(struct hash_bucket *bucket)
+{
+	bucket_write_begin(bucket);
+	bucket_release_unlocked(bucket, 1);
+	atomic_store(&bucket->state, BUCKET_EMPTY);
+	bucket_write_end(bucket);
+	return 0;
+}
+
+int
+bucket_move_unlocked(struct hash_bucket *dst, struct hash_bucket *src)
+{
+	bucket_write_begin(dst);
+	dst->flags = src->flags;
+	dst->key_len = src->key_len;
+	dst->value_len = src->value_len;
+	dst->expires = src->expires;
+	memcpy(dst->data, src->data, sizeof(dst->data));
+	atomic_store_explicit(&dst->hash, bucket_hash(src),
+			      memory_order_relaxed);
+	atomic_store(&dst->state, BUCKET_OCCUPIED);
+	bucket_write_end(dst);
+
+	/* dst owns any out-of-line parts now */
+	bucket_write_begin(src);
+	src->flags = 0;
+	src->key_len = 0;
+	src->value_len = 0;
+	src->expires = 0;
+	atomic_store(&src->state, BUCKET_EMPTY);
+	bucket_write_end(src);
 	return 0;
 }
 
 int
-bucket_make_tombstone(struct hash_bucket *bucket)
+bucket_adopt_unlocked(struct hash_bucket *dst, struct hash_bucket *src)
 {
-	futex_mutex_lock(&bucket->lock_futex);
-	bucket_make_tombstone_unlocked(bucket);
-	futex_mutex_unlock(&bucket->lock_futex);
+	uint32_t unowned = BUCKET_F_KEY_MAPPED | BUCKET_F_VALUE_MAPPED;
+	unsigned char *slot;
+	void *key = NULL;
+	void *value = NULL;
+
+	/* Parts src does not own only live as long as their mapping */
+	if (src->flags & BUCKET_F_KEY_MAPPED) {
+		key = bucket_blob_alloc(bucket_key(src), src->key_len);
+		if (!key)
+			return -ENOMEM;
+	}
+	if (src->flags & BUCKET_F_VALUE_MAPPED) {
+		value = bucket_blob_alloc(bucket_value(src), src->value_len);
+		if (!value) {
+			bucket_blob_free(key);
+			return -ENOMEM;
+		}
+	}
+
+	bucket_write_begin(dst);
+	dst->flags = src->flags & ~unowned;
+	dst->key_len = src->key_len;
+	dst->value_len = src->value_len;
+	dst->expires = src->expires;
+	memcpy(dst->data, src->data, sizeof(dst->data));
+	if (key)
+		memcpy(dst->data, &key, sizeof(key));
+	slot = dst->data + bucket_value_offset(dst);
+	if (value)
+		memcpy(slot, &value, sizeof(value));
+	atomic_store_explicit(&dst->hash, bucket_hash(src),
+			      memory_order_relaxed);
+	atomic_store(&dst->state, BUCKET_OCCUPIED);
+	bucket_write_end(dst);
+
+	/*
+	 * Blobs are immutable, so src's readers may keep using them; dst
+	 * retires them through the epoch layer like any other of its own.
+	 */
+	bucket_write_begin(src);
+	if (src->flags & BUCKET_F_KEY_EXT)
+		src->flags |= BUCKET_F_KEY_MAPPED;
+	if (src->flags & BUCKET_F_VALUE_EXT)
+		src->flags |= BUCKET_F_VALUE_MAPPED;
+	bucket_write_end(src);
 	return 0;
 }
 
@@ -53,79 +264,102 @@ int
 bucket_init(struct hash_bucket *bucket)
 {
 	atomic_store(&bucket->state, BUCKET_EMPTY);
-	bucket->key = NULL;
+	atomic_store(&bucket->seq, 0);
+	bucket->flags = 0;
 	bucket->key_len = 0;
-	bucket->value = NULL;
 	bucket->value_len = 0;
-	futex_mutex_init(&bucket->lock_futex);
+	bucket->expires = 0;
+	atomic_store_explicit(&bucket->hash, 0, memory_order_relaxed);
 	return 0;
 }
 
 int
-bucket_set(struct hash_bucket *bucket, const void *key, size_t key_len,
-	   const void *value, size_t value_len)
-{
-	void *key_copy;
-	void *value_copy;
-
-	key_copy = malloc(key_len);
-	if (!key_copy)
-		return -ENOMEM;
-	value_copy = malloc(value_len);
-	if (!value_copy) {
-		free(key_copy);
-		return -ENOMEM;
-	}
-	memcpy(key_copy, key, key_len);
-	memcpy(value_copy, value, value_len);
-
-	futex_mutex_lock(&bucket->lock_futex);
-	free((void *)bucket->key);
-	free((void *)bucket->value);
-	bucket->key = key_copy;
-	bucket->key_len = key_len;
-	bucket->value = value_copy;
-	bucket->value_len = value_len;
+bucket_store_unlocked(struct hash_bucket *bucket, uint64_t hash,
+		      const void *key, size_t key_len, const void *value,
+		      size_t value_len, uint32_t expires)
+{
+	struct bucket_spill spill;
+	int rc;
+
+	rc = bucket_spill_prepare(&spill, key, key_len, value, value_len);
+	if (rc != 0)
+		return rc;
+
+	bucket_write_begin(bucket);
+	bucket_write_unlocked(bucket, &spill, key, key_len, value, value_len);
+	bucket->expires = expires;
+	atomic_store_explicit(&bucket->hash, hash, memory_order_relaxed);
 	atomic_store(&bucket->state, BUCKET_OCCUPIED);
-	futex_mutex_unlock(&bucket->lock_futex);
+	bucket_write_end(bucket);
 	return 0;
 }
 
 int
-bucket_set_replace_value(struct hash_bucket *bucket, const void *value,
-			 size_t value_len, size_t *old_value_len)
-{
-	void *value_copy;
-	void *old_value;
-
-	value_copy = malloc(value_len);
-	if (!value_copy)
-		return -ENOMEM;
-	memcpy(value_copy, value, value_len);
-
-	futex_mutex_lock(&bucket->lock_futex);
-	if (old_value_len)
-		*old_value_len = bucket->value_len;
-	old_value = (void *)bucket->value;
-	bucket->value = value_copy;
-	bucket->value_len = value_len;
-	futex_mutex_unlock(&bucket->lock_futex);
-
-	free(old_value);
+bucket_replace_value_unlocked(struct hash_bucket *bucket, const void *value,
+			      size_t value_len, uint32_t expires)
+{
+	uint32_t flags = bucket_layout(bucket->key_len, value_len);
+	uint32_t old_flags = bucket->flags;
+	const void *old_key = NULL;
+	const void *old_value = NULL;
+	void *new_key = NULL;
+	void *new_value = NULL;
+	unsigned char *slot;
+
+	/*
+	 * Only keys longer than the inline area minus a pointer can change
+	 * placement here, and only when the value grows or shrinks across
+	 * the inline boundary.
+	 */
+	if ((flags ^ bucket->flags) & BUCKET_F_KEY_EXT) {
+		if (flags & BUCKET_F_KEY_EXT) {
+			new_key = bucket_blob_alloc(bucket->data,
+						    bucket->key_len);
+			if (!new_key)
+				return -ENOMEM;
+		} else {
+			old_key = bucket_key(bucket);
+		}
+	} else {
+		flags |= bucket->flags & BUCKET_F_KEY_MAPPED;
+	}
+	if (flags & BUCKET_F_VALUE_EXT) {
+		new_value = bucket_blob_alloc(value, value_len);
+		if (!new_value) {
+			bucket_blob_free(new_key);
+			return -ENOMEM;
+		}
+	}
+	if (bucket->flags & BUCKET_F_VALUE_EXT)
+		old_value = bucket_value(bucket);
+
+	bucket_write_begin(bucket);
+	if (new_key)
+		memcpy(bucket->data, &new_key, sizeof(new_key));
+	else if (old_key)
+		memcpy(bucket->data, old_key, bucket->key_len);
+
+	bucket->flags = flags;
+	bucket->value_len = (uint32_t)value_len;
+	bucket->expires = expires;
+	slot = bucket->data + bucket_value_offset(bucket);
+	if (new_value)
+		memcpy(slot, &new_value, sizeof(new_value));
+	else
+		memcpy(slot, value, value_len);
+	bucket_write_end(bucket);
+
+	if (!(old_flags & BUCKET_F_KEY_MAPPED))
+		bucket_blob_retire(old_key);
+	if (!(old_flags & BUCKET_F_VALUE_MAPPED))
+		bucket_blob_retire(old_value);
 	return 0;
 }
 
 int
 bucket_destroy(struct hash_bucket *bucket)
 {
-	futex_mutex_lock(&bucket->lock_futex);
-	free((void *)bucket->key);
-	free((void *)bucket->value);
-	bucket->key = NULL;
-	bucket->key_len = 0;
-	bucket->value = NULL;
-	bucket->value_len = 0;
+	bucket_release_unlocked(bucket, 0);
 	atomic_store(&bucket->state, BUCKET_EMPTY);
-	futex_mutex_unlock(&bucket->lock_futex);
 	return 0;
 }
@@ -0,0 +1,115 @@
+/**
+ * @file freq_sketch.c
+ */
+
+#include "storage/hash/freq_sketch.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SKETCH_BLOCK 64
+#define SKETCH_ROWS 4
+#define SKETCH_ROW (SKETCH_BLOCK / SKETCH_ROWS)
+
+/*
+ * The engine's hashes already picked the shard and home slot from some of
+ * their bits; remix them so those bits do not also pick the block
+ */
+static inline uint64_t
+sketch_mix(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static inline uint8_t *
+sketch_counter(const struct freq_sketch *sketch, uint64_t mixed, int row)
+{
+	uint64_t block = (mixed >> 32) & sketch->block_mask;
+
+	return &sketch->counters[block * SKETCH_BLOCK + row * SKETCH_ROW
+				 + ((mixed >> (row * 4)) & (SKETCH_ROW - 1))];
+}
+
+int
+freq_sketch_init(struct freq_sketch *sketch, uint64_t width)
+{
+	uint64_t size = FREQ_SKETCH_MIN_WIDTH;
+
+	while (size < width && size < FREQ_SKETCH_MAX_WIDTH)
+		size <<= 1;
+
+	sketch->counters = aligned_alloc(SKETCH_BLOCK, size);
+	if (!sketch->counters)
+		return -ENOMEM;
+	memset(sketch->counters, 0, size);
+	sketch->width = (uint32_t)size;
+	sketch->block_mask = (uint32_t)(size / SKETCH_BLOCK - 1);
+	/* About 2.5 increments per counter between halvings */
+	sketch->sample = size * 5 / 8;
+	atomic_init(&sketch->additions, 0);
+	return 0;
+}
+
+void
+freq_sketch_destroy(struct freq_sketch *sketch)
+{
+	free(sketch->counters);
+	sketch->counters = NULL;
+}
+
+static void
+sketch_halve(struct freq_sketch *sketch)
+{
+	for (uint32_t i = 0; i < sketch->width; i++) {
+		uint8_t count = __atomic_load_n(&sketch->counters[i],
+						__ATOMIC_RELAXED);
+
+		__atomic_store_n(&sketch->counters[i], count >> 1,
+				 __ATOMIC_RELAXED);
+	}
+}
+
+void
+freq_sketch_add(struct freq_sketch *sketch, uint64_t hash)
+{
+	uint64_t mixed = sketch_mix(hash);
+
+	for (int row = 0; row < SKETCH_ROWS; row++) {
+		uint8_t *counter = sketch_counter(sketch, mixed, row);
+		uint8_t count = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+		if (count < FREQ_SKETCH_MAX)
+			__atomic_store_n(counter, count + 1,
+					 __ATOMIC_RELAXED);
+	}
+
+	/* Exactly one adder sees the count reach the sample and halves */
+	if (atomic_fetch_add_explicit(&sketch->additions, 1,
+				      memory_order_relaxed)
+		+ 1
+	    == sketch->sample) {
+		sketch_halve(sketch);
+		atomic_fetch_sub_explicit(&sketch->additions,
+					  sketch->sample / 2,
+					  memory_order_relaxed);
+	}
+}
+
+uint32_t
+freq_sketch_estimate(const struct freq_sketch *sketch, uint64_t hash)
+{
+	uint64_t mixed = sketch_mix(hash);
+	uint32_t estimate = FREQ_SKETCH_MAX;
+
+	for (int row = 0; row < SKETCH_ROWS; row++) {
+		uint8_t count = __atomic_load_n(
+		    sketch_counter(sketch, mixed, row), __ATOMIC_RELAXED);
+
+		if (count < estimate)
+			estimate = count;
+	}
+	return estimate;
+}
@@ -2,693 +2,4094 @@
  * @file hash_engine.c
  * @brief Core hash table engine using SipHash with linear probing and
  * tombstones.
+ *
+ * Probing walks a dense control-byte array GROUP_WIDTH slots at a time (see
+ * storage/hash/group.h). A bucket is only locked when its control byte
+ * carries the key's 7-bit hash tag and its stored 64-bit hash matches too;
+ * each operation hashes its key once and passes the hash down, using the
+ * engine's hasher (storage/hash/hasher.h, SipHash by default). Engines
+ * configured with HASH_PROBE_ROBIN_HOOD instead probe slot by slot and
+ * delete by backward shift, so their tables never hold tombstones outside
+ * of a resize.
+ *
+ * The key space is split into shards by hash bits (hash_engine_config), each
+ * with its own table, counters and incremental resize, so operations on
+ * different shards share no written cache lines. Large bucket chunks and
+ * control arrays can be placed on huge pages and NUMA nodes
+ * (storage/hash/pages.h).
+ *
+ * Resizes migrate a few buckets per operation by default. In
+ * HASH_RESIZE_BACKGROUND mode dedicated worker threads start resizes and
+ * migrate them in chunks, and operations only assist by a configured budget.
+ *
+ * hash_scan() walks the entries with a cursor that survives resizes, reading
+ * buckets lock-free like lookups do.
+ *
+ * Entries may carry an expiry second (hash_put_ttl()). Readers treat expired
+ * entries as absent, and a per-shard timer wheel (storage/hash/ttl_wheel.h)
+ * finds them again by hash to remove them.
+ *
+ * Engines given a memory limit run as caches: lookups mark the slots they
+ * hit, and writers over their shard's share evict with a CLOCK hand,
+ * optionally gated by TinyLFU admission (storage/hash/freq_sketch.h).
+ *
+ * Every operation runs inside an epoch read section (utils/epoch.h), which
+ * keeps replaced tables and out-of-line blobs alive while it uses them.
+ * During a resize an entry is always inserted into the new table before it
+ * is removed from the old one, so lookups probe the old table first.
  */
 
+/* sched_getcpu() */
+#define _GNU_SOURCE
+
 #include "storage/hash_engine.h"
 #include "storage/hash/bucket.h"
+#include "storage/hash/group.h"
 #include "storage/hash/siphash.h"
+#include "storage/hash/snapshot.h"
+#include "utils/epoch.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
 
 static _Atomic int siphash_initialized = 0;
 static uint64_t hash_key_0 = 0;
 static uint64_t hash_key_1 = 0;
 static futex_mutex_t siphash_init_lock;
 
-static inline uint32_t compute_hash(const void *key, size_t key_len,
-				    uint32_t bucket_count);
+static inline uint64_t compute_hash(struct hash_engine *engine,
+				    const void *key, size_t key_len);
 static inline int keys_equal(const void *k1, size_t l1, const void *k2,
 			     size_t l2);
-static void migrate_bucket(struct hash_engine *engine,
-			   struct hash_bucket *old_bucket);
-static void migrate_some_buckets(struct hash_engine *engine, uint32_t count);
-static void finish_resize(struct hash_engine *engine);
-static int hash_engine_start_resize(struct hash_engine *engine,
-				    uint32_t new_bucket_count);
+static int migrate_bucket(struct hash_shard *shard, struct hash_table *old,
+			  uint64_t idx);
+static int migrate_some_buckets(struct hash_engine *engine,
+				struct hash_shard *shard, uint32_t count);
+static void finish_resize(struct hash_engine *engine, struct hash_shard *shard,
+			  struct hash_table *old);
+static int migrate_all(struct hash_engine *engine, struct hash_shard *shard,
+		       struct hash_table *old);
+static int shard_start_resize(struct hash_shard *shard,
+				    uint64_t new_bucket_count);
+static void resize_kick(struct hash_engine *engine);
+static int resize_workers_start(struct hash_engine *engine, uint32_t count);
+static void resize_workers_stop(struct hash_engine *engine, uint32_t count);
+static uint64_t shard_expire(struct hash_engine *engine,
+			     struct hash_shard *shard, uint32_t now,
+			     uint32_t *budget, int wait);
+static inline int shard_timers_due(struct hash_shard *shard, uint32_t now);
+
+static inline struct hash_counter *
+shard_stripe(struct hash_shard *shard)
+{
+	return &shard->counters[(uint32_t)sched_getcpu() & shard->counter_mask];
+}
 
-static inline int
-needs_grow(struct hash_engine *engine)
+/* Writers add to their CPU's stripe; see struct hash_shard */
+static inline void
+shard_add_counts(struct hash_shard *shard, int64_t items, int64_t memory)
 {
-	uint32_t count = atomic_load(&engine->item_count);
-	uint32_t buckets = atomic_load(&engine->bucket_count);
-	return count >= buckets * MAX_LOAD_FACTOR;
+	struct hash_counter *counter = shard_stripe(shard);
+	int64_t drift;
+
+	drift = atomic_fetch_add_explicit(&counter->memory, memory,
+					  memory_order_relaxed)
+		+ memory;
+	if (drift >= HASH_MEMORY_BATCH || drift <= -HASH_MEMORY_BATCH)
+		atomic_fetch_add_explicit(
+		    &shard->memory,
+		    atomic_exchange_explicit(&counter->memory, 0,
+					     memory_order_relaxed),
+		    memory_order_relaxed);
+	if (!items)
+		return;
+	drift = atomic_fetch_add_explicit(&counter->items, items,
+					  memory_order_relaxed)
+		+ items;
+	if (drift >= HASH_COUNTER_BATCH || drift <= -HASH_COUNTER_BATCH)
+		atomic_fetch_add_explicit(
+		    &shard->item_count,
+		    atomic_exchange_explicit(&counter->items, 0,
+					     memory_order_relaxed),
+		    memory_order_relaxed);
 }
 
-static inline int
-needs_shrink(struct hash_engine *engine)
+static int64_t
+shard_items_exact(struct hash_shard *shard)
 {
-	uint32_t count = atomic_load(&engine->item_count);
-	uint32_t buckets = atomic_load(&engine->bucket_count);
-	return buckets > MIN_BUCKET_COUNT && count < buckets * MIN_LOAD_FACTOR;
+	int64_t items = atomic_load(&shard->item_count);
+
+	for (uint32_t i = 0; i <= shard->counter_mask; i++)
+		items += atomic_load_explicit(&shard->counters[i].items,
+					      memory_order_relaxed);
+	return items;
 }
 
-static inline uint32_t
-compute_hash(const void *key, size_t key_len, uint32_t bucket_count)
+static int64_t
+shard_memory_exact(struct hash_shard *shard)
 {
-	uint64_t h = siphash(key, key_len, hash_key_0, hash_key_1);
-	return (uint32_t)(h % bucket_count);
+	int64_t memory = atomic_load(&shard->memory);
+
+	for (uint32_t i = 0; i <= shard->counter_mask; i++)
+		memory += atomic_load_explicit(&shard->counters[i].memory,
+					       memory_order_relaxed);
+	return memory;
 }
 
-static inline int
-keys_equal(const void *k1, size_t l1, const void *k2, size_t l2)
+/*
+ * Bytes a cache-mode shard holds over its limit, judged from the folded
+ * count and this CPU's own stripe: summing every stripe on each put would
+ * cost a cache miss per CPU, so the limit holds to within
+ * HASH_MEMORY_BATCH per other stripe. Counting its own stripe keeps a
+ * writer from evicting again for bytes it already freed.
+ */
+static inline int64_t
+shard_memory_excess(struct hash_shard *shard)
 {
-	return (l1 == l2) && (memcmp(k1, k2, l1) == 0);
+	return atomic_load_explicit(&shard->memory, memory_order_relaxed)
+	       + atomic_load_explicit(&shard_stripe(shard)->memory,
+				      memory_order_relaxed)
+	       - (int64_t)shard->memory_limit;
 }
 
-static void
-init_siphash_keys(void)
+/*
+ * Whether the shard holds at least limit items. The stripes are only
+ * summed when the folded count is within their possible drift of limit.
+ */
+static int
+shard_items_reach(struct hash_shard *shard, double limit)
 {
-	uint64_t k0 = 0, k1 = 0;
+	int64_t slack = (int64_t)(shard->counter_mask + 1) * HASH_COUNTER_BATCH;
+	int64_t items = atomic_load_explicit(&shard->item_count,
+					     memory_order_relaxed);
 
-	if (atomic_load(&siphash_initialized))
-		return;
+	if (items + slack < limit)
+		return 0;
+	if (items - slack >= limit)
+		return 1;
+	return shard_items_exact(shard) >= limit;
+}
 
-	futex_mutex_lock(&siphash_init_lock);
-	if (atomic_load(&siphash_initialized)) {
-		futex_mutex_unlock(&siphash_init_lock);
-		return;
-	}
+static inline int
+needs_grow(struct hash_shard *shard)
+{
+	uint64_t buckets = atomic_load(&shard->table)->bucket_count;
+	return shard_items_reach(shard, buckets * MAX_LOAD_FACTOR);
+}
 
-	if (siphash_init_random_key(&k0, &k1) != 0) {
-		fprintf(stderr, "hash_engine_init: warning: weak "
-				"SipHash key used\n");
-	}
-	hash_key_0 = k0;
-	hash_key_1 = k1;
-	siphash_set_key(k0, k1);
-	atomic_store(&siphash_initialized, 1);
-	futex_mutex_unlock(&siphash_init_lock);
+static inline int
+needs_grow_now(struct hash_shard *shard)
+{
+	uint64_t buckets = atomic_load(&shard->table)->bucket_count;
+	return shard_items_reach(shard, buckets * HARD_LOAD_FACTOR);
 }
 
-int
-hash_engine_init(struct hash_engine *engine, uint32_t bucket_count)
+static inline int
+needs_shrink(struct hash_shard *shard)
 {
-	struct hash_bucket *buckets;
+	uint64_t buckets = atomic_load(&shard->table)->bucket_count;
+	return buckets > MIN_BUCKET_COUNT
+	       && !shard_items_reach(shard, buckets * MIN_LOAD_FACTOR);
+}
 
-	if (!engine || bucket_count == 0)
-		return -EINVAL;
+/* Too few empty slots are left to end probes; rehash at the same size */
+static inline int
+needs_purge(struct hash_shard *shard)
+{
+	struct hash_table *table = atomic_load(&shard->table);
 
-	futex_mutex_init(&engine->engine_lock);
-	atomic_store(&engine->hash_buckets, NULL);
-	atomic_store(&engine->bucket_count, 0);
-	atomic_store(&engine->item_count, 0);
-	atomic_store(&engine->total_memory, 0);
-	atomic_store(&engine->old_buckets, NULL);
-	atomic_store(&engine->old_bucket_count, 0);
-	atomic_store(&engine->migrate_index, 0);
-	atomic_store(&engine->migrate_workers, 0);
+	return table->probe_mode != HASH_PROBE_ROBIN_HOOD
+	       && atomic_load_explicit(&table->used, memory_order_relaxed)
+			  >= table->bucket_count * HARD_LOAD_FACTOR;
+}
 
-	init_siphash_keys();
+static inline uint32_t
+engine_now(struct hash_engine *engine)
+{
+	struct timespec ts;
 
-	buckets = calloc(bucket_count, sizeof(struct hash_bucket));
-	if (!buckets)
-		return -ENOMEM;
+	if (engine->clock)
+		return engine->clock(engine->clock_arg);
+	clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+	return (uint32_t)ts.tv_sec;
+}
 
-	for (uint32_t i = 0; i < bucket_count; i++) {
-		if (bucket_init(&buckets[i]) != 0) {
-			for (uint32_t j = 0; j < i; j++)
-				bucket_destroy(&buckets[j]);
-			free(buckets);
-			return -ENOMEM;
-		}
-	}
+/*
+ * The time expiry is judged by. Until an entry has been given a TTL none
+ * can have expired, so 0 does and saves reading the clock.
+ */
+static inline uint32_t
+engine_ttl_now(struct hash_engine *engine)
+{
+	if (!atomic_load_explicit(&engine->ttl_used, memory_order_relaxed))
+		return 0;
+	return engine_now(engine);
+}
 
-	atomic_store(&engine->hash_buckets, buckets);
-	atomic_store(&engine->bucket_count, bucket_count);
-	return 0;
+static inline int
+expired_by(uint32_t expires, uint32_t now)
+{
+	return expires != 0 && expires <= now;
 }
 
-int
-hash_engine_get_stats(struct hash_engine *engine, uint32_t *item_count,
-		      uint32_t *bucket_count, uint32_t *memory_usage)
+static inline uint64_t
+compute_hash(struct hash_engine *engine, const void *key, size_t key_len)
 {
-	if (!engine)
-		return -EINVAL;
-	if (item_count)
-		*item_count = atomic_load(&engine->item_count);
-	if (bucket_count)
-		*bucket_count = atomic_load(&engine->bucket_count);
-	if (memory_usage)
-		*memory_usage = atomic_load(&engine->total_memory);
-	return 0;
+	return engine->hash_fn(key, key_len, engine->hash_key_0,
+			       engine->hash_key_1);
 }
 
-static int
-lookup_in_table(struct hash_bucket *buckets, uint32_t bucket_count,
-		const void *key, size_t key_len, const void **value,
-		size_t *value_len)
+/*
+ * Table sizes are powers of two, so the home slot and every probe step wrap
+ * with a mask instead of a division. The low hash bits pick the slot; the
+ * control-byte tag comes from the top seven, so the two stay independent.
+ */
+static inline uint64_t
+home_index(uint64_t hash, uint64_t mask)
 {
-	uint32_t index = compute_hash(key, key_len, bucket_count);
+	return hash & mask;
+}
 
-	for (uint32_t i = 0; i < bucket_count; i++) {
-		struct hash_bucket *bucket
-		    = &buckets[(index + i) % bucket_count];
-		int state = bucket_state(bucket);
+static inline uint64_t
+round_up_pow2(uint64_t n)
+{
+	if (n <= 1)
+		return 1;
+	return 1ULL << (64 - __builtin_clzll(n - 1));
+}
 
-		if (state == BUCKET_EMPTY)
-			return -ENOENT;
-		if (state == BUCKET_TOMBSTONE)
-			continue;
+static inline int
+keys_equal(const void *k1, size_t l1, const void *k2, size_t l2)
+{
+	return (l1 == l2) && (memcmp(k1, k2, l1) == 0);
+}
 
-		futex_mutex_lock(&bucket->lock_futex);
-		if (atomic_load(&bucket->state) != BUCKET_OCCUPIED) {
-			futex_mutex_unlock(&bucket->lock_futex);
-			continue;
-		}
-		if (keys_equal(bucket->key, bucket->key_len, key, key_len)) {
-			if (value)
-				*value = bucket->value;
-			if (value_len)
-				*value_len = bucket->value_len;
-			futex_mutex_unlock(&bucket->lock_futex);
-			return 0;
-		}
-		futex_mutex_unlock(&bucket->lock_futex);
-	}
-	return -ENOENT;
+/* Slots live in BUCKET_CHUNK_SIZE-bucket chunks; see struct hash_table */
+static inline struct hash_bucket *
+table_bucket(const struct hash_table *table, uint64_t idx)
+{
+	return &table->chunks[idx >> BUCKET_CHUNK_SHIFT]
+			     [idx & BUCKET_CHUNK_MASK];
 }
 
-static int
-insert_into_table(struct hash_bucket *buckets, uint32_t bucket_count,
-		  const void *key, size_t key_len, const void *value,
-		  size_t value_len, int *is_new, size_t *old_value_len)
+/* The stripe holding group-mode slot idx; see struct hash_table */
+static inline futex_mutex_t *
+table_slot_lock(const struct hash_table *table, uint64_t idx)
 {
-	uint32_t index = compute_hash(key, key_len, bucket_count);
-	int tombstone_idx = -1;
+	return &table->locks[idx & table->lock_mask].lock;
+}
 
-	for (uint32_t i = 0; i < bucket_count; i++) {
-		uint32_t idx = (index + i) % bucket_count;
-		struct hash_bucket *bucket = &buckets[idx];
-		int state = bucket_state(bucket);
+static inline void
+stripe_lock(const struct hash_table *table, uint64_t idx)
+{
+	futex_mutex_lock_class(table_slot_lock(table, idx),
+			       FUTEX_CLASS_HASH_SLOT);
+}
 
-		if (state == BUCKET_EMPTY) {
-			uint32_t target_idx = (tombstone_idx >= 0)
-						  ? (uint32_t)tombstone_idx
-						  : idx;
-			struct hash_bucket *target = &buckets[target_idx];
-			void *key_copy;
-			void *value_copy;
+static inline void
+stripe_unlock(const struct hash_table *table, uint64_t idx)
+{
+	futex_mutex_unlock(table_slot_lock(table, idx));
+}
 
-			futex_mutex_lock(&target->lock_futex);
-			state = atomic_load(&target->state);
-			if (state != BUCKET_EMPTY
-			    && state != BUCKET_TOMBSTONE) {
-				futex_mutex_unlock(&target->lock_futex);
-				continue;
-			}
-			free((void *)target->key);
-			free((void *)target->value);
+static inline uint64_t
+table_chunk_count(uint64_t bucket_count)
+{
+	return (bucket_count + BUCKET_CHUNK_MASK) >> BUCKET_CHUNK_SHIFT;
+}
 
-			key_copy = malloc(key_len);
-			if (!key_copy) {
-				futex_mutex_unlock(&target->lock_futex);
-				return -ENOMEM;
-			}
-			value_copy = malloc(value_len);
-			if (!value_copy) {
-				free(key_copy);
-				futex_mutex_unlock(&target->lock_futex);
-				return -ENOMEM;
-			}
-			memcpy(key_copy, key, key_len);
-			memcpy(value_copy, value, value_len);
-			target->key = key_copy;
-			target->key_len = key_len;
-			target->value = value_copy;
-			target->value_len = value_len;
-			atomic_store(&target->state, BUCKET_OCCUPIED);
-			futex_mutex_unlock(&target->lock_futex);
+static inline size_t
+table_chunk_bytes(uint64_t bucket_count)
+{
+	uint64_t len = bucket_count < BUCKET_CHUNK_SIZE ? bucket_count
+							: BUCKET_CHUNK_SIZE;
 
-			if (is_new)
-				*is_new = 1;
-			return 0;
-		}
+	return (size_t)len * sizeof(struct hash_bucket);
+}
 
-		if (state == BUCKET_TOMBSTONE) {
-			if (tombstone_idx < 0)
-				tombstone_idx = (int)idx;
-			continue;
-		}
+/* Release whole pages within [addr, addr + len) */
+static void
+discard_pages(void *addr, size_t len)
+{
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start = ((uintptr_t)addr + page - 1) & ~(page - 1);
+	uintptr_t end = ((uintptr_t)addr + len) & ~(page - 1);
 
-		futex_mutex_lock(&bucket->lock_futex);
-		if (atomic_load(&bucket->state) != BUCKET_OCCUPIED) {
-			futex_mutex_unlock(&bucket->lock_futex);
-			continue;
-		}
-		if (keys_equal(bucket->key, bucket->key_len, key, key_len)) {
-			void *value_copy = malloc(value_len);
-			if (!value_copy) {
-				futex_mutex_unlock(&bucket->lock_futex);
-				return -ENOMEM;
-			}
-			memcpy(value_copy, value, value_len);
-			if (old_value_len)
-				*old_value_len = bucket->value_len;
-			free((void *)bucket->value);
-			bucket->value = value_copy;
-			bucket->value_len = value_len;
-			futex_mutex_unlock(&bucket->lock_futex);
-			if (is_new)
-				*is_new = 0;
-			return 0;
-		}
-		futex_mutex_unlock(&bucket->lock_futex);
-	}
+	if (end > start)
+		madvise((void *)start, end - start, MADV_DONTNEED);
+}
 
-	if (tombstone_idx >= 0) {
-		struct hash_bucket *target = &buckets[tombstone_idx];
-		int tstate;
-		void *key_copy;
-		void *value_copy;
+static void
+snapshot_map_put(struct hash_snapshot_map *map)
+{
+	if (atomic_fetch_sub_explicit(&map->refs, 1, memory_order_acq_rel)
+	    != 1)
+		return;
+	munmap(map->base, map->len);
+	free(map);
+}
 
-		futex_mutex_lock(&target->lock_futex);
-		tstate = atomic_load(&target->state);
-		if (tstate != BUCKET_TOMBSTONE) {
-			futex_mutex_unlock(&target->lock_futex);
-			return -ENOSPC;
-		}
-		free((void *)target->key);
-		free((void *)target->value);
+/*
+ * The pages a mapped table's writers copied can go as soon as a resize
+ * retires it; no lookup reaches the range again. The table's reference
+ * keeps the mapping, and so the range, its own until then.
+ */
+static void
+table_unmap(struct hash_table *table)
+{
+	struct hash_snapshot_map *map = table->snapshot;
+
+	discard_pages(table->ctrl, (size_t)table->bucket_count + GROUP_WIDTH);
+	discard_pages(table->chunks[0],
+		      (size_t)table->bucket_count * sizeof(struct hash_bucket));
+	free(table->chunks);
+	free(table->ref);
+	free(table->locks);
+	free(table);
+	snapshot_map_put(map);
+}
 
-		key_copy = malloc(key_len);
-		if (!key_copy) {
-			futex_mutex_unlock(&target->lock_futex);
-			return -ENOMEM;
-		}
-		value_copy = malloc(value_len);
-		if (!value_copy) {
-			free(key_copy);
-			futex_mutex_unlock(&target->lock_futex);
-			return -ENOMEM;
-		}
-		memcpy(key_copy, key, key_len);
-		memcpy(value_copy, value, value_len);
-		target->key = key_copy;
-		target->key_len = key_len;
-		target->value = value_copy;
-		target->value_len = value_len;
-		atomic_store(&target->state, BUCKET_OCCUPIED);
-		futex_mutex_unlock(&target->lock_futex);
-
-		if (is_new)
-			*is_new = 1;
-		return 0;
+/* Free a table's memory; chunks may be partly allocated */
+static void
+table_free(struct hash_table *table)
+{
+	if (table->snapshot) {
+		table_unmap(table);
+		return;
 	}
+	if (table->chunks) {
+		uint64_t chunks = table_chunk_count(table->bucket_count);
+		size_t bytes = table_chunk_bytes(table->bucket_count);
 
-	return -ENOSPC;
+		for (uint64_t c = 0; c < chunks; c++)
+			pages_free(table->chunks[c], bytes, &table->pages);
+	}
+	free(table->chunks);
+	free(table->ref);
+	free(table->locks);
+	pages_free(table->ctrl, (size_t)table->bucket_count + GROUP_WIDTH,
+		   &table->pages);
+	free(table);
 }
 
+/* Give a cache-mode table its reference bytes, all clear */
 static int
-delete_from_table(struct hash_bucket *buckets, uint32_t bucket_count,
-		  const void *key, size_t key_len, size_t *deleted_key_len,
-		  size_t *deleted_value_len)
+table_alloc_ref(struct hash_table *table)
 {
-	uint32_t index = compute_hash(key, key_len, bucket_count);
+	table->ref = calloc(table->bucket_count, 1);
+	return table->ref ? 0 : -ENOMEM;
+}
 
-	for (uint32_t i = 0; i < bucket_count; i++) {
-		struct hash_bucket *bucket
-		    = &buckets[(index + i) % bucket_count];
-		int state = bucket_state(bucket);
+/* Give a group-mode table up to stripes slot locks, all unlocked */
+static int
+table_alloc_locks(struct hash_table *table, uint32_t stripes)
+{
+	uint64_t count = table->bucket_count / HASH_LOCK_MIN_SLOTS;
 
-		if (state == BUCKET_EMPTY)
-			return -ENOENT;
-		if (state == BUCKET_TOMBSTONE)
-			continue;
+	table->locks = NULL;
+	table->lock_mask = 0;
+	if (table->probe_mode == HASH_PROBE_ROBIN_HOOD)
+		return 0;
+	if (count > stripes)
+		count = stripes;
+	if (count == 0)
+		count = 1;
+	table->locks = aligned_alloc(_Alignof(struct hash_slot_lock),
+				     count * sizeof(*table->locks));
+	if (!table->locks)
+		return -ENOMEM;
+	for (uint64_t i = 0; i < count; i++)
+		futex_mutex_init(&table->locks[i].lock);
+	table->lock_mask = count - 1;
+	return 0;
+}
 
-		futex_mutex_lock(&bucket->lock_futex);
-		if (atomic_load(&bucket->state) != BUCKET_OCCUPIED) {
-			futex_mutex_unlock(&bucket->lock_futex);
-			continue;
-		}
-		if (keys_equal(bucket->key, bucket->key_len, key, key_len)) {
-			if (deleted_key_len)
-				*deleted_key_len = bucket->key_len;
-			if (deleted_value_len)
-				*deleted_value_len = bucket->value_len;
-			bucket_make_tombstone_unlocked(bucket);
-			futex_mutex_unlock(&bucket->lock_futex);
-			return 0;
+static struct hash_table *
+table_create(uint64_t bucket_count, int probe_mode,
+	     const struct pages_policy *pages, int cache, uint32_t stripes)
+{
+	uint64_t chunks = table_chunk_count(bucket_count);
+	size_t chunk_bytes = table_chunk_bytes(bucket_count);
+	uint64_t chunk_len = chunk_bytes / sizeof(struct hash_bucket);
+	struct hash_table *table;
+
+	table = malloc(sizeof(*table));
+	if (!table)
+		return NULL;
+
+	table->bucket_count = bucket_count;
+	table->mask = bucket_count - 1;
+	table->pages = *pages;
+	table->snapshot = NULL;
+	table->ref = NULL;
+	table->probe_mode = probe_mode;
+	table->chunks = calloc(chunks, sizeof(*table->chunks));
+	table->ctrl = pages_alloc((size_t)bucket_count + GROUP_WIDTH, 64,
+				  &table->pages);
+	if (table_alloc_locks(table, stripes) != 0 || !table->chunks
+	    || !table->ctrl || (cache && table_alloc_ref(table) != 0)) {
+		table_free(table);
+		return NULL;
+	}
+	memset(table->ctrl, CTRL_EMPTY, (size_t)bucket_count + GROUP_WIDTH);
+
+	for (uint64_t c = 0; c < chunks; c++) {
+		/* Buckets are over-aligned beyond malloc's guarantee */
+		table->chunks[c] = pages_alloc(chunk_bytes, BUCKET_ALIGN,
+					       &table->pages);
+		if (!table->chunks[c]) {
+			table_free(table);
+			return NULL;
 		}
-		futex_mutex_unlock(&bucket->lock_futex);
+		for (uint64_t i = 0; i < chunk_len; i++)
+			bucket_init(&table->chunks[c][i]);
 	}
-	return -ENOENT;
+
+	atomic_init(&table->draining, 0);
+	futex_mutex_init(&table->write_lock);
+	atomic_init(&table->seq, 0);
+	atomic_init(&table->migrate_index, 0);
+	atomic_init(&table->migrated, 0);
+	atomic_init(&table->migrate_failed, 0);
+	atomic_init(&table->used, 0);
+	return table;
 }
 
 static void
-migrate_bucket(struct hash_engine *engine, struct hash_bucket *old_bucket)
+table_destroy(struct hash_table *table)
 {
-	struct hash_bucket *new_buckets;
-	uint32_t new_bucket_count;
-	int state = bucket_state(old_bucket);
-
-	if (state != BUCKET_OCCUPIED)
-		return;
-
-	new_buckets = atomic_load(&engine->hash_buckets);
-	new_bucket_count = atomic_load(&engine->bucket_count);
-
-	futex_mutex_lock(&old_bucket->lock_futex);
-	if (atomic_load(&old_bucket->state) != BUCKET_OCCUPIED) {
-		futex_mutex_unlock(&old_bucket->lock_futex);
-		return;
+	for (uint64_t i = 0; i < table->bucket_count; i++) {
+		/* Mapped slots are read in from disk; skip the empty ones */
+		if (table->snapshot && !ctrl_is_full(table->ctrl[i]))
+			continue;
+		bucket_destroy(table_bucket(table, i));
 	}
-
-	insert_into_table(new_buckets, new_bucket_count, old_bucket->key,
-			  old_bucket->key_len, old_bucket->value,
-			  old_bucket->value_len, NULL, NULL);
-
-	bucket_make_tombstone_unlocked(old_bucket);
-	futex_mutex_unlock(&old_bucket->lock_futex);
+	table_free(table);
 }
 
 static void
-migrate_some_buckets(struct hash_engine *engine, uint32_t count)
+table_destroy_rcu(struct epoch_head *head)
 {
-	struct hash_bucket *old;
-	uint32_t old_count;
-	uint32_t idx;
-	uint32_t i;
+	table_destroy((struct hash_table *)((char *)head
+					    - offsetof(struct hash_table,
+						       epoch)));
+}
 
-	atomic_fetch_add(&engine->migrate_workers, 1);
+/*
+ * Publish a slot's control byte. Writers update the bucket first, so a
+ * reader that sees the new tag also finds the bucket filled.
+ */
+static inline void
+table_set_ctrl(struct hash_table *table, uint64_t idx, uint8_t ctrl)
+{
+	__atomic_store_n(&table->ctrl[idx], ctrl, __ATOMIC_RELEASE);
+	if (idx < GROUP_WIDTH)
+		__atomic_store_n(&table->ctrl[table->bucket_count + idx], ctrl,
+				 __ATOMIC_RELEASE);
+}
 
-	old = atomic_load(&engine->old_buckets);
-	if (!old) {
-		atomic_fetch_sub(&engine->migrate_workers, 1);
-		return;
-	}
+/*
+ * Reference bytes of cache-mode tables. Lookups only store to a byte that
+ * is clear, so hot entries do not keep dirtying the line; writers move
+ * and clear them while holding the slots.
+ */
+static inline void
+table_ref_set(struct hash_table *table, uint64_t idx)
+{
+	if (table->ref && !__atomic_load_n(&table->ref[idx], __ATOMIC_RELAXED))
+		__atomic_store_n(&table->ref[idx], 1, __ATOMIC_RELAXED);
+}
 
-	old_count = atomic_load(&engine->old_bucket_count);
+static inline void
+table_ref_clear(struct hash_table *table, uint64_t idx)
+{
+	if (table->ref)
+		__atomic_store_n(&table->ref[idx], 0, __ATOMIC_RELAXED);
+}
 
-	for (i = 0; i < count; i++) {
-		idx = atomic_fetch_add(&engine->migrate_index, 1);
-		if (idx >= old_count) {
-			atomic_fetch_sub(&engine->migrate_workers, 1);
-			finish_resize(engine);
-			return;
-		}
-		migrate_bucket(engine, &old[idx]);
-	}
+static inline void
+table_ref_move(struct hash_table *table, uint64_t to, uint64_t from)
+{
+	if (table->ref)
+		__atomic_store_n(&table->ref[to],
+				 __atomic_load_n(&table->ref[from],
+						 __ATOMIC_RELAXED),
+				 __ATOMIC_RELAXED);
+}
 
-	atomic_fetch_sub(&engine->migrate_workers, 1);
+/*
+ * Snapshot the current and draining tables. start_resize publishes the
+ * draining table before the new one, so seeing the same table in both
+ * means a swap is half done.
+ */
+static void
+shard_tables(struct hash_shard *shard, struct hash_table **table,
+	      struct hash_table **old)
+{
+	do {
+		*table = atomic_load(&shard->table);
+		*old = atomic_load(&shard->old_table);
+	} while (*table == *old);
 }
 
 static void
-finish_resize(struct hash_engine *engine)
+init_siphash_keys(void)
 {
-	struct hash_bucket *old;
-	uint32_t old_count;
-	uint32_t workers;
-	uint32_t i;
+	uint64_t k0 = 0, k1 = 0;
 
-	if (futex_mutex_trylock(&engine->engine_lock) != 0)
+	if (atomic_load(&siphash_initialized))
 		return;
 
-	old = atomic_load(&engine->old_buckets);
-	if (!old) {
-		futex_mutex_unlock(&engine->engine_lock);
+	futex_mutex_lock_class(&siphash_init_lock, FUTEX_CLASS_HASH_SIPHASH);
+	if (atomic_load(&siphash_initialized)) {
+		futex_mutex_unlock(&siphash_init_lock);
 		return;
 	}
 
-	workers = atomic_load(&engine->migrate_workers);
-	if (workers > 0) {
-		futex_mutex_unlock(&engine->engine_lock);
-		return;
+	if (siphash_init_random_key(&k0, &k1) != 0) {
+		fprintf(stderr, "hash_engine_init: warning: weak "
+				"SipHash key used\n");
 	}
+	hash_key_0 = k0;
+	hash_key_1 = k1;
+	siphash_set_key(k0, k1);
+	atomic_store(&siphash_initialized, 1);
+	futex_mutex_unlock(&siphash_init_lock);
+}
 
-	old_count = atomic_load(&engine->old_bucket_count);
-
-	for (i = 0; i < old_count; i++)
-		bucket_destroy(&old[i]);
-	free(old);
-
-	atomic_store(&engine->old_buckets, NULL);
-	atomic_store(&engine->old_bucket_count, 0);
-	atomic_store(&engine->migrate_index, 0);
-
-	futex_mutex_unlock(&engine->engine_lock);
+/*
+ * Shards are picked by the hash bits just below the control-byte tag, so
+ * neither the tag nor the low bits that index a shard's table depend on
+ * the shard choice.
+ */
+static inline struct hash_shard *
+engine_shard(struct hash_engine *engine, uint64_t hash)
+{
+	return &engine->shards[(hash >> engine->shard_shift)
+			       & (engine->shard_count - 1)];
 }
 
+/*
+ * A TinyLFU sketch with a counter per 8 bytes of the shard's limit, about
+ * ten per entry of typical size, so an addition's four increments leave
+ * counters room to tell popular hashes apart
+ */
 static int
-hash_engine_start_resize(struct hash_engine *engine, uint32_t new_bucket_count)
+shard_sketch_create(struct hash_shard *shard)
 {
-	struct hash_bucket *new_buckets;
-	struct hash_bucket *current_buckets;
-	uint32_t current_count;
+	shard->sketch = malloc(sizeof(*shard->sketch));
+	if (!shard->sketch)
+		return -ENOMEM;
+	if (freq_sketch_init(shard->sketch, shard->memory_limit / 8) != 0) {
+		free(shard->sketch);
+		shard->sketch = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+}
 
-	futex_mutex_lock(&engine->engine_lock);
+static void
+shard_sketch_destroy(struct hash_shard *shard)
+{
+	if (!shard->sketch)
+		return;
+	freq_sketch_destroy(shard->sketch);
+	free(shard->sketch);
+	shard->sketch = NULL;
+}
 
-	if (atomic_load(&engine->old_buckets) != NULL) {
-		futex_mutex_unlock(&engine->engine_lock);
-		return 0;
-	}
+static int
+shard_init(struct hash_shard *shard, uint64_t bucket_count, int probe_mode,
+	   uint32_t stripes, const struct pages_policy *pages, uint32_t now,
+	   uint64_t memory_limit, int evict_policy, uint32_t lock_stripes)
+{
+	struct hash_table *table;
+
+	futex_mutex_init(&shard->resize_lock);
+	atomic_init(&shard->item_count, 0);
+	atomic_init(&shard->old_table, NULL);
+	shard->pages = *pages;
+	shard->lock_stripes = lock_stripes;
+	futex_mutex_init(&shard->wheel_lock);
+	atomic_init(&shard->timers, 0);
+	atomic_init(&shard->expire_next, now);
+	atomic_init(&shard->memory, 0);
+	shard->memory_limit = memory_limit;
+	atomic_init(&shard->clock_hand, 0);
+	shard->sketch = NULL;
+
+	shard->wheel = malloc(sizeof(*shard->wheel));
+	if (!shard->wheel)
+		return -ENOMEM;
+	ttl_wheel_init(shard->wheel, now);
 
-	if (new_bucket_count < MIN_BUCKET_COUNT
-	    || new_bucket_count > MAX_BUCKET_COUNT) {
-		futex_mutex_unlock(&engine->engine_lock);
-		return -EINVAL;
+	shard->counters = aligned_alloc(_Alignof(struct hash_counter),
+					stripes * sizeof(struct hash_counter));
+	if (!shard->counters) {
+		free(shard->wheel);
+		return -ENOMEM;
 	}
-
-	current_count = atomic_load(&engine->bucket_count);
-	if (new_bucket_count > current_count) {
-		if (!needs_grow(engine)) {
-			futex_mutex_unlock(&engine->engine_lock);
-			return 0;
-		}
-	} else {
-		if (!needs_shrink(engine)) {
-			futex_mutex_unlock(&engine->engine_lock);
-			return 0;
-		}
+	shard->counter_mask = stripes - 1;
+	for (uint32_t i = 0; i < stripes; i++) {
+		atomic_init(&shard->counters[i].items, 0);
+		atomic_init(&shard->counters[i].memory, 0);
+		atomic_init(&shard->counters[i].hits, 0);
+		atomic_init(&shard->counters[i].misses, 0);
+		atomic_init(&shard->counters[i].evictions, 0);
+		atomic_init(&shard->counters[i].rejections, 0);
 	}
 
-	new_buckets = calloc(new_bucket_count, sizeof(struct hash_bucket));
-	if (!new_buckets) {
-		futex_mutex_unlock(&engine->engine_lock);
+	if (memory_limit && evict_policy == HASH_EVICT_TINYLFU
+	    && shard_sketch_create(shard) != 0) {
+		free(shard->counters);
+		free(shard->wheel);
 		return -ENOMEM;
 	}
 
-	for (uint32_t i = 0; i < new_bucket_count; i++) {
-		if (bucket_init(&new_buckets[i]) != 0) {
-			for (uint32_t j = 0; j < i; j++)
-				bucket_destroy(&new_buckets[j]);
-			free(new_buckets);
-			futex_mutex_unlock(&engine->engine_lock);
-			return -ENOMEM;
-		}
+	table = table_create(bucket_count, probe_mode, &shard->pages,
+			     memory_limit != 0, lock_stripes);
+	if (!table) {
+		shard_sketch_destroy(shard);
+		free(shard->counters);
+		free(shard->wheel);
+		return -ENOMEM;
 	}
-
-	current_buckets = atomic_load(&engine->hash_buckets);
-	current_count = atomic_load(&engine->bucket_count);
-
-	atomic_store(&engine->old_buckets, current_buckets);
-	atomic_store(&engine->old_bucket_count, current_count);
-	atomic_store(&engine->migrate_index, 0);
-	atomic_store(&engine->hash_buckets, new_buckets);
-	atomic_store(&engine->bucket_count, new_bucket_count);
-
-	futex_mutex_unlock(&engine->engine_lock);
+	atomic_init(&shard->table, table);
 	return 0;
 }
 
-int
-hash_get(struct hash_engine *engine, const void *key, size_t key_len,
-	 const void **value, size_t *value_len)
+static void
+shard_destroy(struct hash_shard *shard)
 {
-	struct hash_bucket *buckets;
-	struct hash_bucket *old;
-	uint32_t bucket_count;
-	int rc;
+	struct hash_table *table;
+	struct hash_table *old;
 
-	if (!engine || !key || key_len == 0)
-		return -EINVAL;
+	futex_mutex_lock_class(&shard->resize_lock, FUTEX_CLASS_HASH_RESIZE);
 
-	migrate_some_buckets(engine, MIGRATE_BATCH_SIZE);
+	table = atomic_load(&shard->table);
+	if (table)
+		table_destroy(table);
 
-	buckets = atomic_load(&engine->hash_buckets);
-	bucket_count = atomic_load(&engine->bucket_count);
-	rc = lookup_in_table(buckets, bucket_count, key, key_len, value,
-			     value_len);
-	if (rc == 0)
-		return 0;
+	old = atomic_load(&shard->old_table);
+	if (old)
+		table_destroy(old);
 
-	old = atomic_load(&engine->old_buckets);
-	if (old) {
-		uint32_t old_count = atomic_load(&engine->old_bucket_count);
-		rc = lookup_in_table(old, old_count, key, key_len, value,
-				     value_len);
-	}
+	free(shard->counters);
+	shard->counters = NULL;
+	shard_sketch_destroy(shard);
+	ttl_wheel_destroy(shard->wheel);
+	free(shard->wheel);
+	shard->wheel = NULL;
+	atomic_store(&shard->timers, 0);
 
-	return rc;
+	atomic_store(&shard->table, NULL);
+	atomic_store(&shard->item_count, 0);
+	atomic_store(&shard->old_table, NULL);
+
+	futex_mutex_unlock(&shard->resize_lock);
 }
 
 int
-hash_put(struct hash_engine *engine, const void *key, size_t key_len,
-	 const void *value, size_t value_len)
+hash_engine_init(struct hash_engine *engine, uint64_t bucket_count)
 {
-	struct hash_bucket *buckets;
-	struct hash_bucket *old;
-	uint32_t bucket_count;
-	int is_new = 0;
-	int existed_in_old = 0;
-	size_t old_tbl_key_len = 0;
-	size_t old_tbl_value_len = 0;
-	size_t new_tbl_old_value_len = 0;
+	struct hash_engine_config config = {
+		.bucket_count = bucket_count,
+		.probe_mode = HASH_PROBE_GROUP,
+		.shard_count = 1,
+		.hasher = HASHER_SIPHASH,
+		.resize_mode = HASH_RESIZE_INLINE,
+	};
+
+	return hash_engine_init_config(engine, &config);
+}
+
+int
+hash_engine_init_config(struct hash_engine *engine,
+			const struct hash_engine_config *config)
+{
+	struct pages_policy pages;
+	uint32_t shard_count;
+	uint64_t bucket_count;
+	uint64_t shard_limit;
+	uint32_t lock_stripes;
+	uint32_t threads;
+	uint32_t stripes;
+	long cpus;
+	uint32_t i;
+	int rc;
+
+	if (!engine || !config || config->bucket_count == 0)
+		return -EINVAL;
+	if (config->probe_mode != HASH_PROBE_GROUP
+	    && config->probe_mode != HASH_PROBE_ROBIN_HOOD)
+		return -EINVAL;
+	shard_count = config->shard_count ? config->shard_count : 1;
+	if (shard_count > HASH_MAX_SHARDS
+	    || (shard_count & (shard_count - 1)) != 0)
+		return -EINVAL;
+	if (config->resize_mode != HASH_RESIZE_INLINE
+	    && config->resize_mode != HASH_RESIZE_BACKGROUND)
+		return -EINVAL;
+	if (config->resize_threads > HASH_MAX_RESIZE_THREADS)
+		return -EINVAL;
+	if (config->page_mode < PAGES_DEFAULT
+	    || config->page_mode > PAGES_HUGETLB)
+		return -EINVAL;
+	if (config->numa_policy < PAGES_NUMA_DEFAULT
+	    || config->numa_policy > PAGES_NUMA_LOCAL)
+		return -EINVAL;
+	if (config->evict_policy != HASH_EVICT_CLOCK
+	    && config->evict_policy != HASH_EVICT_TINYLFU)
+		return -EINVAL;
+	engine->hash_fn = hasher_get(config->hasher);
+	if (!engine->hash_fn)
+		return -EINVAL;
+	engine->hasher = config->hasher;
+
+	init_siphash_keys();
+	engine->hash_key_0 = hash_key_0;
+	engine->hash_key_1 = hash_key_1;
+	engine->snapshot = NULL;
+	engine->clock = config->clock;
+	engine->clock_arg = config->clock_arg;
+	atomic_init(&engine->ttl_used, 0);
+	atomic_init(&engine->expire_shard, 0);
+	engine->memory_limit = config->memory_limit;
+	engine->evict_policy = config->evict_policy;
+
+	/* bucket_count is the total; each shard gets an equal part */
+	bucket_count = config->bucket_count / shard_count;
+
+	/* Group loads read GROUP_WIDTH control bytes from any slot */
+	if (bucket_count < MIN_BUCKET_COUNT)
+		bucket_count = MIN_BUCKET_COUNT;
+	if (bucket_count > MAX_BUCKET_COUNT)
+		bucket_count = MAX_BUCKET_COUNT;
+	bucket_count = round_up_pow2(bucket_count);
+
+	pages.mode = config->page_mode;
+	pages.numa = config->numa_policy;
+
+	/* So is the memory limit, which must leave every shard some */
+	shard_limit = config->memory_limit / shard_count;
+	if (config->memory_limit && shard_limit == 0)
+		shard_limit = 1;
+
+	/* And so are the slot locks, though every shard gets at least one */
+	lock_stripes = config->lock_stripes ? config->lock_stripes
+					    : HASH_LOCK_STRIPES;
+	lock_stripes /= shard_count;
+	if (lock_stripes == 0)
+		lock_stripes = 1;
+	if (lock_stripes > 1U << 31)
+		lock_stripes = 1U << 31;
+	lock_stripes = (uint32_t)round_up_pow2(lock_stripes);
+
+	/* Counter stripes are indexed by CPU number */
+	cpus = sysconf(_SC_NPROCESSORS_CONF);
+	stripes = HASH_MAX_COUNTER_STRIPES;
+	if (cpus > 0 && cpus < HASH_MAX_COUNTER_STRIPES)
+		stripes = (uint32_t)round_up_pow2((uint64_t)cpus);
+
+	engine->shards = aligned_alloc(_Alignof(struct hash_shard),
+				       shard_count * sizeof(struct hash_shard));
+	if (!engine->shards)
+		return -ENOMEM;
+	engine->shard_count = shard_count;
+	engine->shard_shift = 57 - (uint32_t)__builtin_ctz(shard_count);
+	engine->assist_budget = config->assist_budget;
+	if (engine->assist_budget == 0
+	    && config->resize_mode == HASH_RESIZE_INLINE)
+		engine->assist_budget = MIGRATE_BATCH_SIZE;
+	engine->resize_done = config->resize_done;
+	engine->resize_done_arg = config->resize_done_arg;
+	engine->resize_threads = NULL;
+	engine->resize_thread_count = 0;
+	atomic_init(&engine->resize_seq, 0);
+	atomic_init(&engine->resize_pending, 0);
+	atomic_init(&engine->resize_stop, 0);
+
+	for (i = 0; i < shard_count; i++) {
+		/* LOCAL spreads shards over nodes, one whole table per node */
+		pages.node = (int)(i % (uint32_t)pages_numa_nodes());
+		rc = shard_init(&engine->shards[i], bucket_count,
+				config->probe_mode, stripes, &pages,
+				engine_now(engine), shard_limit,
+				config->evict_policy, lock_stripes);
+		if (rc != 0) {
+			while (i-- > 0)
+				shard_destroy(&engine->shards[i]);
+			free(engine->shards);
+			engine->shards = NULL;
+			return rc;
+		}
+	}
+
+	if (config->resize_mode == HASH_RESIZE_BACKGROUND) {
+		threads = config->resize_threads ? config->resize_threads : 1;
+		rc = resize_workers_start(engine, threads);
+		if (rc != 0) {
+			for (i = 0; i < shard_count; i++)
+				shard_destroy(&engine->shards[i]);
+			free(engine->shards);
+			engine->shards = NULL;
+			return rc;
+		}
+	}
+	return 0;
+}
+
+int
+hash_engine_get_stats(struct hash_engine *engine, uint64_t *item_count,
+		      uint64_t *bucket_count, uint64_t *memory_usage)
+{
+	int64_t items = 0;
+	uint64_t buckets = 0;
+	int64_t memory = 0;
+	uint32_t i;
+
+	if (!engine)
+		return -EINVAL;
+
+	epoch_enter();
+	for (i = 0; i < engine->shard_count; i++) {
+		struct hash_shard *shard = &engine->shards[i];
+
+		items += shard_items_exact(shard);
+		buckets += atomic_load(&shard->table)->bucket_count;
+		memory += shard_memory_exact(shard);
+	}
+	epoch_exit();
+
+	/* A racing put and delete may be summed in either order */
+	if (item_count)
+		*item_count = items > 0 ? (uint64_t)items : 0;
+	if (bucket_count)
+		*bucket_count = buckets;
+	if (memory_usage)
+		*memory_usage = memory > 0 ? (uint64_t)memory : 0;
+	return 0;
+}
+
+/* What a walk of some tables' slots has seen so far */
+struct table_walk {
+	uint64_t *hist;
+	uint32_t bins;
+	uint64_t slots;
+	uint64_t entries;
+	uint64_t tombstones;
+	uint64_t probe_total;
+	uint64_t max_probe;
+	uint64_t clusters;
+	uint64_t cluster_total;
+	uint64_t longest_cluster;
+};
+
+static void
+walk_cluster(struct table_walk *walk, uint64_t len)
+{
+	walk->clusters++;
+	walk->cluster_total += len;
+	if (len > walk->longest_cluster)
+		walk->longest_cluster = len;
+}
+
+/*
+ * Add count slots of table from start, wrapping, to walk. Only clusters
+ * that start inside the range are counted, but those are followed past
+ * its end, so a walk of the whole table counts each exactly once.
+ */
+static void
+table_walk_range(struct hash_table *table, uint64_t start, uint64_t count,
+		 struct table_walk *walk)
+{
+	uint64_t run = 0;
+	int open = 0;
+
+	walk->slots += count;
+	for (uint64_t i = 0; i < count + table->bucket_count; i++) {
+		uint64_t idx = (start + i) & table->mask;
+		uint8_t ctrl = __atomic_load_n(&table->ctrl[idx],
+					       __ATOMIC_RELAXED);
+		uint64_t probe;
+
+		if (ctrl == CTRL_EMPTY) {
+			if (open && run)
+				walk_cluster(walk, run);
+			if (i >= count)
+				return;
+			open = 1;
+			run = 0;
+			continue;
+		}
+		run++;
+		if (i >= count) {
+			if (!open)
+				return;
+			continue;
+		}
+		if (ctrl == CTRL_DELETED) {
+			walk->tombstones++;
+			continue;
+		}
+		probe = idx - home_index(bucket_hash(table_bucket(table, idx)),
+					 table->mask);
+		probe = (probe & table->mask) + 1;
+		if (probe > walk->max_probe)
+			walk->max_probe = probe;
+		walk->hist[probe <= walk->bins ? probe - 1 : walk->bins - 1]++;
+		walk->probe_total += probe;
+		walk->entries++;
+	}
+	if (open && run)
+		walk_cluster(walk, run);
+}
+
+/* Smallest probe length at least q of the walked entries are within */
+static uint32_t
+walk_probe_quantile(const struct table_walk *walk, double q)
+{
+	uint64_t seen = 0;
+	uint32_t bin;
+
+	for (bin = 0; bin < walk->bins - 1; bin++) {
+		seen += walk->hist[bin];
+		if ((double)seen >= q * (double)walk->entries)
+			break;
+	}
+	return bin + 1;
+}
+
+int
+hash_engine_get_cache_stats(struct hash_engine *engine,
+			    struct hash_cache_stats *stats)
+{
+	int64_t sums[4] = { 0, 0, 0, 0 };
+	uint64_t lookups;
+
+	if (!engine || !stats || !engine->memory_limit)
+		return -EINVAL;
+
+	for (uint32_t i = 0; i < engine->shard_count; i++) {
+		struct hash_shard *shard = &engine->shards[i];
+
+		for (uint32_t c = 0; c <= shard->counter_mask; c++) {
+			struct hash_counter *counter = &shard->counters[c];
+
+			sums[0] += atomic_load_explicit(&counter->hits,
+							memory_order_relaxed);
+			sums[1] += atomic_load_explicit(&counter->misses,
+							memory_order_relaxed);
+			sums[2] += atomic_load_explicit(&counter->evictions,
+							memory_order_relaxed);
+			sums[3] += atomic_load_explicit(&counter->rejections,
+							memory_order_relaxed);
+		}
+	}
+
+	stats->hits = (uint64_t)sums[0];
+	stats->misses = (uint64_t)sums[1];
+	stats->evictions = (uint64_t)sums[2];
+	stats->rejections = (uint64_t)sums[3];
+	lookups = stats->hits + stats->misses;
+	stats->hit_ratio = lookups ? (double)stats->hits / (double)lookups : 0;
+	return 0;
+}
+
+/* The full walk's figures, so the two calls never disagree */
+int
+hash_engine_get_probe_stats(struct hash_engine *engine,
+			    struct hash_probe_stats *stats)
+{
+	struct hash_table_stats table;
+	int rc;
+
+	if (!engine || !stats)
+		return -EINVAL;
+	rc = hash_engine_get_table_stats(engine, 0, &table);
+	if (rc != 0)
+		return rc;
+	stats->max_probe = table.max_probe;
+	stats->p99_probe = table.p99_probe;
+	stats->avg_probe = table.avg_probe;
+	stats->tombstones = table.tombstones;
+	return 0;
+}
+
+int
+hash_engine_get_table_stats(struct hash_engine *engine, uint64_t sample,
+			    struct hash_table_stats *stats)
+{
+	struct table_walk walk = { 0 };
+	uint64_t resize_total = 0;
+	uint64_t migrated = 0;
+	uint32_t i;
+
+	if (!engine || !stats)
+		return -EINVAL;
+	memset(stats, 0, sizeof(*stats));
+	walk.hist = stats->probe_hist;
+	walk.bins = HASH_PROBE_HIST_BINS;
+
+	epoch_enter();
+	for (i = 0; i < engine->shard_count; i++) {
+		struct hash_shard *shard = &engine->shards[i];
+		struct hash_table *table = atomic_load(&shard->table);
+		struct hash_table *old = atomic_load(&shard->old_table);
+		uint64_t windows;
+		uint64_t len;
+		uint64_t stride;
+
+		if (sample == 0 || sample >= table->bucket_count) {
+			table_walk_range(table, 0, table->bucket_count, &walk);
+		} else {
+			windows = (sample + HASH_STATS_WINDOW - 1)
+				  / HASH_STATS_WINDOW;
+			len = (sample + windows - 1) / windows;
+			stride = table->bucket_count / windows;
+			for (uint64_t w = 0; w < windows; w++)
+				table_walk_range(table, w * stride, len,
+						 &walk);
+		}
+
+		if (old) {
+			uint64_t done = atomic_load(&old->migrated);
+			uint64_t failed = atomic_load(&old->migrate_failed);
+
+			/* Failures are counted first, so may be ahead here */
+			done = done > failed ? done - failed : 0;
+			if (done > old->bucket_count)
+				done = old->bucket_count;
+			stats->resizing_shards++;
+			resize_total += old->bucket_count;
+			migrated += done;
+		}
+	}
+	epoch_exit();
+
+	stats->slots = walk.slots;
+	stats->entries = walk.entries;
+	stats->tombstones = walk.tombstones;
+	stats->max_probe = walk.max_probe;
+	stats->clusters = walk.clusters;
+	stats->longest_cluster = walk.longest_cluster;
+	if (walk.slots) {
+		stats->load_factor = (double)walk.entries / (double)walk.slots;
+		stats->tombstone_ratio =
+		    (double)walk.tombstones / (double)walk.slots;
+	}
+	if (walk.entries) {
+		stats->avg_probe =
+		    (double)walk.probe_total / (double)walk.entries;
+		stats->p50_probe = walk_probe_quantile(&walk, 0.50);
+		stats->p99_probe = walk_probe_quantile(&walk, 0.99);
+	}
+	if (walk.clusters)
+		stats->avg_cluster =
+		    (double)walk.cluster_total / (double)walk.clusters;
+	stats->resize_remaining = resize_total - migrated;
+	stats->resize_progress =
+	    resize_total ? (double)migrated / (double)resize_total : 1.0;
+	return 0;
+}
+
+/*
+ * Lock-free match of one bucket under its sequence counter. On a match
+ * returns 1, fills value/value_len and, if buf is set, copies up to buf_len
+ * bytes of the value there; returns 0 otherwise, also for an entry expired
+ * by now. Out-of-line keys and values are immutable and epoch-protected, so
+ * only their pointers need to be part of the validated snapshot.
+ */
+static int
+read_bucket(struct hash_bucket *bucket, uint64_t hash, const void *key,
+	    size_t key_len, uint32_t now, void *buf, size_t buf_len,
+	    const void **value, size_t *value_len)
+{
+	const unsigned char *slot;
+	const void *found_key;
+	const void *found_value;
+	uint32_t found_len;
+	uint32_t flags;
+	size_t offset;
+	size_t value_size;
+	uint32_t seq;
+	int rc;
+
+	do {
+		seq = bucket_read_begin(bucket);
+		rc = 0;
+		flags = bucket->flags;
+		found_len = bucket->value_len;
+		found_key = NULL;
+		found_value = NULL;
+
+		if (atomic_load_explicit(&bucket->state, memory_order_relaxed)
+			!= BUCKET_OCCUPIED
+		    || bucket_hash(bucket) != hash
+		    || bucket->key_len != key_len
+		    || expired_by(bucket->expires, now))
+			continue;
+
+		offset = (flags & BUCKET_F_KEY_EXT) ? sizeof(void *) : key_len;
+		value_size = (flags & BUCKET_F_VALUE_EXT) ? sizeof(void *)
+							  : found_len;
+		/* Torn snapshot; the retry check discards it */
+		if (offset + value_size > BUCKET_INLINE_SIZE)
+			continue;
+
+		if (flags & BUCKET_F_KEY_EXT)
+			memcpy(&found_key, bucket->data, sizeof(found_key));
+		else if (memcmp(bucket->data, key, key_len) != 0)
+			continue;
+
+		slot = bucket->data + offset;
+		if (flags & BUCKET_F_VALUE_EXT) {
+			memcpy(&found_value, slot, sizeof(found_value));
+		} else {
+			found_value = slot;
+			if (buf)
+				memcpy(buf, slot,
+				       found_len < buf_len ? found_len
+							   : buf_len);
+		}
+		rc = 1;
+	} while (bucket_read_retry(bucket, seq));
+
+	if (!rc)
+		return 0;
+	if (found_key && memcmp(found_key, key, key_len) != 0)
+		return 0;
+	if (buf && (flags & BUCKET_F_VALUE_EXT))
+		memcpy(buf, found_value,
+		       found_len < buf_len ? found_len : buf_len);
+
+	if (value)
+		*value = found_value;
+	if (value_len)
+		*value_len = found_len;
+	return 1;
+}
+
+/*
+ * Robin Hood mode. Within a cluster entries sit in order of their home
+ * slots, so a probe can stop at the first entry that is closer to its own
+ * home than the key would be, and a delete shifts the rest of the cluster
+ * back one slot instead of leaving a tombstone. Writers hold
+ * table->write_lock; table->seq is odd while entries are being moved, and
+ * a lock-free reader that found nothing checks it to rule out having
+ * raced a move.
+ */
+static inline uint64_t
+rh_distance(const struct hash_table *table, uint64_t idx, uint64_t hash)
+{
+	return (idx - home_index(hash, table->mask)) & table->mask;
+}
+
+static inline void
+table_write_begin(struct hash_table *table)
+{
+	atomic_store_explicit(
+	    &table->seq,
+	    atomic_load_explicit(&table->seq, memory_order_relaxed) + 1,
+	    memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static inline void
+table_write_end(struct hash_table *table)
+{
+	atomic_store_explicit(
+	    &table->seq,
+	    atomic_load_explicit(&table->seq, memory_order_relaxed) + 1,
+	    memory_order_release);
+}
+
+static inline uint32_t
+table_read_begin(const struct hash_table *table)
+{
+	uint32_t seq;
+
+	while ((seq = atomic_load_explicit(&table->seq, memory_order_acquire))
+	       & 1)
+		CPU_RELAX();
+	return seq;
+}
+
+static inline int
+table_read_retry(const struct hash_table *table, uint32_t seq)
+{
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&table->seq, memory_order_relaxed) != seq;
+}
+
+static int
+rh_lookup(struct hash_table *table, uint64_t hash, const void *key,
+	  size_t key_len, uint32_t now, void *buf, size_t buf_len,
+	  const void **value, size_t *value_len)
+{
+	uint32_t seq;
+
+	do {
+		uint64_t pos = home_index(hash, table->mask);
+
+		seq = table_read_begin(table);
+		for (uint64_t dist = 0; dist < table->bucket_count;
+		     dist++, pos = (pos + 1) & table->mask) {
+			struct hash_bucket *bucket = table_bucket(table, pos);
+			uint8_t ctrl = __atomic_load_n(&table->ctrl[pos],
+						       __ATOMIC_ACQUIRE);
+			uint64_t found;
+
+			if (ctrl == CTRL_EMPTY)
+				break;
+			if (ctrl == CTRL_DELETED)
+				continue;
+			found = bucket_hash(bucket);
+			if (rh_distance(table, pos, found) < dist)
+				break;
+			/* read_bucket rechecks the key, so a hit is final */
+			if (found == hash
+			    && read_bucket(bucket, hash, key, key_len, now,
+					   buf, buf_len, value, value_len)) {
+				table_ref_set(table, pos);
+				return 0;
+			}
+		}
+	} while (table_read_retry(table, seq));
+	return -ENOENT;
+}
+
+/*
+ * Whether an occupied bucket of the probed hash is the one a locked lookup
+ * wants: the one holding key or, with key NULL, one that expired by now.
+ */
+static inline int
+bucket_wanted(struct hash_bucket *bucket, const void *key, size_t key_len,
+	      uint32_t now)
+{
+	if (!key)
+		return expired_by(bucket->expires, now);
+	return keys_equal(bucket_key(bucket), bucket->key_len, key, key_len);
+}
+
+/*
+ * Slot wanted by bucket_wanted(), or -ENOENT; the caller holds
+ * table->write_lock
+ */
+static int64_t
+rh_find_locked(struct hash_table *table, uint64_t hash, const void *key,
+	       size_t key_len, uint32_t now)
+{
+	uint64_t pos = home_index(hash, table->mask);
+
+	for (uint64_t dist = 0; dist < table->bucket_count;
+	     dist++, pos = (pos + 1) & table->mask) {
+		struct hash_bucket *bucket = table_bucket(table, pos);
+		uint8_t ctrl = table->ctrl[pos];
+		uint64_t found;
+
+		if (ctrl == CTRL_EMPTY)
+			return -ENOENT;
+		if (ctrl == CTRL_DELETED)
+			continue;
+		found = bucket_hash(bucket);
+		if (rh_distance(table, pos, found) < dist)
+			return -ENOENT;
+		if (found == hash && bucket_wanted(bucket, key, key_len, now))
+			return (int64_t)pos;
+	}
+	return -ENOENT;
+}
+
+/*
+ * A read-modify-write riding on a put (hash_upsert()). Wherever the put
+ * holds the key's slot, the callback runs on the stored entry, or on
+ * nothing for a new key, and its result replaces the value being put.
+ */
+struct upsert_op {
+	hash_upsert_fn fn;
+	void *ctx;
+	/* Entries expired by now are passed to fn as absent */
+	uint32_t now;
+	/* The result of fn's last call */
+	const void *value;
+	size_t value_len;
+	/* Set once fn failed the operation, so its errno is not retried */
+	int failed;
+};
+
+/*
+ * Run op's callback on a held bucket, or on NULL for a new key, and point
+ * *value, *value_len and *expires at what to store instead
+ */
+static int
+upsert_apply(struct upsert_op *op, const struct hash_bucket *bucket,
+	     const void **value, size_t *value_len, uint32_t *expires)
+{
+	const void *current = NULL;
+	size_t current_len = 0;
+	int rc;
+
+	*expires = 0;
+	if (bucket && !expired_by(bucket->expires, op->now)) {
+		current = bucket_value(bucket);
+		current_len = bucket->value_len;
+		*expires = bucket->expires;
+	}
+	op->value = NULL;
+	op->value_len = 0;
+	rc = op->fn(op->ctx, current, current_len, &op->value, &op->value_len);
+	if (rc == 0
+	    && (!op->value || op->value_len == 0
+		|| op->value_len > BUCKET_MAX_LEN))
+		rc = -EINVAL;
+	if (rc != 0) {
+		op->failed = 1;
+		return rc;
+	}
+	*value = op->value;
+	*value_len = op->value_len;
+	return 0;
+}
+
+static int
+rh_insert(struct hash_table *table, uint64_t hash, const void *key,
+	  size_t key_len, const void *value, size_t value_len,
+	  uint32_t expires, int *is_new, size_t *old_value_len,
+	  uint32_t *old_expires, struct upsert_op *op,
+	  struct hash_bucket *from)
+{
+	struct hash_bucket entry;
+	uint64_t mask = table->mask;
+	uint64_t pos = home_index(hash, mask);
+	uint64_t end;
+	uint64_t dist;
+	int rc;
+
+	futex_mutex_lock_class(&table->write_lock, FUTEX_CLASS_HASH_TABLE);
+
+	/* Shifting would move entries behind the migration sweep */
+	if (atomic_load(&table->draining)) {
+		futex_mutex_unlock(&table->write_lock);
+		return -EAGAIN;
+	}
+
+	for (dist = 0; dist < table->bucket_count;
+	     dist++, pos = (pos + 1) & mask) {
+		struct hash_bucket *bucket = table_bucket(table, pos);
+		uint64_t found;
+
+		if (table->ctrl[pos] == CTRL_EMPTY)
+			break;
+		found = bucket_hash(bucket);
+		if (found == hash
+		    && keys_equal(bucket_key(bucket), bucket->key_len, key,
+				  key_len)) {
+			size_t prev_len = bucket->value_len;
+			uint32_t prev_expires = bucket->expires;
+
+			if (op) {
+				rc = upsert_apply(op, bucket, &value,
+						  &value_len, &expires);
+				if (rc != 0) {
+					futex_mutex_unlock(&table->write_lock);
+					return rc;
+				}
+			}
+			rc = bucket_replace_value_unlocked(bucket, value,
+							   value_len, expires);
+			futex_mutex_unlock(&table->write_lock);
+			if (rc != 0)
+				return rc;
+			if (old_value_len)
+				*old_value_len = prev_len;
+			if (old_expires)
+				*old_expires = prev_expires;
+			if (is_new)
+				*is_new = 0;
+			return 0;
+		}
+		if (rh_distance(table, pos, found) < dist)
+			break;
+	}
+
+	/* The key goes at pos; the run up to the next empty slot moves up */
+	for (end = pos; table->ctrl[end] != CTRL_EMPTY;
+	     end = (end + 1) & mask) {
+		if (((end + 1) & mask) == pos) {
+			futex_mutex_unlock(&table->write_lock);
+			return -ENOSPC;
+		}
+	}
+
+	if (op) {
+		rc = upsert_apply(op, NULL, &value, &value_len, &expires);
+		if (rc != 0) {
+			futex_mutex_unlock(&table->write_lock);
+			return rc;
+		}
+	}
+
+	/* Build the entry first so a failed allocation moves nothing */
+	bucket_init(&entry);
+	if (from)
+		rc = bucket_adopt_unlocked(&entry, from);
+	else
+		rc = bucket_store_unlocked(&entry, hash, key, key_len, value,
+					   value_len, expires);
+	if (rc != 0) {
+		futex_mutex_unlock(&table->write_lock);
+		return rc;
+	}
+
+	table_write_begin(table);
+	while (end != pos) {
+		uint64_t prev = (end - 1) & mask;
+
+		bucket_move_unlocked(table_bucket(table, end),
+				     table_bucket(table, prev));
+		table_set_ctrl(table, end, table->ctrl[prev]);
+		table_ref_move(table, end, prev);
+		end = prev;
+	}
+	bucket_move_unlocked(table_bucket(table, pos), &entry);
+	table_set_ctrl(table, pos, ctrl_tag(hash));
+	table_ref_clear(table, pos);
+	table_write_end(table);
+
+	futex_mutex_unlock(&table->write_lock);
+	if (is_new)
+		*is_new = 1;
+	return 0;
+}
+
+/* Remove the entry at idx; the caller holds table->write_lock */
+static void
+rh_remove_locked(struct hash_table *table, uint64_t idx)
+{
+	uint64_t mask = table->mask;
+
+	if (atomic_load(&table->draining)) {
+		bucket_make_tombstone_unlocked(table_bucket(table, idx));
+		table_set_ctrl(table, idx, CTRL_DELETED);
+		return;
+	}
+
+	table_write_begin(table);
+	bucket_clear_unlocked(table_bucket(table, idx));
+	for (;;) {
+		uint64_t next = (idx + 1) & mask;
+		uint8_t ctrl = table->ctrl[next];
+
+		if (ctrl == CTRL_EMPTY
+		    || rh_distance(table, next,
+				   bucket_hash(table_bucket(table, next)))
+			   == 0)
+			break;
+		bucket_move_unlocked(table_bucket(table, idx),
+				     table_bucket(table, next));
+		table_set_ctrl(table, idx, ctrl);
+		table_ref_move(table, idx, next);
+		idx = next;
+	}
+	table_set_ctrl(table, idx, CTRL_EMPTY);
+	table_ref_clear(table, idx);
+	table_write_end(table);
+}
+
+/*
+ * Readers never take slot locks, and only write shared memory to mark
+ * what they hit in cache-mode tables
+ */
+static int
+lookup_in_table(struct hash_table *table, uint64_t hash, const void *key,
+		size_t key_len, uint32_t now, void *buf, size_t buf_len,
+		const void **value, size_t *value_len)
+{
+	uint64_t bucket_count = table->bucket_count;
+	uint64_t mask = table->mask;
+	uint64_t pos = home_index(hash, mask);
+	uint8_t tag = ctrl_tag(hash);
+
+	if (table->probe_mode == HASH_PROBE_ROBIN_HOOD)
+		return rh_lookup(table, hash, key, key_len, now, buf, buf_len,
+				 value, value_len);
+
+	for (uint64_t probed = 0; probed < bucket_count;
+	     probed += GROUP_WIDTH) {
+		const uint8_t *group = &table->ctrl[pos];
+		group_mask_t empty = group_match_empty(group);
+		group_mask_t match = group_match_tag(group, tag)
+				     & group_mask_below_first(empty);
+
+		while (match) {
+			uint64_t idx = (pos + group_mask_next(&match)) & mask;
+			struct hash_bucket *bucket = table_bucket(table, idx);
+
+			if (bucket_hash(bucket) != hash)
+				continue;
+			if (read_bucket(bucket, hash, key, key_len, now, buf,
+					buf_len, value, value_len)) {
+				table_ref_set(table, idx);
+				return 0;
+			}
+		}
+		if (empty)
+			return -ENOENT;
+		pos = (pos + GROUP_WIDTH) & mask;
+	}
+	return -ENOENT;
+}
+
+/*
+ * Put key into table; a key already there reports its old value length
+ * and expiry. from, if set, is the locked bucket of a draining table the
+ * entry moves out of: key and value are its own, and a new slot adopts
+ * its out-of-line parts rather than copying them.
+ */
+static int
+insert_into_table(struct hash_table *table, uint64_t hash, const void *key,
+		  size_t key_len, const void *value, size_t value_len,
+		  uint32_t expires, int *is_new, size_t *old_value_len,
+		  uint32_t *old_expires, struct upsert_op *op,
+		  struct hash_bucket *from)
+{
+	uint64_t bucket_count = table->bucket_count;
+	uint64_t mask = table->mask;
+	uint8_t tag = ctrl_tag(hash);
+	struct hash_bucket *target;
+	uint64_t target_idx;
+	uint64_t pos;
+	int64_t tombstone_idx;
+	int state;
+	int rc;
+
+	if (table->probe_mode == HASH_PROBE_ROBIN_HOOD)
+		return rh_insert(table, hash, key, key_len, value, value_len,
+				 expires, is_new, old_value_len, old_expires,
+				 op, from);
+
+retry:
+	pos = home_index(hash, mask);
+	tombstone_idx = -1;
+
+	for (uint64_t probed = 0; probed < bucket_count;
+	     probed += GROUP_WIDTH) {
+		const uint8_t *group = &table->ctrl[pos];
+		group_mask_t empty = group_match_empty(group);
+		group_mask_t below = group_mask_below_first(empty);
+		group_mask_t match = group_match_tag(group, tag) & below;
+
+		while (match) {
+			uint64_t idx = (pos + group_mask_next(&match)) & mask;
+			struct hash_bucket *bucket = table_bucket(table, idx);
+
+			if (bucket_hash(bucket) != hash)
+				continue;
+
+			stripe_lock(table, idx);
+			if (atomic_load(&bucket->state) == BUCKET_OCCUPIED
+			    && bucket_hash(bucket) == hash
+			    && keys_equal(bucket_key(bucket), bucket->key_len,
+					  key, key_len)) {
+				size_t prev_len = bucket->value_len;
+				uint32_t prev_expires = bucket->expires;
+
+				if (op) {
+					rc = upsert_apply(op, bucket, &value,
+							  &value_len,
+							  &expires);
+					if (rc != 0) {
+						stripe_unlock(table, idx);
+						return rc;
+					}
+				}
+				rc = bucket_replace_value_unlocked(
+				    bucket, value, value_len, expires);
+				stripe_unlock(table, idx);
+				if (rc != 0)
+					return rc;
+				if (old_value_len)
+					*old_value_len = prev_len;
+				if (old_expires)
+					*old_expires = prev_expires;
+				if (is_new)
+					*is_new = 0;
+				return 0;
+			}
+			stripe_unlock(table, idx);
+		}
+
+		if (tombstone_idx < 0) {
+			group_mask_t deleted
+			    = group_match_deleted(group) & below;
+			if (deleted)
+				tombstone_idx = (int64_t)(
+				    (pos + group_mask_first(deleted)) & mask);
+		}
+
+		if (empty) {
+			target_idx = (tombstone_idx >= 0)
+					 ? (uint64_t)tombstone_idx
+					 : (pos + group_mask_first(empty))
+					       & mask;
+			goto claim;
+		}
+		pos = (pos + GROUP_WIDTH) & mask;
+	}
+
+	if (tombstone_idx < 0)
+		return -ENOSPC;
+	target_idx = (uint64_t)tombstone_idx;
+
+claim:
+	target = table_bucket(table, target_idx);
+	stripe_lock(table, target_idx);
+	state = atomic_load(&target->state);
+	if (state != BUCKET_EMPTY && state != BUCKET_TOMBSTONE) {
+		/* Another insert took the slot first; probe again */
+		stripe_unlock(table, target_idx);
+		goto retry;
+	}
+	if (op) {
+		rc = upsert_apply(op, NULL, &value, &value_len, &expires);
+		/* In a draining table the key may have moved on, not be absent */
+		if (rc != 0 && atomic_load(&table->draining)) {
+			op->failed = 0;
+			rc = -EAGAIN;
+		}
+		if (rc != 0) {
+			stripe_unlock(table, target_idx);
+			return rc;
+		}
+	}
+	if (from)
+		rc = bucket_adopt_unlocked(target, from);
+	else
+		rc = bucket_store_unlocked(target, hash, key, key_len, value,
+					   value_len, expires);
+	if (rc == 0) {
+		table_ref_clear(table, target_idx);
+		table_set_ctrl(table, target_idx, tag);
+		if (state == BUCKET_EMPTY)
+			atomic_fetch_add_explicit(&table->used, 1,
+						  memory_order_relaxed);
+	}
+	/*
+	 * A new key may not land in a draining table: the migration sweep
+	 * may have passed this slot, and the key may already have been
+	 * moved to the new table. Checked after the store, so a sweep that
+	 * saw the slot empty is one this sees draining. A table only starts
+	 * draining once every entry of the one before it has moved in, so
+	 * an entry moving in now never meets one.
+	 */
+	if (rc == 0 && !from && atomic_load(&table->draining)) {
+		bucket_make_tombstone_unlocked(target);
+		table_set_ctrl(table, target_idx, CTRL_DELETED);
+		rc = -EAGAIN;
+	}
+	stripe_unlock(table, target_idx);
+	if (rc != 0)
+		return rc;
+
+	if (is_new)
+		*is_new = 1;
+	return 0;
+}
+
+/*
+ * A slot is held through its lock stripe, or through the table's write lock
+ * in Robin Hood mode where writers move entries between slots.
+ */
+static inline void
+lock_slot(struct hash_table *table, uint64_t idx)
+{
+	if (table->probe_mode == HASH_PROBE_ROBIN_HOOD)
+		futex_mutex_lock_class(&table->write_lock,
+				       FUTEX_CLASS_HASH_TABLE);
+	else
+		stripe_lock(table, idx);
+}
+
+static inline void
+unlock_slot(struct hash_table *table, uint64_t idx)
+{
+	if (table->probe_mode == HASH_PROBE_ROBIN_HOOD)
+		futex_mutex_unlock(&table->write_lock);
+	else
+		stripe_unlock(table, idx);
+}
+
+/* Empty a held, occupied slot */
+static void
+remove_slot_locked(struct hash_table *table, uint64_t idx)
+{
+	if (table->probe_mode == HASH_PROBE_ROBIN_HOOD) {
+		rh_remove_locked(table, idx);
+		return;
+	}
+	bucket_make_tombstone_unlocked(table_bucket(table, idx));
+	table_set_ctrl(table, idx, CTRL_DELETED);
+}
+
+/*
+ * Find key, or with key NULL an entry of hash that expired by now, and
+ * return its slot held with lock_slot(), or -ENOENT
+ */
+static int64_t
+lock_key_in_table(struct hash_table *table, uint64_t hash, const void *key,
+		  size_t key_len, uint32_t now)
+{
+	uint64_t bucket_count = table->bucket_count;
+	uint64_t mask = table->mask;
+	uint64_t pos = home_index(hash, mask);
+	uint8_t tag = ctrl_tag(hash);
+	int64_t idx;
+
+	if (table->probe_mode == HASH_PROBE_ROBIN_HOOD) {
+		futex_mutex_lock_class(&table->write_lock,
+				       FUTEX_CLASS_HASH_TABLE);
+		idx = rh_find_locked(table, hash, key, key_len, now);
+		if (idx < 0)
+			futex_mutex_unlock(&table->write_lock);
+		return idx;
+	}
+
+	for (uint64_t probed = 0; probed < bucket_count;
+	     probed += GROUP_WIDTH) {
+		const uint8_t *group = &table->ctrl[pos];
+		group_mask_t empty = group_match_empty(group);
+		group_mask_t match = group_match_tag(group, tag)
+				     & group_mask_below_first(empty);
+
+		while (match) {
+			uint64_t idx = (pos + group_mask_next(&match)) & mask;
+			struct hash_bucket *bucket = table_bucket(table, idx);
+
+			if (bucket_hash(bucket) != hash)
+				continue;
+
+			stripe_lock(table, idx);
+			if (atomic_load(&bucket->state) == BUCKET_OCCUPIED
+			    && bucket_hash(bucket) == hash
+			    && bucket_wanted(bucket, key, key_len, now))
+				return (int64_t)idx;
+			stripe_unlock(table, idx);
+		}
+		if (empty)
+			return -ENOENT;
+		pos = (pos + GROUP_WIDTH) & mask;
+	}
+	return -ENOENT;
+}
+
+/* Delete what lock_key_in_table() finds; *deleted_expires gets its expiry */
+static int
+delete_from_table(struct hash_table *table, uint64_t hash, const void *key,
+		  size_t key_len, uint32_t now, size_t *deleted_key_len,
+		  size_t *deleted_value_len, uint32_t *deleted_expires)
+{
+	struct hash_bucket *bucket;
+	int64_t idx;
+
+	idx = lock_key_in_table(table, hash, key, key_len, now);
+	if (idx < 0)
+		return idx;
+
+	bucket = table_bucket(table, idx);
+	*deleted_key_len = bucket->key_len;
+	*deleted_value_len = bucket->value_len;
+	*deleted_expires = bucket->expires;
+	remove_slot_locked(table, (uint64_t)idx);
+	unlock_slot(table, (uint64_t)idx);
+	return 0;
+}
+
+/*
+ * Move the locked, occupied old bucket idx into table, with value and
+ * expires replacing the stored ones unless value is NULL. The entry is in
+ * the new table before the old slot becomes a tombstone. Unchanged
+ * entries take their out-of-line parts along, so only parts still in a
+ * snapshot mapping are copied; on failure the entry stays in old.
+ */
+static int
+move_bucket_locked(struct hash_table *old, uint64_t idx,
+		   struct hash_table *table, const void *value,
+		   size_t value_len, uint32_t expires)
+{
+	struct hash_bucket *bucket = table_bucket(old, idx);
+	struct hash_bucket *from = NULL;
+	int rc;
+
+	if (!value) {
+		from = bucket;
+		value = bucket_value(bucket);
+		value_len = bucket->value_len;
+		expires = bucket->expires;
+	}
+	rc = insert_into_table(table, bucket_hash(bucket), bucket_key(bucket),
+			       bucket->key_len, value, value_len, expires,
+			       NULL, NULL, NULL, NULL, from);
+	if (rc != 0)
+		return rc;
+
+	remove_slot_locked(old, idx);
+	return 0;
+}
+
+/*
+ * Overwrite a key that still lives in the draining table, running op on it
+ * first if set
+ */
+static int
+move_from_old(struct hash_table *old, struct hash_table *table, uint64_t hash,
+	      const void *key, size_t key_len, const void *value,
+	      size_t value_len, uint32_t expires, size_t *moved_key_len,
+	      size_t *moved_value_len, uint32_t *moved_expires,
+	      struct upsert_op *op)
+{
+	struct hash_bucket *bucket;
+	int64_t idx;
+	int rc;
+
+	idx = lock_key_in_table(old, hash, key, key_len, 0);
+	if (idx < 0)
+		return idx;
+
+	bucket = table_bucket(old, idx);
+	if (op) {
+		rc = upsert_apply(op, bucket, &value, &value_len, &expires);
+		if (rc != 0) {
+			unlock_slot(old, (uint64_t)idx);
+			return rc;
+		}
+	}
+	if (moved_key_len)
+		*moved_key_len = bucket->key_len;
+	if (moved_value_len)
+		*moved_value_len = bucket->value_len;
+	if (moved_expires)
+		*moved_expires = bucket->expires;
+	rc = move_bucket_locked(old, (uint64_t)idx, table, value, value_len,
+				expires);
+	unlock_slot(old, (uint64_t)idx);
+	return rc;
+}
+
+/* Returns nonzero if the slot's entry could not move and is still in old */
+static int
+migrate_bucket(struct hash_shard *shard, struct hash_table *old,
+	       uint64_t idx)
+{
+	struct hash_bucket *old_bucket = table_bucket(old, idx);
+	int rc = 0;
+
+	/*
+	 * A Robin Hood delete that began before the table started draining
+	 * may still be shifting entries, so its slots are only read locked.
+	 */
+	if (old->probe_mode != HASH_PROBE_ROBIN_HOOD
+	    && bucket_state(old_bucket) != BUCKET_OCCUPIED)
+		return 0;
+
+	lock_slot(old, idx);
+	if (atomic_load(&old_bucket->state) == BUCKET_OCCUPIED)
+		rc = move_bucket_locked(old, idx, atomic_load(&shard->table),
+					NULL, 0, 0);
+	unlock_slot(old, idx);
+	return rc;
+}
+
+/*
+ * Claim and migrate the next chunk of up to count buckets of the shard's
+ * draining table. Returns 0 once nothing is left to claim.
+ *
+ * Slots whose entry failed to move are counted in migrate_failed, before
+ * migrated, so whoever completes migrated sees them and leaves the resize
+ * open. Once every slot is claimed, callers sweep the table again until
+ * one sweep moves everything.
+ */
+static int
+migrate_some_buckets(struct hash_engine *engine, struct hash_shard *shard,
+		     uint32_t count)
+{
+	struct hash_table *old;
+	uint64_t failed = 0;
+	uint64_t start;
+	uint64_t end;
+
+	/* Keep the common no-resize path free of shared writes */
+	old = atomic_load(&shard->old_table);
+	if (!old || count == 0)
+		return 0;
+	if (atomic_load_explicit(&old->migrate_index, memory_order_relaxed)
+	    >= old->bucket_count) {
+		if (atomic_load_explicit(&old->migrate_failed,
+					 memory_order_relaxed))
+			migrate_all(engine, shard, old);
+		return 0;
+	}
+
+	start = atomic_fetch_add(&old->migrate_index, count);
+	if (start >= old->bucket_count)
+		return 0;
+	end = start + count < old->bucket_count ? start + count
+						: old->bucket_count;
+
+	for (uint64_t idx = start; idx < end; idx++)
+		if (migrate_bucket(shard, old, idx) != 0)
+			failed++;
+	if (failed)
+		atomic_fetch_add(&old->migrate_failed, failed);
+	if (atomic_fetch_add(&old->migrated, end - start) + (end - start)
+		== old->bucket_count
+	    && !atomic_load(&old->migrate_failed))
+		finish_resize(engine, shard, old);
+	return end < old->bucket_count;
+}
+
+/* Only the caller that unpublishes old retires it */
+static void
+finish_resize(struct hash_engine *engine, struct hash_shard *shard,
+	      struct hash_table *old)
+{
+	if (!atomic_compare_exchange_strong(&shard->old_table, &old, NULL))
+		return;
+	epoch_retire(&old->epoch, table_destroy_rcu);
+	if (engine->resize_done)
+		engine->resize_done(engine->resize_done_arg,
+				    (uint32_t)(shard - engine->shards),
+				    atomic_load(&shard->table)->bucket_count);
+}
+
+/*
+ * Sweep every remaining bucket of old and finish the resize. Used when the
+ * new table fills up before the incremental sweep is done, for instance
+ * because a migrator holding a claimed slot was preempted, and to retry
+ * entries that failed to move. If one fails again the resize stays open
+ * and -ENOMEM is returned.
+ */
+static int
+migrate_all(struct hash_engine *engine, struct hash_shard *shard,
+	    struct hash_table *old)
+{
+	int rc = 0;
+
+	for (uint64_t idx = 0; idx < old->bucket_count; idx++)
+		if (migrate_bucket(shard, old, idx) != 0)
+			rc = -ENOMEM;
+	if (rc == 0)
+		finish_resize(engine, shard, old);
+	return rc;
+}
+
+static int
+shard_start_resize(struct hash_shard *shard, uint64_t new_bucket_count)
+{
+	struct hash_table *new_table;
+	struct hash_table *current;
+
+	futex_mutex_lock_class(&shard->resize_lock, FUTEX_CLASS_HASH_RESIZE);
+
+	if (atomic_load(&shard->old_table) != NULL) {
+		futex_mutex_unlock(&shard->resize_lock);
+		return 0;
+	}
+
+	if (new_bucket_count < MIN_BUCKET_COUNT
+	    || new_bucket_count > MAX_BUCKET_COUNT
+	    || (new_bucket_count & (new_bucket_count - 1)) != 0) {
+		futex_mutex_unlock(&shard->resize_lock);
+		return -EINVAL;
+	}
+
+	current = atomic_load(&shard->table);
+	if (new_bucket_count > current->bucket_count) {
+		if (!needs_grow(shard)) {
+			futex_mutex_unlock(&shard->resize_lock);
+			return 0;
+		}
+	} else if (new_bucket_count < current->bucket_count) {
+		if (!needs_shrink(shard)) {
+			futex_mutex_unlock(&shard->resize_lock);
+			return 0;
+		}
+	} else {
+		if (!needs_purge(shard)) {
+			futex_mutex_unlock(&shard->resize_lock);
+			return 0;
+		}
+	}
+
+	new_table = table_create(new_bucket_count, current->probe_mode,
+				 &shard->pages, shard->memory_limit != 0,
+				 shard->lock_stripes);
+	if (!new_table) {
+		futex_mutex_unlock(&shard->resize_lock);
+		return -ENOMEM;
+	}
+
+	/* Robin Hood writers check this under write_lock before moving */
+	atomic_store(&current->draining, 1);
+	atomic_store(&shard->old_table, current);
+	atomic_store(&shard->table, new_table);
+
+	futex_mutex_unlock(&shard->resize_lock);
+	return 0;
+}
+
+/* Wake the resize workers unless a wakeup is already on its way */
+static void
+resize_kick(struct hash_engine *engine)
+{
+	if (atomic_load_explicit(&engine->resize_pending, memory_order_relaxed)
+	    || atomic_exchange(&engine->resize_pending, 1))
+		return;
+	atomic_fetch_add(&engine->resize_seq, 1);
+	sys_futex(&engine->resize_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Do one chunk of resize work on a shard: migrate, or start the grow,
+ * shrink or purge that writers deferred. Returns nonzero if more work may remain.
+ */
+static int
+resize_step(struct hash_engine *engine, struct hash_shard *shard)
+{
+	uint64_t current;
+	int more;
+
+	epoch_enter();
+	if (atomic_load(&shard->old_table)) {
+		more = migrate_some_buckets(engine, shard, HASH_RESIZE_CHUNK);
+	} else {
+		current = atomic_load(&shard->table)->bucket_count;
+		if (needs_grow(shard) && current * 2 <= MAX_BUCKET_COUNT)
+			shard_start_resize(shard, current * 2);
+		else if (needs_shrink(shard))
+			shard_start_resize(shard, current / 2);
+		else if (needs_purge(shard))
+			shard_start_resize(shard, current);
+		more = atomic_load(&shard->old_table) != NULL;
+	}
+	epoch_exit();
+	return more;
+}
+
+static void *
+resize_worker(void *arg)
+{
+	struct hash_engine *engine = arg;
+	uint32_t seen;
+	int more;
+
+	for (;;) {
+		seen = atomic_load(&engine->resize_seq);
+		if (atomic_load(&engine->resize_stop))
+			break;
+		/* Kicks from here on bump resize_seq past seen */
+		atomic_store(&engine->resize_pending, 0);
+
+		do {
+			more = 0;
+			for (uint32_t i = 0; i < engine->shard_count; i++)
+				more |= resize_step(engine, &engine->shards[i]);
+		} while (more && !atomic_load(&engine->resize_stop));
+
+		/* Free drained tables now, not after many more retires */
+		epoch_synchronize();
+
+		sys_futex(&engine->resize_seq, FUTEX_WAIT, (int)seen, NULL,
+			  NULL, 0);
+	}
+	return NULL;
+}
+
+static void
+resize_workers_stop(struct hash_engine *engine, uint32_t count)
+{
+	atomic_store(&engine->resize_stop, 1);
+	atomic_fetch_add(&engine->resize_seq, 1);
+	sys_futex(&engine->resize_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	for (uint32_t i = 0; i < count; i++)
+		pthread_join(engine->resize_threads[i], NULL);
+	free(engine->resize_threads);
+	engine->resize_threads = NULL;
+	engine->resize_thread_count = 0;
+}
+
+static int
+resize_workers_start(struct hash_engine *engine, uint32_t count)
+{
+	uint32_t i;
+
+	engine->resize_threads = calloc(count, sizeof(pthread_t));
+	if (!engine->resize_threads)
+		return -ENOMEM;
+	for (i = 0; i < count; i++) {
+		if (pthread_create(&engine->resize_threads[i], NULL,
+				   resize_worker, engine)
+		    != 0) {
+			resize_workers_stop(engine, i);
+			return -EAGAIN;
+		}
+	}
+	engine->resize_thread_count = count;
+	return 0;
+}
+
+/*
+ * Operations snapshot the tables once. If a resize swapped them meanwhile,
+ * the migration sweep may already have passed the slot an operation used
+ * in the now-draining table, so the operation is repeated against the new
+ * snapshot; every step below is safe to repeat.
+ */
+static inline int
+tables_changed(struct hash_shard *shard, struct hash_table *table)
+{
+	return atomic_load(&shard->table) != table;
+}
+
+/*
+ * Hash a batch of keys; zero-length entries mark invalid keys and their
+ * hashes are left unset. SipHash engines hash several keys at once in SIMD
+ * lanes.
+ */
+static void
+engine_hash_batch(struct hash_engine *engine, const void *const *keys,
+		  const size_t *key_lens, size_t n, uint64_t *hashes)
+{
+	size_t i;
+
+	if (engine->hash_fn == siphash) {
+		siphash_batch(keys, key_lens, n, engine->hash_key_0,
+			      engine->hash_key_1, hashes);
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		if (key_lens[i])
+			hashes[i] = compute_hash(engine, keys[i], key_lens[i]);
+	}
+}
+
+/* Start pulling a key's home control group and bucket into the cache */
+static inline void
+engine_prefetch(struct hash_engine *engine, uint64_t hash, int for_write)
+{
+	struct hash_table *table = atomic_load_explicit(
+	    &engine_shard(engine, hash)->table, memory_order_acquire);
+	uint64_t idx = home_index(hash, table->mask);
+
+	if (for_write) {
+		__builtin_prefetch(&table->ctrl[idx], 1);
+		__builtin_prefetch(table_bucket(table, idx), 1);
+	} else {
+		__builtin_prefetch(&table->ctrl[idx], 0);
+		__builtin_prefetch(table_bucket(table, idx), 0);
+	}
+}
+
+static int
+shard_lookup(struct hash_shard *shard, uint64_t hash, const void *key,
+	     size_t key_len, uint32_t now, void *buf, size_t buf_len,
+	     const void **value, size_t *value_len)
+{
+	struct hash_table *table;
+	struct hash_table *old;
+	int rc;
+
+	do {
+		shard_tables(shard, &table, &old);
+		rc = -ENOENT;
+		if (old)
+			rc = lookup_in_table(old, hash, key, key_len, now, buf,
+					     buf_len, value, value_len);
+		if (rc != 0)
+			rc = lookup_in_table(table, hash, key, key_len, now,
+					     buf, buf_len, value, value_len);
+	} while (rc != 0 && tables_changed(shard, table));
+	return rc;
+}
+
+static int
+engine_lookup(struct hash_engine *engine, uint64_t hash, const void *key,
+	      size_t key_len, void *buf, size_t buf_len, const void **value,
+	      size_t *value_len)
+{
+	struct hash_shard *shard = engine_shard(engine, hash);
+	struct hash_counter *counter;
+	int rc;
+
+	migrate_some_buckets(engine, shard, engine->assist_budget);
+
+	rc = shard_lookup(shard, hash, key, key_len, engine_ttl_now(engine),
+			  buf, buf_len, value, value_len);
+	if (!shard->memory_limit)
+		return rc;
+
+	/* Misses count towards admission too: TinyLFU weighs demand */
+	if (shard->sketch)
+		freq_sketch_add(shard->sketch, hash);
+	counter = shard_stripe(shard);
+	if (rc == 0)
+		atomic_fetch_add_explicit(&counter->hits, 1,
+					  memory_order_relaxed);
+	else
+		atomic_fetch_add_explicit(&counter->misses, 1,
+					  memory_order_relaxed);
+	return rc;
+}
+
+int
+hash_get(struct hash_engine *engine, const void *key, size_t key_len,
+	 const void **value, size_t *value_len)
+{
+	int rc;
+
+	if (!engine || !key || key_len == 0)
+		return -EINVAL;
+
+	epoch_enter();
+	rc = engine_lookup(engine, compute_hash(engine, key, key_len), key,
+			   key_len, NULL, 0, value, value_len);
+	epoch_exit();
+	return rc;
+}
+
+int
+hash_multi_get(struct hash_engine *engine, size_t count,
+	       const void *const *keys, const size_t *key_lens,
+	       const void **values, size_t *value_lens, int *results)
+{
+	const void *batch_keys[HASH_MULTI_BATCH];
+	size_t batch_lens[HASH_MULTI_BATCH];
+	uint64_t hashes[HASH_MULTI_BATCH];
+	size_t base;
+	size_t n;
+	size_t i;
+
+	if (!engine || (count && (!keys || !key_lens || !values
+				  || !value_lens || !results)))
+		return -EINVAL;
+
+	epoch_enter();
+	for (base = 0; base < count; base += n) {
+		n = count - base < HASH_MULTI_BATCH ? count - base
+						    : HASH_MULTI_BATCH;
+		for (i = 0; i < n; i++) {
+			int valid = keys[base + i] && key_lens[base + i] != 0;
+
+			batch_keys[i] = valid ? keys[base + i] : "";
+			batch_lens[i] = valid ? key_lens[base + i] : 0;
+		}
+		engine_hash_batch(engine, batch_keys, batch_lens, n, hashes);
+		for (i = 0; i < n; i++) {
+			if (batch_lens[i])
+				engine_prefetch(engine, hashes[i], 0);
+		}
+		for (i = 0; i < n; i++) {
+			if (!batch_lens[i]) {
+				results[base + i] = -EINVAL;
+				continue;
+			}
+			results[base + i] = engine_lookup(
+			    engine, hashes[i], keys[base + i],
+			    key_lens[base + i], NULL, 0, &values[base + i],
+			    &value_lens[base + i]);
+		}
+	}
+	epoch_exit();
+	return 0;
+}
+
+int
+hash_get_copy(struct hash_engine *engine, const void *key, size_t key_len,
+	      void *buf, size_t buf_len, size_t *value_len)
+{
+	size_t len = 0;
+	int rc;
+
+	if (!engine || !key || key_len == 0 || (!buf && buf_len))
+		return -EINVAL;
+
+	epoch_enter();
+	rc = engine_lookup(engine, compute_hash(engine, key, key_len), key,
+			   key_len, buf, buf_len, NULL, &len);
+	epoch_exit();
+	if (rc != 0)
+		return rc;
+
+	if (value_len)
+		*value_len = len;
+	return len > buf_len ? -ENOSPC : 0;
+}
+
+/*
+ * One put attempt against a table snapshot, including its accounting.
+ * *counted_new is set once the key has been counted as a new item; a
+ * repeated attempt whose first copy was stranded in a retired table must
+ * not count it again. With op set the value put is whatever op's callback
+ * makes of the stored one. *prev_expires gets the expiry of the entry
+ * replaced, 0 for a new key.
+ */
+static int
+shard_put(struct hash_shard *shard, struct hash_table *table,
+	   struct hash_table *old, uint64_t hash, const void *key,
+	   size_t key_len, const void *value, size_t value_len,
+	   uint32_t expires, int *counted_new, struct upsert_op *op,
+	   uint32_t *prev_expires)
+{
+	int is_new = 0;
+	int existed_in_old = 0;
+	size_t old_tbl_key_len = 0;
+	size_t old_tbl_value_len = 0;
+	size_t new_tbl_old_value_len = 0;
+	int rc;
+
+	*prev_expires = 0;
+	if (old) {
+		rc = move_from_old(old, table, hash, key, key_len, value,
+				   value_len, expires, &old_tbl_key_len,
+				   &old_tbl_value_len, prev_expires, op);
+		if (rc == 0)
+			existed_in_old = 1;
+		else if (rc != -ENOENT || (op && op->failed))
+			return rc;
+	}
+
+	if (!existed_in_old) {
+		rc = insert_into_table(table, hash, key, key_len, value,
+				       value_len, expires, &is_new,
+				       &new_tbl_old_value_len, prev_expires,
+				       op, NULL);
+		if (rc != 0)
+			return rc;
+	}
+	if (op)
+		value_len = op->value_len;
+
+	if (is_new) {
+		if (*counted_new)
+			return 0;
+		*counted_new = 1;
+		shard_add_counts(shard, 1, (int64_t)(key_len + value_len));
+	} else if (existed_in_old) {
+		shard_add_counts(shard, 0,
+			    (int64_t)(key_len + value_len)
+				- (int64_t)(old_tbl_key_len
+					    + old_tbl_value_len));
+	} else if (value_len != new_tbl_old_value_len) {
+		shard_add_counts(shard, 0,
+			    (int64_t)value_len
+				- (int64_t)new_tbl_old_value_len);
+	}
+	return 0;
+}
+
+static inline int
+put_args_valid(const void *key, size_t key_len, const void *value,
+	       size_t value_len)
+{
+	return key && key_len != 0 && key_len <= BUCKET_MAX_LEN && value
+	       && value_len != 0 && value_len <= BUCKET_MAX_LEN;
+}
+
+/* Remove whatever entry the slot holds; returns the bytes freed, or 0 */
+static int64_t
+evict_slot(struct hash_shard *shard, struct hash_table *table, uint64_t idx)
+{
+	struct hash_bucket *bucket = table_bucket(table, idx);
+	int64_t freed;
+
+	lock_slot(table, idx);
+	if (!ctrl_is_full(table->ctrl[idx])
+	    || atomic_load(&bucket->state) != BUCKET_OCCUPIED) {
+		unlock_slot(table, idx);
+		return 0;
+	}
+	freed = (int64_t)(bucket->key_len + bucket->value_len);
+	remove_slot_locked(table, idx);
+	unlock_slot(table, idx);
+
+	shard_add_counts(shard, -1, -freed);
+	atomic_fetch_add_explicit(&shard_stripe(shard)->evictions, 1,
+				  memory_order_relaxed);
+	return freed;
+}
+
+/*
+ * CLOCK: sweep the hand over up to scan slots of table, giving each
+ * referenced entry another round and evicting unreferenced ones until
+ * excess bytes are gone. Concurrent writers take distinct slots off the
+ * hand, and what they free is only folded in later, so each counts down
+ * its own view of the excess. Returns what is left of it.
+ */
+static int64_t
+clock_sweep(struct hash_shard *shard, struct hash_table *table,
+	    int64_t excess, uint32_t scan)
+{
+	for (uint32_t scanned = 0; scanned < scan && excess > 0; scanned++) {
+		uint64_t idx = atomic_fetch_add_explicit(&shard->clock_hand, 1,
+							 memory_order_relaxed)
+			       & table->mask;
+
+		if (!ctrl_is_full(__atomic_load_n(&table->ctrl[idx],
+						  __ATOMIC_ACQUIRE)))
+			continue;
+		if (__atomic_load_n(&table->ref[idx], __ATOMIC_RELAXED)) {
+			table_ref_clear(table, idx);
+			continue;
+		}
+		excess -= evict_slot(shard, table, idx);
+	}
+	return excess;
+}
+
+/*
+ * During a resize the entries are split between the tables, so the hand
+ * sweeps the draining one first and moves on to its successor for what
+ * that could not free.
+ */
+static void
+shard_evict(struct hash_shard *shard, int64_t excess)
+{
+	struct hash_table *table;
+	struct hash_table *old;
+
+	shard_tables(shard, &table, &old);
+	if (old)
+		excess = clock_sweep(shard, old, excess, HASH_EVICT_SCAN);
+	clock_sweep(shard, table, excess, HASH_EVICT_SCAN);
+}
+
+/* Where the hand would next evict in table; returns 0 if nowhere in reach */
+static int
+clock_peek(struct hash_table *table, uint64_t hand, uint64_t *victim)
+{
+	for (uint32_t i = 0; i < HASH_EVICT_SCAN; i++) {
+		uint64_t idx = (hand + i) & table->mask;
+
+		if (!ctrl_is_full(__atomic_load_n(&table->ctrl[idx],
+						  __ATOMIC_ACQUIRE))
+		    || __atomic_load_n(&table->ref[idx], __ATOMIC_RELAXED))
+			continue;
+		*victim = bucket_hash(table_bucket(table, idx));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * TinyLFU admission: a new key may only replace the entry the CLOCK hand
+ * would evict next if it has been asked for more often lately. The hand
+ * is only peeked at, not moved. A key that is already present is an update
+ * and always goes in, but that costs a lookup, so it is only checked once
+ * the key has lost on frequency.
+ */
+static int
+shard_admit(struct hash_engine *engine, struct hash_shard *shard,
+	    uint64_t hash, const void *key, size_t key_len)
+{
+	uint64_t hand = atomic_load_explicit(&shard->clock_hand,
+					     memory_order_relaxed);
+	struct hash_table *table;
+	struct hash_table *old;
+	uint64_t victim;
+
+	shard_tables(shard, &table, &old);
+	if (!(old && clock_peek(old, hand, &victim))
+	    && !clock_peek(table, hand, &victim))
+		/* Every entry in reach is referenced; nothing to compare */
+		return 1;
+	if (freq_sketch_estimate(shard->sketch, hash)
+	    > freq_sketch_estimate(shard->sketch, victim))
+		return 1;
+	return shard_lookup(shard, hash, key, key_len, engine_ttl_now(engine),
+			    NULL, 0, NULL, NULL)
+	       == 0;
+}
+
+/*
+ * Put with a precomputed hash, or with op set the read-modify-write of
+ * hash_upsert(); the caller is inside an epoch section. If prev_expires is
+ * set it gets the expiry of the entry the put replaced, 0 for a new key.
+ */
+static int
+engine_put(struct hash_engine *engine, uint64_t hash, const void *key,
+	   size_t key_len, const void *value, size_t value_len,
+	   uint32_t expires, struct upsert_op *op, uint32_t *prev_expires)
+{
+	struct hash_shard *shard = engine_shard(engine, hash);
+	struct hash_table *table;
+	struct hash_table *old;
+	uint32_t replaced_expires;
+	int counted_new = 0;
+	int stored = 0;
+	int64_t excess;
+	int rc;
+
+	migrate_some_buckets(engine, shard, engine->assist_budget);
+
+	if (shard->sketch) {
+		freq_sketch_add(shard->sketch, hash);
+		/* Only a put that takes the shard over the limit competes */
+		if (!op
+		    && shard_memory_excess(shard)
+				   + (int64_t)(key_len + value_len)
+			   > 0
+		    && !shard_admit(engine, shard, hash, key, key_len)) {
+			atomic_fetch_add_explicit(
+			    &shard_stripe(shard)->rejections, 1,
+			    memory_order_relaxed);
+			return 0;
+		}
+	}
+
+	if (needs_grow(shard)) {
+		uint64_t current = atomic_load(&shard->table)->bucket_count;
+		uint64_t new_size = current * 2;
+
+		if (engine->resize_thread_count > 0 && !needs_grow_now(shard)) {
+			resize_kick(engine);
+		} else {
+			old = atomic_load(&shard->old_table);
+			if (old)
+				migrate_all(engine, shard, old);
+			if (new_size <= MAX_BUCKET_COUNT)
+				shard_start_resize(shard, new_size);
+		}
+	} else if (needs_purge(shard)) {
+		if (engine->resize_thread_count > 0) {
+			resize_kick(engine);
+		} else {
+			old = atomic_load(&shard->old_table);
+			if (old)
+				migrate_all(engine, shard, old);
+			shard_start_resize(
+			    shard, atomic_load(&shard->table)->bucket_count);
+		}
+	}
+
+	do {
+		shard_tables(shard, &table, &old);
+		rc = shard_put(shard, table, old, hash, key, key_len, value,
+				value_len, expires, &counted_new, op,
+				&replaced_expires);
+		if (op && op->failed)
+			break;
+		/* A repeat may only find what the first attempt stored */
+		if (rc == 0 && !stored) {
+			stored = 1;
+			if (prev_expires)
+				*prev_expires = replaced_expires;
+		}
+		/* A table that started draining refused a new key */
+		if (rc == -EAGAIN)
+			CPU_RELAX();
+		/*
+		 * A read-modify-write that went in must not be applied twice.
+		 * It needs no repeat anyway: a table only refuses new keys
+		 * once draining, and the sweep carries updates along.
+		 */
+	} while (rc == -EAGAIN
+		 || (rc == 0 && !op && tables_changed(shard, table)));
+
+	if (shard->memory_limit && rc == 0) {
+		excess = shard_memory_excess(shard);
+		if (excess > 0)
+			shard_evict(shard, excess);
+	}
+
+	/* Writers reclaim a few expired entries, as they assist resizes */
+	if (atomic_load_explicit(&shard->timers, memory_order_relaxed)) {
+		uint32_t now = engine_now(engine);
+		uint32_t budget = HASH_EXPIRE_ASSIST;
+
+		if (shard_timers_due(shard, now))
+			shard_expire(engine, shard, now, &budget, 0);
+	}
+	return rc;
+}
+
+int
+hash_put(struct hash_engine *engine, const void *key, size_t key_len,
+	 const void *value, size_t value_len)
+{
+	int rc;
+
+	if (!engine || !put_args_valid(key, key_len, value, value_len))
+		return -EINVAL;
+
+	epoch_enter();
+	rc = engine_put(engine, compute_hash(engine, key, key_len), key,
+			key_len, value, value_len, 0, NULL, NULL);
+	epoch_exit();
+	return rc;
+}
+
+int
+hash_multi_put(struct hash_engine *engine, size_t count,
+	       const void *const *keys, const size_t *key_lens,
+	       const void *const *values, const size_t *value_lens,
+	       int *results)
+{
+	const void *batch_keys[HASH_MULTI_BATCH];
+	size_t batch_lens[HASH_MULTI_BATCH];
+	uint64_t hashes[HASH_MULTI_BATCH];
+	size_t base;
+	size_t n;
+	size_t i;
+
+	if (!engine || (count && (!keys || !key_lens || !values
+				  || !value_lens || !results)))
+		return -EINVAL;
+
+	epoch_enter();
+	for (base = 0; base < count; base += n) {
+		n = count - base < HASH_MULTI_BATCH ? count - base
+						    : HASH_MULTI_BATCH;
+		for (i = 0; i < n; i++) {
+			int valid = put_args_valid(
+			    keys[base + i], key_lens[base + i],
+			    values[base + i], value_lens[base + i]);
+
+			batch_keys[i] = valid ? keys[base + i] : "";
+			batch_lens[i] = valid ? key_lens[base + i] : 0;
+		}
+		engine_hash_batch(engine, batch_keys, batch_lens, n, hashes);
+		for (i = 0; i < n; i++) {
+			if (batch_lens[i])
+				engine_prefetch(engine, hashes[i], 1);
+		}
+		for (i = 0; i < n; i++) {
+			if (!batch_lens[i]) {
+				results[base + i] = -EINVAL;
+				continue;
+			}
+			results[base + i]
+			    = engine_put(engine, hashes[i], keys[base + i],
+					 key_lens[base + i], values[base + i],
+					 value_lens[base + i], 0, NULL, NULL);
+		}
+	}
+	epoch_exit();
+	return 0;
+}
+
+/*
+ * One delete attempt against a table snapshot, including its accounting.
+ * key NULL deletes an entry of hash that expired by now instead. Returns 1
+ * if the entry removed had expired by now, 0 if it had not, or -ENOENT.
+ */
+static int
+shard_delete(struct hash_shard *shard, struct hash_table *table,
+	      struct hash_table *old, uint64_t hash, const void *key,
+	      size_t key_len, uint32_t now)
+{
+	size_t del_key_len = 0;
+	size_t del_value_len = 0;
+	uint32_t del_expires = 0;
+	size_t old_del_key_len = 0;
+	size_t old_del_value_len = 0;
+	uint32_t old_del_expires = 0;
+	int deleted_from_old = 0;
+	int deleted_from_new = 0;
+
+	if (old) {
+		if (delete_from_table(old, hash, key, key_len, now,
+				      &old_del_key_len, &old_del_value_len,
+				      &old_del_expires)
+		    == 0)
+			deleted_from_old = 1;
+	}
+
+	if (delete_from_table(table, hash, key, key_len, now, &del_key_len,
+			      &del_value_len, &del_expires)
+	    == 0)
+		deleted_from_new = 1;
+
+	if (!deleted_from_new && !deleted_from_old)
+		return -ENOENT;
+
+	if (deleted_from_new) {
+		shard_add_counts(shard, -1,
+			    -(int64_t)(del_key_len + del_value_len));
+		return expired_by(del_expires, now);
+	}
+	shard_add_counts(shard, -1,
+		    -(int64_t)(old_del_key_len + old_del_value_len));
+	return expired_by(old_del_expires, now);
+}
+
+/* Start a shrink after deletes, or leave it to the resize workers */
+static void
+shard_maybe_shrink(struct hash_engine *engine, struct hash_shard *shard)
+{
+	uint64_t current;
+
+	if (!needs_shrink(shard))
+		return;
+	current = atomic_load(&shard->table)->bucket_count;
+	if (engine->resize_thread_count > 0)
+		resize_kick(engine);
+	else if (current / 2 >= MIN_BUCKET_COUNT)
+		shard_start_resize(shard, current / 2);
+}
+
+int
+hash_delete(struct hash_engine *engine, const void *key, size_t key_len)
+{
+	struct hash_shard *shard;
+	struct hash_table *table;
+	struct hash_table *old;
+	uint64_t hash;
+	uint32_t now;
+	int deleted = 0;
+	int live = 0;
+	int rc;
+
+	if (!engine || !key || key_len == 0)
+		return -EINVAL;
+
+	hash = compute_hash(engine, key, key_len);
+	shard = engine_shard(engine, hash);
+	now = engine_ttl_now(engine);
+
+	epoch_enter();
+	migrate_some_buckets(engine, shard, engine->assist_budget);
+
+	do {
+		shard_tables(shard, &table, &old);
+		rc = shard_delete(shard, table, old, hash, key, key_len, now);
+		if (rc >= 0)
+			deleted = 1;
+		if (rc == 0)
+			live = 1;
+	} while (tables_changed(shard, table));
+
+	if (deleted)
+		shard_maybe_shrink(engine, shard);
+
+	epoch_exit();
+	/* An expired entry is removed all the same, but was already gone */
+	return live ? 0 : -ENOENT;
+}
+
+/* Publish the wheel's count and clock; the caller holds wheel_lock */
+static void
+shard_wheel_sync(struct hash_shard *shard)
+{
+	atomic_store_explicit(&shard->timers, shard->wheel->count,
+			      memory_order_relaxed);
+	atomic_store_explicit(&shard->expire_next, shard->wheel->clock,
+			      memory_order_relaxed);
+}
+
+static int
+shard_add_timer(struct hash_shard *shard, uint64_t hash, uint32_t expires)
+{
+	int rc;
+
+	futex_mutex_lock_class(&shard->wheel_lock, FUTEX_CLASS_HASH_WHEEL);
+	rc = ttl_wheel_add(shard->wheel, hash, expires);
+	shard_wheel_sync(shard);
+	futex_mutex_unlock(&shard->wheel_lock);
+	return rc;
+}
+
+/* Earliest expiry among table's entries of hash, or 0 if none has one */
+static uint32_t
+table_next_expiry(struct hash_table *table, uint64_t hash)
+{
+	uint64_t mask = table->mask;
+	uint64_t pos = home_index(hash, mask);
+	uint8_t tag = ctrl_tag(hash);
+	uint32_t next = 0;
+
+	if (table->probe_mode == HASH_PROBE_ROBIN_HOOD) {
+		futex_mutex_lock_class(&table->write_lock,
+				       FUTEX_CLASS_HASH_TABLE);
+		for (uint64_t dist = 0; dist < table->bucket_count;
+		     dist++, pos = (pos + 1) & mask) {
+			struct hash_bucket *bucket = table_bucket(table, pos);
+			uint64_t found;
+
+			if (table->ctrl[pos] == CTRL_EMPTY)
+				break;
+			if (table->ctrl[pos] == CTRL_DELETED)
+				continue;
+			found = bucket_hash(bucket);
+			if (rh_distance(table, pos, found) < dist)
+				break;
+			if (found == hash && bucket->expires
+			    && (!next || bucket->expires < next))
+				next = bucket->expires;
+		}
+		futex_mutex_unlock(&table->write_lock);
+		return next;
+	}
+
+	for (uint64_t probed = 0; probed < table->bucket_count;
+	     probed += GROUP_WIDTH) {
+		const uint8_t *group = &table->ctrl[pos];
+		group_mask_t empty = group_match_empty(group);
+		group_mask_t match = group_match_tag(group, tag)
+				     & group_mask_below_first(empty);
+
+		while (match) {
+			uint64_t idx = (pos + group_mask_next(&match)) & mask;
+			struct hash_bucket *bucket = table_bucket(table, idx);
+
+			if (bucket_hash(bucket) != hash)
+				continue;
+			stripe_lock(table, idx);
+			if (atomic_load(&bucket->state) == BUCKET_OCCUPIED
+			    && bucket_hash(bucket) == hash && bucket->expires
+			    && (!next || bucket->expires < next))
+				next = bucket->expires;
+			stripe_unlock(table, idx);
+		}
+		if (empty)
+			break;
+		pos = (pos + GROUP_WIDTH) & mask;
+	}
+	return next;
+}
+
+/*
+ * Remove whichever entries of hash expired by now; returns how many. A
+ * timer may fire before the entry it was set for expires, once a refresh
+ * pushed the expiry out without adding another (see hash_put_ttl()), so
+ * the entries left get a timer for the earliest of their expiries.
+ */
+static uint64_t
+shard_expire_hash(struct hash_shard *shard, uint64_t hash, uint32_t now)
+{
+	struct hash_table *table;
+	struct hash_table *old;
+	uint64_t removed = 0;
+	uint32_t next;
+	uint32_t e;
+
+	do {
+		shard_tables(shard, &table, &old);
+		while (shard_delete(shard, table, old, hash, NULL, 0, now) > 0)
+			removed++;
+		/* Old first: a migration moves entries on, never back */
+		next = old ? table_next_expiry(old, hash) : 0;
+		e = table_next_expiry(table, hash);
+		if (e && (!next || e < next))
+			next = e;
+	} while (tables_changed(shard, table));
+	if (next)
+		shard_add_timer(shard, hash, next);
+	return removed;
+}
+
+/*
+ * Fire up to *budget of the shard's timers due by now, taking the ones
+ * fired off *budget, and remove the entries they name if those are still
+ * expired; a key given a later expiry since has a timer of its own.
+ * Without wait, gives up rather than queue behind another thread firing
+ * timers. The caller is inside an epoch section. Returns the number of
+ * entries removed.
+ */
+static uint64_t
+shard_expire(struct hash_engine *engine, struct hash_shard *shard,
+	     uint32_t now, uint32_t *budget, int wait)
+{
+	struct ttl_timer timers[HASH_EXPIRE_BATCH];
+	uint64_t removed = 0;
+	size_t n;
+
+	while (*budget > 0) {
+		if (wait)
+			futex_mutex_lock_class(&shard->wheel_lock,
+					       FUTEX_CLASS_HASH_WHEEL);
+		else if (futex_mutex_trylock_class(&shard->wheel_lock,
+						   FUTEX_CLASS_HASH_WHEEL) != 0)
+			break;
+		n = ttl_wheel_expire(shard->wheel, now, timers,
+				     *budget < HASH_EXPIRE_BATCH
+					 ? *budget
+					 : HASH_EXPIRE_BATCH);
+		shard_wheel_sync(shard);
+		futex_mutex_unlock(&shard->wheel_lock);
+		if (n == 0)
+			break;
+
+		for (size_t i = 0; i < n; i++)
+			removed += shard_expire_hash(shard, timers[i].hash,
+						     now);
+		*budget -= (uint32_t)n;
+	}
+	if (removed)
+		shard_maybe_shrink(engine, shard);
+	return removed;
+}
+
+/* Whether any of the shard's timers may be due, judged without the lock */
+static inline int
+shard_timers_due(struct hash_shard *shard, uint32_t now)
+{
+	return atomic_load_explicit(&shard->timers, memory_order_relaxed)
+	       && atomic_load_explicit(&shard->expire_next,
+				       memory_order_relaxed)
+		      <= now;
+}
+
+int
+hash_put_ttl(struct hash_engine *engine, const void *key, size_t key_len,
+	     const void *value, size_t value_len, uint32_t ttl)
+{
+	uint32_t prev_expires = 0;
+	uint32_t expires = 0;
+	uint32_t now;
+	uint64_t hash;
+	int rc;
+
+	if (!engine || !put_args_valid(key, key_len, value, value_len))
+		return -EINVAL;
+
+	hash = compute_hash(engine, key, key_len);
+	if (ttl) {
+		now = engine_now(engine);
+		/* Saturate rather than wrap into the past or into "never" */
+		expires = ttl > UINT32_MAX - now ? UINT32_MAX : now + ttl;
+		if (!atomic_load_explicit(&engine->ttl_used,
+					  memory_order_relaxed))
+			atomic_store(&engine->ttl_used, 1);
+	}
+
+	epoch_enter();
+	rc = engine_put(engine, hash, key, key_len, value, value_len, expires,
+			NULL, &prev_expires);
+	epoch_exit();
+
+	/*
+	 * Only once the entry is in, or the timer could fire before it is.
+	 * An entry with an expiry always has a timer at or before it, and
+	 * one firing early sets another for the entry's expiry then, so a
+	 * refresh that only pushes the expiry out needs none. Without its
+	 * timer the entry still expires lazily, so the put stands.
+	 */
+	if (rc == 0 && expires && !(prev_expires && prev_expires <= expires))
+		shard_add_timer(engine_shard(engine, hash), hash, expires);
+	return rc;
+}
+
+int
+hash_upsert(struct hash_engine *engine, const void *key, size_t key_len,
+	    hash_upsert_fn fn, void *ctx)
+{
+	struct upsert_op op = { .fn = fn, .ctx = ctx };
 	int rc;
 
-	if (!engine || !key || key_len == 0 || !value || value_len == 0)
+	if (!engine || !key || key_len == 0 || key_len > BUCKET_MAX_LEN || !fn)
+		return -EINVAL;
+
+	epoch_enter();
+	op.now = engine_ttl_now(engine);
+	rc = engine_put(engine, compute_hash(engine, key, key_len), key,
+			key_len, NULL, 0, 0, &op, NULL);
+	epoch_exit();
+	return rc;
+}
+
+struct cas_ctx {
+	const void *expected;
+	size_t expected_len;
+	const void *value;
+	size_t value_len;
+};
+
+static int
+cas_apply(void *arg, const void *value, size_t value_len,
+	  const void **new_value, size_t *new_len)
+{
+	struct cas_ctx *cas = arg;
+
+	if (!value && cas->expected)
+		return -ENOENT;
+	if (value && !cas->expected)
+		return -EEXIST;
+	if (value
+	    && (value_len != cas->expected_len
+		|| memcmp(value, cas->expected, value_len) != 0))
+		return -ECANCELED;
+	*new_value = cas->value;
+	*new_len = cas->value_len;
+	return 0;
+}
+
+int
+hash_cas(struct hash_engine *engine, const void *key, size_t key_len,
+	 const void *expected, size_t expected_len, const void *value,
+	 size_t value_len)
+{
+	struct cas_ctx cas = {
+		.expected = expected,
+		.expected_len = expected_len,
+		.value = value,
+		.value_len = value_len,
+	};
+
+	if (!put_args_valid(key, key_len, value, value_len)
+	    || (expected && expected_len == 0))
 		return -EINVAL;
+	return hash_upsert(engine, key, key_len, cas_apply, &cas);
+}
 
-	migrate_some_buckets(engine, MIGRATE_BATCH_SIZE);
+struct incr_ctx {
+	int64_t delta;
+	int64_t result;
+};
 
-	if (needs_grow(engine)) {
-		uint32_t current = atomic_load(&engine->bucket_count);
-		uint32_t new_size = current * 2;
-		if (new_size <= MAX_BUCKET_COUNT)
-			hash_engine_start_resize(engine, new_size);
-	}
+static int
+incr_apply(void *arg, const void *value, size_t value_len,
+	   const void **new_value, size_t *new_len)
+{
+	struct incr_ctx *incr = arg;
+	int64_t count = 0;
 
-	old = atomic_load(&engine->old_buckets);
-	if (old) {
-		uint32_t old_count = atomic_load(&engine->old_bucket_count);
-		if (delete_from_table(old, old_count, key, key_len,
-				      &old_tbl_key_len, &old_tbl_value_len)
-		    == 0)
-			existed_in_old = 1;
+	if (value) {
+		if (value_len != sizeof(count))
+			return -EINVAL;
+		memcpy(&count, value, sizeof(count));
 	}
+	if (__builtin_add_overflow(count, incr->delta, &incr->result))
+		return -ERANGE;
+	*new_value = &incr->result;
+	*new_len = sizeof(incr->result);
+	return 0;
+}
 
-	buckets = atomic_load(&engine->hash_buckets);
-	bucket_count = atomic_load(&engine->bucket_count);
+int
+hash_incr(struct hash_engine *engine, const void *key, size_t key_len,
+	  int64_t delta, int64_t *result)
+{
+	struct incr_ctx incr = { .delta = delta };
+	int rc;
 
-	rc = insert_into_table(buckets, bucket_count, key, key_len, value,
-			       value_len, &is_new, &new_tbl_old_value_len);
-	if (rc != 0)
-		return rc;
+	rc = hash_upsert(engine, key, key_len, incr_apply, &incr);
+	if (rc == 0 && result)
+		*result = incr.result;
+	return rc;
+}
 
-	if (is_new && !existed_in_old) {
-		atomic_fetch_add(&engine->item_count, 1);
-		atomic_fetch_add(&engine->total_memory,
-				 (uint32_t)(key_len + value_len));
-	} else if (existed_in_old) {
-		atomic_fetch_sub(
-		    &engine->total_memory,
-		    (uint32_t)(old_tbl_key_len + old_tbl_value_len));
-		atomic_fetch_add(&engine->total_memory,
-				 (uint32_t)(key_len + value_len));
-	} else {
-		if (value_len > new_tbl_old_value_len)
-			atomic_fetch_add(
-			    &engine->total_memory,
-			    (uint32_t)(value_len - new_tbl_old_value_len));
-		else if (new_tbl_old_value_len > value_len)
-			atomic_fetch_sub(
-			    &engine->total_memory,
-			    (uint32_t)(new_tbl_old_value_len - value_len));
+int
+hash_expire(struct hash_engine *engine, uint32_t budget, uint64_t *expired)
+{
+	uint64_t removed = 0;
+	uint32_t start;
+	uint32_t now;
+
+	if (!engine || !engine->shards)
+		return -EINVAL;
+	if (budget == 0)
+		budget = UINT32_MAX;
+
+	now = engine_now(engine);
+	start = atomic_fetch_add_explicit(&engine->expire_shard, 1,
+					  memory_order_relaxed);
+	epoch_enter();
+	for (uint32_t i = 0; i < engine->shard_count && budget > 0; i++) {
+		struct hash_shard *shard
+		    = &engine->shards[(start + i) & (engine->shard_count - 1)];
+
+		removed += shard_expire(engine, shard, now, &budget, 1);
 	}
+	epoch_exit();
 
+	if (expired)
+		*expired = removed;
 	return 0;
 }
 
-int
-hash_delete(struct hash_engine *engine, const void *key, size_t key_len)
+/*
+ * Scan cursors keep a shard index above SCAN_SHARD_SHIFT and a home slot
+ * below it. Home slots are walked in reversed-bit order, as Redis SCAN
+ * does: the reversed cursor is incremented under the table mask, so the
+ * slots already visited at one table size are exactly the ones that map
+ * onto visited slots at any other size, and a resize between calls cannot
+ * make the scan skip a slot.
+ */
+#define SCAN_SHARD_SHIFT 32
+#define SCAN_SLOT_MASK 0xffffffffULL
+
+/* A bucket's contents, copied out under its sequence counter */
+struct scan_entry {
+	uint32_t flags;
+	uint32_t key_len;
+	uint32_t value_len;
+	unsigned char data[BUCKET_INLINE_SIZE];
+};
+
+static inline uint32_t
+rev32(uint32_t v)
 {
-	struct hash_bucket *buckets;
-	struct hash_bucket *old;
-	uint32_t bucket_count;
-	size_t del_key_len = 0;
-	size_t del_value_len = 0;
-	size_t old_del_key_len = 0;
-	size_t old_del_value_len = 0;
+	v = ((v >> 1) & 0x55555555U) | ((v & 0x55555555U) << 1);
+	v = ((v >> 2) & 0x33333333U) | ((v & 0x33333333U) << 2);
+	v = ((v >> 4) & 0x0f0f0f0fU) | ((v & 0x0f0f0f0fU) << 4);
+	return __builtin_bswap32(v);
+}
+
+/* Next home slot after slot in a table of mask; 0 once all are visited */
+static inline uint64_t
+scan_next_slot(uint64_t slot, uint64_t mask)
+{
+	return rev32(rev32((uint32_t)(slot | ~mask)) + 1);
+}
+
+/*
+ * Copy an occupied bucket whose home is home; returns 0 if it is not, or
+ * if it expired by now
+ */
+static int
+scan_read_bucket(struct hash_bucket *bucket, uint64_t mask, uint64_t home,
+		 uint32_t now, struct scan_entry *entry)
+{
+	uint32_t seq;
 	int rc;
-	int deleted_from_old = 0;
-	int deleted_from_new = 0;
 
-	if (!engine || !key || key_len == 0)
+	do {
+		seq = bucket_read_begin(bucket);
+		rc = 0;
+		if (atomic_load_explicit(&bucket->state, memory_order_relaxed)
+			!= BUCKET_OCCUPIED
+		    || home_index(bucket_hash(bucket), mask) != home
+		    || expired_by(bucket->expires, now))
+			continue;
+		entry->flags = bucket->flags;
+		entry->key_len = bucket->key_len;
+		entry->value_len = bucket->value_len;
+		memcpy(entry->data, bucket->data, sizeof(entry->data));
+		rc = 1;
+	} while (bucket_read_retry(bucket, seq));
+	return rc;
+}
+
+/* Out-of-line parts are immutable and epoch-protected, like in hash_get() */
+static int
+scan_emit(const struct scan_entry *entry, hash_scan_fn fn, void *arg)
+{
+	size_t offset = (entry->flags & BUCKET_F_KEY_EXT) ? sizeof(void *)
+							  : entry->key_len;
+	const void *key = entry->data;
+	const void *value = entry->data + offset;
+
+	if (entry->flags & BUCKET_F_KEY_EXT)
+		memcpy(&key, entry->data, sizeof(key));
+	if (entry->flags & BUCKET_F_VALUE_EXT)
+		memcpy(&value, entry->data + offset, sizeof(value));
+	return fn(arg, key, entry->key_len, value, entry->value_len);
+}
+
+/*
+ * Report the entries whose home slot is home. Probing is linear in both
+ * modes, so they all sit between home and the next empty slot. A walk
+ * that raced Robin Hood writers shifting entries is repeated, which may
+ * report an entry twice but cannot miss one.
+ */
+static int
+scan_home(struct hash_table *table, uint64_t home, uint32_t now,
+	  hash_scan_fn fn, void *arg)
+{
+	int robin_hood = table->probe_mode == HASH_PROBE_ROBIN_HOOD;
+	struct scan_entry entry;
+	uint32_t seq = 0;
+	int rc;
+
+	do {
+		uint64_t pos = home;
+
+		if (robin_hood)
+			seq = table_read_begin(table);
+		for (uint64_t n = 0; n < table->bucket_count;
+		     n++, pos = (pos + 1) & table->mask) {
+			struct hash_bucket *bucket = table_bucket(table, pos);
+			uint8_t ctrl = __atomic_load_n(&table->ctrl[pos],
+						       __ATOMIC_ACQUIRE);
+
+			if (ctrl == CTRL_EMPTY)
+				break;
+			if (!ctrl_is_full(ctrl)
+			    || home_index(bucket_hash(bucket), table->mask)
+				   != home
+			    || !scan_read_bucket(bucket, table->mask, home,
+						 now, &entry))
+				continue;
+			rc = scan_emit(&entry, fn, arg);
+			if (rc != 0)
+				return rc;
+		}
+	} while (robin_hood && table_read_retry(table, seq));
+	return 0;
+}
+
+/*
+ * Visit cursor slot in table, whose mask may be larger than the mask of
+ * the smaller of the shard's tables: slot then stands for every home slot
+ * that agrees with it in the bits of mask.
+ */
+static int
+scan_slots(struct hash_table *table, uint64_t slot, uint64_t mask,
+	   uint32_t now, hash_scan_fn fn, void *arg)
+{
+	uint64_t extra = mask ^ table->mask;
+	int rc;
+
+	do {
+		rc = scan_home(table, slot & table->mask, now, fn, arg);
+		if (rc != 0)
+			return rc;
+		slot = (((slot | mask) + 1) & ~mask) | (slot & mask);
+	} while (slot & extra);
+	return 0;
+}
+
+/*
+ * One cursor step in a shard. Entries only move from the draining table
+ * into the current one, and are inserted there first, so visiting the
+ * draining table first finds every entry that stays put. A resize that
+ * starts mid-step may move entries behind the walk, so the step is then
+ * repeated. *mask gets the smaller table mask, which the cursor advances
+ * under.
+ */
+static int
+scan_shard_step(struct hash_shard *shard, uint64_t slot, uint32_t now,
+		hash_scan_fn fn, void *arg, uint64_t *mask)
+{
+	struct hash_table *table;
+	struct hash_table *old;
+	int rc;
+
+	do {
+		shard_tables(shard, &table, &old);
+		*mask = table->mask;
+		rc = 0;
+		if (old) {
+			if (old->mask < *mask)
+				*mask = old->mask;
+			rc = scan_slots(old, slot, *mask, now, fn, arg);
+		}
+		if (rc == 0)
+			rc = scan_slots(table, slot, *mask, now, fn, arg);
+	} while (rc == 0 && tables_changed(shard, table));
+	return rc;
+}
+
+int
+hash_scan(struct hash_engine *engine, uint64_t cursor, uint32_t batch,
+	  hash_scan_fn fn, void *arg, uint64_t *next_cursor)
+{
+	uint64_t shard = cursor >> SCAN_SHARD_SHIFT;
+	uint64_t slot = cursor & SCAN_SLOT_MASK;
+	uint32_t now;
+	uint64_t mask;
+	int rc = 0;
+
+	if (!engine || !engine->shards || !fn || !next_cursor || batch == 0
+	    || shard >= engine->shard_count)
 		return -EINVAL;
 
-	migrate_some_buckets(engine, MIGRATE_BATCH_SIZE);
+	now = engine_ttl_now(engine);
+	epoch_enter();
+	while (batch-- > 0) {
+		rc = scan_shard_step(&engine->shards[shard], slot, now, fn,
+				     arg, &mask);
+		if (rc != 0)
+			break;
+		slot = scan_next_slot(slot, mask);
+		if (slot == 0 && ++shard == engine->shard_count)
+			break;
+	}
+	epoch_exit();
+
+	*next_cursor = shard == engine->shard_count
+			       ? 0
+			       : (shard << SCAN_SHARD_SHIFT) | slot;
+	return rc;
+}
 
-	old = atomic_load(&engine->old_buckets);
-	if (old) {
-		uint32_t old_count = atomic_load(&engine->old_bucket_count);
-		if (delete_from_table(old, old_count, key, key_len,
-				      &old_del_key_len, &old_del_value_len)
-		    == 0)
-			deleted_from_old = 1;
+/*
+ * Snapshots (storage/hash/snapshot.h). Out-of-line pointers are written as
+ * 64-bit file offsets in the pointer's place.
+ */
+_Static_assert(sizeof(void *) == sizeof(uint64_t),
+	       "snapshot relocations replace pointers with 64-bit offsets");
+
+#define SNAPSHOT_ARENA_BUFFER (1U << 20)
+
+/*
+ * Buckets and control bytes are staged a chunk at a time and the arena
+ * through a buffer of its own, each written at its own file offset, so
+ * the arena can grow while the buckets ahead of it are still being written.
+ */
+struct snapshot_writer {
+	int fd;
+	struct hash_bucket *images;
+	uint8_t *ctrl;
+	unsigned char *arena;
+	size_t arena_fill;
+	/* File offset of arena[0] */
+	uint64_t arena_base;
+	uint32_t arena_crc;
+	uint64_t *relocs;
+	uint64_t reloc_count;
+	uint64_t reloc_cap;
+	struct snapshot_timer *timers;
+	uint64_t timer_count;
+	uint64_t timer_cap;
+};
+
+static inline uint64_t
+snapshot_align(uint64_t offset)
+{
+	return (offset + SNAPSHOT_ALIGN - 1) & ~(uint64_t)(SNAPSHOT_ALIGN - 1);
+}
+
+static int
+write_at(int fd, const void *buf, size_t len, uint64_t offset)
+{
+	const char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = pwrite(fd, p, len, (off_t)offset);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		len -= (size_t)n;
+		offset += (uint64_t)n;
 	}
+	return 0;
+}
 
-	buckets = atomic_load(&engine->hash_buckets);
-	bucket_count = atomic_load(&engine->bucket_count);
-	rc = delete_from_table(buckets, bucket_count, key, key_len,
-			       &del_key_len, &del_value_len);
-	if (rc == 0)
-		deleted_from_new = 1;
+static int
+arena_flush(struct snapshot_writer *w)
+{
+	int rc;
+
+	w->arena_crc = crc32c(w->arena_crc, w->arena, w->arena_fill);
+	rc = write_at(w->fd, w->arena, w->arena_fill, w->arena_base);
+	w->arena_base += w->arena_fill;
+	w->arena_fill = 0;
+	return rc;
+}
+
+/* Append len bytes to the arena; *offset gets their file offset */
+static int
+arena_append(struct snapshot_writer *w, const void *data, size_t len,
+	     uint64_t *offset)
+{
+	const unsigned char *p = data;
+	int rc;
 
-	if (deleted_from_new || deleted_from_old) {
-		atomic_fetch_sub(&engine->item_count, 1);
-		if (deleted_from_new)
-			atomic_fetch_sub(
-			    &engine->total_memory,
-			    (uint32_t)(del_key_len + del_value_len));
-		else
-			atomic_fetch_sub(
-			    &engine->total_memory,
-			    (uint32_t)(old_del_key_len + old_del_value_len));
-
-		if (needs_shrink(engine)) {
-			uint32_t current = atomic_load(&engine->bucket_count);
-			uint32_t new_size = current / 2;
-			if (new_size >= MIN_BUCKET_COUNT)
-				hash_engine_start_resize(engine, new_size);
+	*offset = w->arena_base + w->arena_fill;
+	while (len > 0) {
+		size_t n = SNAPSHOT_ARENA_BUFFER - w->arena_fill;
+
+		if (n > len)
+			n = len;
+		memcpy(w->arena + w->arena_fill, p, n);
+		w->arena_fill += n;
+		p += n;
+		len -= n;
+		if (w->arena_fill == SNAPSHOT_ARENA_BUFFER) {
+			rc = arena_flush(w);
+			if (rc != 0)
+				return rc;
 		}
+	}
+	return 0;
+}
+
+static int
+reloc_add(struct snapshot_writer *w, uint64_t slot)
+{
+	if (w->reloc_count == w->reloc_cap) {
+		uint64_t cap = w->reloc_cap ? w->reloc_cap * 2 : 1024;
+		uint64_t *relocs = realloc(w->relocs, cap * sizeof(*relocs));
+
+		if (!relocs)
+			return -ENOMEM;
+		w->relocs = relocs;
+		w->reloc_cap = cap;
+	}
+	w->relocs[w->reloc_count++] = slot;
+	return 0;
+}
+
+/* Wheels are rebuilt from the entries, which drops stale timers */
+static int
+timer_add(struct snapshot_writer *w, uint64_t hash, uint32_t expires)
+{
+	struct snapshot_timer *timer;
+
+	if (w->timer_count == w->timer_cap) {
+		uint64_t cap = w->timer_cap ? w->timer_cap * 2 : 1024;
+		struct snapshot_timer *timers
+		    = realloc(w->timers, cap * sizeof(*timers));
+
+		if (!timers)
+			return -ENOMEM;
+		w->timers = timers;
+		w->timer_cap = cap;
+	}
+	timer = &w->timers[w->timer_count++];
+	timer->hash = hash;
+	timer->expires = expires;
+	timer->reserved = 0;
+	return 0;
+}
+
+/* Move an out-of-line part at data into the arena, leaving its offset */
+static int
+spill_to_arena(struct snapshot_writer *w, unsigned char *data, size_t len)
+{
+	const void *ptr;
+	uint64_t offset;
+	int rc;
+
+	memcpy(&ptr, data, sizeof(ptr));
+	rc = arena_append(w, ptr, len, &offset);
+	if (rc == 0)
+		memcpy(data, &offset, sizeof(offset));
+	return rc;
+}
+
+/*
+ * Build the file image of slot's bucket in image and its control byte in
+ * *ctrl. The copy is taken under the bucket's sequence counter; the
+ * out-of-line parts it points to are immutable, so they can be read after.
+ */
+static int
+snapshot_bucket(struct snapshot_writer *w, struct hash_bucket *bucket,
+		uint64_t slot, struct hash_bucket *image, uint8_t *ctrl,
+		struct snapshot_shard *rec)
+{
+	uint32_t ext = BUCKET_F_KEY_EXT | BUCKET_F_VALUE_EXT;
+	uint64_t hash;
+	uint32_t seq;
+	size_t offset;
+	int state;
+	int rc;
+
+	memset(image, 0, sizeof(*image));
+	bucket_init(image);
+	do {
+		seq = bucket_read_begin(bucket);
+		state = atomic_load_explicit(&bucket->state,
+					     memory_order_relaxed);
+		hash = bucket_hash(bucket);
+		image->flags = bucket->flags & ext;
+		image->key_len = bucket->key_len;
+		image->value_len = bucket->value_len;
+		image->expires = bucket->expires;
+		memcpy(image->data, bucket->data, sizeof(image->data));
+	} while (bucket_read_retry(bucket, seq));
+
+	if (state != BUCKET_OCCUPIED) {
+		image->flags = 0;
+		image->key_len = 0;
+		image->value_len = 0;
+		image->expires = 0;
+		memset(image->data, 0, sizeof(image->data));
+		atomic_store(&image->state, state);
+		*ctrl = state == BUCKET_TOMBSTONE ? CTRL_DELETED : CTRL_EMPTY;
+		return 0;
+	}
+
+	atomic_store_explicit(&image->hash, hash, memory_order_relaxed);
+	atomic_store(&image->state, BUCKET_OCCUPIED);
+	*ctrl = ctrl_tag(hash);
+	rec->items++;
+	rec->memory += (uint64_t)image->key_len + image->value_len;
+	if (image->expires) {
+		rc = timer_add(w, hash, image->expires);
+		if (rc != 0)
+			return rc;
+	}
+	if (!(image->flags & ext))
 		return 0;
+
+	offset = bucket_value_offset(image);
+	if (image->flags & BUCKET_F_KEY_EXT) {
+		rc = spill_to_arena(w, image->data, image->key_len);
+		if (rc != 0)
+			return rc;
 	}
+	if (image->flags & BUCKET_F_VALUE_EXT) {
+		rc = spill_to_arena(w, image->data + offset, image->value_len);
+		if (rc != 0)
+			return rc;
+	}
+	return reloc_add(w, slot);
+}
+
+/* Write one shard's sections from *offset on, and advance it past them */
+static int
+save_shard(struct hash_engine *engine, struct hash_shard *shard,
+	   struct snapshot_writer *w, struct snapshot_shard *rec,
+	   uint64_t *offset)
+{
+	struct hash_table *table;
+	struct hash_table *old;
+	uint64_t chunk_len;
+	uint64_t count;
+	uint8_t tail[GROUP_WIDTH];
+	uint32_t ctrl_crc = 0;
+	uint32_t buckets_crc = 0;
+	int rc = 0;
+
+	/* Holding resize_lock keeps the shard on one table throughout */
+	futex_mutex_lock_class(&shard->resize_lock, FUTEX_CLASS_HASH_RESIZE);
+	epoch_enter();
+	old = atomic_load(&shard->old_table);
+	if (old && migrate_all(engine, shard, old) != 0) {
+		epoch_exit();
+		futex_mutex_unlock(&shard->resize_lock);
+		return -ENOMEM;
+	}
+	table = atomic_load(&shard->table);
+
+	count = table->bucket_count;
+	chunk_len = count < BUCKET_CHUNK_SIZE ? count : BUCKET_CHUNK_SIZE;
+	rec->bucket_count = count;
+	rec->ctrl_offset = *offset;
+	rec->buckets_offset = snapshot_align(rec->ctrl_offset + count
+					     + GROUP_WIDTH);
+	rec->arena_offset = snapshot_align(rec->buckets_offset
+					   + count * sizeof(struct hash_bucket));
+	w->arena_base = rec->arena_offset;
+	w->arena_fill = 0;
+	w->arena_crc = 0;
+	w->reloc_count = 0;
+	w->timer_count = 0;
+
+	for (uint64_t start = 0; start < count && rc == 0;
+	     start += chunk_len) {
+		size_t bytes = chunk_len * sizeof(struct hash_bucket);
+
+		for (uint64_t i = 0; i < chunk_len && rc == 0; i++)
+			rc = snapshot_bucket(w, table_bucket(table, start + i),
+					     start + i, &w->images[i],
+					     &w->ctrl[i], rec);
+		if (rc != 0)
+			break;
+		if (start == 0)
+			memcpy(tail, w->ctrl, GROUP_WIDTH);
+		ctrl_crc = crc32c(ctrl_crc, w->ctrl, chunk_len);
+		buckets_crc = crc32c(buckets_crc, w->images, bytes);
+		rc = write_at(w->fd, w->ctrl, chunk_len,
+			      rec->ctrl_offset + start);
+		if (rc == 0)
+			rc = write_at(w->fd, w->images, bytes,
+				      rec->buckets_offset
+					  + start * sizeof(struct hash_bucket));
+	}
+	epoch_exit();
+	futex_mutex_unlock(&shard->resize_lock);
+	if (rc != 0)
+		return rc;
+
+	rc = write_at(w->fd, tail, GROUP_WIDTH, rec->ctrl_offset + count);
+	if (rc == 0)
+		rc = arena_flush(w);
+	if (rc != 0)
+		return rc;
+	rec->ctrl_crc = crc32c(ctrl_crc, tail, GROUP_WIDTH);
+	rec->buckets_crc = buckets_crc;
+	rec->arena_size = w->arena_base - rec->arena_offset;
+	rec->arena_crc = w->arena_crc;
+
+	rec->reloc_offset = snapshot_align(w->arena_base);
+	rec->reloc_count = w->reloc_count;
+	rec->reloc_crc = crc32c(0, w->relocs,
+				w->reloc_count * sizeof(*w->relocs));
+	rc = write_at(w->fd, w->relocs, w->reloc_count * sizeof(*w->relocs),
+		      rec->reloc_offset);
+	if (rc != 0)
+		return rc;
 
+	rec->timer_offset = snapshot_align(rec->reloc_offset
+					   + w->reloc_count
+						 * sizeof(*w->relocs));
+	rec->timer_count = w->timer_count;
+	rec->timer_crc = crc32c(0, w->timers,
+				w->timer_count * sizeof(*w->timers));
+	rc = write_at(w->fd, w->timers, w->timer_count * sizeof(*w->timers),
+		      rec->timer_offset);
+	*offset = snapshot_align(rec->timer_offset
+				 + w->timer_count * sizeof(*w->timers));
 	return rc;
 }
 
+/* CRC of the header and shard records with header_crc taken as zero */
+static uint32_t
+snapshot_header_crc(const struct snapshot_header *header, size_t size)
+{
+	static const uint32_t zero;
+	size_t field = offsetof(struct snapshot_header, header_crc);
+	uint32_t crc;
+
+	crc = crc32c(0, header, field);
+	crc = crc32c(crc, &zero, sizeof(zero));
+	return crc32c(crc, (const char *)header + field + sizeof(zero),
+		      size - field - sizeof(zero));
+}
+
 int
-hash_engine_destroy(struct hash_engine *engine)
+hash_engine_save(struct hash_engine *engine, const char *path)
 {
-	struct hash_bucket *buckets;
-	struct hash_bucket *old;
-	uint32_t bucket_count;
-	uint32_t old_count;
+	struct snapshot_header *header = NULL;
+	struct snapshot_writer w;
+	size_t header_size;
+	uint64_t offset;
+	char *tmp;
+	int rc = 0;
+
+	if (!engine || !engine->shards || !path)
+		return -EINVAL;
 
-	if (!engine)
+	memset(&w, 0, sizeof(w));
+	w.fd = -1;
+	header_size = sizeof(*header)
+		      + engine->shard_count * sizeof(struct snapshot_shard);
+	tmp = malloc(strlen(path) + sizeof(".tmp"));
+	header = calloc(1, header_size);
+	w.images = aligned_alloc(BUCKET_ALIGN,
+				 BUCKET_CHUNK_SIZE * sizeof(*w.images));
+	w.ctrl = malloc(BUCKET_CHUNK_SIZE);
+	w.arena = malloc(SNAPSHOT_ARENA_BUFFER);
+	if (!tmp || !header || !w.images || !w.ctrl || !w.arena) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	/* Owner-only: the file holds the hash key */
+	sprintf(tmp, "%s.tmp", path);
+	w.fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (w.fd < 0) {
+		rc = -errno;
+		goto out;
+	}
+
+	offset = snapshot_align(header_size);
+	for (uint32_t i = 0; i < engine->shard_count && rc == 0; i++)
+		rc = save_shard(engine, &engine->shards[i], &w,
+				&header->shards[i], &offset);
+	if (rc != 0)
+		goto fail;
+
+	memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+	header->byte_order = SNAPSHOT_BYTE_ORDER;
+	header->version = SNAPSHOT_VERSION;
+	header->bucket_size = sizeof(struct hash_bucket);
+	header->inline_size = BUCKET_INLINE_SIZE;
+	header->group_width = GROUP_WIDTH;
+	header->hasher = (uint32_t)engine->hasher;
+	header->probe_mode = (uint32_t)atomic_load(&engine->shards[0].table)
+				 ->probe_mode;
+	header->shard_count = engine->shard_count;
+	header->hash_key_0 = engine->hash_key_0;
+	header->hash_key_1 = engine->hash_key_1;
+	header->file_size = offset;
+	header->header_crc = snapshot_header_crc(header, header_size);
+
+	rc = write_at(w.fd, header, header_size, 0);
+	if (rc == 0 && ftruncate(w.fd, (off_t)offset) != 0)
+		rc = -errno;
+	if (rc == 0 && fsync(w.fd) != 0)
+		rc = -errno;
+	if (close(w.fd) != 0 && rc == 0)
+		rc = -errno;
+	w.fd = -1;
+	if (rc == 0 && rename(tmp, path) != 0)
+		rc = -errno;
+fail:
+	if (w.fd >= 0)
+		close(w.fd);
+	if (rc != 0)
+		unlink(tmp);
+out:
+	free(w.relocs);
+	free(w.timers);
+	free(w.arena);
+	free(w.ctrl);
+	free(w.images);
+	free(header);
+	free(tmp);
+	return rc;
+}
+
+/* A section lies wholly in the file, aligned and at or after start */
+static int
+section_ok(uint64_t offset, uint64_t len, uint64_t start, uint64_t size)
+{
+	return offset >= start && offset % SNAPSHOT_ALIGN == 0
+	       && offset <= size && len <= size - offset;
+}
+
+static int
+snapshot_check(const struct snapshot_header *header, uint64_t size,
+	       int flags)
+{
+	const unsigned char *base = (const unsigned char *)header;
+	uint64_t header_size;
+	uint64_t end;
+
+	if (size < sizeof(*header)
+	    || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic))
+		   != 0)
+		return -EBADMSG;
+	if (header->byte_order != SNAPSHOT_BYTE_ORDER
+	    || header->version != SNAPSHOT_VERSION
+	    || header->bucket_size != sizeof(struct hash_bucket)
+	    || header->inline_size != BUCKET_INLINE_SIZE
+	    || header->group_width != GROUP_WIDTH)
 		return -EINVAL;
 
-	futex_mutex_lock(&engine->engine_lock);
+	if (header->shard_count == 0 || header->shard_count > HASH_MAX_SHARDS
+	    || (header->shard_count & (header->shard_count - 1)) != 0)
+		return -EBADMSG;
+	header_size = sizeof(*header)
+		      + header->shard_count * sizeof(struct snapshot_shard);
+	if (header_size > size || header->file_size != size
+	    || snapshot_header_crc(header, header_size) != header->header_crc)
+		return -EBADMSG;
+	if (!hasher_get((int)header->hasher)
+	    || (header->probe_mode != HASH_PROBE_GROUP
+		&& header->probe_mode != HASH_PROBE_ROBIN_HOOD))
+		return -EBADMSG;
+
+	end = header_size;
+	for (uint32_t i = 0; i < header->shard_count; i++) {
+		const struct snapshot_shard *rec = &header->shards[i];
+		uint64_t count = rec->bucket_count;
+		uint64_t bytes = count * sizeof(struct hash_bucket);
+
+		if (count < MIN_BUCKET_COUNT || count > MAX_BUCKET_COUNT
+		    || (count & (count - 1)) != 0 || rec->items > count)
+			return -EBADMSG;
+		if (!section_ok(rec->ctrl_offset, count + GROUP_WIDTH, end,
+				size))
+			return -EBADMSG;
+		end = rec->ctrl_offset + count + GROUP_WIDTH;
+		if (!section_ok(rec->buckets_offset, bytes, end, size))
+			return -EBADMSG;
+		end = rec->buckets_offset + bytes;
+		if (!section_ok(rec->arena_offset, rec->arena_size, end, size))
+			return -EBADMSG;
+		end = rec->arena_offset + rec->arena_size;
+		if (rec->reloc_count > size / sizeof(uint64_t)
+		    || !section_ok(rec->reloc_offset,
+				   rec->reloc_count * sizeof(uint64_t), end,
+				   size))
+			return -EBADMSG;
+		end = rec->reloc_offset + rec->reloc_count * sizeof(uint64_t);
+		if (rec->timer_count > size / sizeof(struct snapshot_timer)
+		    || !section_ok(rec->timer_offset,
+				   rec->timer_count
+				       * sizeof(struct snapshot_timer),
+				   end, size))
+			return -EBADMSG;
+		end = rec->timer_offset
+		      + rec->timer_count * sizeof(struct snapshot_timer);
+
+		/* Relocations and timers are read in full anyway */
+		if (crc32c(0, base + rec->reloc_offset,
+			   rec->reloc_count * sizeof(uint64_t))
+			!= rec->reloc_crc
+		    || crc32c(0, base + rec->timer_offset,
+			      rec->timer_count * sizeof(struct snapshot_timer))
+			   != rec->timer_crc)
+			return -EBADMSG;
+		if (!(flags & HASH_LOAD_VERIFY))
+			continue;
+		if (crc32c(0, base + rec->ctrl_offset, count + GROUP_WIDTH)
+			!= rec->ctrl_crc
+		    || crc32c(0, base + rec->buckets_offset, bytes)
+			   != rec->buckets_crc
+		    || crc32c(0, base + rec->arena_offset, rec->arena_size)
+			   != rec->arena_crc)
+			return -EBADMSG;
+	}
+	return 0;
+}
 
-	buckets = atomic_load(&engine->hash_buckets);
-	bucket_count = atomic_load(&engine->bucket_count);
-	if (buckets) {
-		for (uint32_t i = 0; i < bucket_count; i++)
-			bucket_destroy(&buckets[i]);
-		free(buckets);
+/* A table whose chunks and control bytes are a shard's file sections */
+static struct hash_table *
+table_map(struct hash_snapshot_map *map, const struct snapshot_shard *rec,
+	  int probe_mode, uint32_t lock_stripes)
+{
+	unsigned char *base = map->base;
+	struct hash_bucket *buckets
+	    = (struct hash_bucket *)(base + rec->buckets_offset);
+	uint64_t chunks = table_chunk_count(rec->bucket_count);
+	struct hash_table *table;
+
+	table = malloc(sizeof(*table));
+	if (!table)
+		return NULL;
+	table->bucket_count = rec->bucket_count;
+	table->mask = rec->bucket_count - 1;
+	table->probe_mode = probe_mode;
+	table->chunks = malloc(chunks * sizeof(*table->chunks));
+	if (!table->chunks || table_alloc_locks(table, lock_stripes) != 0) {
+		free(table->chunks);
+		free(table);
+		return NULL;
 	}
+	for (uint64_t c = 0; c < chunks; c++)
+		table->chunks[c] = buckets + c * BUCKET_CHUNK_SIZE;
+
+	table->ctrl = base + rec->ctrl_offset;
+	table->ref = NULL;
+	memset(&table->pages, 0, sizeof(table->pages));
+	table->snapshot = map;
+	atomic_fetch_add_explicit(&map->refs, 1, memory_order_relaxed);
+	atomic_init(&table->draining, 0);
+	futex_mutex_init(&table->write_lock);
+	atomic_init(&table->seq, 0);
+	atomic_init(&table->migrate_index, 0);
+	atomic_init(&table->migrated, 0);
+	atomic_init(&table->migrate_failed, 0);
+	atomic_init(&table->used, 0);
+	for (uint64_t i = 0; i < table->bucket_count; i++) {
+		if (table->ctrl[i] != CTRL_EMPTY)
+			atomic_fetch_add_explicit(&table->used, 1,
+						  memory_order_relaxed);
+	}
+	return table;
+}
 
-	old = atomic_load(&engine->old_buckets);
-	old_count = atomic_load(&engine->old_bucket_count);
-	if (old) {
-		for (uint32_t i = 0; i < old_count; i++)
-			bucket_destroy(&old[i]);
-		free(old);
+/* Turn an arena offset at data into a pointer, if it is in bounds */
+static int
+relocate_part(unsigned char *base, const struct snapshot_shard *rec,
+	      unsigned char *data, uint64_t len)
+{
+	uint64_t end = rec->arena_offset + rec->arena_size;
+	uint64_t offset;
+	void *ptr;
+
+	memcpy(&offset, data, sizeof(offset));
+	if (offset < rec->arena_offset || offset > end || len > end - offset)
+		return -EBADMSG;
+	ptr = base + offset;
+	memcpy(data, &ptr, sizeof(ptr));
+	return 0;
+}
+
+static int
+relocate_bucket(unsigned char *base, const struct snapshot_shard *rec,
+		struct hash_bucket *bucket)
+{
+	uint32_t ext = BUCKET_F_KEY_EXT | BUCKET_F_VALUE_EXT;
+	size_t offset = bucket_value_offset(bucket);
+	size_t value_size = (bucket->flags & BUCKET_F_VALUE_EXT)
+				    ? sizeof(void *)
+				    : bucket->value_len;
+
+	/* Also rejects a slot listed twice, as it is marked mapped by now */
+	if (atomic_load(&bucket->state) != BUCKET_OCCUPIED
+	    || !(bucket->flags & ext) || (bucket->flags & ~ext)
+	    || offset + value_size > BUCKET_INLINE_SIZE)
+		return -EBADMSG;
+	if ((bucket->flags & BUCKET_F_KEY_EXT)
+	    && relocate_part(base, rec, bucket->data, bucket->key_len) != 0)
+		return -EBADMSG;
+	if ((bucket->flags & BUCKET_F_VALUE_EXT)
+	    && relocate_part(base, rec, bucket->data + offset,
+			     bucket->value_len)
+		   != 0)
+		return -EBADMSG;
+	if (bucket->flags & BUCKET_F_KEY_EXT)
+		bucket->flags |= BUCKET_F_KEY_MAPPED;
+	if (bucket->flags & BUCKET_F_VALUE_EXT)
+		bucket->flags |= BUCKET_F_VALUE_MAPPED;
+	return 0;
+}
+
+/* Swap a shard's placeholder table for its mapped one and load its timers */
+static int
+load_shard(struct hash_shard *shard, struct hash_snapshot_map *map,
+	   const struct snapshot_shard *rec, int probe_mode)
+{
+	unsigned char *base = map->base;
+	const uint64_t *relocs = (const uint64_t *)(base + rec->reloc_offset);
+	const struct snapshot_timer *timers
+	    = (const struct snapshot_timer *)(base + rec->timer_offset);
+	struct hash_table *table;
+	int rc = 0;
+
+	table = table_map(map, rec, probe_mode, shard->lock_stripes);
+	if (!table)
+		return -ENOMEM;
+	for (uint64_t i = 0; i < rec->reloc_count; i++) {
+		if (relocs[i] >= rec->bucket_count
+		    || relocate_bucket(base, rec,
+				       table_bucket(table, relocs[i]))
+			   != 0) {
+			table_free(table);
+			return -EBADMSG;
+		}
+	}
+
+	if (shard->memory_limit && table_alloc_ref(table) != 0) {
+		table_free(table);
+		return -ENOMEM;
+	}
+
+	atomic_store(&shard->item_count, (int64_t)rec->items);
+	atomic_store(&shard->memory, (int64_t)rec->memory);
+	table_destroy(atomic_load(&shard->table));
+	atomic_store(&shard->table, table);
+
+	for (uint64_t i = 0; i < rec->timer_count && rc == 0; i++)
+		rc = ttl_wheel_add(shard->wheel, timers[i].hash,
+				   timers[i].expires);
+	shard_wheel_sync(shard);
+	return rc;
+}
+
+int
+hash_engine_load(struct hash_engine *engine, const char *path,
+		 const struct hash_engine_config *config, int flags)
+{
+	struct hash_engine_config cfg;
+	struct snapshot_header *header;
+	struct stat st;
+	uint32_t threads;
+	void *map;
+	int rc;
+	int fd;
+
+	if (!engine || !path || (flags & ~HASH_LOAD_VERIFY))
+		return -EINVAL;
+	memset(&cfg, 0, sizeof(cfg));
+	if (config)
+		cfg = *config;
+	if (cfg.resize_mode != HASH_RESIZE_INLINE
+	    && cfg.resize_mode != HASH_RESIZE_BACKGROUND)
+		return -EINVAL;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) != 0) {
+		rc = -errno;
+		close(fd);
+		return rc;
+	}
+	if ((uint64_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		return -EBADMSG;
+	}
+	/* Private and writable: writers copy on write, the file stays put */
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	header = map;
+	rc = snapshot_check(header, (uint64_t)st.st_size, flags);
+	if (rc != 0)
+		goto unmap;
+
+	/*
+	 * Placeholder tables are swapped for the mapped ones before any
+	 * resize worker starts, so none can act on them meanwhile.
+	 */
+	cfg.bucket_count = (uint64_t)header->shard_count * MIN_BUCKET_COUNT;
+	cfg.shard_count = header->shard_count;
+	cfg.probe_mode = (int)header->probe_mode;
+	cfg.hasher = (int)header->hasher;
+	cfg.resize_mode = HASH_RESIZE_INLINE;
+	rc = hash_engine_init_config(engine, &cfg);
+	if (rc != 0)
+		goto unmap;
+	engine->hash_key_0 = header->hash_key_0;
+	engine->hash_key_1 = header->hash_key_1;
+	engine->snapshot = malloc(sizeof(*engine->snapshot));
+	if (!engine->snapshot) {
+		hash_engine_destroy(engine);
+		rc = -ENOMEM;
+		goto unmap;
 	}
+	engine->snapshot->base = map;
+	engine->snapshot->len = (size_t)st.st_size;
+	atomic_init(&engine->snapshot->refs, 1);
+
+	for (uint32_t i = 0; i < header->shard_count && rc == 0; i++) {
+		rc = load_shard(&engine->shards[i], engine->snapshot,
+				&header->shards[i], cfg.probe_mode);
+		if (header->shards[i].timer_count)
+			atomic_store(&engine->ttl_used, 1);
+	}
+	if (rc == 0 && config
+	    && config->resize_mode == HASH_RESIZE_BACKGROUND) {
+		engine->assist_budget = config->assist_budget;
+		threads = config->resize_threads ? config->resize_threads : 1;
+		rc = resize_workers_start(engine, threads);
+	}
+	if (rc != 0)
+		hash_engine_destroy(engine);
+	return rc;
+
+unmap:
+	munmap(map, (size_t)st.st_size);
+	return rc;
+}
+
+int
+hash_engine_destroy(struct hash_engine *engine)
+{
+	uint32_t i;
 
-	atomic_store(&engine->hash_buckets, NULL);
-	atomic_store(&engine->bucket_count, 0);
-	atomic_store(&engine->item_count, 0);
-	atomic_store(&engine->total_memory, 0);
-	atomic_store(&engine->old_buckets, NULL);
-	atomic_store(&engine->old_bucket_count, 0);
-	atomic_store(&engine->migrate_index, 0);
+	if (!engine)
+		return -EINVAL;
+	if (!engine->shards)
+		return 0;
 
-	futex_mutex_unlock(&engine->engine_lock);
+	if (engine->resize_thread_count > 0)
+		resize_workers_stop(engine, engine->resize_thread_count);
+
+	/* Run deferred frees, including tables retired by past resizes */
+	epoch_synchronize();
+
+	for (i = 0; i < engine->shard_count; i++)
+		shard_destroy(&engine->shards[i]);
+	free(engine->shards);
+	engine->shards = NULL;
+	engine->shard_count = 0;
+
+	/*
+	 * Out-of-line parts still in the mapping went with the tables above,
+	 * but a mapped table another thread retired may not be reclaimed yet;
+	 * the last reference unmaps.
+	 */
+	if (engine->snapshot) {
+		snapshot_map_put(engine->snapshot);
+		engine->snapshot = NULL;
+	}
 	return 0;
 }
@@ -0,0 +1,336 @@
+/**
+ * @file hasher.c
+ */
+
+#include "storage/hash/hasher.h"
+#include "storage/hash/siphash.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HASHER_X86 1
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#define HASHER_ARM 1
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78U
+
+static const uint64_t wyp[4] = { 0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+				 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL };
+
+static inline uint64_t
+load64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t
+load32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* Load 0-7 trailing bytes into the low end of a word */
+static inline uint64_t
+load_tail(const uint8_t *p, size_t len)
+{
+	uint64_t v = 0;
+
+	memcpy(&v, p, len);
+	return v;
+}
+
+static inline void
+wymum(uint64_t *a, uint64_t *b)
+{
+	__uint128_t r = (__uint128_t)*a * *b;
+
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t
+wymix(uint64_t a, uint64_t b)
+{
+	wymum(&a, &b);
+	return a ^ b;
+}
+
+uint64_t
+wyhash(const void *data, size_t len, uint64_t k0, uint64_t k1)
+{
+	const uint8_t *p = data;
+	uint64_t seed = k0 ^ wymix(k1 ^ wyp[0], wyp[1]);
+	uint64_t a;
+	uint64_t b;
+
+	if (len <= 16) {
+		if (len >= 4) {
+			size_t mid = (len >> 3) << 2;
+
+			a = (load32(p) << 32) | load32(p + mid);
+			b = (load32(p + len - 4) << 32)
+			    | load32(p + len - 4 - mid);
+		} else if (len > 0) {
+			a = ((uint64_t)p[0] << 16)
+			    | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = 0;
+			b = 0;
+		}
+	} else {
+		size_t i = len;
+
+		if (i > 48) {
+			uint64_t see1 = seed;
+			uint64_t see2 = seed;
+
+			do {
+				seed = wymix(load64(p) ^ wyp[1],
+					     load64(p + 8) ^ seed);
+				see1 = wymix(load64(p + 16) ^ wyp[2],
+					     load64(p + 24) ^ see1);
+				see2 = wymix(load64(p + 32) ^ wyp[3],
+					     load64(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wymix(load64(p) ^ wyp[1], load64(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = load64(p + i - 16);
+		b = load64(p + i - 8);
+	}
+
+	a ^= wyp[1];
+	b ^= seed;
+	wymum(&a, &b);
+	return wymix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_table_once = PTHREAD_ONCE_INIT;
+
+static void
+crc32c_table_init(void)
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & (0U - (crc & 1)));
+		crc32c_table[i] = crc;
+	}
+}
+
+static inline uint32_t
+crc32c_sw_u8(uint32_t crc, uint8_t v)
+{
+	return (crc >> 8) ^ crc32c_table[(crc ^ v) & 0xff];
+}
+
+static inline uint32_t
+crc32c_sw_u64(uint32_t crc, uint64_t v)
+{
+	for (int i = 0; i < 8; i++, v >>= 8)
+		crc = crc32c_sw_u8(crc, (uint8_t)v);
+	return crc;
+}
+
+/*
+ * CRC32C is linear in its input, so a single lane only ever carries 32
+ * bits of state. Two lanes over alternate words give 64 bits for keys of
+ * 16 bytes and up, and run as independent dependency chains; a
+ * multiply-xorshift finalizer then spreads them over every output bit.
+ */
+static inline __attribute__((always_inline)) uint64_t
+crc_hash_body(const uint8_t *p, size_t len, uint64_t k0, uint64_t k1,
+	      uint32_t (*step)(uint32_t crc, uint64_t v))
+{
+	uint32_t a = (uint32_t)k0;
+	uint32_t b = (uint32_t)(k0 >> 32);
+	uint64_t h;
+	size_t i = len;
+
+	for (; i >= 16; i -= 16, p += 16) {
+		a = step(a, load64(p));
+		b = step(b, load64(p + 8));
+	}
+	if (i >= 8) {
+		a = step(a, load64(p));
+		p += 8;
+		i -= 8;
+	}
+	if (i > 0)
+		b = step(b, load_tail(p, i));
+
+	h = (((uint64_t)b << 32) | a) ^ k1 ^ ((uint64_t)len << 56);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/* hasher_get() builds the table before handing this out */
+static uint64_t
+crc_hash_sw(const void *data, size_t len, uint64_t k0, uint64_t k1)
+{
+	return crc_hash_body(data, len, k0, k1, crc32c_sw_u64);
+}
+
+uint32_t
+crc32c_sw(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	pthread_once(&crc32c_table_once, crc32c_table_init);
+	crc = ~crc;
+	while (len--)
+		crc = crc32c_sw_u8(crc, *p++);
+	return ~crc;
+}
+
+#if defined(HASHER_X86)
+static inline __attribute__((target("sse4.2"))) uint32_t
+crc32c_hw_u64(uint32_t crc, uint64_t v)
+{
+#if defined(__x86_64__)
+	return (uint32_t)_mm_crc32_u64(crc, v);
+#else
+	crc = _mm_crc32_u32(crc, (uint32_t)v);
+	return _mm_crc32_u32(crc, (uint32_t)(v >> 32));
+#endif
+}
+
+static inline __attribute__((target("sse4.2"))) uint32_t
+crc32c_hw_u8(uint32_t crc, uint8_t v)
+{
+	return _mm_crc32_u8(crc, v);
+}
+
+static int
+cpu_has_crc32c(void)
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+
+#define CRC32C_HW_NAME "crc32c/sse4.2"
+#define CRC32C_HW_TARGET __attribute__((target("sse4.2")))
+#elif defined(HASHER_ARM)
+static inline __attribute__((target("+crc"))) uint32_t
+crc32c_hw_u64(uint32_t crc, uint64_t v)
+{
+	return __crc32cd(crc, v);
+}
+
+static inline __attribute__((target("+crc"))) uint32_t
+crc32c_hw_u8(uint32_t crc, uint8_t v)
+{
+	return __crc32cb(crc, v);
+}
+
+static int
+cpu_has_crc32c(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#define CRC32C_HW_NAME "crc32c/armv8-crc"
+#define CRC32C_HW_TARGET __attribute__((target("+crc")))
+#endif
+
+#ifdef CRC32C_HW_NAME
+static CRC32C_HW_TARGET uint64_t
+crc_hash_hw(const void *data, size_t len, uint64_t k0, uint64_t k1)
+{
+	return crc_hash_body(data, len, k0, k1, crc32c_hw_u64);
+}
+
+static CRC32C_HW_TARGET uint32_t
+crc32c_hw(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	crc = ~crc;
+	for (; len >= 8; len -= 8, p += 8)
+		crc = crc32c_hw_u64(crc, load64(p));
+	while (len--)
+		crc = crc32c_hw_u8(crc, *p++);
+	return ~crc;
+}
+#else
+static int
+cpu_has_crc32c(void)
+{
+	return 0;
+}
+#endif
+
+uint32_t
+crc32c(uint32_t crc, const void *data, size_t len)
+{
+#ifdef CRC32C_HW_NAME
+	if (cpu_has_crc32c())
+		return crc32c_hw(crc, data, len);
+#endif
+	return crc32c_sw(crc, data, len);
+}
+
+hasher_fn
+hasher_get(int kind)
+{
+	switch (kind) {
+	case HASHER_SIPHASH:
+		return siphash;
+	case HASHER_WYHASH:
+		return wyhash;
+	case HASHER_CRC32C:
+#ifdef CRC32C_HW_NAME
+		if (cpu_has_crc32c())
+			return crc_hash_hw;
+#endif
+		pthread_once(&crc32c_table_once, crc32c_table_init);
+		return crc_hash_sw;
+	default:
+		return NULL;
+	}
+}
+
+const char *
+hasher_name(int kind)
+{
+	switch (kind) {
+	case HASHER_SIPHASH:
+		return "siphash-2-4";
+	case HASHER_WYHASH:
+		return "wyhash";
+	case HASHER_CRC32C:
+#ifdef CRC32C_HW_NAME
+		if (cpu_has_crc32c())
+			return CRC32C_HW_NAME;
+#endif
+		return "crc32c/table";
+	default:
+		return NULL;
+	}
+}
@@ -0,0 +1,172 @@
+/**
+ * @file pages.c
+ */
+
+#include "storage/hash/pages.h"
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PAGES_HUGE_SHIFT 21
+
+/* Nodes past the first word of the mask are never bound to */
+static unsigned long node_mask = 1;
+static int node_count = 1;
+static pthread_once_t nodes_once = PTHREAD_ONCE_INIT;
+
+/* Parse a sysfs node list such as "0-3,6" */
+static void
+nodes_init(void)
+{
+	char buf[256];
+	unsigned long mask = 0;
+	int count = 0;
+	FILE *f;
+	char *p;
+
+	f = fopen("/sys/devices/system/node/online", "r");
+	if (!f)
+		return;
+	p = fgets(buf, sizeof(buf), f);
+	fclose(f);
+	if (!p)
+		return;
+
+	for (;;) {
+		char *end;
+		long lo = strtol(p, &end, 10);
+		long hi = lo;
+
+		if (end == p || lo < 0)
+			break;
+		p = end;
+		if (*p == '-') {
+			hi = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		for (long n = lo; n <= hi && n < (long)sizeof(mask) * 8; n++)
+			mask |= 1UL << n;
+		if (hi + 1 > count)
+			count = (int)hi + 1;
+		if (*p != ',')
+			break;
+		p++;
+	}
+	if (mask) {
+		node_mask = mask;
+		node_count = count;
+	}
+}
+
+int
+pages_numa_nodes(void)
+{
+	pthread_once(&nodes_once, nodes_init);
+	return node_count;
+}
+
+/* Placement is a hint; the memory is usable whether or not it applies */
+static void
+bind_pages(void *addr, size_t len, const struct pages_policy *policy)
+{
+	unsigned long mask;
+	int mode;
+
+	if (policy->numa == PAGES_NUMA_DEFAULT || pages_numa_nodes() < 2)
+		return;
+	if (policy->numa == PAGES_NUMA_INTERLEAVE) {
+		mode = MPOL_INTERLEAVE;
+		mask = node_mask;
+	} else {
+		mode = MPOL_PREFERRED;
+		mask = 1UL << (policy->node % node_count);
+		if (!(mask & node_mask))
+			return;
+	}
+	/* maxnode counts one past the last bit, as for libnuma's mbind() */
+	syscall(SYS_mbind, addr, len, mode, &mask, sizeof(mask) * 8 + 1, 0);
+}
+
+static int
+use_mapping(size_t size, const struct pages_policy *policy)
+{
+	return size >= PAGES_HUGE_SIZE
+	       && (policy->mode != PAGES_DEFAULT
+		   || policy->numa != PAGES_NUMA_DEFAULT);
+}
+
+static size_t
+mapping_size(size_t size)
+{
+	return (size + PAGES_HUGE_SIZE - 1) & ~(PAGES_HUGE_SIZE - 1);
+}
+
+/* Over-map, then trim so the region starts on a huge page boundary */
+static void *
+map_aligned(size_t len)
+{
+	char *raw;
+	size_t head;
+
+	raw = mmap(NULL, len + PAGES_HUGE_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED)
+		return NULL;
+	head = (PAGES_HUGE_SIZE - ((uintptr_t)raw & (PAGES_HUGE_SIZE - 1)))
+	       & (PAGES_HUGE_SIZE - 1);
+	if (head)
+		munmap(raw, head);
+	munmap(raw + head + len, PAGES_HUGE_SIZE - head);
+	return raw + head;
+}
+
+void *
+pages_alloc(size_t size, size_t align, const struct pages_policy *policy)
+{
+	size_t len;
+	void *ptr;
+
+	if (!use_mapping(size, policy)) {
+		ptr = aligned_alloc(align, size);
+		if (ptr)
+			memset(ptr, 0, size);
+		return ptr;
+	}
+
+	len = mapping_size(size);
+	if (policy->mode == PAGES_HUGETLB) {
+		ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+			       | (PAGES_HUGE_SHIFT << MAP_HUGE_SHIFT),
+			   -1, 0);
+		if (ptr != MAP_FAILED) {
+			bind_pages(ptr, len, policy);
+			return ptr;
+		}
+	}
+
+	ptr = map_aligned(len);
+	if (!ptr)
+		return NULL;
+	if (policy->mode != PAGES_DEFAULT)
+		madvise(ptr, len, MADV_HUGEPAGE);
+	bind_pages(ptr, len, policy);
+	return ptr;
+}
+
+void
+pages_free(void *ptr, size_t size, const struct pages_policy *policy)
+{
+	if (!ptr)
+		return;
+	if (use_mapping(size, policy))
+		munmap(ptr, mapping_size(size));
+	else
+		free(ptr);
+}
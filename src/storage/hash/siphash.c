@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -40,6 +41,40 @@ read64le(const uint8_t *p)
 	       | ((uint64_t)p[7] << 56);
 }
 
+/* Last message word: the 0-7 trailing bytes with the length in the top byte */
+static inline uint64_t
+siphash_final_word(const uint8_t *in, size_t len)
+{
+	uint64_t b = ((uint64_t)len) << 56;
+
+	switch (len & 7) {
+	case 7:
+		b |= ((uint64_t)in[6]) << 48;
+		/* fallthrough */
+	case 6:
+		b |= ((uint64_t)in[5]) << 40;
+		/* fallthrough */
+	case 5:
+		b |= ((uint64_t)in[4]) << 32;
+		/* fallthrough */
+	case 4:
+		b |= ((uint64_t)in[3]) << 24;
+		/* fallthrough */
+	case 3:
+		b |= ((uint64_t)in[2]) << 16;
+		/* fallthrough */
+	case 2:
+		b |= ((uint64_t)in[1]) << 8;
+		/* fallthrough */
+	case 1:
+		b |= ((uint64_t)in[0]);
+		/* fallthrough */
+	case 0:
+		break;
+	}
+	return b;
+}
+
 static uint64_t global_k0 = 0;
 static uint64_t global_k1 = 0;
 static int keys_initialized = 0;
@@ -107,32 +142,7 @@ siphash(const void *data, size_t len, uint64_t k0, uint64_t k1)
 		v0 ^= m;
 	}
 
-	b = ((uint64_t)len) << 56;
-	switch (len & 7) {
-	case 7:
-		b |= ((uint64_t)in[6]) << 48;
-		/* fallthrough */
-	case 6:
-		b |= ((uint64_t)in[5]) << 40;
-		/* fallthrough */
-	case 5:
-		b |= ((uint64_t)in[4]) << 32;
-		/* fallthrough */
-	case 4:
-		b |= ((uint64_t)in[3]) << 24;
-		/* fallthrough */
-	case 3:
-		b |= ((uint64_t)in[2]) << 16;
-		/* fallthrough */
-	case 2:
-		b |= ((uint64_t)in[1]) << 8;
-		/* fallthrough */
-	case 1:
-		b |= ((uint64_t)in[0]);
-		/* fallthrough */
-	case 0:
-		break;
-	}
+	b = siphash_final_word(in, len);
 
 	v3 ^= b;
 	SIPROUND;
@@ -155,3 +165,223 @@ siphash_key(const void *data, size_t len, const uint8_t key[16])
 	uint64_t k1 = read64le(key + 8);
 	return siphash(data, len, k0, k1);
 }
+
+/*
+ * Multi-lane SipHash. Each 64-bit vector lane carries one message's state
+ * through the same rounds as siphash(); the 8-lane kernel runs two 4-lane
+ * groups side by side for instruction-level parallelism. Lanes take one
+ * word per step, then their final word, and lanes that have finished keep
+ * their state through the remaining steps by masking, so every lane is
+ * bit-identical to the scalar result whatever the mix of lengths.
+ *
+ * The kernels are built for AVX2 on x86-64, picked at runtime, and for the
+ * baseline NEON unit on aarch64; everything else uses scalar siphash().
+ * There is no SSE2 kernel: without a 64-bit rotate or a whole-vector byte
+ * shuffle each rotation takes three instructions for two lanes, and four
+ * lanes that way hash about 1.5x slower than siphash() does one at a time.
+ */
+#if defined(__x86_64__) || defined(__aarch64__)
+#define SIPHASH_HAVE_LANES 1
+
+#if defined(__x86_64__)
+#define SIP_LANES_TARGET __attribute__((target("avx2")))
+
+static int
+cpu_has_lanes(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#else
+#define SIP_LANES_TARGET
+
+static int
+cpu_has_lanes(void)
+{
+	return 1;
+}
+#endif
+
+typedef uint64_t sip_v4 __attribute__((vector_size(32)));
+typedef uint8_t sip_b32 __attribute__((vector_size(32)));
+
+/* Byte shuffles for the rotations by whole bytes */
+#define SIP_ROT16_LANE(j)                                                      \
+	8 * j + 6, 8 * j + 7, 8 * j + 0, 8 * j + 1, 8 * j + 2, 8 * j + 3,      \
+	    8 * j + 4, 8 * j + 5
+#define SIP_ROT32_LANE(j)                                                      \
+	8 * j + 4, 8 * j + 5, 8 * j + 6, 8 * j + 7, 8 * j + 0, 8 * j + 1,      \
+	    8 * j + 2, 8 * j + 3
+
+static inline SIP_LANES_TARGET __attribute__((always_inline)) sip_v4
+sip_rotl(sip_v4 x, int b)
+{
+	static const sip_b32 rot16 = { SIP_ROT16_LANE(0), SIP_ROT16_LANE(1),
+				       SIP_ROT16_LANE(2), SIP_ROT16_LANE(3) };
+	static const sip_b32 rot32 = { SIP_ROT32_LANE(0), SIP_ROT32_LANE(1),
+				       SIP_ROT32_LANE(2), SIP_ROT32_LANE(3) };
+
+	if (b == 16)
+		return (sip_v4)__builtin_shuffle((sip_b32)x, rot16);
+	if (b == 32)
+		return (sip_v4)__builtin_shuffle((sip_b32)x, rot32);
+	return (x << b) | (x >> (64 - b));
+}
+
+static inline SIP_LANES_TARGET __attribute__((always_inline)) void
+sip_round_v(sip_v4 *v0, sip_v4 *v1, sip_v4 *v2, sip_v4 *v3)
+{
+	*v0 += *v1;
+	*v1 = sip_rotl(*v1, 13);
+	*v1 ^= *v0;
+	*v0 = sip_rotl(*v0, 32);
+	*v2 += *v3;
+	*v3 = sip_rotl(*v3, 16);
+	*v3 ^= *v2;
+	*v0 += *v3;
+	*v3 = sip_rotl(*v3, 21);
+	*v3 ^= *v0;
+	*v2 += *v1;
+	*v1 = sip_rotl(*v1, 17);
+	*v1 ^= *v2;
+	*v2 = sip_rotl(*v2, 32);
+}
+
+/* Message word of lane l at step, or 0 once the lane is done */
+static inline __attribute__((always_inline)) uint64_t
+sip_lane_word(const uint8_t *in, size_t len, size_t step)
+{
+	size_t blocks = len / 8;
+
+	if (step < blocks)
+		return read64le(in + step * 8);
+	if (step == blocks)
+		return siphash_final_word(in + blocks * 8, len);
+	return 0;
+}
+
+static inline SIP_LANES_TARGET __attribute__((always_inline)) void
+sip_lanes(const void *const *data, const size_t *len, uint64_t k0,
+	  uint64_t k1, uint64_t *out, int groups)
+{
+	sip_v4 v0[2], v1[2], v2[2], v3[2];
+	size_t min_steps = SIZE_MAX;
+	size_t steps = 0;
+	int lanes = groups * 4;
+
+	for (int l = 0; l < lanes; l++) {
+		size_t n = len[l] / 8 + 1;
+
+		if (n > steps)
+			steps = n;
+		if (n < min_steps)
+			min_steps = n;
+	}
+	for (int g = 0; g < groups; g++) {
+		v0[g] = (sip_v4){ 0 } + (0x736f6d6570736575ULL ^ k0);
+		v1[g] = (sip_v4){ 0 } + (0x646f72616e646f6dULL ^ k1);
+		v2[g] = (sip_v4){ 0 } + (0x6c7967656e657261ULL ^ k0);
+		v3[g] = (sip_v4){ 0 } + (0x7465646279746573ULL ^ k1);
+	}
+
+	for (size_t step = 0; step < steps; step++) {
+		for (int g = 0; g < groups; g++) {
+			const void *const *d = data + 4 * g;
+			const size_t *n = len + 4 * g;
+			sip_v4 m = { sip_lane_word(d[0], n[0], step),
+				     sip_lane_word(d[1], n[1], step),
+				     sip_lane_word(d[2], n[2], step),
+				     sip_lane_word(d[3], n[3], step) };
+			sip_v4 o0 = v0[g], o1 = v1[g], o2 = v2[g], o3 = v3[g];
+			sip_v4 live;
+
+			v3[g] ^= m;
+			sip_round_v(&v0[g], &v1[g], &v2[g], &v3[g]);
+			sip_round_v(&v0[g], &v1[g], &v2[g], &v3[g]);
+			v0[g] ^= m;
+			if (step < min_steps)
+				continue;
+
+			/* Some lane has already taken its final word */
+			live = (sip_v4){ step * 8 <= n[0], step * 8 <= n[1],
+					 step * 8 <= n[2], step * 8 <= n[3] };
+			live = -live;
+			v0[g] = (v0[g] & live) | (o0 & ~live);
+			v1[g] = (v1[g] & live) | (o1 & ~live);
+			v2[g] = (v2[g] & live) | (o2 & ~live);
+			v3[g] = (v3[g] & live) | (o3 & ~live);
+		}
+	}
+
+	for (int g = 0; g < groups; g++) {
+		sip_v4 h;
+
+		v2[g] ^= 0xff;
+		sip_round_v(&v0[g], &v1[g], &v2[g], &v3[g]);
+		sip_round_v(&v0[g], &v1[g], &v2[g], &v3[g]);
+		sip_round_v(&v0[g], &v1[g], &v2[g], &v3[g]);
+		sip_round_v(&v0[g], &v1[g], &v2[g], &v3[g]);
+		h = v0[g] ^ v1[g] ^ v2[g] ^ v3[g];
+		memcpy(out + 4 * g, &h, sizeof(h));
+	}
+}
+
+static SIP_LANES_TARGET void
+siphash_x4_simd(const void *const data[4], const size_t len[4], uint64_t k0,
+		uint64_t k1, uint64_t out[4])
+{
+	sip_lanes(data, len, k0, k1, out, 1);
+}
+
+static SIP_LANES_TARGET void
+siphash_x8_simd(const void *const data[8], const size_t len[8], uint64_t k0,
+		uint64_t k1, uint64_t out[8])
+{
+	sip_lanes(data, len, k0, k1, out, 2);
+}
+#endif /* __x86_64__ || __aarch64__ */
+
+void
+siphash_x4(const void *const data[4], const size_t len[4], uint64_t k0,
+	   uint64_t k1, uint64_t out[4])
+{
+#ifdef SIPHASH_HAVE_LANES
+	if (cpu_has_lanes()) {
+		siphash_x4_simd(data, len, k0, k1, out);
+		return;
+	}
+#endif
+	for (int i = 0; i < 4; i++)
+		out[i] = siphash(data[i], len[i], k0, k1);
+}
+
+void
+siphash_x8(const void *const data[8], const size_t len[8], uint64_t k0,
+	   uint64_t k1, uint64_t out[8])
+{
+#ifdef SIPHASH_HAVE_LANES
+	if (cpu_has_lanes()) {
+		siphash_x8_simd(data, len, k0, k1, out);
+		return;
+	}
+#endif
+	for (int i = 0; i < 8; i++)
+		out[i] = siphash(data[i], len[i], k0, k1);
+}
+
+void
+siphash_batch(const void *const *data, const size_t *len, size_t n,
+	      uint64_t k0, uint64_t k1, uint64_t *out)
+{
+	size_t i = 0;
+
+#ifdef SIPHASH_HAVE_LANES
+	if (cpu_has_lanes()) {
+		for (; i + 8 <= n; i += 8)
+			siphash_x8_simd(data + i, len + i, k0, k1, out + i);
+		for (; i + 4 <= n; i += 4)
+			siphash_x4_simd(data + i, len + i, k0, k1, out + i);
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = siphash(data[i], len[i], k0, k1);
+}
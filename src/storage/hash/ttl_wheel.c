@@ -0,0 +1,155 @@
+/**
+ * @file ttl_wheel.c
+ */
+
+#include "storage/hash/ttl_wheel.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TTL_WHEEL_MASK (TTL_WHEEL_SLOTS - 1)
+/* Seconds ahead that the top level still covers */
+#define TTL_WHEEL_SPAN (1ULL << (TTL_WHEEL_BITS * TTL_WHEEL_LEVELS))
+
+static int
+slot_push(struct ttl_slot *slot, uint64_t hash, uint32_t expires)
+{
+	if (slot->count == slot->cap) {
+		uint32_t cap = slot->cap ? slot->cap * 2 : 8;
+		struct ttl_timer *timers
+		    = realloc(slot->timers, cap * sizeof(*timers));
+
+		if (!timers)
+			return -ENOMEM;
+		slot->timers = timers;
+		slot->cap = cap;
+	}
+	slot->timers[slot->count].hash = hash;
+	slot->timers[slot->count].expires = expires;
+	slot->count++;
+	return 0;
+}
+
+/* The slot a timer belongs in, given the wheel's clock */
+static struct ttl_slot *
+wheel_slot(struct ttl_wheel *wheel, uint32_t expires)
+{
+	uint64_t at = expires > wheel->clock ? expires : wheel->clock;
+	uint64_t delta = at - wheel->clock;
+	int level;
+
+	if (delta >= TTL_WHEEL_SPAN)
+		at = wheel->clock + TTL_WHEEL_SPAN - 1;
+	for (level = 0; level < TTL_WHEEL_LEVELS - 1; level++) {
+		if (delta < (1ULL << (TTL_WHEEL_BITS * (level + 1))))
+			break;
+	}
+	return &wheel->slots[level]
+			    [(at >> (TTL_WHEEL_BITS * level)) & TTL_WHEEL_MASK];
+}
+
+void
+ttl_wheel_init(struct ttl_wheel *wheel, uint32_t now)
+{
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->clock = now;
+}
+
+void
+ttl_wheel_destroy(struct ttl_wheel *wheel)
+{
+	for (int level = 0; level < TTL_WHEEL_LEVELS; level++)
+		for (uint32_t i = 0; i < TTL_WHEEL_SLOTS; i++)
+			free(wheel->slots[level][i].timers);
+	memset(wheel, 0, sizeof(*wheel));
+}
+
+int
+ttl_wheel_add(struct ttl_wheel *wheel, uint64_t hash, uint32_t expires)
+{
+	int rc = slot_push(wheel_slot(wheel, expires), hash, expires);
+
+	if (rc == 0)
+		wheel->count++;
+	return rc;
+}
+
+/*
+ * Refile a slot's timers one level down or further. Timers that cannot be
+ * refiled for lack of memory stay in the slot, to be tried when the clock
+ * comes around to it again, unless refiling put others there meanwhile;
+ * then they are dropped and their entries left to expire lazily.
+ */
+static void
+cascade_slot(struct ttl_wheel *wheel, struct ttl_slot *slot)
+{
+	struct ttl_slot moving = *slot;
+	uint32_t kept = 0;
+
+	memset(slot, 0, sizeof(*slot));
+	for (uint32_t i = 0; i < moving.count; i++) {
+		struct ttl_timer *timer = &moving.timers[i];
+
+		if (slot_push(wheel_slot(wheel, timer->expires), timer->hash,
+			      timer->expires)
+		    != 0)
+			moving.timers[kept++] = *timer;
+	}
+	if (kept == 0 || slot->count != 0) {
+		free(moving.timers);
+		wheel->count -= kept;
+		return;
+	}
+	moving.count = kept;
+	*slot = moving;
+}
+
+/* Move down the slots whose span starts at the clock, top level first */
+static void
+cascade(struct ttl_wheel *wheel)
+{
+	for (int level = TTL_WHEEL_LEVELS - 1; level > 0; level--) {
+		uint32_t shift = TTL_WHEEL_BITS * level;
+
+		if (wheel->clock & ((1U << shift) - 1))
+			continue;
+		cascade_slot(wheel,
+			     &wheel->slots[level][(wheel->clock >> shift)
+						  & TTL_WHEEL_MASK]);
+	}
+}
+
+size_t
+ttl_wheel_expire(struct ttl_wheel *wheel, uint32_t now, struct ttl_timer *out,
+		 size_t max)
+{
+	size_t n = 0;
+
+	/* An empty wheel skips ahead instead of stepping through the gap */
+	if (wheel->count == 0 && wheel->clock < now) {
+		wheel->clock = now;
+		wheel->cascaded = 0;
+	}
+
+	while (n < max && wheel->clock <= now) {
+		struct ttl_slot *slot;
+
+		if (!wheel->cascaded) {
+			cascade(wheel);
+			wheel->cascaded = 1;
+		}
+		slot = &wheel->slots[0][wheel->clock & TTL_WHEEL_MASK];
+		while (slot->count > 0 && n < max) {
+			out[n++] = slot->timers[--slot->count];
+			wheel->count--;
+		}
+		if (slot->count > 0)
+			break;
+		/* The clock stops at the last second a 32-bit time can hold */
+		if (wheel->clock == UINT32_MAX)
+			break;
+		wheel->clock++;
+		wheel->cascaded = 0;
+	}
+	return n;
+}
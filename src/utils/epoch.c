@@ -0,0 +1,249 @@
+/**
+ * @file epoch.c
+ */
+
+#include "utils/epoch.h"
+#include "utils/futex_mutex_wrapper.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Try to advance the epoch and reclaim after this many retires */
+#define EPOCH_RETIRE_BATCH 64
+
+#define EPOCH_ACTIVE 1ULL
+
+struct epoch_record {
+	/* (epoch << 1) | EPOCH_ACTIVE inside a section, 0 outside */
+	_Atomic uint64_t local;
+	_Atomic int in_use;
+	struct epoch_record *next;
+	unsigned int nesting;
+	unsigned int pending;
+	/* Retired objects, newest first */
+	struct epoch_head *limbo;
+} __attribute__((aligned(64)));
+
+static _Atomic uint64_t global_epoch = 1;
+static _Atomic(struct epoch_record *) records;
+
+/* Callbacks left behind by exited threads */
+static futex_mutex_t orphan_lock;
+static struct epoch_head *orphans;
+
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t epoch_key;
+static __thread struct epoch_record *epoch_self;
+
+static void
+epoch_thread_exit(void *arg)
+{
+	struct epoch_record *rec = arg;
+	struct epoch_head *tail;
+
+	if (rec->limbo) {
+		tail = rec->limbo;
+		while (tail->next)
+			tail = tail->next;
+		futex_mutex_lock_class(&orphan_lock, FUTEX_CLASS_EPOCH);
+		tail->next = orphans;
+		orphans = rec->limbo;
+		futex_mutex_unlock(&orphan_lock);
+		rec->limbo = NULL;
+	}
+	rec->nesting = 0;
+	rec->pending = 0;
+	atomic_store_explicit(&rec->local, 0, memory_order_relaxed);
+	atomic_store_explicit(&rec->in_use, 0, memory_order_release);
+}
+
+static void
+epoch_key_init(void)
+{
+	futex_mutex_init(&orphan_lock);
+	pthread_key_create(&epoch_key, epoch_thread_exit);
+}
+
+static struct epoch_record *
+epoch_register(void)
+{
+	struct epoch_record *rec;
+	int expected;
+
+	pthread_once(&epoch_once, epoch_key_init);
+
+	/* Reuse a record left by an exited thread before allocating */
+	for (rec = atomic_load(&records); rec; rec = rec->next) {
+		expected = 0;
+		if (atomic_compare_exchange_strong(&rec->in_use, &expected, 1))
+			goto out;
+	}
+
+	rec = aligned_alloc(64, sizeof(*rec));
+	if (!rec)
+		abort();
+	atomic_init(&rec->local, 0);
+	atomic_init(&rec->in_use, 1);
+	rec->limbo = NULL;
+	rec->next = atomic_load(&records);
+	while (!atomic_compare_exchange_weak(&records, &rec->next, rec))
+		;
+
+out:
+	rec->nesting = 0;
+	rec->pending = 0;
+	pthread_setspecific(epoch_key, rec);
+	epoch_self = rec;
+	return rec;
+}
+
+static inline struct epoch_record *
+epoch_record(void)
+{
+	struct epoch_record *rec = epoch_self;
+
+	return rec ? rec : epoch_register();
+}
+
+void
+epoch_enter(void)
+{
+	struct epoch_record *rec = epoch_record();
+	uint64_t epoch;
+
+	if (rec->nesting++ > 0)
+		return;
+
+	epoch = atomic_load_explicit(&global_epoch, memory_order_relaxed);
+	atomic_store_explicit(&rec->local, (epoch << 1) | EPOCH_ACTIVE,
+			      memory_order_relaxed);
+	/* Publish the announcement before any shared pointer is loaded */
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+void
+epoch_exit(void)
+{
+	struct epoch_record *rec = epoch_self;
+
+	if (--rec->nesting > 0)
+		return;
+	atomic_store_explicit(&rec->local, 0, memory_order_release);
+}
+
+/* Advance the global epoch if every active reader has caught up to it */
+static uint64_t
+epoch_try_advance(void)
+{
+	uint64_t epoch;
+	uint64_t local;
+	struct epoch_record *rec;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	epoch = atomic_load_explicit(&global_epoch, memory_order_relaxed);
+
+	for (rec = atomic_load(&records); rec; rec = rec->next) {
+		local = atomic_load_explicit(&rec->local, memory_order_acquire);
+		if ((local & EPOCH_ACTIVE) && (local >> 1) != epoch)
+			return epoch;
+	}
+
+	if (atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1))
+		return epoch + 1;
+	return epoch;
+}
+
+/* Detach and run every callback in *list retired at or before safe */
+static void
+epoch_reclaim_list(struct epoch_head **list, uint64_t safe)
+{
+	struct epoch_head *head;
+	struct epoch_head *done = NULL;
+
+	while ((head = *list) != NULL) {
+		if (head->epoch <= safe) {
+			*list = head->next;
+			head->next = done;
+			done = head;
+		} else {
+			list = &head->next;
+		}
+	}
+
+	while (done) {
+		head = done;
+		done = head->next;
+		head->func(head);
+	}
+}
+
+static void
+epoch_reclaim(struct epoch_record *rec, uint64_t epoch, int wait_orphans)
+{
+	uint64_t safe = epoch - 2;
+
+	if (epoch < 2)
+		return;
+
+	epoch_reclaim_list(&rec->limbo, safe);
+
+	if (!wait_orphans) {
+		if (futex_mutex_trylock_class(&orphan_lock,
+					      FUTEX_CLASS_EPOCH) != 0)
+			return;
+	} else {
+		futex_mutex_lock_class(&orphan_lock, FUTEX_CLASS_EPOCH);
+	}
+	epoch_reclaim_list(&orphans, safe);
+	futex_mutex_unlock(&orphan_lock);
+}
+
+void
+epoch_retire(struct epoch_head *head, void (*func)(struct epoch_head *head))
+{
+	struct epoch_record *rec = epoch_record();
+
+	head->func = func;
+	/* The object must be unlinked before its epoch is sampled */
+	atomic_thread_fence(memory_order_seq_cst);
+	head->epoch = atomic_load_explicit(&global_epoch, memory_order_relaxed);
+	head->next = rec->limbo;
+	rec->limbo = head;
+
+	if (++rec->pending < EPOCH_RETIRE_BATCH)
+		return;
+	rec->pending = 0;
+	epoch_reclaim(rec, epoch_try_advance(), 0);
+}
+
+uint64_t
+epoch_get_state(void)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	return atomic_load_explicit(&global_epoch, memory_order_relaxed);
+}
+
+int
+epoch_poll_state(uint64_t state)
+{
+	uint64_t epoch;
+
+	epoch = atomic_load_explicit(&global_epoch, memory_order_acquire);
+	if (epoch >= state + 2)
+		return 1;
+	return epoch_try_advance() >= state + 2;
+}
+
+void
+epoch_synchronize(void)
+{
+	struct epoch_record *rec = epoch_record();
+	uint64_t state = epoch_get_state();
+
+	while (!epoch_poll_state(state))
+		sched_yield();
+
+	epoch_reclaim(rec, atomic_load(&global_epoch), 1);
+}
@@ -0,0 +1,9 @@
+/**
+ * @file futex_mutex.c
+ */
+
+#include "utils/futex_mutex_wrapper.h"
+#include <stdint.h>
+
+/* Spins this thread took to get a lock; see futex_mutex_wrapper.h */
+__thread int32_t futex_spin_estimate;
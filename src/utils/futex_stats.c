@@ -0,0 +1,387 @@
+/**
+ * @file futex_stats.c
+ */
+
+#include "utils/futex_stats.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+
+static const char *const class_names[FUTEX_CLASS_COUNT] = {
+	[FUTEX_CLASS_OTHER] = "other",
+	[FUTEX_CLASS_HASH_SLOT] = "hash_slot",
+	[FUTEX_CLASS_HASH_TABLE] = "hash_table_write",
+	[FUTEX_CLASS_HASH_RESIZE] = "hash_resize",
+	[FUTEX_CLASS_HASH_WHEEL] = "hash_ttl_wheel",
+	[FUTEX_CLASS_HASH_SIPHASH] = "hash_siphash_init",
+	[FUTEX_CLASS_EPOCH] = "epoch_orphans",
+};
+
+const char *
+futex_class_name(int cls)
+{
+	if (cls < 0 || cls >= FUTEX_CLASS_COUNT)
+		return NULL;
+	return class_names[cls];
+}
+
+#ifdef FUTEX_STATS
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* One class's counters in a thread's record; written by that thread only */
+struct futex_class_counters {
+	_Atomic uint64_t acquisitions;
+	_Atomic uint64_t contended;
+	_Atomic uint64_t spin_acquired;
+	_Atomic uint64_t sleeps;
+	_Atomic uint64_t wait_ns;
+	_Atomic uint64_t hold_ns;
+	_Atomic uint64_t wait_hist[FUTEX_STATS_BUCKETS];
+	_Atomic uint64_t hold_hist[FUTEX_STATS_BUCKETS];
+};
+
+/* A lock the thread holds, with when it got it */
+struct futex_held {
+	const void *lock;
+	int cls;
+	uint64_t since;
+};
+
+struct futex_stats_record {
+	struct futex_class_counters classes[FUTEX_CLASS_COUNT];
+	/* Oldest first; locks taken beyond the first few go untimed */
+	struct futex_held held[FUTEX_STATS_MAX_HELD];
+	unsigned int nheld;
+	_Atomic int in_use;
+	struct futex_stats_record *next;
+} __attribute__((aligned(64)));
+
+static _Atomic(struct futex_stats_record *) records;
+
+/* Totals at the last reset, subtracted from every read */
+static pthread_mutex_t baseline_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct futex_class_stats baseline[FUTEX_CLASS_COUNT];
+
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static __thread struct futex_stats_record *stats_self;
+
+static void
+stats_thread_exit(void *arg)
+{
+	struct futex_stats_record *rec = arg;
+
+	/* Locks still held at exit are never released; forget them */
+	rec->nheld = 0;
+	atomic_store_explicit(&rec->in_use, 0, memory_order_release);
+}
+
+static void
+stats_key_init(void)
+{
+	pthread_key_create(&stats_key, stats_thread_exit);
+}
+
+/* Take over an exited thread's record, counts and all, or add one */
+static struct futex_stats_record *
+stats_register(void)
+{
+	struct futex_stats_record *rec;
+	int free_slot;
+
+	pthread_once(&stats_once, stats_key_init);
+	for (rec = atomic_load(&records); rec; rec = rec->next) {
+		free_slot = 0;
+		if (atomic_compare_exchange_strong(&rec->in_use, &free_slot, 1))
+			goto found;
+	}
+
+	rec = aligned_alloc(_Alignof(struct futex_stats_record),
+			    sizeof(*rec));
+	if (!rec)
+		return NULL;
+	memset(rec, 0, sizeof(*rec));
+	atomic_init(&rec->in_use, 1);
+	rec->next = atomic_load(&records);
+	while (!atomic_compare_exchange_weak(&records, &rec->next, rec))
+		;
+found:
+	rec->nheld = 0;
+	pthread_setspecific(stats_key, rec);
+	stats_self = rec;
+	return rec;
+}
+
+static inline struct futex_stats_record *
+stats_record(void)
+{
+	struct futex_stats_record *rec = stats_self;
+
+	return rec ? rec : stats_register();
+}
+
+/* Only the owner writes, so a plain load and store is enough */
+static inline void
+counter_add(_Atomic uint64_t *counter, uint64_t n)
+{
+	atomic_store_explicit(
+	    counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+	    memory_order_relaxed);
+}
+
+static inline unsigned int
+hist_bucket(uint64_t ns)
+{
+	unsigned int bucket = ns ? 64 - (unsigned int)__builtin_clzll(ns) : 0;
+
+	return bucket < FUTEX_STATS_BUCKETS ? bucket : FUTEX_STATS_BUCKETS - 1;
+}
+
+uint64_t
+futex_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void
+futex_stats_acquired(const void *lock, int cls, int sleeps, uint64_t wait_ns)
+{
+	struct futex_stats_record *rec = stats_record();
+	struct futex_class_counters *c;
+
+	if (!rec)
+		return;
+	if (cls < 0 || cls >= FUTEX_CLASS_COUNT)
+		cls = FUTEX_CLASS_OTHER;
+	c = &rec->classes[cls];
+
+	counter_add(&c->acquisitions, 1);
+	if (sleeps != FUTEX_ACQ_FREE) {
+		counter_add(&c->contended, 1);
+		if (sleeps == FUTEX_ACQ_SPUN)
+			counter_add(&c->spin_acquired, 1);
+		else
+			counter_add(&c->sleeps, (uint64_t)sleeps);
+		counter_add(&c->wait_ns, wait_ns);
+		counter_add(&c->wait_hist[hist_bucket(wait_ns)], 1);
+	}
+
+	if (rec->nheld < FUTEX_STATS_MAX_HELD) {
+		rec->held[rec->nheld].lock = lock;
+		rec->held[rec->nheld].cls = cls;
+		rec->held[rec->nheld].since = futex_stats_now();
+		rec->nheld++;
+	}
+}
+
+void
+futex_stats_released(const void *lock)
+{
+	struct futex_stats_record *rec = stats_self;
+	struct futex_class_counters *c;
+	uint64_t hold;
+	unsigned int i;
+
+	if (!rec)
+		return;
+	/* Most releases are of the lock taken last */
+	i = rec->nheld;
+	while (i > 0 && rec->held[i - 1].lock != lock)
+		i--;
+	if (i == 0)
+		return;
+
+	c = &rec->classes[rec->held[i - 1].cls];
+	hold = futex_stats_now() - rec->held[i - 1].since;
+	counter_add(&c->hold_ns, hold);
+	counter_add(&c->hold_hist[hist_bucket(hold)], 1);
+	memmove(&rec->held[i - 1], &rec->held[i],
+		(rec->nheld - i) * sizeof(rec->held[0]));
+	rec->nheld--;
+}
+
+/* Every record's counts, whether or not it has been reset since */
+static void
+stats_sum(struct futex_class_stats *stats)
+{
+	struct futex_stats_record *rec;
+
+	memset(stats, 0, FUTEX_CLASS_COUNT * sizeof(*stats));
+	for (rec = atomic_load(&records); rec; rec = rec->next) {
+		for (int cls = 0; cls < FUTEX_CLASS_COUNT; cls++) {
+			struct futex_class_counters *c = &rec->classes[cls];
+			struct futex_class_stats *s = &stats[cls];
+
+			s->acquisitions += atomic_load_explicit(
+			    &c->acquisitions, memory_order_relaxed);
+			s->contended += atomic_load_explicit(
+			    &c->contended, memory_order_relaxed);
+			s->spin_acquired += atomic_load_explicit(
+			    &c->spin_acquired, memory_order_relaxed);
+			s->sleeps += atomic_load_explicit(
+			    &c->sleeps, memory_order_relaxed);
+			s->wait_ns += atomic_load_explicit(
+			    &c->wait_ns, memory_order_relaxed);
+			s->hold_ns += atomic_load_explicit(
+			    &c->hold_ns, memory_order_relaxed);
+			for (int b = 0; b < FUTEX_STATS_BUCKETS; b++) {
+				s->wait_hist[b] += atomic_load_explicit(
+				    &c->wait_hist[b], memory_order_relaxed);
+				s->hold_hist[b] += atomic_load_explicit(
+				    &c->hold_hist[b], memory_order_relaxed);
+			}
+		}
+	}
+}
+
+int
+futex_stats_read(struct futex_class_stats *stats)
+{
+	if (!stats)
+		return -EINVAL;
+
+	pthread_mutex_lock(&baseline_lock);
+	stats_sum(stats);
+	for (int cls = 0; cls < FUTEX_CLASS_COUNT; cls++) {
+		struct futex_class_stats *s = &stats[cls];
+		const struct futex_class_stats *base = &baseline[cls];
+
+		s->acquisitions -= base->acquisitions;
+		s->contended -= base->contended;
+		s->spin_acquired -= base->spin_acquired;
+		s->sleeps -= base->sleeps;
+		s->wait_ns -= base->wait_ns;
+		s->hold_ns -= base->hold_ns;
+		for (int b = 0; b < FUTEX_STATS_BUCKETS; b++) {
+			s->wait_hist[b] -= base->wait_hist[b];
+			s->hold_hist[b] -= base->hold_hist[b];
+		}
+	}
+	pthread_mutex_unlock(&baseline_lock);
+	return 0;
+}
+
+int
+futex_stats_reset(void)
+{
+	pthread_mutex_lock(&baseline_lock);
+	stats_sum(baseline);
+	pthread_mutex_unlock(&baseline_lock);
+	return 0;
+}
+
+/* Upper bound of the histogram bucket holding the given fraction */
+static uint64_t
+hist_quantile(const uint64_t *hist, double q)
+{
+	uint64_t total = 0;
+	uint64_t seen = 0;
+	uint64_t rank;
+
+	for (int b = 0; b < FUTEX_STATS_BUCKETS; b++)
+		total += hist[b];
+	if (total == 0)
+		return 0;
+	rank = (uint64_t)((double)(total - 1) * q) + 1;
+	for (int b = 0; b < FUTEX_STATS_BUCKETS; b++) {
+		seen += hist[b];
+		if (seen >= rank)
+			return b == 0 ? 0 : (1ULL << b) - 1;
+	}
+	return (1ULL << (FUTEX_STATS_BUCKETS - 1)) - 1;
+}
+
+static void
+dump_hist(FILE *out, const char *name, uint64_t total_ns,
+	  const uint64_t *hist)
+{
+	fprintf(out,
+		"      \"%s\": {\"total\": %llu, \"p50\": %llu, "
+		"\"p99\": %llu, \"log2_histogram\": [",
+		name, (unsigned long long)total_ns,
+		(unsigned long long)hist_quantile(hist, 0.50),
+		(unsigned long long)hist_quantile(hist, 0.99));
+	for (int b = 0; b < FUTEX_STATS_BUCKETS; b++)
+		fprintf(out, "%s%llu", b ? ", " : "",
+			(unsigned long long)hist[b]);
+	fprintf(out, "]}");
+}
+
+int
+futex_stats_dump_json(FILE *out)
+{
+	struct futex_class_stats stats[FUTEX_CLASS_COUNT];
+
+	if (!out)
+		return -EINVAL;
+	futex_stats_read(stats);
+
+	fprintf(out, "{\n");
+	for (int cls = 0; cls < FUTEX_CLASS_COUNT; cls++) {
+		const struct futex_class_stats *s = &stats[cls];
+
+		fprintf(out,
+			"  \"%s\": {\n"
+			"      \"acquisitions\": %llu,\n"
+			"      \"contended\": %llu,\n"
+			"      \"spin_acquired\": %llu,\n"
+			"      \"sleeps\": %llu,\n",
+			class_names[cls], (unsigned long long)s->acquisitions,
+			(unsigned long long)s->contended,
+			(unsigned long long)s->spin_acquired,
+			(unsigned long long)s->sleeps);
+		dump_hist(out, "wait_ns", s->wait_ns, s->wait_hist);
+		fprintf(out, ",\n");
+		dump_hist(out, "hold_ns", s->hold_ns, s->hold_hist);
+		fprintf(out, "\n  }%s\n",
+			cls + 1 < FUTEX_CLASS_COUNT ? "," : "");
+	}
+	fprintf(out, "}\n");
+	return ferror(out) ? -EIO : 0;
+}
+
+#else /* !FUTEX_STATS */
+
+int
+futex_stats_read(struct futex_class_stats *stats)
+{
+	return -ENOTSUP;
+}
+
+int
+futex_stats_reset(void)
+{
+	return -ENOTSUP;
+}
+
+int
+futex_stats_dump_json(FILE *out)
+{
+	return -ENOTSUP;
+}
+
+uint64_t
+futex_stats_now(void)
+{
+	return 0;
+}
+
+void
+futex_stats_acquired(const void *lock, int cls, int sleeps, uint64_t wait_ns)
+{
+}
+
+void
+futex_stats_released(const void *lock)
+{
+}
+
+#endif /* FUTEX_STATS */
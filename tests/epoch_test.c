@@ -0,0 +1,303 @@
+/**
+ * @file epoch_test.c
+ * @brief Tests for epoch-based reclamation
+ *
+ * Checks that retired objects outlive every read section that could still
+ * reference them, and that they are reclaimed once those sections end.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "utils/epoch.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+#define STRESS_THREADS 4
+#define STRESS_ITERATIONS 20000
+#define NODE_MAGIC 0x5eedf00dU
+
+struct test_node {
+	struct epoch_head epoch;
+	unsigned int magic;
+	_Atomic int *freed;
+};
+
+static void
+test_node_free(struct epoch_head *head)
+{
+	struct test_node *node = (struct test_node *)head;
+
+	if (node->freed)
+		atomic_fetch_add(node->freed, 1);
+	node->magic = 0;
+	free(node);
+}
+
+static struct test_node *
+test_node_alloc(_Atomic int *freed)
+{
+	struct test_node *node = malloc(sizeof(*node));
+
+	if (!node)
+		return NULL;
+	node->magic = NODE_MAGIC;
+	node->freed = freed;
+	return node;
+}
+
+/* Test: Retired objects are freed by epoch_synchronize */
+static int
+test_retire_and_synchronize(void)
+{
+	_Atomic int freed = 0;
+	struct test_node *node;
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		node = test_node_alloc(&freed);
+		if (!node)
+			return TEST_FAILED;
+		epoch_retire(&node->epoch, test_node_free);
+	}
+
+	epoch_synchronize();
+
+	if (atomic_load(&freed) != 10) {
+		fprintf(stderr, "Expected 10 frees, got %d\n",
+			atomic_load(&freed));
+		return TEST_FAILED;
+	}
+	return TEST_PASSED;
+}
+
+/* Test: Grace periods wait for the outermost epoch_exit */
+static int
+test_nested_sections(void)
+{
+	uint64_t state;
+	int i;
+
+	epoch_enter();
+	epoch_enter();
+	state = epoch_get_state();
+	epoch_exit();
+
+	/* Still inside the outer section: the epoch cannot move far */
+	for (i = 0; i < 100; i++) {
+		if (epoch_poll_state(state)) {
+			epoch_exit();
+			return TEST_FAILED;
+		}
+	}
+	epoch_exit();
+
+	for (i = 0; i < 100; i++) {
+		if (epoch_poll_state(state))
+			return TEST_PASSED;
+	}
+	return TEST_FAILED;
+}
+
+struct reader_args {
+	_Atomic int *in_section;
+	_Atomic int *release;
+};
+
+static void *
+blocking_reader(void *arg)
+{
+	struct reader_args *args = arg;
+
+	epoch_enter();
+	atomic_store(args->in_section, 1);
+	while (!atomic_load(args->release))
+		usleep(100);
+	epoch_exit();
+	return NULL;
+}
+
+/* Test: Another thread's open section holds back reclamation */
+static int
+test_reader_blocks_reclaim(void)
+{
+	_Atomic int in_section = 0;
+	_Atomic int release = 0;
+	_Atomic int freed = 0;
+	struct reader_args args;
+	struct test_node *node;
+	pthread_t thread;
+	uint64_t state;
+	int i;
+
+	args.in_section = &in_section;
+	args.release = &release;
+	pthread_create(&thread, NULL, blocking_reader, &args);
+	while (!atomic_load(&in_section))
+		usleep(100);
+
+	node = test_node_alloc(&freed);
+	if (!node) {
+		atomic_store(&release, 1);
+		pthread_join(thread, NULL);
+		return TEST_FAILED;
+	}
+	state = epoch_get_state();
+	epoch_retire(&node->epoch, test_node_free);
+
+	for (i = 0; i < 1000; i++) {
+		if (epoch_poll_state(state) || atomic_load(&freed)) {
+			fprintf(stderr, "Grace period ended under a reader\n");
+			atomic_store(&release, 1);
+			pthread_join(thread, NULL);
+			return TEST_FAILED;
+		}
+	}
+
+	atomic_store(&release, 1);
+	pthread_join(thread, NULL);
+	epoch_synchronize();
+
+	return atomic_load(&freed) == 1 ? TEST_PASSED : TEST_FAILED;
+}
+
+static _Atomic(struct test_node *) shared_node;
+static _Atomic int stress_errors;
+
+static void *
+stress_reader(void *arg)
+{
+	_Atomic int *stop = arg;
+	struct test_node *node;
+
+	while (!atomic_load(stop)) {
+		epoch_enter();
+		node = atomic_load(&shared_node);
+		if (node && node->magic != NODE_MAGIC)
+			atomic_fetch_add(&stress_errors, 1);
+		epoch_exit();
+	}
+	return NULL;
+}
+
+/* Test: Readers never see a freed object while writers swap and retire */
+static int
+test_concurrent_swap_and_retire(void)
+{
+	pthread_t threads[STRESS_THREADS];
+	_Atomic int stop = 0;
+	_Atomic int freed = 0;
+	struct test_node *node;
+	struct test_node *prev;
+	int i;
+
+	atomic_store(&stress_errors, 0);
+	atomic_store(&shared_node, test_node_alloc(&freed));
+
+	for (i = 0; i < STRESS_THREADS; i++)
+		pthread_create(&threads[i], NULL, stress_reader, &stop);
+
+	for (i = 0; i < STRESS_ITERATIONS; i++) {
+		node = test_node_alloc(&freed);
+		if (!node)
+			break;
+		prev = atomic_exchange(&shared_node, node);
+		epoch_retire(&prev->epoch, test_node_free);
+	}
+
+	atomic_store(&stop, 1);
+	for (i = 0; i < STRESS_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	prev = atomic_exchange(&shared_node, NULL);
+	if (prev)
+		epoch_retire(&prev->epoch, test_node_free);
+	epoch_synchronize();
+
+	if (atomic_load(&stress_errors) != 0) {
+		fprintf(stderr, "Readers saw %d freed objects\n",
+			atomic_load(&stress_errors));
+		return TEST_FAILED;
+	}
+	if (atomic_load(&freed) != STRESS_ITERATIONS + 1) {
+		fprintf(stderr, "Expected %d frees, got %d\n",
+			STRESS_ITERATIONS + 1, atomic_load(&freed));
+		return TEST_FAILED;
+	}
+	return TEST_PASSED;
+}
+
+static void *
+retire_and_exit(void *arg)
+{
+	struct test_node *node = test_node_alloc(arg);
+
+	if (node)
+		epoch_retire(&node->epoch, test_node_free);
+	return NULL;
+}
+
+/* Test: Objects retired by exited threads are still reclaimed */
+static int
+test_thread_exit_orphans(void)
+{
+	_Atomic int freed = 0;
+	pthread_t thread;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		pthread_create(&thread, NULL, retire_and_exit, &freed);
+		pthread_join(thread, NULL);
+	}
+
+	epoch_synchronize();
+
+	if (atomic_load(&freed) != 8) {
+		fprintf(stderr, "Expected 8 frees, got %d\n",
+			atomic_load(&freed));
+		return TEST_FAILED;
+	}
+	return TEST_PASSED;
+}
+
+int
+main(void)
+{
+	printf("===== Epoch Reclamation Tests =====\n\n");
+
+	RUN_TEST(test_retire_and_synchronize);
+	RUN_TEST(test_nested_sections);
+	RUN_TEST(test_reader_blocks_reclaim);
+	RUN_TEST(test_concurrent_swap_and_retire);
+	RUN_TEST(test_thread_exit_orphans);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,270 @@
+/**
+ * @file futex_lock_test.c
+ * @brief Tests for the futex mutex and reader-writer lock
+ *
+ * Checks that the adaptive mutex still excludes and keeps its spin budget
+ * in bounds; that the reader-writer lock lets readers share and writers
+ * exclude everyone; that a waiting writer holds off new readers; and that
+ * sleeping readers and writers are all woken.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "utils/futex_mutex_wrapper.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+#define LOCK_THREADS 8
+#define LOCK_OPS 50000
+#define SLEEPERS 4
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+struct shared {
+	futex_mutex_t mutex;
+	futex_rwlock_t rwlock;
+	/* Written non-atomically under the lock */
+	volatile uint64_t a;
+	volatile uint64_t b;
+	_Atomic int torn;
+	_Atomic int done;
+};
+
+static void *
+mutex_worker(void *p)
+{
+	struct shared *sh = p;
+
+	for (int i = 0; i < LOCK_OPS; i++) {
+		futex_mutex_lock(&sh->mutex);
+		sh->a = sh->a + 1;
+		futex_mutex_unlock(&sh->mutex);
+	}
+	if (futex_spin_estimate < 0 || futex_spin_estimate > FUTEX_SPIN_LIMIT)
+		atomic_store(&sh->torn, 1);
+	return NULL;
+}
+
+static int
+test_mutex_exclusion(void)
+{
+	static struct shared sh;
+	pthread_t threads[LOCK_THREADS];
+
+	futex_mutex_init(&sh.mutex);
+	for (int i = 0; i < LOCK_THREADS; i++)
+		pthread_create(&threads[i], NULL, mutex_worker, &sh);
+	for (int i = 0; i < LOCK_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	if (sh.a != (uint64_t)LOCK_THREADS * LOCK_OPS || atomic_load(&sh.torn))
+		return TEST_FAILED;
+	/* The budget stays within its bounds whatever was learned */
+	if (futex_spin_budget(0) != FUTEX_SPIN_MIN
+	    || futex_spin_budget(FUTEX_SPIN_LIMIT) != FUTEX_SPIN_LIMIT
+	    || futex_spin_learn(0, 80) != 10 || futex_spin_learn(80, 0) != 70)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+/* Every fourth thread writes; the rest check a and b never differ */
+static void *
+rw_worker(void *p)
+{
+	struct shared *sh = p;
+	static _Atomic int next_id;
+	int writer = atomic_fetch_add(&next_id, 1) % 4 == 0;
+
+	for (int i = 0; i < LOCK_OPS; i++) {
+		if (writer) {
+			futex_rwlock_wrlock(&sh->rwlock);
+			sh->a = sh->a + 1;
+			CPU_RELAX();
+			sh->b = sh->b + 1;
+			futex_rwlock_wrunlock(&sh->rwlock);
+		} else {
+			futex_rwlock_rdlock(&sh->rwlock);
+			if (sh->a != sh->b)
+				atomic_store(&sh->torn, 1);
+			futex_rwlock_rdunlock(&sh->rwlock);
+		}
+	}
+	return NULL;
+}
+
+static int
+test_rwlock_exclusion(void)
+{
+	static struct shared sh;
+	pthread_t threads[LOCK_THREADS];
+
+	futex_rwlock_init(&sh.rwlock);
+	for (int i = 0; i < LOCK_THREADS; i++)
+		pthread_create(&threads[i], NULL, rw_worker, &sh);
+	for (int i = 0; i < LOCK_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	if (atomic_load(&sh.torn)
+	    || sh.a != (uint64_t)(LOCK_THREADS / 4) * LOCK_OPS || sh.a != sh.b
+	    || atomic_load(&sh.rwlock.state) != 0)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+static int
+test_rwlock_trylock(void)
+{
+	futex_rwlock_t lock;
+	int rc = TEST_PASSED;
+
+	futex_rwlock_init(&lock);
+
+	/* Readers share */
+	if (futex_rwlock_tryrdlock(&lock) != 0
+	    || futex_rwlock_tryrdlock(&lock) != 0
+	    || futex_rwlock_trywrlock(&lock) != EBUSY)
+		rc = TEST_FAILED;
+	futex_rwlock_rdunlock(&lock);
+	futex_rwlock_rdunlock(&lock);
+
+	/* A writer excludes both */
+	if (futex_rwlock_trywrlock(&lock) != 0
+	    || futex_rwlock_tryrdlock(&lock) != EBUSY
+	    || futex_rwlock_trywrlock(&lock) != EBUSY)
+		rc = TEST_FAILED;
+	futex_rwlock_wrunlock(&lock);
+
+	if (atomic_load(&lock.state) != 0 || futex_rwlock_trywrlock(&lock) != 0)
+		rc = TEST_FAILED;
+	futex_rwlock_wrunlock(&lock);
+	return rc;
+}
+
+static void *
+writer_thread(void *p)
+{
+	struct shared *sh = p;
+
+	futex_rwlock_wrlock(&sh->rwlock);
+	sh->a = sh->a + 1;
+	futex_rwlock_wrunlock(&sh->rwlock);
+	return NULL;
+}
+
+static void *
+reader_thread(void *p)
+{
+	struct shared *sh = p;
+
+	futex_rwlock_rdlock(&sh->rwlock);
+	atomic_fetch_add(&sh->done, 1);
+	futex_rwlock_rdunlock(&sh->rwlock);
+	return NULL;
+}
+
+/* Wait until a sleeper has set bit in the lock's state */
+static int
+wait_for_bit(futex_rwlock_t *lock, uint32_t bit)
+{
+	for (int i = 0; i < 5000; i++) {
+		if (atomic_load(&lock->state) & bit)
+			return 1;
+		usleep(1000);
+	}
+	return 0;
+}
+
+static int
+test_rwlock_writer_preference(void)
+{
+	static struct shared sh;
+	pthread_t writer;
+	int rc = TEST_PASSED;
+
+	futex_rwlock_init(&sh.rwlock);
+	futex_rwlock_rdlock(&sh.rwlock);
+	pthread_create(&writer, NULL, writer_thread, &sh);
+
+	/* Once the writer waits, readers queue behind it */
+	if (!wait_for_bit(&sh.rwlock, FUTEX_RW_WRITERS_WAITING)
+	    || futex_rwlock_tryrdlock(&sh.rwlock) != EBUSY)
+		rc = TEST_FAILED;
+
+	futex_rwlock_rdunlock(&sh.rwlock);
+	pthread_join(writer, NULL);
+	if (sh.a != 1 || atomic_load(&sh.rwlock.state) != 0)
+		rc = TEST_FAILED;
+	return rc;
+}
+
+static int
+test_rwlock_wakes_sleepers(void)
+{
+	static struct shared sh;
+	pthread_t readers[SLEEPERS];
+	pthread_t writers[SLEEPERS];
+	int rc = TEST_PASSED;
+
+	futex_rwlock_init(&sh.rwlock);
+	futex_rwlock_wrlock(&sh.rwlock);
+	for (int i = 0; i < SLEEPERS; i++) {
+		pthread_create(&readers[i], NULL, reader_thread, &sh);
+		pthread_create(&writers[i], NULL, writer_thread, &sh);
+	}
+	if (!wait_for_bit(&sh.rwlock, FUTEX_RW_READERS_WAITING)
+	    || !wait_for_bit(&sh.rwlock, FUTEX_RW_WRITERS_WAITING))
+		rc = TEST_FAILED;
+	futex_rwlock_wrunlock(&sh.rwlock);
+
+	for (int i = 0; i < SLEEPERS; i++) {
+		pthread_join(readers[i], NULL);
+		pthread_join(writers[i], NULL);
+	}
+	if (atomic_load(&sh.done) != SLEEPERS || sh.a != SLEEPERS
+	    || atomic_load(&sh.rwlock.state) != 0)
+		rc = TEST_FAILED;
+	return rc;
+}
+
+int
+main(void)
+{
+	printf("===== Futex Lock Tests =====\n\n");
+
+	RUN_TEST(test_mutex_exclusion);
+	RUN_TEST(test_rwlock_exclusion);
+	RUN_TEST(test_rwlock_trylock);
+	RUN_TEST(test_rwlock_writer_preference);
+	RUN_TEST(test_rwlock_wakes_sleepers);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
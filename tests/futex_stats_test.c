@@ -0,0 +1,276 @@
+/**
+ * @file futex_stats_test.c
+ * @brief Tests for the opt-in futex contention counters
+ *
+ * Built with -DFUTEX_STATS (see the Makefile). Checks that uncontended
+ * acquisitions are counted with their hold times; that a waiter held off
+ * long enough to sleep is counted as contended, with its wait; that counts
+ * outlive the threads that made them; that reset starts the counts over;
+ * and that the JSON dump names every class.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "utils/futex_mutex_wrapper.h"
+#include "utils/futex_stats.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+#define UNCONTENDED_OPS 1000
+#define EXIT_THREADS 4
+#define HOLD_USEC 20000
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+static uint64_t
+hist_sum(const uint64_t *hist)
+{
+	uint64_t total = 0;
+
+	for (int b = 0; b < FUTEX_STATS_BUCKETS; b++)
+		total += hist[b];
+	return total;
+}
+
+static int
+test_uncontended(void)
+{
+	struct futex_class_stats stats[FUTEX_CLASS_COUNT];
+	const struct futex_class_stats *s = &stats[FUTEX_CLASS_HASH_SLOT];
+	futex_mutex_t lock;
+
+	futex_mutex_init(&lock);
+	if (futex_stats_reset() != 0)
+		return TEST_FAILED;
+	for (int i = 0; i < UNCONTENDED_OPS; i++) {
+		futex_mutex_lock_class(&lock, FUTEX_CLASS_HASH_SLOT);
+		futex_mutex_unlock(&lock);
+	}
+	if (futex_mutex_trylock_class(&lock, FUTEX_CLASS_HASH_SLOT) != 0)
+		return TEST_FAILED;
+	futex_mutex_unlock(&lock);
+
+	if (futex_stats_read(stats) != 0)
+		return TEST_FAILED;
+	if (s->acquisitions != UNCONTENDED_OPS + 1 || s->contended != 0
+	    || s->sleeps != 0 || hist_sum(s->wait_hist) != 0
+	    || hist_sum(s->hold_hist) != UNCONTENDED_OPS + 1)
+		return TEST_FAILED;
+	/* Nothing leaked into the other classes */
+	for (int cls = 0; cls < FUTEX_CLASS_COUNT; cls++)
+		if (cls != FUTEX_CLASS_HASH_SLOT && stats[cls].acquisitions)
+			return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+struct holder {
+	futex_mutex_t lock;
+	_Atomic int locked;
+};
+
+static void *
+hold_lock(void *p)
+{
+	struct holder *h = p;
+
+	futex_mutex_lock_class(&h->lock, FUTEX_CLASS_HASH_RESIZE);
+	atomic_store(&h->locked, 1);
+	usleep(HOLD_USEC);
+	futex_mutex_unlock(&h->lock);
+	return NULL;
+}
+
+static int
+test_contended_sleep(void)
+{
+	struct futex_class_stats stats[FUTEX_CLASS_COUNT];
+	const struct futex_class_stats *s = &stats[FUTEX_CLASS_HASH_RESIZE];
+	struct holder h;
+	pthread_t tid;
+
+	futex_mutex_init(&h.lock);
+	atomic_init(&h.locked, 0);
+	futex_stats_reset();
+	pthread_create(&tid, NULL, hold_lock, &h);
+	while (!atomic_load(&h.locked))
+		usleep(100);
+
+	/* The holder keeps it far longer than any spin lasts */
+	futex_mutex_lock_class(&h.lock, FUTEX_CLASS_HASH_RESIZE);
+	futex_mutex_unlock(&h.lock);
+	pthread_join(tid, NULL);
+
+	futex_stats_read(stats);
+	if (s->acquisitions != 2 || s->contended != 1 || s->spin_acquired != 0
+	    || s->sleeps < 1 || hist_sum(s->wait_hist) != 1
+	    || hist_sum(s->hold_hist) != 2)
+		return TEST_FAILED;
+	/* Most of the holder's sleep was spent waiting, and all of it held */
+	if (s->wait_ns < HOLD_USEC * 1000ULL / 2
+	    || s->hold_ns < HOLD_USEC * 1000ULL)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+static void *
+lock_and_exit(void *p)
+{
+	futex_mutex_t *lock = p;
+
+	for (int i = 0; i < UNCONTENDED_OPS; i++) {
+		futex_mutex_lock_class(lock, FUTEX_CLASS_EPOCH);
+		futex_mutex_unlock(lock);
+	}
+	return NULL;
+}
+
+static int
+test_exited_threads_counted(void)
+{
+	struct futex_class_stats stats[FUTEX_CLASS_COUNT];
+	pthread_t tids[EXIT_THREADS];
+	futex_mutex_t lock;
+
+	futex_mutex_init(&lock);
+	futex_stats_reset();
+	/* One after another, so later threads take over earlier records */
+	for (int i = 0; i < EXIT_THREADS; i++) {
+		pthread_create(&tids[i], NULL, lock_and_exit, &lock);
+		pthread_join(tids[i], NULL);
+	}
+
+	futex_stats_read(stats);
+	if (stats[FUTEX_CLASS_EPOCH].acquisitions
+	    != (uint64_t)EXIT_THREADS * UNCONTENDED_OPS)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+static int
+test_reset(void)
+{
+	struct futex_class_stats stats[FUTEX_CLASS_COUNT];
+	futex_mutex_t lock;
+
+	futex_mutex_init(&lock);
+	futex_mutex_lock(&lock);
+	futex_mutex_unlock(&lock);
+	futex_stats_reset();
+
+	futex_stats_read(stats);
+	for (int cls = 0; cls < FUTEX_CLASS_COUNT; cls++)
+		if (stats[cls].acquisitions || stats[cls].hold_ns
+		    || hist_sum(stats[cls].hold_hist))
+			return TEST_FAILED;
+
+	futex_mutex_lock(&lock);
+	futex_mutex_unlock(&lock);
+	futex_stats_read(stats);
+	if (stats[FUTEX_CLASS_OTHER].acquisitions != 1)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+static int
+test_nested_hold_times(void)
+{
+	struct futex_class_stats stats[FUTEX_CLASS_COUNT];
+	const struct futex_class_stats *s = &stats[FUTEX_CLASS_HASH_TABLE];
+	futex_mutex_t outer;
+	futex_mutex_t inner;
+
+	futex_mutex_init(&outer);
+	futex_mutex_init(&inner);
+	futex_stats_reset();
+
+	/* Released out of order, as old and new table slots can be */
+	futex_mutex_lock_class(&outer, FUTEX_CLASS_HASH_TABLE);
+	futex_mutex_lock_class(&inner, FUTEX_CLASS_HASH_TABLE);
+	usleep(1000);
+	futex_mutex_unlock(&outer);
+	futex_mutex_unlock(&inner);
+
+	futex_stats_read(stats);
+	if (s->acquisitions != 2 || hist_sum(s->hold_hist) != 2
+	    || s->hold_ns < 2 * 1000000ULL)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+static int
+test_dump_json(void)
+{
+	char buf[16384];
+	size_t len;
+	FILE *out;
+	int rc = TEST_PASSED;
+
+	out = tmpfile();
+	if (!out)
+		return TEST_FAILED;
+	if (futex_stats_dump_json(out) != 0)
+		rc = TEST_FAILED;
+	rewind(out);
+	len = fread(buf, 1, sizeof(buf) - 1, out);
+	buf[len] = '\0';
+	fclose(out);
+
+	if (len == 0 || buf[0] != '{')
+		rc = TEST_FAILED;
+	for (int cls = 0; cls < FUTEX_CLASS_COUNT; cls++) {
+		char key[64];
+
+		snprintf(key, sizeof(key), "\"%s\": {", futex_class_name(cls));
+		if (!strstr(buf, key))
+			rc = TEST_FAILED;
+	}
+	if (!strstr(buf, "\"log2_histogram\"") || futex_class_name(-1)
+	    || futex_class_name(FUTEX_CLASS_COUNT))
+		rc = TEST_FAILED;
+	return rc;
+}
+
+int
+main(void)
+{
+	printf("===== Futex Stats Tests =====\n\n");
+
+	RUN_TEST(test_uncontended);
+	RUN_TEST(test_contended_sleep);
+	RUN_TEST(test_exited_threads_counted);
+	RUN_TEST(test_reset);
+	RUN_TEST(test_nested_hold_times);
+	RUN_TEST(test_dump_json);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
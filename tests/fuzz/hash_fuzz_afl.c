@@ -91,9 +91,9 @@ execute_text_operations(const char *input, size_t size)
 				(void)hash_delete(&engine, key, strlen(key));
 			}
 		} else if (strcmp(operation, "STATS") == 0) {
-			uint32_t item_count;
-			uint32_t bucket_count;
-			uint32_t memory_usage;
+			uint64_t item_count;
+			uint64_t bucket_count;
+			uint64_t memory_usage;
 			(void)hash_engine_get_stats(
 			    &engine, &item_count, &bucket_count, &memory_usage);
 		}
@@ -45,9 +45,9 @@ parse_and_execute_operations(const uint8_t *data, size_t size)
 	const uint8_t *value_data;
 	const void *retrieved_value;
 	size_t retrieved_len;
-	uint32_t item_count;
-	uint32_t bucket_count;
-	uint32_t memory_usage;
+	uint64_t item_count;
+	uint64_t bucket_count;
+	uint64_t memory_usage;
 
 	offset = 0;
 
@@ -0,0 +1,332 @@
+/**
+ * @file hash_background_resize_test.c
+ * @brief Tests for resizes driven by background worker threads
+ *
+ * Covers configuration, the completion callback, resizes finishing without
+ * foreground help, and keys staying intact while writers race the workers.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "storage/hash_engine.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+#define WRITER_THREADS 4
+#define KEYS_PER_WRITER 5000
+/* 10 s in 1 ms steps */
+#define SETTLE_POLLS 10000
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+struct resize_log {
+	_Atomic int calls;
+	_Atomic uint64_t last_bucket_count;
+	_Atomic uint32_t bad_shard;
+};
+
+static void
+record_resize(void *arg, uint32_t shard, uint64_t bucket_count)
+{
+	struct resize_log *log = arg;
+
+	if (shard != 0)
+		atomic_store(&log->bad_shard, 1);
+	atomic_store(&log->last_bucket_count, bucket_count);
+	atomic_fetch_add(&log->calls, 1);
+}
+
+static int
+init_background(struct hash_engine *engine, uint32_t shard_count,
+		uint32_t assist_budget, struct resize_log *log)
+{
+	struct hash_engine_config config = {
+		.bucket_count = MIN_BUCKET_COUNT * shard_count,
+		.shard_count = shard_count,
+		.resize_mode = HASH_RESIZE_BACKGROUND,
+		.resize_threads = 2,
+		.assist_budget = assist_budget,
+		.resize_done = log ? record_resize : NULL,
+		.resize_done_arg = log,
+	};
+
+	return hash_engine_init_config(engine, &config);
+}
+
+static int
+check_key(struct hash_engine *engine, int thread, int id)
+{
+	char key[32];
+	int stored;
+	size_t value_len;
+
+	snprintf(key, sizeof(key), "bg_key_%d_%d", thread, id);
+	if (hash_get_copy(engine, key, strlen(key), &stored, sizeof(stored),
+			  &value_len)
+	    != 0)
+		return -1;
+	return stored == id ? 0 : -1;
+}
+
+static int
+put_key(struct hash_engine *engine, int thread, int id)
+{
+	char key[32];
+
+	snprintf(key, sizeof(key), "bg_key_%d_%d", thread, id);
+	return hash_put(engine, key, strlen(key), &id, sizeof(id));
+}
+
+static int
+delete_key(struct hash_engine *engine, int thread, int id)
+{
+	char key[32];
+
+	snprintf(key, sizeof(key), "bg_key_%d_%d", thread, id);
+	return hash_delete(engine, key, strlen(key));
+}
+
+/* Wait for the workers to bring the total size into [lo, hi] */
+static int
+wait_settled(struct hash_engine *engine, uint64_t lo, uint64_t hi)
+{
+	uint64_t buckets;
+	uint32_t i;
+	int poll;
+
+	for (poll = 0; poll < SETTLE_POLLS; poll++) {
+		int pending = 0;
+
+		for (i = 0; i < engine->shard_count; i++) {
+			if (atomic_load(&engine->shards[i].old_table))
+				pending = 1;
+		}
+		hash_engine_get_stats(engine, NULL, &buckets, NULL);
+		if (!pending && buckets >= lo && buckets <= hi)
+			return 0;
+		usleep(1000);
+	}
+	return -1;
+}
+
+/* Test: Unknown resize modes and oversized worker pools are rejected */
+static int
+test_config_validation(void)
+{
+	struct hash_engine engine;
+	struct hash_engine_config config = {
+		.bucket_count = 64,
+		.resize_mode = 7,
+	};
+
+	if (hash_engine_init_config(&engine, &config) != -EINVAL)
+		return TEST_FAILED;
+	config.resize_mode = HASH_RESIZE_BACKGROUND;
+	config.resize_threads = HASH_MAX_RESIZE_THREADS + 1;
+	if (hash_engine_init_config(&engine, &config) != -EINVAL)
+		return TEST_FAILED;
+	config.resize_threads = 0;
+	if (hash_engine_init_config(&engine, &config) != 0)
+		return TEST_FAILED;
+	if (engine.resize_thread_count != 1 || engine.assist_budget != 0) {
+		hash_engine_destroy(&engine);
+		return TEST_FAILED;
+	}
+	hash_engine_destroy(&engine);
+	return TEST_PASSED;
+}
+
+/* Test: Workers grow the table with no foreground assist and report it */
+static int
+test_workers_finish_resize(void)
+{
+	struct resize_log log = { 0 };
+	struct hash_engine engine;
+	uint64_t buckets;
+	int i;
+
+	if (init_background(&engine, 1, 0, &log) != 0)
+		return TEST_FAILED;
+
+	for (i = 0; i < 2000; i++) {
+		if (put_key(&engine, 0, i) != 0)
+			goto fail;
+	}
+	/* 2000 keys need at least 4096 buckets at MAX_LOAD_FACTOR */
+	if (wait_settled(&engine, 4096, MAX_BUCKET_COUNT) != 0) {
+		fprintf(stderr, "resize never settled\n");
+		goto fail;
+	}
+	hash_engine_get_stats(&engine, NULL, &buckets, NULL);
+	/* The callback runs just after the old table is unpublished */
+	for (i = 0; i < SETTLE_POLLS; i++) {
+		if (atomic_load(&log.last_bucket_count) == buckets)
+			break;
+		usleep(1000);
+	}
+	if (atomic_load(&log.calls) == 0 || atomic_load(&log.bad_shard)
+	    || atomic_load(&log.last_bucket_count) != buckets) {
+		fprintf(stderr, "calls=%d last=%llu buckets=%llu\n",
+			atomic_load(&log.calls),
+			(unsigned long long)atomic_load(&log.last_bucket_count),
+			(unsigned long long)buckets);
+		goto fail;
+	}
+	for (i = 0; i < 2000; i++) {
+		if (check_key(&engine, 0, i) != 0)
+			goto fail;
+	}
+
+	/* Deleting most keys lets the workers shrink it again */
+	for (i = 0; i < 1990; i++) {
+		if (delete_key(&engine, 0, i) != 0)
+			goto fail;
+	}
+	if (wait_settled(&engine, MIN_BUCKET_COUNT, 2048) != 0) {
+		fprintf(stderr, "never shrank\n");
+		goto fail;
+	}
+	for (i = 1990; i < 2000; i++) {
+		if (check_key(&engine, 0, i) != 0)
+			goto fail;
+	}
+
+	hash_engine_destroy(&engine);
+	return TEST_PASSED;
+fail:
+	hash_engine_destroy(&engine);
+	return TEST_FAILED;
+}
+
+struct writer_args {
+	struct hash_engine *engine;
+	int thread_id;
+	int errors;
+};
+
+static void *
+writer(void *arg)
+{
+	struct writer_args *args = arg;
+	int i;
+
+	for (i = 0; i < KEYS_PER_WRITER; i++) {
+		if (put_key(args->engine, args->thread_id, i) != 0)
+			args->errors++;
+		/* Read back an older key while resizes move it around */
+		if (check_key(args->engine, args->thread_id, i / 2) != 0)
+			args->errors++;
+	}
+	return NULL;
+}
+
+/* Test: Concurrent writers keep every key while workers migrate shards */
+static int
+test_concurrent_writers(void)
+{
+	struct writer_args args[WRITER_THREADS];
+	pthread_t threads[WRITER_THREADS];
+	struct hash_engine engine;
+	uint64_t items;
+	int errors = 0;
+	int t;
+	int i;
+
+	if (init_background(&engine, 4, 1, NULL) != 0)
+		return TEST_FAILED;
+
+	for (t = 0; t < WRITER_THREADS; t++) {
+		args[t].engine = &engine;
+		args[t].thread_id = t;
+		args[t].errors = 0;
+		pthread_create(&threads[t], NULL, writer, &args[t]);
+	}
+	for (t = 0; t < WRITER_THREADS; t++) {
+		pthread_join(threads[t], NULL);
+		errors += args[t].errors;
+	}
+
+	if (wait_settled(&engine, 0, MAX_BUCKET_COUNT) != 0)
+		errors++;
+	for (t = 0; t < WRITER_THREADS; t++) {
+		for (i = 0; i < KEYS_PER_WRITER; i++) {
+			if (check_key(&engine, t, i) != 0)
+				errors++;
+		}
+	}
+	hash_engine_get_stats(&engine, &items, NULL, NULL);
+	if (items != WRITER_THREADS * KEYS_PER_WRITER)
+		errors++;
+	hash_engine_destroy(&engine);
+
+	if (errors != 0) {
+		fprintf(stderr, "%d errors, %llu items\n", errors,
+			(unsigned long long)items);
+		return TEST_FAILED;
+	}
+	return TEST_PASSED;
+}
+
+/* Test: Destroy stops workers in the middle of a pending resize */
+static int
+test_destroy_during_resize(void)
+{
+	struct hash_engine engine;
+	int round;
+	int i;
+
+	for (round = 0; round < 20; round++) {
+		if (init_background(&engine, 2, 0, NULL) != 0)
+			return TEST_FAILED;
+		for (i = 0; i < 3000; i++) {
+			if (put_key(&engine, round, i) != 0) {
+				hash_engine_destroy(&engine);
+				return TEST_FAILED;
+			}
+		}
+		hash_engine_destroy(&engine);
+	}
+	return TEST_PASSED;
+}
+
+int
+main(void)
+{
+	printf("===== Background Resize Tests =====\n\n");
+
+	RUN_TEST(test_config_validation);
+	RUN_TEST(test_workers_finish_resize);
+	RUN_TEST(test_concurrent_writers);
+	RUN_TEST(test_destroy_during_resize);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
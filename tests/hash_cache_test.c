@@ -0,0 +1,370 @@
+/**
+ * @file hash_cache_test.c
+ * @brief Tests for the memory-bounded cache mode
+ *
+ * Checks that a cache-mode engine stays within its memory limit in both
+ * probing modes and across shards; that CLOCK keeps entries that are being
+ * looked up while streaming ones are evicted; that TinyLFU turns away a
+ * one-off scan; that hit, miss and eviction counts add up; and that
+ * concurrent readers and writers keep the limit and never see a wrong
+ * value.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "storage/hash_engine.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+#define CACHE_LIMIT (256 * 1024)
+#define VALUE_SIZE 100
+#define HOT_KEYS 200
+#define STREAM_KEYS 50000
+#define SCAN_KEYS 10000
+#define READER_THREADS 4
+#define READER_OPS 100000
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+static int
+init_cache(struct hash_engine *engine, int probe_mode, uint32_t shards,
+	   int policy)
+{
+	struct hash_engine_config config = {
+		.bucket_count = 1024,
+		.probe_mode = probe_mode,
+		.shard_count = shards,
+		.memory_limit = CACHE_LIMIT,
+		.evict_policy = policy,
+	};
+
+	return hash_engine_init_config(engine, &config);
+}
+
+static size_t
+make_key(char *buf, size_t len, const char *prefix, int i)
+{
+	return (size_t)snprintf(buf, len, "%s_%d", prefix, i);
+}
+
+/* Values carry their key's number so a reader can tell a wrong one */
+static void
+make_value(unsigned char *value, int i)
+{
+	memset(value, (unsigned char)i, VALUE_SIZE);
+	memcpy(value, &i, sizeof(i));
+}
+
+static int
+put_key(struct hash_engine *engine, const char *prefix, int i)
+{
+	unsigned char value[VALUE_SIZE];
+	char key[32];
+
+	make_value(value, i);
+	return hash_put(engine, key, make_key(key, sizeof(key), prefix, i),
+			value, sizeof(value));
+}
+
+/* 0 on a hit with the right value, 1 on a miss, -1 on a wrong value */
+static int
+get_key(struct hash_engine *engine, const char *prefix, int i)
+{
+	unsigned char expected[VALUE_SIZE];
+	unsigned char value[VALUE_SIZE];
+	size_t value_len = 0;
+	char key[32];
+
+	if (hash_get_copy(engine, key, make_key(key, sizeof(key), prefix, i),
+			  value, sizeof(value), &value_len)
+	    != 0)
+		return 1;
+	make_value(expected, i);
+	return value_len == VALUE_SIZE
+			&& memcmp(value, expected, VALUE_SIZE) == 0
+		   ? 0
+		   : -1;
+}
+
+static uint64_t
+memory_usage(struct hash_engine *engine)
+{
+	uint64_t memory = 0;
+
+	hash_engine_get_stats(engine, NULL, NULL, &memory);
+	return memory;
+}
+
+/* Streams far more than fits; memory stays near the limit */
+static int
+check_stream_bounded(int probe_mode, uint32_t shards, int policy)
+{
+	struct hash_engine engine;
+	struct hash_cache_stats stats;
+	int rc = TEST_PASSED;
+	int present = 0;
+
+	if (init_cache(&engine, probe_mode, shards, policy) != 0)
+		return TEST_FAILED;
+	for (int i = 0; i < STREAM_KEYS; i++) {
+		if (put_key(&engine, "stream", i) != 0)
+			rc = TEST_FAILED;
+		if (memory_usage(&engine) > CACHE_LIMIT + HASH_MEMORY_BATCH)
+			rc = TEST_FAILED;
+	}
+	for (int i = 0; i < STREAM_KEYS; i++) {
+		int found = get_key(&engine, "stream", i);
+
+		if (found < 0)
+			rc = TEST_FAILED;
+		present += found == 0;
+	}
+
+	/* Full, but only about as full as the limit allows */
+	if (present < CACHE_LIMIT / 2 / (VALUE_SIZE + 16)
+	    || present > CACHE_LIMIT / VALUE_SIZE)
+		rc = TEST_FAILED;
+	if (hash_engine_get_cache_stats(&engine, &stats) != 0
+	    || stats.evictions + stats.rejections
+		   < (uint64_t)(STREAM_KEYS - present))
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+test_cache_stays_within_limit(void)
+{
+	return check_stream_bounded(HASH_PROBE_GROUP, 1, HASH_EVICT_CLOCK);
+}
+
+static int
+test_cache_robin_hood_shards(void)
+{
+	if (check_stream_bounded(HASH_PROBE_ROBIN_HOOD, 4, HASH_EVICT_CLOCK)
+	    != TEST_PASSED)
+		return TEST_FAILED;
+	return check_stream_bounded(HASH_PROBE_ROBIN_HOOD, 4,
+				    HASH_EVICT_TINYLFU);
+}
+
+/*
+ * Hot keys looked up between every few streaming puts survive the stream;
+ * returns the share of hot lookups that hit, in percent
+ */
+static int
+hot_hit_percent(int policy, int *wrong)
+{
+	struct hash_engine engine;
+	int hits = 0;
+	int lookups = 0;
+
+	if (init_cache(&engine, HASH_PROBE_GROUP, 1, policy) != 0)
+		return -1;
+	for (int i = 0; i < HOT_KEYS; i++) {
+		put_key(&engine, "hot", i);
+		get_key(&engine, "hot", i);
+	}
+	for (int i = 0; i < STREAM_KEYS; i++) {
+		int hot = i % HOT_KEYS;
+		int found;
+
+		put_key(&engine, "stream", i);
+		found = get_key(&engine, "hot", hot);
+		if (found < 0)
+			*wrong = 1;
+		if (found != 0)
+			put_key(&engine, "hot", hot);
+		hits += found == 0;
+		lookups++;
+	}
+	hash_engine_destroy(&engine);
+	return hits * 100 / lookups;
+}
+
+static int
+test_cache_clock_keeps_hot(void)
+{
+	int wrong = 0;
+
+	return hot_hit_percent(HASH_EVICT_CLOCK, &wrong) >= 90 && !wrong
+		   ? TEST_PASSED
+		   : TEST_FAILED;
+}
+
+static int
+test_cache_tinylfu_resists_scan(void)
+{
+	struct hash_engine engine;
+	struct hash_cache_stats stats;
+	int rc = TEST_PASSED;
+	int wrong = 0;
+	int kept = 0;
+
+	if (hot_hit_percent(HASH_EVICT_TINYLFU, &wrong) < 90 || wrong)
+		rc = TEST_FAILED;
+
+	/* Fill with keys asked for repeatedly, then scan once past them */
+	if (init_cache(&engine, HASH_PROBE_GROUP, 1, HASH_EVICT_TINYLFU) != 0)
+		return TEST_FAILED;
+	for (int round = 0; round < 4; round++) {
+		for (int i = 0; i < HOT_KEYS; i++) {
+			if (get_key(&engine, "hot", i) != 0)
+				put_key(&engine, "hot", i);
+		}
+	}
+	for (int i = 0; i < SCAN_KEYS; i++)
+		put_key(&engine, "scan", i);
+	for (int i = 0; i < HOT_KEYS; i++)
+		kept += get_key(&engine, "hot", i) == 0;
+
+	if (kept < HOT_KEYS * 9 / 10)
+		rc = TEST_FAILED;
+	if (hash_engine_get_cache_stats(&engine, &stats) != 0
+	    || stats.rejections == 0)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+test_cache_stats(void)
+{
+	struct hash_engine engine;
+	struct hash_cache_stats stats;
+	int rc = TEST_PASSED;
+
+	/* Only cache-mode engines count */
+	if (hash_engine_init(&engine, 1024) != 0)
+		return TEST_FAILED;
+	if (hash_engine_get_cache_stats(&engine, &stats) != -EINVAL)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+
+	if (init_cache(&engine, HASH_PROBE_GROUP, 2, HASH_EVICT_CLOCK) != 0)
+		return TEST_FAILED;
+	if (hash_engine_get_cache_stats(&engine, &stats) != 0
+	    || stats.hits || stats.misses || stats.hit_ratio != 0)
+		rc = TEST_FAILED;
+	for (int i = 0; i < 100; i++)
+		put_key(&engine, "stat", i);
+	for (int i = 0; i < 400; i++)
+		get_key(&engine, "stat", i % 200);
+
+	if (hash_engine_get_cache_stats(&engine, &stats) != 0
+	    || stats.hits != 200 || stats.misses != 200
+	    || stats.hit_ratio != 0.5 || stats.evictions != 0)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+struct reader_arg {
+	struct hash_engine *engine;
+	int id;
+	int failed;
+};
+
+/* Get, and put on a miss, over a skewed key range */
+static void *
+cache_reader(void *p)
+{
+	struct reader_arg *arg = p;
+	uint64_t state = 0x9e3779b97f4a7c15ULL * (uint64_t)(arg->id + 1);
+
+	for (int i = 0; i < READER_OPS; i++) {
+		int key;
+		int found;
+
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		/* Squaring a uniform draw skews it towards low keys */
+		key = (int)(((state >> 33) % 1000) * ((state >> 13) % 1000)
+			    / 50);
+		found = get_key(arg->engine, "skew", key);
+		if (found < 0)
+			arg->failed = 1;
+		if (found != 0 && put_key(arg->engine, "skew", key) != 0)
+			arg->failed = 1;
+	}
+	return NULL;
+}
+
+static int
+test_cache_concurrent(void)
+{
+	struct reader_arg args[READER_THREADS];
+	pthread_t threads[READER_THREADS];
+	struct hash_engine engine;
+	struct hash_cache_stats stats;
+	int rc = TEST_PASSED;
+	int i;
+
+	if (init_cache(&engine, HASH_PROBE_GROUP, 4, HASH_EVICT_TINYLFU) != 0)
+		return TEST_FAILED;
+	for (i = 0; i < READER_THREADS; i++) {
+		args[i].engine = &engine;
+		args[i].id = i;
+		args[i].failed = 0;
+		pthread_create(&threads[i], NULL, cache_reader, &args[i]);
+	}
+	for (i = 0; i < READER_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		if (args[i].failed)
+			rc = TEST_FAILED;
+	}
+
+	/* Each writing CPU may hold back a batch per shard unfolded */
+	if (memory_usage(&engine)
+	    > CACHE_LIMIT + 4 * READER_THREADS * HASH_MEMORY_BATCH)
+		rc = TEST_FAILED;
+	if (hash_engine_get_cache_stats(&engine, &stats) != 0
+	    || stats.hits + stats.misses
+		   != (uint64_t)READER_THREADS * READER_OPS
+	    || stats.hits == 0 || stats.evictions == 0)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+int
+main(void)
+{
+	printf("===== Hash Cache Tests =====\n\n");
+
+	RUN_TEST(test_cache_stays_within_limit);
+	RUN_TEST(test_cache_robin_hood_shards);
+	RUN_TEST(test_cache_clock_keeps_hot);
+	RUN_TEST(test_cache_tinylfu_resists_scan);
+	RUN_TEST(test_cache_stats);
+	RUN_TEST(test_cache_concurrent);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
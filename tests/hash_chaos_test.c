@@ -112,9 +112,9 @@ chaos_worker(void *arg)
 			rc = hash_delete(state->engine, key_buf,
 					 strlen(key_buf));
 		} else { /* 5% GET_STATS */
-			uint32_t item_count;
-			uint32_t bucket_count;
-			uint32_t memory_usage;
+			uint64_t item_count;
+			uint64_t bucket_count;
+			uint64_t memory_usage;
 			rc = hash_engine_get_stats(state->engine, &item_count,
 						   &bucket_count,
 						   &memory_usage);
@@ -317,7 +317,7 @@ test_chaos_interleaved_ops(void)
 
 		/* Verify consistency periodically */
 		if (i % 500 == 0) {
-			uint32_t item_count;
+			uint64_t item_count;
 			rc = hash_engine_get_stats(&engine, &item_count, NULL,
 						   NULL);
 			if (rc != 0) {
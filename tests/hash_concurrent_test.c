@@ -187,7 +187,7 @@ test_concurrent_writes_unique_keys(void)
 	struct thread_args args[NUM_THREADS];
 	pthread_mutex_t error_mutex;
 	int error_count;
-	uint32_t item_count;
+	uint64_t item_count;
 	int expected_count;
 	int rc;
 	int i;
@@ -230,8 +230,8 @@ test_concurrent_writes_unique_keys(void)
 	}
 
 	if ((int)item_count != expected_count) {
-		fprintf(stderr, "Item count mismatch: expected %d, got %u\n",
-			expected_count, item_count);
+		fprintf(stderr, "Item count mismatch: expected %d, got %llu\n",
+			expected_count, (unsigned long long)item_count);
 		return TEST_FAILED;
 	}
 
@@ -280,7 +280,7 @@ test_concurrent_writes_same_key(void)
 	const char *key = "contended_key";
 	const void *final_value;
 	size_t final_len;
-	uint32_t item_count;
+	uint64_t item_count;
 	int rc;
 	int i;
 
@@ -311,7 +311,8 @@ test_concurrent_writes_same_key(void)
 	/* Verify single item exists and is readable */
 	rc = hash_engine_get_stats(&engine, &item_count, NULL, NULL);
 	if (rc != 0 || item_count != 1) {
-		fprintf(stderr, "Expected 1 item, got %u\n", item_count);
+		fprintf(stderr, "Expected 1 item, got %llu\n",
+			(unsigned long long)item_count);
 		pthread_mutex_destroy(&error_mutex);
 		hash_engine_destroy(&engine);
 		return TEST_FAILED;
@@ -481,8 +482,8 @@ test_concurrent_resize(void)
 	struct thread_args args[NUM_THREADS];
 	pthread_mutex_t error_mutex;
 	int error_count;
-	uint32_t initial_buckets;
-	uint32_t final_buckets;
+	uint64_t initial_buckets;
+	uint64_t final_buckets;
 	int rc;
 	int i;
 
@@ -529,14 +530,87 @@ test_concurrent_resize(void)
 	}
 
 	if (final_buckets <= initial_buckets) {
-		fprintf(stderr, "Resize did not occur: initial=%u final=%u\n",
-			initial_buckets, final_buckets);
+		fprintf(stderr,
+			"Resize did not occur: initial=%llu final=%llu\n",
+			(unsigned long long)initial_buckets,
+			(unsigned long long)final_buckets);
 		return TEST_FAILED;
 	}
 
 	return TEST_PASSED;
 }
 
+/*
+ * Test: Concurrent growth with every slot of a table on one lock, and with
+ * a lock per HASH_LOCK_MIN_SLOTS slots
+ */
+static int
+test_lock_stripes(void)
+{
+	static const uint32_t stripe_counts[] = { 1, 1U << 20 };
+	char key_buf[64];
+	char value_buf[128];
+	char expect[128];
+	size_t value_len;
+
+	for (size_t s = 0; s < sizeof(stripe_counts) / sizeof(*stripe_counts);
+	     s++) {
+		struct hash_engine_config config = {
+			.bucket_count = 64,
+			.shard_count = 4,
+			.lock_stripes = stripe_counts[s],
+		};
+		struct hash_engine engine;
+		pthread_t threads[NUM_THREADS];
+		struct thread_args args[NUM_THREADS];
+		pthread_mutex_t error_mutex;
+		uint64_t items;
+		int error_count = 0;
+		int i;
+
+		if (hash_engine_init_config(&engine, &config) != 0)
+			return TEST_FAILED;
+		pthread_mutex_init(&error_mutex, NULL);
+		for (i = 0; i < NUM_THREADS; i++) {
+			args[i].engine = &engine;
+			args[i].thread_id = i;
+			args[i].error_count = &error_count;
+			args[i].error_mutex = &error_mutex;
+			pthread_create(&threads[i], NULL,
+				       concurrent_resize_worker, &args[i]);
+		}
+		for (i = 0; i < NUM_THREADS; i++)
+			pthread_join(threads[i], NULL);
+		pthread_mutex_destroy(&error_mutex);
+
+		hash_engine_get_stats(&engine, &items, NULL, NULL);
+		if (error_count > 0
+		    || items != (uint64_t)NUM_THREADS * OPS_PER_THREAD * 2) {
+			hash_engine_destroy(&engine);
+			return TEST_FAILED;
+		}
+		for (i = 0; i < NUM_THREADS * OPS_PER_THREAD * 2; i++) {
+			int t = i % NUM_THREADS;
+			int k = i / NUM_THREADS;
+
+			snprintf(key_buf, sizeof(key_buf), "resize_key_%d_%d",
+				 t, k);
+			snprintf(expect, sizeof(expect),
+				 "resize_value_%d_%d_with_padding", t, k);
+			if (hash_get_copy(&engine, key_buf, strlen(key_buf),
+					  value_buf, sizeof(value_buf),
+					  &value_len) != 0
+			    || value_len != strlen(expect)
+			    || memcmp(value_buf, expect, value_len) != 0) {
+				hash_engine_destroy(&engine);
+				return TEST_FAILED;
+			}
+		}
+		hash_engine_destroy(&engine);
+	}
+	return TEST_PASSED;
+}
+
 int
 main(void)
 {
@@ -549,6 +623,7 @@ main(void)
 	RUN_TEST(test_concurrent_writes_same_key);
 	RUN_TEST(test_concurrent_mixed_operations);
 	RUN_TEST(test_concurrent_resize);
+	RUN_TEST(test_lock_stripes);
 
 	printf("\n========================================\n");
 	printf("Tests run: %d\n", tests_run);
@@ -16,6 +16,9 @@
 #define TEST_PASSED 0
 #define TEST_FAILED 1
 
+/* MAX_BUCKET_COUNT buckets would take 512 GiB; this is as large as tests go */
+#define LARGE_BUCKET_COUNT (1U << 20)
+
 static int tests_run = 0;
 static int tests_passed = 0;
 static int tests_failed = 0;
@@ -57,10 +60,10 @@ test_init_various_sizes(void)
 	}
 	hash_engine_destroy(&engine);
 
-	/* Test maximum bucket count */
-	rc = hash_engine_init(&engine, MAX_BUCKET_COUNT);
+	/* Test a large bucket count */
+	rc = hash_engine_init(&engine, LARGE_BUCKET_COUNT);
 	if (rc != 0) {
-		fprintf(stderr, "Failed to init with MAX_BUCKET_COUNT\n");
+		fprintf(stderr, "Failed to init with LARGE_BUCKET_COUNT\n");
 		return TEST_FAILED;
 	}
 	hash_engine_destroy(&engine);
@@ -84,7 +87,7 @@ test_empty_table_operations(void)
 	const void *value = NULL;
 	size_t value_len = 0;
 	const char *key = "nonexistent";
-	uint32_t item_count;
+	uint64_t item_count;
 	int rc;
 
 	rc = hash_engine_init(&engine, DEFAULT_BUCKET_COUNT);
@@ -130,7 +133,7 @@ test_single_element(void)
 	const char *value = "test_value";
 	const void *retrieved_value = NULL;
 	size_t retrieved_len = 0;
-	uint32_t item_count;
+	uint64_t item_count;
 	int rc;
 
 	rc = hash_engine_init(&engine, DEFAULT_BUCKET_COUNT);
@@ -203,7 +206,7 @@ test_update_existing_key(void)
 	const char *value2 = "updated_value";
 	const void *retrieved_value = NULL;
 	size_t retrieved_len = 0;
-	uint32_t item_count;
+	uint64_t item_count;
 	int rc;
 
 	rc = hash_engine_init(&engine, DEFAULT_BUCKET_COUNT);
@@ -258,7 +261,7 @@ test_multiple_keys(void)
 	char value_buf[32];
 	const void *retrieved_value = NULL;
 	size_t retrieved_len = 0;
-	uint32_t item_count;
+	uint64_t item_count;
 	int rc;
 	int i;
 	const int NUM_KEYS = 100;
@@ -284,8 +287,8 @@ test_multiple_keys(void)
 	/* Verify item count */
 	rc = hash_engine_get_stats(&engine, &item_count, NULL, NULL);
 	if (rc != 0 || item_count != NUM_KEYS) {
-		fprintf(stderr, "Item count should be %d, got %u\n", NUM_KEYS,
-			item_count);
+		fprintf(stderr, "Item count should be %d, got %llu\n",
+			NUM_KEYS, (unsigned long long)item_count);
 		hash_engine_destroy(&engine);
 		return TEST_FAILED;
 	}
@@ -456,7 +459,7 @@ test_duplicate_keys(void)
 	const char *value3 = "third";
 	const void *retrieved_value = NULL;
 	size_t retrieved_len = 0;
-	uint32_t item_count;
+	uint64_t item_count;
 	int rc;
 
 	rc = hash_engine_init(&engine, DEFAULT_BUCKET_COUNT);
@@ -559,7 +562,7 @@ test_resize_trigger(void)
 	struct hash_engine engine;
 	char key_buf[32];
 	char value_buf[32];
-	uint32_t initial_bucket_count, current_bucket_count;
+	uint64_t initial_bucket_count, current_bucket_count;
 	int rc;
 	int i;
 	int num_elements;
@@ -635,7 +638,7 @@ test_sequential_operations(void)
 	const char *value = "value";
 	const void *retrieved_value = NULL;
 	size_t retrieved_len = 0;
-	uint32_t item_count;
+	uint64_t item_count;
 	int rc;
 	int i;
 
@@ -705,6 +708,297 @@ test_sequential_operations(void)
 	return TEST_PASSED;
 }
 
+/* Test: Keys/values on both sides of the inline storage boundary */
+static int
+test_inline_storage_boundaries(void)
+{
+	static const size_t key_sizes[] = { 1, 23, 24, 80, 81, 88, 120 };
+	static const size_t value_sizes[] = { 1, 63, 64, 87, 88, 200 };
+	const int num_keys = sizeof(key_sizes) / sizeof(key_sizes[0]);
+	const int num_values = sizeof(value_sizes) / sizeof(value_sizes[0]);
+	struct hash_engine engine;
+	unsigned char key_buf[128];
+	unsigned char value_buf[256];
+	const void *retrieved_value;
+	size_t retrieved_len;
+	uint64_t memory_usage;
+	size_t expected_memory;
+	int rc;
+	int k;
+	int v;
+
+	rc = hash_engine_init(&engine, DEFAULT_BUCKET_COUNT);
+	if (rc != 0) {
+		return TEST_FAILED;
+	}
+
+	/* Every key cycles through every value size, crossing the boundary */
+	for (v = 0; v < num_values; v++) {
+		expected_memory = 0;
+		for (k = 0; k < num_keys; k++) {
+			size_t value_len = value_sizes[(k + v) % num_values];
+
+			memset(key_buf, 'a' + k, key_sizes[k]);
+			memset(value_buf, 'A' + v, value_len);
+			rc = hash_put(&engine, key_buf, key_sizes[k], value_buf,
+				      value_len);
+			if (rc != 0) {
+				fprintf(stderr,
+					"Put failed: key %zu value %zu\n",
+					key_sizes[k], value_len);
+				hash_engine_destroy(&engine);
+				return TEST_FAILED;
+			}
+			expected_memory += key_sizes[k] + value_len;
+		}
+
+		for (k = 0; k < num_keys; k++) {
+			size_t value_len = value_sizes[(k + v) % num_values];
+
+			memset(key_buf, 'a' + k, key_sizes[k]);
+			memset(value_buf, 'A' + v, value_len);
+			rc = hash_get(&engine, key_buf, key_sizes[k],
+				      &retrieved_value, &retrieved_len);
+			if (rc != 0 || retrieved_len != value_len
+			    || memcmp(retrieved_value, value_buf, value_len)
+				   != 0) {
+				fprintf(stderr,
+					"Get mismatch: key %zu value %zu\n",
+					key_sizes[k], value_len);
+				hash_engine_destroy(&engine);
+				return TEST_FAILED;
+			}
+		}
+
+		rc = hash_engine_get_stats(&engine, NULL, NULL, &memory_usage);
+		if (rc != 0 || memory_usage != expected_memory) {
+			fprintf(stderr, "Memory usage %llu, expected %zu\n",
+				(unsigned long long)memory_usage,
+				expected_memory);
+			hash_engine_destroy(&engine);
+			return TEST_FAILED;
+		}
+	}
+
+	for (k = 0; k < num_keys; k++) {
+		memset(key_buf, 'a' + k, key_sizes[k]);
+		rc = hash_delete(&engine, key_buf, key_sizes[k]);
+		if (rc != 0) {
+			fprintf(stderr, "Delete failed: key %zu\n",
+				key_sizes[k]);
+			hash_engine_destroy(&engine);
+			return TEST_FAILED;
+		}
+	}
+
+	hash_engine_destroy(&engine);
+	return TEST_PASSED;
+}
+
+static int
+test_tombstone_churn(void)
+{
+	struct hash_engine engine;
+	char key[32];
+	const void *retrieved_value;
+	size_t retrieved_len;
+	int rc;
+	int i;
+	int j;
+
+	rc = hash_engine_init(&engine, MIN_BUCKET_COUNT);
+	if (rc != 0) {
+		return TEST_FAILED;
+	}
+
+	/*
+	 * Keep a few keys live while many others come and go, so the small
+	 * table fills with tombstones and probes wrap across group ends.
+	 */
+	for (i = 0; i < 4; i++) {
+		snprintf(key, sizeof(key), "live_%d", i);
+		rc = hash_put(&engine, key, strlen(key), &i, sizeof(i));
+		if (rc != 0) {
+			hash_engine_destroy(&engine);
+			return TEST_FAILED;
+		}
+	}
+
+	for (i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "churn_%d", i);
+		rc = hash_put(&engine, key, strlen(key), &i, sizeof(i));
+		if (rc != 0) {
+			fprintf(stderr, "put %s failed: %d\n", key, rc);
+			hash_engine_destroy(&engine);
+			return TEST_FAILED;
+		}
+		rc = hash_delete(&engine, key, strlen(key));
+		if (rc != 0) {
+			fprintf(stderr, "delete %s failed: %d\n", key, rc);
+			hash_engine_destroy(&engine);
+			return TEST_FAILED;
+		}
+		rc = hash_get(&engine, key, strlen(key), &retrieved_value,
+			      &retrieved_len);
+		if (rc != -ENOENT) {
+			hash_engine_destroy(&engine);
+			return TEST_FAILED;
+		}
+
+		for (j = 0; j < 4; j++) {
+			snprintf(key, sizeof(key), "live_%d", j);
+			rc = hash_get(&engine, key, strlen(key),
+				      &retrieved_value, &retrieved_len);
+			if (rc != 0 || retrieved_len != sizeof(int)
+			    || memcmp(retrieved_value, &j, sizeof(j)) != 0) {
+				fprintf(stderr, "lost %s after %d rounds\n",
+					key, i);
+				hash_engine_destroy(&engine);
+				return TEST_FAILED;
+			}
+		}
+	}
+
+	hash_engine_destroy(&engine);
+	return TEST_PASSED;
+}
+
+static int
+test_get_copy(void)
+{
+	struct hash_engine engine;
+	const char *small_key = "small";
+	const char *big_key = "big";
+	char small_value[16];
+	char big_value[300];
+	char buf[512];
+	size_t value_len;
+	int rc;
+
+	rc = hash_engine_init(&engine, DEFAULT_BUCKET_COUNT);
+	if (rc != 0) {
+		return TEST_FAILED;
+	}
+
+	memset(small_value, 's', sizeof(small_value));
+	memset(big_value, 'b', sizeof(big_value));
+	if (hash_put(&engine, small_key, strlen(small_key), small_value,
+		     sizeof(small_value)) != 0
+	    || hash_put(&engine, big_key, strlen(big_key), big_value,
+			sizeof(big_value)) != 0) {
+		hash_engine_destroy(&engine);
+		return TEST_FAILED;
+	}
+
+	/* Inline value */
+	rc = hash_get_copy(&engine, small_key, strlen(small_key), buf,
+			   sizeof(buf), &value_len);
+	if (rc != 0 || value_len != sizeof(small_value)
+	    || memcmp(buf, small_value, sizeof(small_value)) != 0) {
+		hash_engine_destroy(&engine);
+		return TEST_FAILED;
+	}
+
+	/* Out-of-line value */
+	rc = hash_get_copy(&engine, big_key, strlen(big_key), buf,
+			   sizeof(buf), &value_len);
+	if (rc != 0 || value_len != sizeof(big_value)
+	    || memcmp(buf, big_value, sizeof(big_value)) != 0) {
+		hash_engine_destroy(&engine);
+		return TEST_FAILED;
+	}
+
+	/* Short buffer reports the full length */
+	value_len = 0;
+	rc = hash_get_copy(&engine, big_key, strlen(big_key), buf, 10,
+			   &value_len);
+	if (rc != -ENOSPC || value_len != sizeof(big_value)) {
+		hash_engine_destroy(&engine);
+		return TEST_FAILED;
+	}
+
+	rc = hash_get_copy(&engine, "missing", 7, buf, sizeof(buf),
+			   &value_len);
+	if (rc != -ENOENT) {
+		hash_engine_destroy(&engine);
+		return TEST_FAILED;
+	}
+
+	hash_engine_destroy(&engine);
+	return TEST_PASSED;
+}
+
+#define MULTI_KEYS 100
+
+/* Test: Batched put/get match single-key results, including bad entries */
+static int
+test_multi_get_put(void)
+{
+	struct hash_engine engine;
+	char key_bufs[MULTI_KEYS][32];
+	const void *keys[MULTI_KEYS];
+	size_t key_lens[MULTI_KEYS];
+	const void *values[MULTI_KEYS];
+	size_t value_lens[MULTI_KEYS];
+	int ids[MULTI_KEYS];
+	int results[MULTI_KEYS];
+	int i;
+
+	if (hash_engine_init(&engine, MIN_BUCKET_COUNT) != 0)
+		return TEST_FAILED;
+
+	/* Spans several batches and grows the table mid-call */
+	for (i = 0; i < MULTI_KEYS; i++) {
+		snprintf(key_bufs[i], sizeof(key_bufs[i]), "multi_%d", i);
+		ids[i] = i;
+		keys[i] = key_bufs[i];
+		key_lens[i] = strlen(key_bufs[i]);
+		values[i] = &ids[i];
+		value_lens[i] = sizeof(ids[i]);
+	}
+	key_lens[7] = 0;
+	if (hash_multi_put(&engine, MULTI_KEYS, keys, key_lens, values,
+			   value_lens, results)
+	    != 0)
+		goto fail;
+	for (i = 0; i < MULTI_KEYS; i++) {
+		if (results[i] != (i == 7 ? -EINVAL : 0))
+			goto fail;
+	}
+
+	/* Key 7 was rejected above; swap key 9 for one never stored */
+	key_lens[7] = strlen(key_bufs[7]);
+	snprintf(key_bufs[9], sizeof(key_bufs[9]), "absent");
+	key_lens[9] = strlen(key_bufs[9]);
+	if (hash_multi_get(&engine, MULTI_KEYS, keys, key_lens, values,
+			   value_lens, results)
+	    != 0)
+		goto fail;
+	for (i = 0; i < MULTI_KEYS; i++) {
+		if (i == 7 || i == 9) {
+			if (results[i] != -ENOENT)
+				goto fail;
+			continue;
+		}
+		if (results[i] != 0 || value_lens[i] != sizeof(int)
+		    || memcmp(values[i], &i, sizeof(int)) != 0)
+			goto fail;
+	}
+
+	if (hash_multi_get(&engine, 1, NULL, key_lens, values, value_lens,
+			   results)
+	    != -EINVAL)
+		goto fail;
+	if (hash_multi_get(&engine, 0, NULL, NULL, NULL, NULL, NULL) != 0)
+		goto fail;
+
+	hash_engine_destroy(&engine);
+	return TEST_PASSED;
+fail:
+	hash_engine_destroy(&engine);
+	return TEST_FAILED;
+}
+
 int
 main(void)
 {
@@ -721,6 +1015,10 @@ main(void)
 	RUN_TEST(test_delete_nonexistent);
 	RUN_TEST(test_resize_trigger);
 	RUN_TEST(test_sequential_operations);
+	RUN_TEST(test_inline_storage_boundaries);
+	RUN_TEST(test_tombstone_churn);
+	RUN_TEST(test_get_copy);
+	RUN_TEST(test_multi_get_put);
 
 	printf("\n========================================\n");
 	printf("Tests run: %d\n", tests_run);
@@ -18,6 +18,9 @@
 #define TEST_PASSED 0
 #define TEST_FAILED 1
 
+/* MAX_BUCKET_COUNT buckets would take 512 GiB; this is as large as tests go */
+#define LARGE_BUCKET_COUNT (1U << 20)
+
 static int tests_run = 0;
 static int tests_passed = 0;
 static int tests_failed = 0;
@@ -215,17 +218,17 @@ test_boundary_bucket_counts(void)
 	}
 	hash_engine_destroy(&engine);
 
-	/* Maximum bucket count */
-	rc = hash_engine_init(&engine, MAX_BUCKET_COUNT);
+	/* Large bucket count */
+	rc = hash_engine_init(&engine, LARGE_BUCKET_COUNT);
 	if (rc != 0) {
-		fprintf(stderr, "Init failed with MAX_BUCKET_COUNT\n");
+		fprintf(stderr, "Init failed with LARGE_BUCKET_COUNT\n");
 		return TEST_FAILED;
 	}
 	hash_engine_destroy(&engine);
 
-	/* Above maximum */
-	rc = hash_engine_init(&engine, MAX_BUCKET_COUNT + 1);
-	/* Implementation should handle or round down */
+	/* Just above a power of two */
+	rc = hash_engine_init(&engine, LARGE_BUCKET_COUNT + 1);
+	/* Implementation should handle or round */
 	if (rc == 0) {
 		hash_engine_destroy(&engine);
 	}
@@ -571,8 +574,8 @@ test_load_factor_boundaries(void)
 	struct hash_engine engine;
 	char key_buf[32];
 	const char *value = "boundary_value";
-	uint32_t initial_buckets;
-	uint32_t current_buckets;
+	uint64_t initial_buckets;
+	uint64_t current_buckets;
 	int rc;
 	int i;
 	int max_items_before_resize;
@@ -6,19 +6,31 @@
  * - Memory allocation failures
  * - Partial operation failures
  * - State corruption scenarios
+ *
+ * The resize tests make malloc() itself fail, through the wrapper below,
+ * while lookups drive an incremental migration.
  */
 
 #include <assert.h>
 #include <errno.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "storage/hash_engine.h"
 
 #define TEST_PASSED 0
 #define TEST_FAILED 1
 
+/* MAX_BUCKET_COUNT buckets would take 512 GiB; this is as large as tests go */
+#define LARGE_BUCKET_COUNT (1U << 20)
+
+/* Out-of-line values, so every entry owns an allocation */
+#define BLOB_VALUE_LEN 200
+#define MIGRATE_LOOKUPS 100000
+
 static int tests_run = 0;
 static int tests_passed = 0;
 static int tests_failed = 0;
@@ -37,6 +49,19 @@ static int tests_failed = 0;
 		}                                                              \
 	} while (0)
 
+/* While set, every malloc() fails */
+static int fail_malloc;
+
+extern void *__libc_malloc(size_t size);
+
+void *
+malloc(size_t size)
+{
+	if (fail_malloc)
+		return NULL;
+	return __libc_malloc(size);
+}
+
 /*
  * NOTE: These tests simulate failure scenarios.
  * In a real implementation with failure injection hooks,
@@ -50,7 +75,7 @@ test_near_oom_behavior(void)
 	struct hash_engine engine;
 	char key_buf[64];
 	char *large_value;
-	uint32_t item_count;
+	uint64_t item_count;
 	int rc;
 	int i;
 	int successful_inserts;
@@ -102,7 +127,8 @@ test_near_oom_behavior(void)
 		return TEST_FAILED;
 	}
 
-	printf("  Engine remains functional with %u items\n", item_count);
+	printf("  Engine remains functional with %llu items\n",
+	       (unsigned long long)item_count);
 
 	hash_engine_destroy(&engine);
 	return TEST_PASSED;
@@ -232,8 +258,8 @@ test_resize_failure_recovery(void)
 	struct hash_engine engine;
 	char key_buf[64];
 	const char *value = "resize_value";
-	uint32_t initial_bucket_count;
-	uint32_t current_bucket_count;
+	uint64_t initial_bucket_count;
+	uint64_t current_bucket_count;
 	int max_items;
 	int rc;
 	int i;
@@ -287,29 +313,179 @@ test_resize_failure_recovery(void)
 		return TEST_FAILED;
 	}
 
-	printf("  Engine recovered with %u buckets, %d items inserted\n",
-	       current_bucket_count, inserted_before_failure);
+	printf("  Engine recovered with %llu buckets, %d items inserted\n",
+	       (unsigned long long)current_bucket_count,
+	       inserted_before_failure);
 
 	hash_engine_destroy(&engine);
 	return TEST_PASSED;
 }
 
-/* Test: Handling of maximum capacity */
+static size_t
+blob_value(char *value, int i)
+{
+	memset(value, 'a' + i % 26, BLOB_VALUE_LEN);
+	memcpy(value, &i, sizeof(i));
+	return BLOB_VALUE_LEN;
+}
+
+static int
+resizing(struct hash_engine *engine)
+{
+	return atomic_load(&engine->shards[0].old_table) != NULL;
+}
+
+/* Put blob keys from *n on until a put starts a resize */
+static int
+fill_until_resize(struct hash_engine *engine, int *n)
+{
+	char key[64];
+	char value[BLOB_VALUE_LEN];
+
+	while (!resizing(engine)) {
+		snprintf(key, sizeof(key), "blob_key_%d", *n);
+		if (hash_put(engine, key, strlen(key), value,
+			     blob_value(value, *n))
+		    != 0)
+			return TEST_FAILED;
+		(*n)++;
+	}
+	return TEST_PASSED;
+}
+
+/* Look keys up, which also migrates, until the resize is done or stuck */
+static int
+check_blobs(struct hash_engine *engine, int n, int lookups)
+{
+	char key[64];
+	char want[BLOB_VALUE_LEN];
+	char got[BLOB_VALUE_LEN];
+	size_t got_len;
+
+	for (int i = 0; i < lookups && (i < n || resizing(engine)); i++) {
+		snprintf(key, sizeof(key), "blob_key_%d", i % n);
+		if (hash_get_copy(engine, key, strlen(key), got, sizeof(got),
+				  &got_len)
+			    != 0
+		    || got_len != blob_value(want, i % n)
+		    || memcmp(got, want, got_len) != 0) {
+			fprintf(stderr, "  blob_key_%d lost\n", i % n);
+			return TEST_FAILED;
+		}
+	}
+	return TEST_PASSED;
+}
+
+/* Test: A resize moves out-of-line entries without allocating */
+static int
+check_resize_without_malloc(int probe_mode)
+{
+	struct hash_engine_config config = {
+		.bucket_count = 1024,
+		.shard_count = 1,
+		.probe_mode = probe_mode,
+		.assist_budget = 1,
+	};
+	struct hash_engine engine;
+	uint64_t items;
+	int n = 0;
+	int rc;
+
+	if (hash_engine_init_config(&engine, &config) != 0)
+		return TEST_FAILED;
+	rc = fill_until_resize(&engine, &n);
+
+	fail_malloc = 1;
+	if (rc == TEST_PASSED)
+		rc = check_blobs(&engine, n, MIGRATE_LOOKUPS);
+	fail_malloc = 0;
+
+	if (resizing(&engine)
+	    || hash_engine_get_stats(&engine, &items, NULL, NULL) != 0
+	    || items != (uint64_t)n)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+test_resize_without_malloc_group(void)
+{
+	return check_resize_without_malloc(HASH_PROBE_GROUP);
+}
+
+static int
+test_resize_without_malloc_robin_hood(void)
+{
+	return check_resize_without_malloc(HASH_PROBE_ROBIN_HOOD);
+}
+
+/*
+ * Test: Entries whose values are in a snapshot mapping need a copy to
+ * move. While that fails they stay in the old table and the resize stays
+ * open; once it succeeds the resize finishes.
+ */
+static int
+test_resize_failure_retried(void)
+{
+	struct hash_engine_config config = {
+		.bucket_count = 1024,
+		.shard_count = 1,
+		.assist_budget = 1,
+	};
+	struct hash_engine engine;
+	char path[64];
+	int n = 0;
+	int rc;
+
+	snprintf(path, sizeof(path), "/tmp/hash_failure_%d.snap",
+		 (int)getpid());
+	if (hash_engine_init_config(&engine, &config) != 0)
+		return TEST_FAILED;
+	rc = fill_until_resize(&engine, &n);
+	if (rc == TEST_PASSED && hash_engine_save(&engine, path) != 0)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	if (rc != TEST_PASSED
+	    || hash_engine_load(&engine, path, &config, 0) != 0) {
+		unlink(path);
+		return TEST_FAILED;
+	}
+	unlink(path);
+
+	rc = fill_until_resize(&engine, &n);
+	fail_malloc = 1;
+	if (rc == TEST_PASSED)
+		rc = check_blobs(&engine, n, 4 * n);
+	fail_malloc = 0;
+	/* The loaded entries could not move */
+	if (!resizing(&engine))
+		rc = TEST_FAILED;
+
+	if (rc == TEST_PASSED)
+		rc = check_blobs(&engine, n, MIGRATE_LOOKUPS);
+	if (resizing(&engine))
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+/* Test: Handling of a large capacity */
 static int
 test_max_capacity_handling(void)
 {
 	struct hash_engine engine;
 	char key_buf[64];
 	const char *value = "capacity_value";
-	uint32_t bucket_count;
+	uint64_t bucket_count;
 	int rc;
 	int i;
 	int max_attempts;
 
-	/* Start with max bucket count */
-	rc = hash_engine_init(&engine, MAX_BUCKET_COUNT);
+	/* Start with a large bucket count */
+	rc = hash_engine_init(&engine, LARGE_BUCKET_COUNT);
 	if (rc != 0) {
-		fprintf(stderr, "  Cannot init with MAX_BUCKET_COUNT\n");
+		fprintf(stderr, "  Cannot init with LARGE_BUCKET_COUNT\n");
 		return TEST_FAILED;
 	}
 
@@ -319,7 +495,8 @@ test_max_capacity_handling(void)
 		return TEST_FAILED;
 	}
 
-	printf("\n  Testing with maximum bucket count: %u\n", bucket_count);
+	printf("\n  Testing with a large bucket count: %llu\n",
+	       (unsigned long long)bucket_count);
 
 	/* Try to fill beyond capacity */
 	max_attempts = bucket_count + 1000;
@@ -356,6 +533,9 @@ main(void)
 	RUN_TEST(test_invalid_state_transitions);
 	RUN_TEST(test_resize_failure_recovery);
 	RUN_TEST(test_max_capacity_handling);
+	RUN_TEST(test_resize_without_malloc_group);
+	RUN_TEST(test_resize_without_malloc_robin_hood);
+	RUN_TEST(test_resize_failure_retried);
 
 	printf("\n========================================\n");
 	printf("Tests run: %d\n", tests_run);
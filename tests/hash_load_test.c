@@ -45,7 +45,7 @@ test_load_100k_items(void)
 	char value_buf[128];
 	const void *retrieved_value;
 	size_t retrieved_len;
-	uint32_t item_count;
+	uint64_t item_count;
 	int rc;
 	int i;
 	const int NUM_ITEMS = 100000;
@@ -85,8 +85,8 @@ test_load_100k_items(void)
 	rc = hash_engine_get_stats(&engine, &item_count, NULL, NULL);
 	if (rc != 0 || item_count != NUM_ITEMS) {
 		fprintf(stderr,
-			"\n  Item count mismatch: expected %d, got %u\n",
-			NUM_ITEMS, item_count);
+			"\n  Item count mismatch: expected %d, got %llu\n",
+			NUM_ITEMS, (unsigned long long)item_count);
 		hash_engine_destroy(&engine);
 		return TEST_FAILED;
 	}
@@ -303,8 +303,8 @@ test_load_resize_stress(void)
 	struct hash_engine engine;
 	char key_buf[64];
 	const char *value = "resize_stress_value";
-	uint32_t initial_buckets;
-	uint32_t current_buckets;
+	uint64_t initial_buckets;
+	uint64_t current_buckets;
 	int rc;
 	int i;
 	int cycle;
@@ -369,8 +369,9 @@ test_load_resize_stress(void)
 		return TEST_FAILED;
 	}
 
-	printf("\n  Buckets: initial=%u, final=%u", initial_buckets,
-	       current_buckets);
+	printf("\n  Buckets: initial=%llu, final=%llu",
+	       (unsigned long long)initial_buckets,
+	       (unsigned long long)current_buckets);
 	printf("\n  Complete!");
 	hash_engine_destroy(&engine);
 	return TEST_PASSED;
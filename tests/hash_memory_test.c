@@ -250,7 +250,7 @@ test_large_scale_memory(void)
 	struct hash_engine engine;
 	char key_buf[64];
 	char value_buf[256];
-	uint32_t item_count;
+	uint64_t item_count;
 	int rc;
 	int i;
 	const int NUM_ITEMS = 1000;
@@ -284,8 +284,8 @@ test_large_scale_memory(void)
 	/* Verify count */
 	rc = hash_engine_get_stats(&engine, &item_count, NULL, NULL);
 	if (rc != 0 || item_count != NUM_ITEMS) {
-		fprintf(stderr, "Item count mismatch: expected %d, got %u\n",
-			NUM_ITEMS, item_count);
+		fprintf(stderr, "Item count mismatch: expected %d, got %llu\n",
+			NUM_ITEMS, (unsigned long long)item_count);
 		hash_engine_destroy(&engine);
 		return TEST_FAILED;
 	}
@@ -320,8 +320,8 @@ test_resize_memory_safety(void)
 	struct hash_engine engine;
 	char key_buf[32];
 	char value_buf[64];
-	uint32_t initial_buckets;
-	uint32_t final_buckets;
+	uint64_t initial_buckets;
+	uint64_t final_buckets;
 	const void *retrieved_value;
 	size_t retrieved_len;
 	int rc;
@@ -392,7 +392,7 @@ test_tombstone_memory(void)
 	struct hash_engine engine;
 	char key_buf[32];
 	const char *value = "tombstone_test_value";
-	uint32_t item_count;
+	uint64_t item_count;
 	int rc;
 	int i;
 	const int NUM_CYCLES = 200;
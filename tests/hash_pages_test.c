@@ -0,0 +1,227 @@
+/**
+ * @file hash_pages_test.c
+ * @brief Tests for huge-page and NUMA placement of table memory
+ *
+ * Checks pages_alloc() on both sides of the mapping threshold under every
+ * policy, and engines whose tables span several huge-page sized chunks
+ * under each page mode and NUMA policy, across resizes.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "storage/hash/pages.h"
+#include "storage/hash_engine.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+/* Four bucket chunks per shard, each well past PAGES_HUGE_SIZE */
+#define PAGES_BUCKET_COUNT (4 * BUCKET_CHUNK_SIZE)
+#define PAGES_KEYS 50000
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+static int
+check_region(unsigned char *p, size_t size, size_t align)
+{
+	if (!p || (uintptr_t)p % align != 0)
+		return TEST_FAILED;
+	/* Zeroed at both ends, and every page is writable */
+	if (p[0] != 0 || p[size - 1] != 0)
+		return TEST_FAILED;
+	for (size_t off = 0; off < size; off += 4096)
+		p[off] = 0xa5;
+	p[size - 1] = 0x5a;
+	return TEST_PASSED;
+}
+
+/* Test: Small and large allocations are aligned, zeroed and usable */
+static int
+test_pages_alloc(void)
+{
+	static const size_t sizes[] = {
+		64, 4096, PAGES_HUGE_SIZE - 1, PAGES_HUGE_SIZE,
+		3 * PAGES_HUGE_SIZE + 100,
+	};
+	struct pages_policy policy;
+
+	if (pages_numa_nodes() < 1)
+		return TEST_FAILED;
+
+	for (int mode = PAGES_DEFAULT; mode <= PAGES_HUGETLB; mode++) {
+		for (int numa = PAGES_NUMA_DEFAULT; numa <= PAGES_NUMA_LOCAL;
+		     numa++) {
+			policy.mode = mode;
+			policy.numa = numa;
+			policy.node = 1;
+			for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]);
+			     i++) {
+				unsigned char *p;
+				int rc;
+
+				p = pages_alloc(sizes[i], 128, &policy);
+				rc = check_region(p, sizes[i], 128);
+				pages_free(p, sizes[i], &policy);
+				if (rc != TEST_PASSED) {
+					fprintf(stderr,
+						"mode %d numa %d size %zu\n",
+						mode, numa, sizes[i]);
+					return TEST_FAILED;
+				}
+			}
+		}
+	}
+	pages_free(NULL, PAGES_HUGE_SIZE, &policy);
+	return TEST_PASSED;
+}
+
+/* Test: Unknown page modes and NUMA policies are rejected */
+static int
+test_pages_config_rejected(void)
+{
+	struct hash_engine engine;
+	struct hash_engine_config config = {
+		.bucket_count = MIN_BUCKET_COUNT,
+		.page_mode = PAGES_HUGETLB + 1,
+	};
+
+	if (hash_engine_init_config(&engine, &config) != -EINVAL)
+		return TEST_FAILED;
+	config.page_mode = -1;
+	if (hash_engine_init_config(&engine, &config) != -EINVAL)
+		return TEST_FAILED;
+	config.page_mode = PAGES_DEFAULT;
+	config.numa_policy = PAGES_NUMA_LOCAL + 1;
+	if (hash_engine_init_config(&engine, &config) != -EINVAL)
+		return TEST_FAILED;
+	config.numa_policy = -1;
+	if (hash_engine_init_config(&engine, &config) != -EINVAL)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+static int
+fill_and_check(struct hash_engine *engine, int keys)
+{
+	uint64_t items;
+	uint64_t buckets;
+	uint64_t memory;
+	size_t value_len;
+	int stored;
+	char key[32];
+
+	for (int i = 0; i < keys; i++) {
+		snprintf(key, sizeof(key), "pages_key_%d", i);
+		if (hash_put(engine, key, strlen(key), &i, sizeof(i)) != 0)
+			return TEST_FAILED;
+	}
+	for (int i = 0; i < keys; i++) {
+		snprintf(key, sizeof(key), "pages_key_%d", i);
+		if (hash_get_copy(engine, key, strlen(key), &stored,
+				  sizeof(stored), &value_len)
+			    != 0
+		    || stored != i)
+			return TEST_FAILED;
+	}
+	if (hash_engine_get_stats(engine, &items, &buckets, &memory) != 0
+	    || items != (uint64_t)keys)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+/* Test: Multi-chunk engines work under every page mode and NUMA policy */
+static int
+test_engine_page_policies(void)
+{
+	struct hash_engine engine;
+	struct hash_engine_config config = {
+		.bucket_count = PAGES_BUCKET_COUNT * 2,
+		.shard_count = 2,
+	};
+
+	for (int mode = PAGES_DEFAULT; mode <= PAGES_HUGETLB; mode++) {
+		for (int numa = PAGES_NUMA_DEFAULT; numa <= PAGES_NUMA_LOCAL;
+		     numa++) {
+			config.page_mode = mode;
+			config.numa_policy = numa;
+			if (hash_engine_init_config(&engine, &config) != 0)
+				return TEST_FAILED;
+			if (fill_and_check(&engine, PAGES_KEYS)
+			    != TEST_PASSED) {
+				fprintf(stderr, "mode %d numa %d\n", mode,
+					numa);
+				hash_engine_destroy(&engine);
+				return TEST_FAILED;
+			}
+			hash_engine_destroy(&engine);
+		}
+	}
+	return TEST_PASSED;
+}
+
+/* Test: Tables created by a resize keep the engine's page policy */
+static int
+test_resize_keeps_policy(void)
+{
+	struct hash_engine engine;
+	struct hash_engine_config config = {
+		.bucket_count = BUCKET_CHUNK_SIZE / 4,
+		.page_mode = PAGES_THP,
+		.numa_policy = PAGES_NUMA_INTERLEAVE,
+	};
+	uint64_t items;
+	uint64_t buckets;
+	uint64_t memory;
+	int rc;
+
+	if (hash_engine_init_config(&engine, &config) != 0)
+		return TEST_FAILED;
+	/* Grows from heap-sized chunks into mapped ones */
+	rc = fill_and_check(&engine, 4 * BUCKET_CHUNK_SIZE / 5);
+	if (rc == TEST_PASSED) {
+		hash_engine_get_stats(&engine, &items, &buckets, &memory);
+		if (buckets <= BUCKET_CHUNK_SIZE / 4)
+			rc = TEST_FAILED;
+	}
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+int
+main(void)
+{
+	printf("===== Hash Page Placement Tests =====\n\n");
+
+	RUN_TEST(test_pages_alloc);
+	RUN_TEST(test_pages_config_rejected);
+	RUN_TEST(test_engine_page_policies);
+	RUN_TEST(test_resize_keeps_policy);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
@@ -60,7 +60,7 @@ test_property_oracle(void)
 	char value_buf[64];
 	const void *retrieved_value;
 	size_t retrieved_len;
-	uint32_t hash_count;
+	uint64_t hash_count;
 	int oracle_count;
 	int rc;
 	int trial;
@@ -185,8 +185,8 @@ test_property_oracle(void)
 	}
 
 	if ((int)hash_count != oracle_count) {
-		fprintf(stderr, "Final count mismatch: hash=%u oracle=%d\n",
-			hash_count, oracle_count);
+		fprintf(stderr, "Final count mismatch: hash=%llu oracle=%d\n",
+			(unsigned long long)hash_count, oracle_count);
 		hash_engine_destroy(&engine);
 		return TEST_FAILED;
 	}
@@ -291,7 +291,7 @@ test_invariant_count_consistency(void)
 	struct hash_engine engine;
 	char key_buf[32];
 	const char *value = "inv_value";
-	uint32_t reported_count;
+	uint64_t reported_count;
 	int actual_count;
 	const void *retrieved_value;
 	size_t retrieved_len;
@@ -346,8 +346,9 @@ test_invariant_count_consistency(void)
 		if ((int)reported_count != actual_count) {
 			fprintf(stderr,
 				"Count invariant violated at op %d: "
-				"reported=%u actual=%d\n",
-				i, reported_count, actual_count);
+				"reported=%llu actual=%d\n",
+				i, (unsigned long long)reported_count,
+				actual_count);
 			hash_engine_destroy(&engine);
 			return TEST_FAILED;
 		}
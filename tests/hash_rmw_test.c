@@ -0,0 +1,450 @@
+/**
+ * @file hash_rmw_test.c
+ * @brief Tests for hash_upsert(), hash_cas() and hash_incr()
+ *
+ * Checks each call's return codes and that it leaves the entry unchanged
+ * when it fails; that an upsert sees expired entries as absent and keeps a
+ * live entry's TTL; that a value may grow out of line; and that
+ * concurrent increments and CAS loops lose no update while shards resize,
+ * inline or in the background, in both probing modes.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "storage/hash_engine.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+#define START_TIME 1000000
+#define COUNTER_KEYS 64
+#define WRITER_THREADS 4
+#define WRITER_OPS 20000
+#define GROW_KEYS 20000
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+static _Atomic uint32_t test_now;
+
+static uint32_t
+test_clock(void *arg)
+{
+	return atomic_load(&test_now);
+}
+
+static int
+init_engine(struct hash_engine *engine, int probe_mode, uint32_t shards,
+	    uint64_t buckets)
+{
+	struct hash_engine_config config = {
+		.bucket_count = buckets,
+		.probe_mode = probe_mode,
+		.shard_count = shards,
+		.clock = test_clock,
+	};
+
+	atomic_store(&test_now, START_TIME);
+	return hash_engine_init_config(engine, &config);
+}
+
+static int64_t
+get_count(struct hash_engine *engine, const char *key)
+{
+	int64_t count = -1;
+	size_t len = 0;
+
+	if (hash_get_copy(engine, key, strlen(key), &count, sizeof(count),
+			  &len)
+		    != 0
+	    || len != sizeof(count))
+		return -1;
+	return count;
+}
+
+static int
+test_incr_basic(void)
+{
+	struct hash_engine engine;
+	int rc = TEST_PASSED;
+	int64_t result = 0;
+	int64_t big = INT64_MAX;
+
+	if (init_engine(&engine, HASH_PROBE_GROUP, 1, 64) != 0)
+		return TEST_FAILED;
+
+	/* An absent key counts from zero */
+	if (hash_incr(&engine, "hits", 4, 5, &result) != 0 || result != 5)
+		rc = TEST_FAILED;
+	if (hash_incr(&engine, "hits", 4, -7, &result) != 0 || result != -2)
+		rc = TEST_FAILED;
+	if (hash_incr(&engine, "hits", 4, 2, NULL) != 0
+	    || get_count(&engine, "hits") != 0)
+		rc = TEST_FAILED;
+
+	/* Overflow fails and leaves the count alone */
+	hash_put(&engine, "big", 3, &big, sizeof(big));
+	if (hash_incr(&engine, "big", 3, 1, &result) != -ERANGE
+	    || get_count(&engine, "big") != INT64_MAX)
+		rc = TEST_FAILED;
+
+	/* Only 8-byte values are counters */
+	hash_put(&engine, "name", 4, "abc", 3);
+	if (hash_incr(&engine, "name", 4, 1, &result) != -EINVAL)
+		rc = TEST_FAILED;
+	if (hash_incr(&engine, NULL, 4, 1, &result) != -EINVAL
+	    || hash_incr(&engine, "x", 0, 1, &result) != -EINVAL)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+test_cas_basic(void)
+{
+	struct hash_engine engine;
+	char value[16];
+	size_t len = 0;
+	int rc = TEST_PASSED;
+
+	if (init_engine(&engine, HASH_PROBE_GROUP, 1, 64) != 0)
+		return TEST_FAILED;
+
+	if (hash_cas(&engine, "state", 5, "idle", 4, "busy", 4) != -ENOENT)
+		rc = TEST_FAILED;
+	/* NULL expected creates, but only once */
+	if (hash_cas(&engine, "state", 5, NULL, 0, "idle", 4) != 0
+	    || hash_cas(&engine, "state", 5, NULL, 0, "busy", 4) != -EEXIST)
+		rc = TEST_FAILED;
+	if (hash_cas(&engine, "state", 5, "done", 4, "busy", 4) != -ECANCELED
+	    || hash_cas(&engine, "state", 5, "idl", 3, "busy", 4)
+		   != -ECANCELED)
+		rc = TEST_FAILED;
+	if (hash_get_copy(&engine, "state", 5, value, sizeof(value), &len)
+		!= 0
+	    || len != 4 || memcmp(value, "idle", 4) != 0)
+		rc = TEST_FAILED;
+
+	if (hash_cas(&engine, "state", 5, "idle", 4, "running", 7) != 0
+	    || hash_get_copy(&engine, "state", 5, value, sizeof(value), &len)
+		   != 0
+	    || len != 7 || memcmp(value, "running", 7) != 0)
+		rc = TEST_FAILED;
+	if (hash_cas(&engine, "state", 5, "idle", 0, "x", 1) != -EINVAL
+	    || hash_cas(&engine, "state", 5, "running", 7, NULL, 1)
+		   != -EINVAL)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+/* Appends ctx's byte to the value, or fails with the errno in fail */
+struct append_ctx {
+	unsigned char buf[512];
+	unsigned char byte;
+	int fail;
+	int calls;
+};
+
+static int
+append_fn(void *arg, const void *value, size_t value_len,
+	  const void **new_value, size_t *new_len)
+{
+	struct append_ctx *ctx = arg;
+
+	ctx->calls++;
+	if (ctx->fail)
+		return ctx->fail;
+	if (value_len >= sizeof(ctx->buf))
+		return -ENOSPC;
+	if (value)
+		memcpy(ctx->buf, value, value_len);
+	ctx->buf[value_len] = ctx->byte;
+	*new_value = ctx->buf;
+	*new_len = value_len + 1;
+	return 0;
+}
+
+static int
+value_is(struct hash_engine *engine, const char *key, unsigned char byte,
+	 size_t expect_len)
+{
+	unsigned char value[512];
+	size_t len = 0;
+
+	if (hash_get_copy(engine, key, strlen(key), value, sizeof(value),
+			  &len)
+		    != 0
+	    || len != expect_len)
+		return 0;
+	for (size_t i = 0; i < len; i++) {
+		if (value[i] != byte)
+			return 0;
+	}
+	return 1;
+}
+
+static int
+check_upsert(int probe_mode)
+{
+	struct hash_engine engine;
+	struct append_ctx ctx = { .byte = 'a' };
+	uint64_t items = 0;
+	uint64_t memory = 0;
+	int rc = TEST_PASSED;
+
+	if (init_engine(&engine, probe_mode, 1, 64) != 0)
+		return TEST_FAILED;
+
+	/* Past the inline area and out of line */
+	for (int i = 0; i < 200; i++) {
+		if (hash_upsert(&engine, "log", 3, append_fn, &ctx) != 0)
+			rc = TEST_FAILED;
+	}
+	if (!value_is(&engine, "log", 'a', 200) || ctx.calls != 200)
+		rc = TEST_FAILED;
+
+	/* A failing callback's errno comes back and nothing changes */
+	ctx.fail = -ENOENT;
+	if (hash_upsert(&engine, "log", 3, append_fn, &ctx) != -ENOENT
+	    || !value_is(&engine, "log", 'a', 200))
+		rc = TEST_FAILED;
+	ctx.fail = 7;
+	if (hash_upsert(&engine, "new", 3, append_fn, &ctx) != 7)
+		rc = TEST_FAILED;
+	ctx.fail = 0;
+	if (value_is(&engine, "new", 'a', 1))
+		rc = TEST_FAILED;
+
+	hash_engine_get_stats(&engine, &items, NULL, &memory);
+	if (items != 1 || memory != 3 + 200)
+		rc = TEST_FAILED;
+	if (hash_upsert(&engine, "log", 3, NULL, &ctx) != -EINVAL)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+test_upsert_callback(void)
+{
+	if (check_upsert(HASH_PROBE_GROUP) != TEST_PASSED)
+		return TEST_FAILED;
+	return check_upsert(HASH_PROBE_ROBIN_HOOD);
+}
+
+static int
+test_upsert_ttl(void)
+{
+	struct hash_engine engine;
+	struct append_ctx ctx = { .byte = 'b' };
+	int rc = TEST_PASSED;
+
+	if (init_engine(&engine, HASH_PROBE_GROUP, 1, 64) != 0)
+		return TEST_FAILED;
+
+	/* A live entry keeps its TTL through an update */
+	hash_put_ttl(&engine, "temp", 4, "b", 1, 10);
+	if (hash_upsert(&engine, "temp", 4, append_fn, &ctx) != 0
+	    || !value_is(&engine, "temp", 'b', 2))
+		rc = TEST_FAILED;
+	atomic_store(&test_now, START_TIME + 10);
+	if (value_is(&engine, "temp", 'b', 2))
+		rc = TEST_FAILED;
+
+	/* An expired one is absent to the callback, and what replaces it
+	 * never expires */
+	if (hash_upsert(&engine, "temp", 4, append_fn, &ctx) != 0
+	    || !value_is(&engine, "temp", 'b', 1))
+		rc = TEST_FAILED;
+	atomic_store(&test_now, START_TIME + 100000);
+	hash_expire(&engine, 0, NULL);
+	if (!value_is(&engine, "temp", 'b', 1))
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+struct writer_arg {
+	struct hash_engine *engine;
+	int id;
+	int failed;
+};
+
+static void
+counter_key(char *buf, size_t len, int i)
+{
+	snprintf(buf, len, "counter_%d", i % COUNTER_KEYS);
+}
+
+/* Increments the counters while putting filler keys that force resizes */
+static void *
+incr_writer(void *p)
+{
+	struct writer_arg *arg = p;
+	char key[32];
+
+	for (int i = 0; i < WRITER_OPS; i++) {
+		counter_key(key, sizeof(key), i + arg->id);
+		if (hash_incr(arg->engine, key, strlen(key), 1, NULL) != 0)
+			arg->failed = 1;
+		if (i < GROW_KEYS / WRITER_THREADS) {
+			snprintf(key, sizeof(key), "grow_%d_%d", arg->id, i);
+			hash_put(arg->engine, key, strlen(key), &i,
+				 sizeof(i));
+		}
+	}
+	return NULL;
+}
+
+/* The same increments as a CAS retry loop */
+static void *
+cas_writer(void *p)
+{
+	struct writer_arg *arg = p;
+	char key[32];
+
+	for (int i = 0; i < WRITER_OPS; i++) {
+		int64_t count;
+		int64_t next;
+		size_t len;
+		int rc;
+
+		counter_key(key, sizeof(key), i + arg->id);
+		do {
+			if (hash_get_copy(arg->engine, key, strlen(key),
+					  &count, sizeof(count), &len)
+			    == 0) {
+				next = count + 1;
+				rc = hash_cas(arg->engine, key, strlen(key),
+					      &count, sizeof(count), &next,
+					      sizeof(next));
+			} else {
+				next = 1;
+				rc = hash_cas(arg->engine, key, strlen(key),
+					      NULL, 0, &next, sizeof(next));
+			}
+		} while (rc == -ECANCELED || rc == -EEXIST);
+		if (rc != 0)
+			arg->failed = 1;
+		if (i < GROW_KEYS / WRITER_THREADS) {
+			snprintf(key, sizeof(key), "grow_%d_%d", arg->id, i);
+			hash_put(arg->engine, key, strlen(key), &i,
+				 sizeof(i));
+		}
+	}
+	return NULL;
+}
+
+static int
+check_concurrent(int probe_mode, uint32_t shards, int resize_mode,
+		 void *(*writer)(void *))
+{
+	struct hash_engine_config config = {
+		.bucket_count = 16,
+		.probe_mode = probe_mode,
+		.shard_count = shards,
+		.resize_mode = resize_mode,
+	};
+	struct writer_arg args[WRITER_THREADS];
+	pthread_t threads[WRITER_THREADS];
+	struct hash_engine engine;
+	int64_t total = 0;
+	int rc = TEST_PASSED;
+	char key[32];
+
+	if (hash_engine_init_config(&engine, &config) != 0)
+		return TEST_FAILED;
+	for (int i = 0; i < WRITER_THREADS; i++) {
+		args[i].engine = &engine;
+		args[i].id = i;
+		args[i].failed = 0;
+		pthread_create(&threads[i], NULL, writer, &args[i]);
+	}
+	for (int i = 0; i < WRITER_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		if (args[i].failed)
+			rc = TEST_FAILED;
+	}
+
+	for (int i = 0; i < COUNTER_KEYS; i++) {
+		counter_key(key, sizeof(key), i);
+		total += get_count(&engine, key);
+	}
+	if (total != (int64_t)WRITER_THREADS * WRITER_OPS)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+test_incr_concurrent(void)
+{
+	if (check_concurrent(HASH_PROBE_GROUP, 1, HASH_RESIZE_INLINE,
+			     incr_writer)
+	    != TEST_PASSED)
+		return TEST_FAILED;
+	if (check_concurrent(HASH_PROBE_GROUP, 4, HASH_RESIZE_BACKGROUND,
+			     incr_writer)
+	    != TEST_PASSED)
+		return TEST_FAILED;
+	return check_concurrent(HASH_PROBE_ROBIN_HOOD, 1, HASH_RESIZE_INLINE,
+				incr_writer);
+}
+
+static int
+test_cas_concurrent(void)
+{
+	if (check_concurrent(HASH_PROBE_GROUP, 1, HASH_RESIZE_INLINE,
+			     cas_writer)
+	    != TEST_PASSED)
+		return TEST_FAILED;
+	if (check_concurrent(HASH_PROBE_GROUP, 2, HASH_RESIZE_BACKGROUND,
+			     cas_writer)
+	    != TEST_PASSED)
+		return TEST_FAILED;
+	return check_concurrent(HASH_PROBE_ROBIN_HOOD, 2,
+				HASH_RESIZE_BACKGROUND, cas_writer);
+}
+
+int
+main(void)
+{
+	printf("===== Hash Read-Modify-Write Tests =====\n\n");
+
+	RUN_TEST(test_incr_basic);
+	RUN_TEST(test_cas_basic);
+	RUN_TEST(test_upsert_callback);
+	RUN_TEST(test_upsert_ttl);
+	RUN_TEST(test_incr_concurrent);
+	RUN_TEST(test_cas_concurrent);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
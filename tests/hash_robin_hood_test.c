@@ -0,0 +1,349 @@
+/**
+ * @file hash_robin_hood_test.c
+ * @brief Tests for the Robin Hood probing mode
+ *
+ * Covers basic operations, backward-shift deletion under churn, resizes,
+ * and lock-free readers racing writers that shift entries.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "storage/hash_engine.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+#define CHURN_KEYS 3000
+#define CHURN_ROUNDS 20000
+#define STABLE_KEYS 200
+#define READER_THREADS 4
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+static int
+init_robin_hood(struct hash_engine *engine, uint32_t bucket_count)
+{
+	struct hash_engine_config config = {
+		.bucket_count = bucket_count,
+		.probe_mode = HASH_PROBE_ROBIN_HOOD,
+	};
+
+	return hash_engine_init_config(engine, &config);
+}
+
+/*
+ * Shifts move inline values between slots, so a pointer from hash_get()
+ * can end up showing a neighbour's value; copy instead.
+ */
+static int
+check_key(struct hash_engine *engine, int id, int expected)
+{
+	char key[32];
+	size_t value_len;
+	int stored;
+
+	snprintf(key, sizeof(key), "rh_key_%d", id);
+	if (hash_get_copy(engine, key, strlen(key), &stored, sizeof(stored),
+			  &value_len)
+	    != 0)
+		return -1;
+	if (value_len != sizeof(stored))
+		return -1;
+	return stored == expected ? 0 : -1;
+}
+
+static int
+put_key(struct hash_engine *engine, int id, int value)
+{
+	char key[32];
+
+	snprintf(key, sizeof(key), "rh_key_%d", id);
+	return hash_put(engine, key, strlen(key), &value, sizeof(value));
+}
+
+static int
+delete_key(struct hash_engine *engine, int id)
+{
+	char key[32];
+
+	snprintf(key, sizeof(key), "rh_key_%d", id);
+	return hash_delete(engine, key, strlen(key));
+}
+
+/* Test: Invalid probe modes are rejected */
+static int
+test_config_validation(void)
+{
+	struct hash_engine engine;
+	struct hash_engine_config config = {
+		.bucket_count = 64,
+		.probe_mode = 42,
+	};
+
+	if (hash_engine_init_config(&engine, &config) != -EINVAL)
+		return TEST_FAILED;
+	if (hash_engine_init_config(&engine, NULL) != -EINVAL)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+/* Test: Put, overwrite, get and delete */
+static int
+test_basic_operations(void)
+{
+	struct hash_engine engine;
+	uint64_t item_count;
+	int i;
+
+	if (init_robin_hood(&engine, 64) != 0)
+		return TEST_FAILED;
+
+	for (i = 0; i < 40; i++) {
+		if (put_key(&engine, i, i) != 0)
+			goto fail;
+	}
+	for (i = 0; i < 40; i += 2) {
+		if (put_key(&engine, i, i * 10) != 0)
+			goto fail;
+	}
+	for (i = 0; i < 40; i++) {
+		if (check_key(&engine, i, (i % 2) ? i : i * 10) != 0)
+			goto fail;
+	}
+	for (i = 0; i < 40; i += 3) {
+		if (delete_key(&engine, i) != 0)
+			goto fail;
+		if (delete_key(&engine, i) != -ENOENT)
+			goto fail;
+	}
+	for (i = 0; i < 40; i++) {
+		int rc = check_key(&engine, i, (i % 2) ? i : i * 10);
+
+		if ((i % 3 == 0) != (rc != 0))
+			goto fail;
+	}
+
+	hash_engine_get_stats(&engine, &item_count, NULL, NULL);
+	if (item_count != 40 - 14)
+		goto fail;
+
+	hash_engine_destroy(&engine);
+	return TEST_PASSED;
+fail:
+	hash_engine_destroy(&engine);
+	return TEST_FAILED;
+}
+
+/* Test: Churn leaves no tombstones and keeps probe lengths short */
+static int
+test_churn_probe_lengths(void)
+{
+	struct hash_engine engine;
+	struct hash_probe_stats stats;
+	unsigned int seed = 7;
+	char *live;
+	int i;
+
+	/* Fixed size near the grow threshold so only churn is measured */
+	if (init_robin_hood(&engine, 4096) != 0)
+		return TEST_FAILED;
+	live = calloc(CHURN_KEYS, 1);
+	if (!live) {
+		hash_engine_destroy(&engine);
+		return TEST_FAILED;
+	}
+
+	for (i = 0; i < CHURN_KEYS / 2; i++) {
+		if (put_key(&engine, i, i) != 0)
+			goto fail;
+		live[i] = 1;
+	}
+
+	for (i = 0; i < CHURN_ROUNDS; i++) {
+		int id = rand_r(&seed) % CHURN_KEYS;
+
+		if (live[id]) {
+			if (delete_key(&engine, id) != 0)
+				goto fail;
+		} else if (put_key(&engine, id, id) != 0) {
+			goto fail;
+		}
+		live[id] = !live[id];
+	}
+
+	for (i = 0; i < CHURN_KEYS; i++) {
+		if ((check_key(&engine, i, i) == 0) != live[i]) {
+			fprintf(stderr, "key %d lost after churn\n", i);
+			goto fail;
+		}
+	}
+
+	if (hash_engine_get_probe_stats(&engine, &stats) != 0)
+		goto fail;
+	if (stats.tombstones != 0 || stats.p99_probe > 8) {
+		fprintf(stderr, "tombstones=%llu p99=%u max=%llu\n",
+			(unsigned long long)stats.tombstones, stats.p99_probe,
+			(unsigned long long)stats.max_probe);
+		goto fail;
+	}
+
+	free(live);
+	hash_engine_destroy(&engine);
+	return TEST_PASSED;
+fail:
+	free(live);
+	hash_engine_destroy(&engine);
+	return TEST_FAILED;
+}
+
+/* Test: Keys survive growing and shrinking through incremental resizes */
+static int
+test_resize(void)
+{
+	struct hash_engine engine;
+	uint64_t buckets;
+	int i;
+
+	if (init_robin_hood(&engine, MIN_BUCKET_COUNT) != 0)
+		return TEST_FAILED;
+
+	for (i = 0; i < 5000; i++) {
+		if (put_key(&engine, i, i) != 0)
+			goto fail;
+	}
+	hash_engine_get_stats(&engine, NULL, &buckets, NULL);
+	if (buckets <= MIN_BUCKET_COUNT)
+		goto fail;
+	for (i = 0; i < 5000; i++) {
+		if (check_key(&engine, i, i) != 0)
+			goto fail;
+	}
+
+	for (i = 0; i < 4950; i++) {
+		if (delete_key(&engine, i) != 0)
+			goto fail;
+	}
+	for (i = 4950; i < 5000; i++) {
+		if (check_key(&engine, i, i) != 0)
+			goto fail;
+	}
+
+	hash_engine_destroy(&engine);
+	return TEST_PASSED;
+fail:
+	hash_engine_destroy(&engine);
+	return TEST_FAILED;
+}
+
+struct reader_args {
+	struct hash_engine *engine;
+	_Atomic int *stop;
+	_Atomic int *errors;
+};
+
+static void *
+stable_reader(void *arg)
+{
+	struct reader_args *args = arg;
+	int i = 0;
+
+	while (!atomic_load(args->stop)) {
+		if (check_key(args->engine, i, i) != 0)
+			atomic_fetch_add(args->errors, 1);
+		i = (i + 1) % STABLE_KEYS;
+	}
+	return NULL;
+}
+
+/* Test: Readers never miss stable keys while writers shift neighbours */
+static int
+test_concurrent_shifts(void)
+{
+	struct hash_engine engine;
+	pthread_t threads[READER_THREADS];
+	struct reader_args args;
+	_Atomic int stop = 0;
+	_Atomic int errors = 0;
+	int round;
+	int i;
+
+	if (init_robin_hood(&engine, 1024) != 0)
+		return TEST_FAILED;
+	for (i = 0; i < STABLE_KEYS; i++) {
+		if (put_key(&engine, i, i) != 0) {
+			hash_engine_destroy(&engine);
+			return TEST_FAILED;
+		}
+	}
+
+	args.engine = &engine;
+	args.stop = &stop;
+	args.errors = &errors;
+	for (i = 0; i < READER_THREADS; i++)
+		pthread_create(&threads[i], NULL, stable_reader, &args);
+
+	/* Churn enough keys to trigger grows and shrinks as well as shifts */
+	for (round = 0; round < 10; round++) {
+		for (i = STABLE_KEYS; i < STABLE_KEYS + 2000; i++)
+			put_key(&engine, i, i);
+		for (i = STABLE_KEYS; i < STABLE_KEYS + 2000; i++)
+			delete_key(&engine, i);
+	}
+
+	atomic_store(&stop, 1);
+	for (i = 0; i < READER_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < STABLE_KEYS; i++) {
+		if (check_key(&engine, i, i) != 0)
+			atomic_fetch_add(&errors, 1);
+	}
+	hash_engine_destroy(&engine);
+
+	if (atomic_load(&errors) != 0) {
+		fprintf(stderr, "%d missed reads\n", atomic_load(&errors));
+		return TEST_FAILED;
+	}
+	return TEST_PASSED;
+}
+
+int
+main(void)
+{
+	printf("===== Robin Hood Probing Tests =====\n\n");
+
+	RUN_TEST(test_config_validation);
+	RUN_TEST(test_basic_operations);
+	RUN_TEST(test_churn_probe_lengths);
+	RUN_TEST(test_resize);
+	RUN_TEST(test_concurrent_shifts);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
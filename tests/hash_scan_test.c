@@ -0,0 +1,469 @@
+/**
+ * @file hash_scan_test.c
+ * @brief Tests for cursor scans over the hash engine
+ *
+ * Checks that a scan of a quiet engine reports each key exactly once, that
+ * keys present throughout are still reported while shards grow and shrink
+ * between and during calls, that callbacks can delete what they are given,
+ * and that a stopped scan resumes where it left off.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "storage/hash_engine.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+#define SCAN_KEYS 5000
+#define CHURN_THREADS 2
+#define CHURN_KEYS 3000
+/* Keys and values past the inline area exercise out-of-line entries */
+#define LONG_KEY_LEN 100
+#define LONG_VALUE_LEN 200
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+struct scan_state {
+	struct hash_engine *engine;
+	/* Times each tracked key was reported, indexed by its value */
+	int *seen;
+	int keys;
+	int bad;
+	int delete_seen;
+	/* Stop with stop_rc once this many entries were reported */
+	int stop_after;
+	int stop_rc;
+	int reported;
+};
+
+/* Tracked key i, every 11th one long enough to live out of line */
+static size_t
+make_key(char *buf, const char *prefix, int i)
+{
+	int len = snprintf(buf, LONG_KEY_LEN + 1, "%s_%d", prefix, i);
+
+	if (i % 11 == 0) {
+		memset(buf + len, 'k', LONG_KEY_LEN - len);
+		len = LONG_KEY_LEN;
+	}
+	return (size_t)len;
+}
+
+/* Values start with the tracked index; untracked keys store -1 */
+static int
+put_key(struct hash_engine *engine, const char *prefix, int i, int value)
+{
+	unsigned char buf[LONG_VALUE_LEN];
+	char key[LONG_KEY_LEN + 1];
+	size_t value_len = i % 7 == 0 ? LONG_VALUE_LEN : sizeof(value);
+
+	memset(buf, 0x5a, sizeof(buf));
+	memcpy(buf, &value, sizeof(value));
+	return hash_put(engine, key, make_key(key, prefix, i), buf, value_len);
+}
+
+static int
+delete_key(struct hash_engine *engine, const char *prefix, int i)
+{
+	char key[LONG_KEY_LEN + 1];
+
+	return hash_delete(engine, key, make_key(key, prefix, i));
+}
+
+static int
+record(void *arg, const void *key, size_t key_len, const void *value,
+       size_t value_len)
+{
+	struct scan_state *state = arg;
+	char expect[LONG_KEY_LEN + 1];
+	int i;
+
+	if (value_len < sizeof(i)) {
+		state->bad++;
+		return 0;
+	}
+	memcpy(&i, value, sizeof(i));
+	if (i >= 0) {
+		if (i >= state->keys
+		    || make_key(expect, "scan", i) != key_len
+		    || memcmp(expect, key, key_len) != 0)
+			state->bad++;
+		else
+			state->seen[i]++;
+	}
+	if (state->delete_seen
+	    && hash_delete(state->engine, key, key_len) != 0)
+		state->bad++;
+	if (++state->reported == state->stop_after)
+		return state->stop_rc;
+	return 0;
+}
+
+static int
+fill_tracked(struct hash_engine *engine, int keys)
+{
+	for (int i = 0; i < keys; i++) {
+		if (put_key(engine, "scan", i, i) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Scan to completion, calling between() before every call after the first */
+static int
+scan_all(struct hash_engine *engine, struct scan_state *state,
+	 uint32_t batch, void (*between)(struct hash_engine *, int))
+{
+	uint64_t cursor = 0;
+	int n = 0;
+	int rc;
+
+	do {
+		if (between && n > 0)
+			between(engine, n);
+		rc = hash_scan(engine, cursor, batch, record, state, &cursor);
+		if (rc != 0)
+			return rc;
+		n++;
+	} while (cursor != 0);
+	return 0;
+}
+
+static int
+check_seen(struct scan_state *state, int exactly_once)
+{
+	if (state->bad)
+		return TEST_FAILED;
+	for (int i = 0; i < state->keys; i++) {
+		if (state->seen[i] == 0
+		    || (exactly_once && state->seen[i] != 1)) {
+			fprintf(stderr, "key %d reported %d times\n", i,
+				state->seen[i]);
+			return TEST_FAILED;
+		}
+	}
+	return TEST_PASSED;
+}
+
+static void
+state_init(struct scan_state *state, struct hash_engine *engine, int *seen,
+	   int keys)
+{
+	memset(state, 0, sizeof(*state));
+	memset(seen, 0, keys * sizeof(*seen));
+	state->engine = engine;
+	state->seen = seen;
+	state->keys = keys;
+}
+
+/* Test: Without concurrent changes every key is reported exactly once */
+static int
+test_scan_exact_once(void)
+{
+	static int seen[SCAN_KEYS];
+	static const uint32_t shards[] = { 1, 4 };
+	struct hash_engine engine;
+	struct scan_state state;
+
+	for (int mode = HASH_PROBE_GROUP; mode <= HASH_PROBE_ROBIN_HOOD;
+	     mode++) {
+		for (size_t s = 0; s < sizeof(shards) / sizeof(shards[0]);
+		     s++) {
+			struct hash_engine_config config = {
+				.bucket_count = 4 * SCAN_KEYS,
+				.probe_mode = mode,
+				.shard_count = shards[s],
+			};
+			int rc;
+
+			if (hash_engine_init_config(&engine, &config) != 0)
+				return TEST_FAILED;
+			state_init(&state, &engine, seen, SCAN_KEYS);
+
+			/* An empty engine still finishes */
+			rc = scan_all(&engine, &state, 1000, NULL);
+			if (rc == 0 && state.reported == 0
+			    && fill_tracked(&engine, SCAN_KEYS) == 0)
+				rc = scan_all(&engine, &state, 7, NULL);
+			else
+				rc = -1;
+			hash_engine_destroy(&engine);
+			if (rc != 0 || check_seen(&state, 1) != TEST_PASSED)
+				return TEST_FAILED;
+		}
+	}
+	return TEST_PASSED;
+}
+
+static void
+grow_between(struct hash_engine *engine, int call)
+{
+	for (int i = 0; i < 40; i++)
+		put_key(engine, "grow", call * 40 + i, -1);
+}
+
+static void
+shrink_between(struct hash_engine *engine, int call)
+{
+	for (int i = 0; i < 400; i++)
+		delete_key(engine, "grow", call * 400 + i);
+}
+
+/* Test: Keys present throughout survive grows and shrinks mid-scan */
+static int
+test_scan_across_resizes(void)
+{
+	static int seen[SCAN_KEYS];
+	struct hash_engine engine;
+	struct scan_state state;
+	uint64_t items;
+	uint64_t buckets;
+	uint64_t before;
+	uint64_t memory;
+	int mode;
+
+	for (mode = HASH_PROBE_GROUP; mode <= HASH_PROBE_ROBIN_HOOD; mode++) {
+		struct hash_engine_config config = {
+			.bucket_count = MIN_BUCKET_COUNT * 2,
+			.probe_mode = mode,
+			.shard_count = 2,
+		};
+
+		if (hash_engine_init_config(&engine, &config) != 0
+		    || fill_tracked(&engine, SCAN_KEYS) != 0)
+			return TEST_FAILED;
+
+		state_init(&state, &engine, seen, SCAN_KEYS);
+		hash_engine_get_stats(&engine, &items, &before, &memory);
+		if (scan_all(&engine, &state, 64, grow_between) != 0)
+			goto fail;
+		hash_engine_get_stats(&engine, &items, &buckets, &memory);
+		if (buckets <= before || check_seen(&state, 0) != TEST_PASSED)
+			goto fail;
+
+		/* Pad well past the tracked keys, then delete it mid-scan */
+		for (int i = 0; i < 40000; i++)
+			put_key(&engine, "grow", i, -1);
+		state_init(&state, &engine, seen, SCAN_KEYS);
+		hash_engine_get_stats(&engine, &items, &before, &memory);
+		if (scan_all(&engine, &state, 256, shrink_between)
+		    != 0)
+			goto fail;
+		hash_engine_get_stats(&engine, &items, &buckets, &memory);
+		if (buckets >= before || check_seen(&state, 0) != TEST_PASSED)
+			goto fail;
+		hash_engine_destroy(&engine);
+	}
+	return TEST_PASSED;
+fail:
+	fprintf(stderr, "probe mode %d\n", mode);
+	hash_engine_destroy(&engine);
+	return TEST_FAILED;
+}
+
+/* Test: A callback can delete every key it is given */
+static int
+test_scan_delete_in_callback(void)
+{
+	static int seen[SCAN_KEYS];
+	struct hash_engine engine;
+	struct scan_state state;
+	uint64_t items;
+	uint64_t buckets;
+	uint64_t memory;
+	int rc;
+
+	for (int mode = HASH_PROBE_GROUP; mode <= HASH_PROBE_ROBIN_HOOD;
+	     mode++) {
+		struct hash_engine_config config = {
+			.bucket_count = SCAN_KEYS,
+			.probe_mode = mode,
+		};
+
+		if (hash_engine_init_config(&engine, &config) != 0
+		    || fill_tracked(&engine, SCAN_KEYS) != 0)
+			return TEST_FAILED;
+		state_init(&state, &engine, seen, SCAN_KEYS);
+		state.delete_seen = 1;
+		/* The deletes shrink the table under the scan */
+		rc = scan_all(&engine, &state, 32, NULL);
+		hash_engine_get_stats(&engine, &items, &buckets, &memory);
+		hash_engine_destroy(&engine);
+		if (rc != 0 || items != 0
+		    || check_seen(&state, 0) != TEST_PASSED)
+			return TEST_FAILED;
+	}
+	return TEST_PASSED;
+}
+
+/* Test: A nonzero callback return stops the scan, which then resumes */
+static int
+test_scan_stop_and_resume(void)
+{
+	static int seen[SCAN_KEYS];
+	struct hash_engine engine;
+	struct scan_state state;
+	uint64_t cursor = 0;
+	int stops = 0;
+	int rc;
+
+	if (hash_engine_init(&engine, 4 * SCAN_KEYS) != 0
+	    || fill_tracked(&engine, SCAN_KEYS) != 0)
+		return TEST_FAILED;
+	state_init(&state, &engine, seen, SCAN_KEYS);
+	state.stop_rc = 7;
+
+	do {
+		state.stop_after = state.reported + 100;
+		rc = hash_scan(&engine, cursor, 1000, record, &state,
+			       &cursor);
+		if (rc == 7)
+			stops++;
+		else if (rc != 0)
+			break;
+	} while (cursor != 0);
+	hash_engine_destroy(&engine);
+
+	/* Resuming revisits the slot that was cut short */
+	if (rc != 0 || stops < SCAN_KEYS / 100 - 1)
+		return TEST_FAILED;
+	return check_seen(&state, 0);
+}
+
+struct churn_args {
+	struct hash_engine *engine;
+	int id;
+	atomic_int *stop;
+};
+
+/* Grow and shrink shards by adding and removing untracked keys */
+static void *
+churner(void *arg)
+{
+	struct churn_args *args = arg;
+	char prefix[16];
+
+	snprintf(prefix, sizeof(prefix), "churn%d", args->id);
+	while (!atomic_load(args->stop)) {
+		for (int i = 0; i < CHURN_KEYS; i++)
+			put_key(args->engine, prefix, i, -1);
+		for (int i = 0; i < CHURN_KEYS; i++)
+			delete_key(args->engine, prefix, i);
+	}
+	return NULL;
+}
+
+/* Test: Scans stay complete while other threads resize the shards */
+static int
+test_scan_concurrent_writers(void)
+{
+	static int seen[SCAN_KEYS];
+	pthread_t threads[CHURN_THREADS];
+	struct churn_args args[CHURN_THREADS];
+	struct hash_engine engine;
+	struct scan_state state;
+	atomic_int stop = 0;
+	int rc = TEST_PASSED;
+
+	for (int mode = HASH_RESIZE_INLINE; mode <= HASH_RESIZE_BACKGROUND;
+	     mode++) {
+		struct hash_engine_config config = {
+			.bucket_count = MIN_BUCKET_COUNT * 4,
+			.shard_count = 4,
+			.resize_mode = mode,
+		};
+
+		if (hash_engine_init_config(&engine, &config) != 0
+		    || fill_tracked(&engine, SCAN_KEYS) != 0)
+			return TEST_FAILED;
+		atomic_store(&stop, 0);
+		for (int t = 0; t < CHURN_THREADS; t++) {
+			args[t].engine = &engine;
+			args[t].id = t;
+			args[t].stop = &stop;
+			pthread_create(&threads[t], NULL, churner, &args[t]);
+		}
+
+		for (int pass = 0; pass < 5 && rc == TEST_PASSED; pass++) {
+			state_init(&state, &engine, seen, SCAN_KEYS);
+			if (scan_all(&engine, &state, 16, NULL) != 0
+			    || check_seen(&state, 0) != TEST_PASSED)
+				rc = TEST_FAILED;
+		}
+
+		atomic_store(&stop, 1);
+		for (int t = 0; t < CHURN_THREADS; t++)
+			pthread_join(threads[t], NULL);
+		hash_engine_destroy(&engine);
+		if (rc != TEST_PASSED)
+			return rc;
+	}
+	return TEST_PASSED;
+}
+
+/* Test: Bad arguments and cursors past the last shard are rejected */
+static int
+test_scan_invalid(void)
+{
+	struct hash_engine engine;
+	struct scan_state state;
+	uint64_t cursor;
+	int rc = TEST_PASSED;
+
+	memset(&state, 0, sizeof(state));
+	if (hash_scan(NULL, 0, 1, record, &state, &cursor) != -EINVAL)
+		return TEST_FAILED;
+	if (hash_engine_init(&engine, MIN_BUCKET_COUNT) != 0)
+		return TEST_FAILED;
+	if (hash_scan(&engine, 0, 1, NULL, &state, &cursor) != -EINVAL
+	    || hash_scan(&engine, 0, 0, record, &state, &cursor) != -EINVAL
+	    || hash_scan(&engine, 0, 1, record, &state, NULL) != -EINVAL
+	    || hash_scan(&engine, 1ULL << 32, 1, record, &state, &cursor)
+		   != -EINVAL)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+int
+main(void)
+{
+	printf("===== Hash Scan Tests =====\n\n");
+
+	RUN_TEST(test_scan_exact_once);
+	RUN_TEST(test_scan_across_resizes);
+	RUN_TEST(test_scan_delete_in_callback);
+	RUN_TEST(test_scan_stop_and_resume);
+	RUN_TEST(test_scan_concurrent_writers);
+	RUN_TEST(test_scan_invalid);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
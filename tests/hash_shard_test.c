@@ -0,0 +1,342 @@
+/**
+ * @file hash_shard_test.c
+ * @brief Tests for the sharded hash engine front end
+ *
+ * Checks shard configuration, that stats aggregate across shards, that
+ * shards resize independently under concurrent writers, and that per-CPU
+ * counter stripes add up.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "storage/hash_engine.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+#define WRITER_THREADS 8
+#define KEYS_PER_WRITER 5000
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+static int
+init_sharded(struct hash_engine *engine, uint32_t bucket_count,
+	     uint32_t shard_count, int probe_mode)
+{
+	struct hash_engine_config config = {
+		.bucket_count = bucket_count,
+		.probe_mode = probe_mode,
+		.shard_count = shard_count,
+	};
+
+	return hash_engine_init_config(engine, &config);
+}
+
+/* Test: Shard counts must be powers of two within range */
+static int
+test_shard_config(void)
+{
+	struct hash_engine engine;
+	uint64_t buckets;
+
+	if (init_sharded(&engine, 1024, 3, HASH_PROBE_GROUP) != -EINVAL)
+		return TEST_FAILED;
+	if (init_sharded(&engine, 1024, HASH_MAX_SHARDS * 2, HASH_PROBE_GROUP)
+	    != -EINVAL)
+		return TEST_FAILED;
+
+	/* Tiny totals still give every shard a minimum table */
+	if (init_sharded(&engine, 16, 64, HASH_PROBE_GROUP) != 0)
+		return TEST_FAILED;
+	hash_engine_get_stats(&engine, NULL, &buckets, NULL);
+	hash_engine_destroy(&engine);
+	if (buckets != 64 * MIN_BUCKET_COUNT)
+		return TEST_FAILED;
+
+	if (init_sharded(&engine, 4096, 16, HASH_PROBE_GROUP) != 0)
+		return TEST_FAILED;
+	hash_engine_get_stats(&engine, NULL, &buckets, NULL);
+	hash_engine_destroy(&engine);
+	return buckets == 4096 ? TEST_PASSED : TEST_FAILED;
+}
+
+static int
+run_basic_ops(int probe_mode)
+{
+	struct hash_engine engine;
+	char key[32];
+	char value[32];
+	char buf[32];
+	uint64_t items;
+	uint64_t memory;
+	size_t expected_memory = 0;
+	size_t len;
+	int i;
+
+	if (init_sharded(&engine, 256, 16, probe_mode) != 0)
+		return TEST_FAILED;
+
+	for (i = 0; i < 2000; i++) {
+		snprintf(key, sizeof(key), "shard_key_%d", i);
+		snprintf(value, sizeof(value), "value_%d", i);
+		if (hash_put(&engine, key, strlen(key), value, strlen(value))
+		    != 0)
+			goto fail;
+		expected_memory += strlen(key) + strlen(value);
+	}
+	for (i = 0; i < 2000; i++) {
+		snprintf(key, sizeof(key), "shard_key_%d", i);
+		snprintf(value, sizeof(value), "value_%d", i);
+		if (hash_get_copy(&engine, key, strlen(key), buf, sizeof(buf),
+				  &len)
+			!= 0
+		    || len != strlen(value) || memcmp(buf, value, len) != 0)
+			goto fail;
+	}
+	for (i = 0; i < 2000; i += 2) {
+		snprintf(key, sizeof(key), "shard_key_%d", i);
+		snprintf(value, sizeof(value), "value_%d", i);
+		if (hash_delete(&engine, key, strlen(key)) != 0)
+			goto fail;
+		expected_memory -= strlen(key) + strlen(value);
+	}
+
+	hash_engine_get_stats(&engine, &items, NULL, &memory);
+	if (items != 1000 || memory != expected_memory)
+		goto fail;
+
+	hash_engine_destroy(&engine);
+	return TEST_PASSED;
+fail:
+	hash_engine_destroy(&engine);
+	return TEST_FAILED;
+}
+
+/* Test: Operations and aggregated stats across shards */
+static int
+test_basic_ops_group(void)
+{
+	return run_basic_ops(HASH_PROBE_GROUP);
+}
+
+static int
+test_basic_ops_robin_hood(void)
+{
+	return run_basic_ops(HASH_PROBE_ROBIN_HOOD);
+}
+
+struct writer_args {
+	struct hash_engine *engine;
+	int id;
+	_Atomic int *errors;
+};
+
+static void *
+writer(void *arg)
+{
+	struct writer_args *args = arg;
+	char key[32];
+	int i;
+
+	for (i = 0; i < KEYS_PER_WRITER; i++) {
+		snprintf(key, sizeof(key), "w%d_%d", args->id, i);
+		if (hash_put(args->engine, key, strlen(key), &i, sizeof(i))
+		    != 0)
+			atomic_fetch_add(args->errors, 1);
+	}
+	return NULL;
+}
+
+/* Test: Concurrent writers grow every shard independently */
+static int
+test_concurrent_growth(void)
+{
+	struct hash_engine engine;
+	pthread_t threads[WRITER_THREADS];
+	struct writer_args args[WRITER_THREADS];
+	_Atomic int errors = 0;
+	uint64_t items;
+	uint64_t buckets;
+	char key[32];
+	int value;
+	size_t len;
+	int t;
+	int i;
+
+	if (init_sharded(&engine, 16, 8, HASH_PROBE_GROUP) != 0)
+		return TEST_FAILED;
+
+	for (t = 0; t < WRITER_THREADS; t++) {
+		args[t].engine = &engine;
+		args[t].id = t;
+		args[t].errors = &errors;
+		pthread_create(&threads[t], NULL, writer, &args[t]);
+	}
+	for (t = 0; t < WRITER_THREADS; t++)
+		pthread_join(threads[t], NULL);
+
+	for (t = 0; t < WRITER_THREADS; t++) {
+		for (i = 0; i < KEYS_PER_WRITER; i++) {
+			snprintf(key, sizeof(key), "w%d_%d", t, i);
+			if (hash_get_copy(&engine, key, strlen(key), &value,
+					  sizeof(value), &len)
+				!= 0
+			    || value != i)
+				atomic_fetch_add(&errors, 1);
+		}
+	}
+
+	hash_engine_get_stats(&engine, &items, &buckets, NULL);
+	hash_engine_destroy(&engine);
+
+	if (atomic_load(&errors) != 0) {
+		fprintf(stderr, "%d errors\n", atomic_load(&errors));
+		return TEST_FAILED;
+	}
+	if (items != WRITER_THREADS * KEYS_PER_WRITER
+	    || items >= buckets * MAX_LOAD_FACTOR) {
+		fprintf(stderr, "items=%llu buckets=%llu\n",
+			(unsigned long long)items,
+			(unsigned long long)buckets);
+		return TEST_FAILED;
+	}
+	return TEST_PASSED;
+}
+
+static void *
+churner(void *arg)
+{
+	struct writer_args *args = arg;
+	char key[32];
+	int i;
+
+	for (i = 0; i < KEYS_PER_WRITER; i++) {
+		snprintf(key, sizeof(key), "c%d_%d", args->id, i);
+		if (hash_put(args->engine, key, strlen(key), &i, sizeof(i))
+		    != 0)
+			atomic_fetch_add(args->errors, 1);
+	}
+	for (i = 1; i < KEYS_PER_WRITER; i += 2) {
+		snprintf(key, sizeof(key), "c%d_%d", args->id, i);
+		if (hash_delete(args->engine, key, strlen(key)) != 0)
+			atomic_fetch_add(args->errors, 1);
+	}
+	return NULL;
+}
+
+/*
+ * Test: Per-CPU counter stripes add up exactly once writers stop, and each
+ * shard's folded count stays within one batch per stripe of the truth
+ */
+static int
+test_counter_stripes(void)
+{
+	struct hash_engine engine;
+	pthread_t threads[WRITER_THREADS];
+	struct writer_args args[WRITER_THREADS];
+	_Atomic int errors = 0;
+	uint64_t expected_memory = 0;
+	uint64_t items;
+	uint64_t memory;
+	char key[32];
+	int64_t total = 0;
+	uint32_t s;
+	int t;
+	int i;
+
+	if (init_sharded(&engine, 16, 4, HASH_PROBE_GROUP) != 0)
+		return TEST_FAILED;
+
+	for (t = 0; t < WRITER_THREADS; t++) {
+		args[t].engine = &engine;
+		args[t].id = t;
+		args[t].errors = &errors;
+		pthread_create(&threads[t], NULL, churner, &args[t]);
+	}
+	for (t = 0; t < WRITER_THREADS; t++)
+		pthread_join(threads[t], NULL);
+
+	for (t = 0; t < WRITER_THREADS; t++) {
+		for (i = 0; i < KEYS_PER_WRITER; i += 2)
+			expected_memory += snprintf(key, sizeof(key), "c%d_%d",
+						    t, i)
+					   + sizeof(i);
+	}
+
+	for (s = 0; s < engine.shard_count; s++) {
+		struct hash_shard *shard = &engine.shards[s];
+		int64_t stripes = 0;
+		uint32_t c;
+
+		if (((shard->counter_mask + 1) & shard->counter_mask) != 0
+		    || shard->counter_mask >= HASH_MAX_COUNTER_STRIPES)
+			goto fail;
+		for (c = 0; c <= shard->counter_mask; c++) {
+			int64_t drift = atomic_load(&shard->counters[c].items);
+
+			if (drift >= HASH_COUNTER_BATCH
+			    || drift <= -HASH_COUNTER_BATCH)
+				goto fail;
+			stripes += drift;
+		}
+		total += atomic_load(&shard->item_count) + stripes;
+	}
+
+	hash_engine_get_stats(&engine, &items, NULL, &memory);
+	if (atomic_load(&errors) != 0 || (int64_t)items != total
+	    || items != WRITER_THREADS * KEYS_PER_WRITER / 2
+	    || memory != expected_memory) {
+		fprintf(stderr, "errors=%d items=%llu memory=%llu/%llu\n",
+			atomic_load(&errors), (unsigned long long)items,
+			(unsigned long long)memory,
+			(unsigned long long)expected_memory);
+		goto fail;
+	}
+
+	hash_engine_destroy(&engine);
+	return TEST_PASSED;
+fail:
+	hash_engine_destroy(&engine);
+	return TEST_FAILED;
+}
+
+int
+main(void)
+{
+	printf("===== Sharded Engine Tests =====\n\n");
+
+	RUN_TEST(test_shard_config);
+	RUN_TEST(test_basic_ops_group);
+	RUN_TEST(test_basic_ops_robin_hood);
+	RUN_TEST(test_concurrent_growth);
+	RUN_TEST(test_counter_stripes);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
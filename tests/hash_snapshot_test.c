@@ -0,0 +1,525 @@
+/**
+ * @file hash_snapshot_test.c
+ * @brief Tests for saving engines to snapshots and loading them back
+ *
+ * Round-trips engines with inline and out-of-line keys and values through
+ * hash_engine_save() and hash_engine_load() under each probe mode, then
+ * keeps writing to the loaded engine. Damaged, truncated and foreign files
+ * must be refused rather than served, and a mapped table another thread
+ * reclaims after the engine is destroyed must still find its mapping.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "storage/hash/hasher.h"
+#include "storage/hash/snapshot.h"
+#include "storage/hash_engine.h"
+#include "utils/epoch.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+#define SNAPSHOT_KEYS 20000
+/* Every SNAPSHOT_LONG_KEY-th key and SNAPSHOT_LONG_VALUE-th value spill */
+#define SNAPSHOT_LONG_KEY 11
+#define SNAPSHOT_LONG_VALUE 7
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+static char snapshot_path[64];
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+		unlink(snapshot_path);                                         \
+	} while (0)
+
+static size_t
+make_key(char *key, size_t size, int i)
+{
+	if (i % SNAPSHOT_LONG_KEY == 0) {
+		memset(key, 'k', 100);
+		return 100 + (size_t)snprintf(key + 100, size - 100, "%d", i);
+	}
+	return (size_t)snprintf(key, size, "snap_%d", i);
+}
+
+static size_t
+make_value(char *value, int i, int round)
+{
+	size_t len = i % SNAPSHOT_LONG_VALUE == 0 ? 200 : 12;
+
+	for (size_t j = 0; j < len; j++)
+		value[j] = (char)(i + round + j);
+	return len;
+}
+
+static int
+fill(struct hash_engine *engine, int from, int to, int round)
+{
+	char key[128];
+	char value[256];
+
+	for (int i = from; i < to; i++) {
+		size_t key_len = make_key(key, sizeof(key), i);
+		size_t value_len = make_value(value, i, round);
+
+		if (hash_put(engine, key, key_len, value, value_len) != 0)
+			return TEST_FAILED;
+	}
+	return TEST_PASSED;
+}
+
+/* Keys in [from, to) hold round's values and the engine holds items keys */
+static int
+check(struct hash_engine *engine, int from, int to, int round,
+      uint64_t items)
+{
+	char key[128];
+	char want[256];
+	char got[256];
+	uint64_t count;
+	uint64_t buckets;
+	uint64_t memory;
+
+	for (int i = from; i < to; i++) {
+		size_t key_len = make_key(key, sizeof(key), i);
+		size_t want_len = make_value(want, i, round);
+		size_t got_len;
+
+		if (hash_get_copy(engine, key, key_len, got, sizeof(got),
+				  &got_len)
+			    != 0
+		    || got_len != want_len || memcmp(got, want, want_len) != 0) {
+			fprintf(stderr, "key %d\n", i);
+			return TEST_FAILED;
+		}
+	}
+	if (hash_engine_get_stats(engine, &count, &buckets, &memory) != 0
+	    || count != items)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+static int
+save_filled(const struct hash_engine_config *config, int keys)
+{
+	struct hash_engine engine;
+	int rc;
+
+	if (hash_engine_init_config(&engine, config) != 0)
+		return TEST_FAILED;
+	rc = fill(&engine, 0, keys, 0);
+	if (rc == TEST_PASSED && hash_engine_save(&engine, snapshot_path) != 0)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+/* Test: Engines load back with every key, value and counter intact */
+static int
+test_snapshot_round_trip(void)
+{
+	static const struct hash_engine_config configs[] = {
+		{ .bucket_count = 1024 },
+		{ .bucket_count = 4096, .shard_count = 4 },
+		{ .bucket_count = 1024, .probe_mode = HASH_PROBE_ROBIN_HOOD },
+		{ .bucket_count = 8192, .shard_count = 2,
+		  .probe_mode = HASH_PROBE_ROBIN_HOOD,
+		  .hasher = HASHER_WYHASH },
+	};
+
+	for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		struct hash_engine engine;
+		int rc;
+
+		if (save_filled(&configs[c], SNAPSHOT_KEYS) != TEST_PASSED)
+			return TEST_FAILED;
+		if (hash_engine_load(&engine, snapshot_path, NULL, 0) != 0)
+			return TEST_FAILED;
+		rc = check(&engine, 0, SNAPSHOT_KEYS, 0, SNAPSHOT_KEYS);
+		if (engine.shard_count
+		    != (configs[c].shard_count ? configs[c].shard_count : 1))
+			rc = TEST_FAILED;
+		hash_engine_destroy(&engine);
+		if (rc != TEST_PASSED) {
+			fprintf(stderr, "config %zu\n", c);
+			return TEST_FAILED;
+		}
+	}
+	return TEST_PASSED;
+}
+
+/* Test: Loaded engines take overwrites, deletes and growth */
+static int
+test_snapshot_writes_after_load(void)
+{
+	struct hash_engine_config config = { .bucket_count = 2048 };
+	struct hash_engine engine;
+	char key[128];
+	int rc = TEST_FAILED;
+
+	if (save_filled(&config, SNAPSHOT_KEYS / 2) != TEST_PASSED)
+		return TEST_FAILED;
+	if (hash_engine_load(&engine, snapshot_path, NULL, 0) != 0)
+		return TEST_FAILED;
+
+	/* Replaces mapped values, then grows off the mapped table */
+	if (fill(&engine, 0, SNAPSHOT_KEYS / 4, 1) != TEST_PASSED
+	    || fill(&engine, SNAPSHOT_KEYS / 2, SNAPSHOT_KEYS, 0) != TEST_PASSED)
+		goto out;
+	for (int i = SNAPSHOT_KEYS / 4; i < SNAPSHOT_KEYS / 2; i += 2) {
+		size_t key_len = make_key(key, sizeof(key), i);
+
+		if (hash_delete(&engine, key, key_len) != 0)
+			goto out;
+	}
+	if (check(&engine, 0, SNAPSHOT_KEYS / 4, 1,
+		  SNAPSHOT_KEYS - SNAPSHOT_KEYS / 8)
+		    != TEST_PASSED
+	    || check(&engine, SNAPSHOT_KEYS / 2, SNAPSHOT_KEYS, 0,
+		     SNAPSHOT_KEYS - SNAPSHOT_KEYS / 8)
+		       != TEST_PASSED)
+		goto out;
+	for (int i = SNAPSHOT_KEYS / 4 + 1; i < SNAPSHOT_KEYS / 2; i += 2) {
+		if (check(&engine, i, i + 1, 0,
+			  SNAPSHOT_KEYS - SNAPSHOT_KEYS / 8)
+		    != TEST_PASSED)
+			goto out;
+	}
+	rc = TEST_PASSED;
+out:
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+/* Test: A loaded engine saves again, including its mapped parts */
+static int
+test_snapshot_resave(void)
+{
+	struct hash_engine_config config = {
+		.bucket_count = 2048,
+		.probe_mode = HASH_PROBE_ROBIN_HOOD,
+	};
+	struct hash_engine engine;
+	int rc;
+
+	if (save_filled(&config, SNAPSHOT_KEYS) != TEST_PASSED)
+		return TEST_FAILED;
+	if (hash_engine_load(&engine, snapshot_path, NULL, 0) != 0)
+		return TEST_FAILED;
+	/* Half the values replaced, the other half still in the mapping */
+	rc = fill(&engine, 0, SNAPSHOT_KEYS / 2, 1);
+	if (rc == TEST_PASSED && hash_engine_save(&engine, snapshot_path) != 0)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	if (rc != TEST_PASSED)
+		return rc;
+
+	if (hash_engine_load(&engine, snapshot_path, NULL, HASH_LOAD_VERIFY)
+	    != 0)
+		return TEST_FAILED;
+	rc = check(&engine, 0, SNAPSHOT_KEYS / 2, 1, SNAPSHOT_KEYS);
+	if (rc == TEST_PASSED)
+		rc = check(&engine, SNAPSHOT_KEYS / 2, SNAPSHOT_KEYS, 0,
+			   SNAPSHOT_KEYS);
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+/* Test: Loading into background resize mode starts its workers */
+static int
+test_snapshot_load_background(void)
+{
+	struct hash_engine_config config = { .bucket_count = 1024 };
+	struct hash_engine_config load = {
+		.resize_mode = HASH_RESIZE_BACKGROUND,
+		.resize_threads = 2,
+	};
+	struct hash_engine engine;
+	int rc;
+
+	if (save_filled(&config, SNAPSHOT_KEYS / 4) != TEST_PASSED)
+		return TEST_FAILED;
+	if (hash_engine_load(&engine, snapshot_path, &load, 0) != 0)
+		return TEST_FAILED;
+	rc = fill(&engine, SNAPSHOT_KEYS / 4, SNAPSHOT_KEYS, 0);
+	if (rc == TEST_PASSED)
+		rc = check(&engine, 0, SNAPSHOT_KEYS, 0, SNAPSHOT_KEYS);
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+struct late_reclaim {
+	struct hash_engine *engine;
+	_Atomic int stage;
+	int rc;
+};
+
+static int
+resizing(struct hash_engine *engine)
+{
+	for (uint32_t i = 0; i < engine->shard_count; i++)
+		if (atomic_load(&engine->shards[i].old_table))
+			return 1;
+	return 0;
+}
+
+/* Grows off the mapped table, then frees it only when told to */
+static void *
+grow_and_reclaim(void *p)
+{
+	struct late_reclaim *late = p;
+	char key[128];
+
+	late->rc = fill(late->engine, SNAPSHOT_KEYS / 4, SNAPSHOT_KEYS, 0);
+	for (int i = 0; resizing(late->engine) && i < 1000000; i++) {
+		size_t key_len = make_key(key, sizeof(key), i % SNAPSHOT_KEYS);
+
+		hash_put(late->engine, key, key_len, "x", 1);
+	}
+	if (resizing(late->engine))
+		late->rc = TEST_FAILED;
+	atomic_store(&late->stage, 1);
+	while (atomic_load(&late->stage) != 2)
+		usleep(100);
+	epoch_synchronize();
+	return NULL;
+}
+
+/* Test: A retired mapped table outlives the engine that mapped it */
+static int
+test_snapshot_reclaim_after_destroy(void)
+{
+	struct hash_engine_config config = { .bucket_count = 1024 };
+	struct hash_engine engine;
+	struct late_reclaim late = { .engine = &engine };
+	long page = sysconf(_SC_PAGESIZE);
+	pthread_t tid;
+	void *base;
+	int rc = TEST_PASSED;
+
+	if (save_filled(&config, SNAPSHOT_KEYS / 4) != TEST_PASSED)
+		return TEST_FAILED;
+	if (hash_engine_load(&engine, snapshot_path, NULL, 0) != 0)
+		return TEST_FAILED;
+	base = engine.snapshot->base;
+
+	/* Held open so the helper's retire of the mapped table must wait */
+	epoch_enter();
+	pthread_create(&tid, NULL, grow_and_reclaim, &late);
+	while (atomic_load(&late.stage) != 1)
+		usleep(100);
+	epoch_exit();
+
+	/* Drains this thread's list; the mapped table is on the helper's */
+	hash_engine_destroy(&engine);
+	if (msync(base, (size_t)page, MS_ASYNC) != 0)
+		rc = TEST_FAILED;
+
+	atomic_store(&late.stage, 2);
+	pthread_join(tid, NULL);
+	if (late.rc != TEST_PASSED)
+		rc = TEST_FAILED;
+	/* The helper's reclaim dropped the last reference */
+	if (msync(base, (size_t)page, MS_ASYNC) == 0 || errno != ENOMEM)
+		rc = TEST_FAILED;
+	return rc;
+}
+
+static int
+patch_file(off_t offset, const void *data, size_t len)
+{
+	int fd = open(snapshot_path, O_WRONLY);
+	int rc = TEST_PASSED;
+
+	if (fd < 0)
+		return TEST_FAILED;
+	if (pwrite(fd, data, len, offset) != (ssize_t)len)
+		rc = TEST_FAILED;
+	close(fd);
+	return rc;
+}
+
+static int
+load_fails(int flags, int expect)
+{
+	struct hash_engine engine;
+	int rc = hash_engine_load(&engine, snapshot_path, NULL, flags);
+
+	if (rc == 0)
+		hash_engine_destroy(&engine);
+	if (rc != expect) {
+		fprintf(stderr, "load returned %d, expected %d\n", rc, expect);
+		return TEST_FAILED;
+	}
+	return TEST_PASSED;
+}
+
+/* Test: Damaged headers and foreign files are refused */
+static int
+test_snapshot_damaged_header(void)
+{
+	struct hash_engine_config config = { .bucket_count = 1024 };
+	struct snapshot_header header;
+	uint32_t version = SNAPSHOT_VERSION + 1;
+	uint64_t count = 1ULL << 40;
+
+	if (save_filled(&config, 100) != TEST_PASSED)
+		return TEST_FAILED;
+	if (patch_file(offsetof(struct snapshot_header, version), &version,
+		       sizeof(version))
+		    != TEST_PASSED
+	    || load_fails(0, -EINVAL) != TEST_PASSED)
+		return TEST_FAILED;
+
+	if (save_filled(&config, 100) != TEST_PASSED)
+		return TEST_FAILED;
+	if (patch_file(0, "NOTASNAP", sizeof(header.magic)) != TEST_PASSED
+	    || load_fails(0, -EBADMSG) != TEST_PASSED)
+		return TEST_FAILED;
+
+	/* Caught by the header CRC before the count is ever used */
+	if (save_filled(&config, 100) != TEST_PASSED)
+		return TEST_FAILED;
+	if (patch_file(offsetof(struct snapshot_header, shards)
+			   + offsetof(struct snapshot_shard, bucket_count),
+		       &count, sizeof(count))
+		    != TEST_PASSED
+	    || load_fails(0, -EBADMSG) != TEST_PASSED)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+/* Test: A damaged bucket is caught when verifying, and only then */
+static int
+test_snapshot_damaged_bucket(void)
+{
+	struct hash_engine_config config = { .bucket_count = 1024 };
+	struct snapshot_header header;
+	struct snapshot_shard shard;
+	struct hash_engine engine;
+	unsigned char byte = 0xff;
+	int fd;
+
+	if (save_filled(&config, 100) != TEST_PASSED)
+		return TEST_FAILED;
+	fd = open(snapshot_path, O_RDONLY);
+	if (fd < 0)
+		return TEST_FAILED;
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header)
+	    || pread(fd, &shard, sizeof(shard), sizeof(header))
+		   != sizeof(shard)) {
+		close(fd);
+		return TEST_FAILED;
+	}
+	close(fd);
+
+	/* The last byte of the bucket section, which no lookup reads */
+	if (patch_file((off_t)(shard.buckets_offset
+			       + shard.bucket_count
+				     * sizeof(struct hash_bucket)
+			       - 1),
+		       &byte, sizeof(byte))
+	    != TEST_PASSED)
+		return TEST_FAILED;
+	if (load_fails(HASH_LOAD_VERIFY, -EBADMSG) != TEST_PASSED)
+		return TEST_FAILED;
+	if (hash_engine_load(&engine, snapshot_path, NULL, 0) != 0)
+		return TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return TEST_PASSED;
+}
+
+/* Test: Truncated files are refused */
+static int
+test_snapshot_truncated(void)
+{
+	struct hash_engine_config config = { .bucket_count = 1024 };
+	struct stat st;
+
+	if (save_filled(&config, 1000) != TEST_PASSED
+	    || stat(snapshot_path, &st) != 0)
+		return TEST_FAILED;
+	if (truncate(snapshot_path, st.st_size - SNAPSHOT_ALIGN) != 0
+	    || load_fails(0, -EBADMSG) != TEST_PASSED)
+		return TEST_FAILED;
+	if (truncate(snapshot_path, 16) != 0
+	    || load_fails(0, -EBADMSG) != TEST_PASSED)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+/* Test: Bad arguments and missing files are rejected */
+static int
+test_snapshot_invalid_args(void)
+{
+	struct hash_engine_config config = { .bucket_count = 1024 };
+	struct hash_engine_config bad = { .resize_mode = 7 };
+	struct hash_engine engine;
+
+	if (hash_engine_save(NULL, snapshot_path) != -EINVAL)
+		return TEST_FAILED;
+	if (hash_engine_load(NULL, snapshot_path, NULL, 0) != -EINVAL
+	    || hash_engine_load(&engine, NULL, NULL, 0) != -EINVAL)
+		return TEST_FAILED;
+	if (hash_engine_load(&engine, snapshot_path, NULL, 0) != -ENOENT)
+		return TEST_FAILED;
+
+	if (save_filled(&config, 10) != TEST_PASSED)
+		return TEST_FAILED;
+	if (hash_engine_load(&engine, snapshot_path, NULL, 0x80) != -EINVAL
+	    || hash_engine_load(&engine, snapshot_path, &bad, 0) != -EINVAL)
+		return TEST_FAILED;
+	memset(&engine, 0, sizeof(engine));
+	if (hash_engine_save(&engine, snapshot_path) != -EINVAL)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+int
+main(void)
+{
+	snprintf(snapshot_path, sizeof(snapshot_path),
+		 "/tmp/hash_snapshot_test_%d", (int)getpid());
+
+	printf("===== Hash Snapshot Tests =====\n\n");
+
+	RUN_TEST(test_snapshot_round_trip);
+	RUN_TEST(test_snapshot_writes_after_load);
+	RUN_TEST(test_snapshot_resave);
+	RUN_TEST(test_snapshot_load_background);
+	RUN_TEST(test_snapshot_reclaim_after_destroy);
+	RUN_TEST(test_snapshot_damaged_header);
+	RUN_TEST(test_snapshot_damaged_bucket);
+	RUN_TEST(test_snapshot_truncated);
+	RUN_TEST(test_snapshot_invalid_args);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
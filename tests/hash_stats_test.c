@@ -0,0 +1,279 @@
+/**
+ * @file hash_stats_test.c
+ * @brief Tests for hash_engine_get_table_stats()
+ *
+ * Checks that a full walk accounts for every slot, entry and tombstone and
+ * that its clusters cover every occupied slot once; that a sampled walk
+ * reads only its sample and estimates the full walk's load factor; that
+ * deletes show up as tombstones; and that a resize reports its progress
+ * until it finishes.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "storage/hash_engine.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+#define STATS_BUCKETS 65536
+#define STATS_KEYS 40000
+#define STATS_SHARDS 4
+#define DELETED_KEYS 10000
+#define SAMPLE_SLOTS 4096
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+static int
+init_engine(struct hash_engine *engine, int probe_mode, uint32_t shards,
+	    uint64_t buckets, uint32_t assist_budget)
+{
+	struct hash_engine_config config = {
+		.bucket_count = buckets,
+		.probe_mode = probe_mode,
+		.shard_count = shards,
+		.assist_budget = assist_budget,
+	};
+
+	return hash_engine_init_config(engine, &config);
+}
+
+static int
+put_key(struct hash_engine *engine, int id)
+{
+	char key[32];
+
+	snprintf(key, sizeof(key), "stats_key_%d", id);
+	return hash_put(engine, key, strlen(key), &id, sizeof(id));
+}
+
+static int
+delete_key(struct hash_engine *engine, int id)
+{
+	char key[32];
+
+	snprintf(key, sizeof(key), "stats_key_%d", id);
+	return hash_delete(engine, key, strlen(key));
+}
+
+static uint64_t
+hist_sum(const struct hash_table_stats *stats)
+{
+	uint64_t total = 0;
+
+	for (int i = 0; i < HASH_PROBE_HIST_BINS; i++)
+		total += stats->probe_hist[i];
+	return total;
+}
+
+/* What every walk, full or sampled, must agree with itself on */
+static int
+check_consistent(const struct hash_table_stats *stats)
+{
+	if (hist_sum(stats) != stats->entries
+	    || stats->entries + stats->tombstones > stats->slots)
+		return 0;
+	if (stats->entries
+	    && (stats->p50_probe < 1 || stats->p50_probe > stats->p99_probe
+		|| stats->p99_probe > stats->max_probe))
+		return 0;
+	if (stats->clusters
+	    && (stats->avg_cluster < 1
+		|| stats->longest_cluster < stats->avg_cluster))
+		return 0;
+	return 1;
+}
+
+static int
+test_empty_engine(void)
+{
+	struct hash_engine engine;
+	struct hash_table_stats stats;
+	uint64_t buckets;
+	int rc = TEST_PASSED;
+
+	if (init_engine(&engine, HASH_PROBE_GROUP, STATS_SHARDS, STATS_BUCKETS,
+			0)
+	    != 0)
+		return TEST_FAILED;
+	hash_engine_get_stats(&engine, NULL, &buckets, NULL);
+
+	if (hash_engine_get_table_stats(&engine, 0, &stats) != 0
+	    || stats.slots != buckets || stats.entries || stats.tombstones
+	    || stats.clusters || stats.max_probe || stats.load_factor != 0
+	    || stats.resizing_shards || stats.resize_progress != 1.0)
+		rc = TEST_FAILED;
+	if (hash_engine_get_table_stats(NULL, 0, &stats) != -EINVAL
+	    || hash_engine_get_table_stats(&engine, 0, NULL) != -EINVAL)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+check_full_walk(int probe_mode)
+{
+	struct hash_engine engine;
+	struct hash_table_stats stats;
+	struct hash_probe_stats probe;
+	uint64_t items;
+	uint64_t buckets;
+	double occupied;
+	int rc = TEST_PASSED;
+
+	if (init_engine(&engine, probe_mode, STATS_SHARDS, STATS_BUCKETS, 0)
+	    != 0)
+		return TEST_FAILED;
+	for (int i = 0; i < STATS_KEYS; i++)
+		if (put_key(&engine, i) != 0)
+			rc = TEST_FAILED;
+	for (int i = 0; i < DELETED_KEYS; i++)
+		if (delete_key(&engine, i) != 0)
+			rc = TEST_FAILED;
+
+	hash_engine_get_stats(&engine, &items, &buckets, NULL);
+	if (hash_engine_get_table_stats(&engine, 0, &stats) != 0
+	    || hash_engine_get_probe_stats(&engine, &probe) != 0)
+		rc = TEST_FAILED;
+
+	if (!check_consistent(&stats) || stats.slots != buckets
+	    || stats.entries != items
+	    || stats.tombstones != probe.tombstones
+	    || stats.max_probe != probe.max_probe
+	    || stats.p99_probe != probe.p99_probe
+	    || stats.avg_probe != probe.avg_probe
+	    || fabs(stats.load_factor - (double)items / (double)buckets)
+		   > 1e-9)
+		rc = TEST_FAILED;
+	/* Group-mode deletes leave tombstones; Robin Hood ones shift back */
+	if (probe_mode == HASH_PROBE_GROUP ? stats.tombstones == 0
+					   : stats.tombstones != 0)
+		rc = TEST_FAILED;
+	/* Every occupied slot is in exactly one cluster */
+	occupied = stats.avg_cluster * (double)stats.clusters;
+	if (fabs(occupied - (double)(stats.entries + stats.tombstones)) > 0.5)
+		rc = TEST_FAILED;
+
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+test_full_walk_group(void)
+{
+	return check_full_walk(HASH_PROBE_GROUP);
+}
+
+static int
+test_full_walk_robin_hood(void)
+{
+	return check_full_walk(HASH_PROBE_ROBIN_HOOD);
+}
+
+static int
+test_sampled_walk(void)
+{
+	struct hash_engine engine;
+	struct hash_table_stats full;
+	struct hash_table_stats sampled;
+	int rc = TEST_PASSED;
+
+	if (init_engine(&engine, HASH_PROBE_GROUP, STATS_SHARDS, STATS_BUCKETS,
+			0)
+	    != 0)
+		return TEST_FAILED;
+	for (int i = 0; i < STATS_KEYS; i++)
+		put_key(&engine, i);
+
+	if (hash_engine_get_table_stats(&engine, 0, &full) != 0
+	    || hash_engine_get_table_stats(&engine, SAMPLE_SLOTS, &sampled)
+		   != 0)
+		rc = TEST_FAILED;
+	if (!check_consistent(&sampled)
+	    || sampled.slots != (uint64_t)SAMPLE_SLOTS * STATS_SHARDS
+	    || sampled.max_probe > full.max_probe
+	    || sampled.longest_cluster > full.longest_cluster
+	    || fabs(sampled.load_factor - full.load_factor) > 0.05)
+		rc = TEST_FAILED;
+
+	/* A sample covering the table is a full walk */
+	if (hash_engine_get_table_stats(&engine, STATS_BUCKETS, &sampled) != 0
+	    || sampled.slots != full.slots || sampled.entries != full.entries
+	    || sampled.clusters != full.clusters)
+		rc = TEST_FAILED;
+
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+test_resize_progress(void)
+{
+	struct hash_engine engine;
+	struct hash_table_stats stats;
+	int rc = TEST_PASSED;
+	int id = 0;
+
+	/* One bucket migrated per operation keeps the resize going a while */
+	if (init_engine(&engine, HASH_PROBE_GROUP, 1, 1024, 1) != 0)
+		return TEST_FAILED;
+	while (!atomic_load(&engine.shards[0].old_table) && id < 100000)
+		put_key(&engine, id++);
+
+	if (hash_engine_get_table_stats(&engine, 0, &stats) != 0
+	    || stats.resizing_shards != 1 || stats.resize_remaining == 0
+	    || stats.resize_progress >= 1.0)
+		rc = TEST_FAILED;
+
+	for (int i = 0; i < 100000 && atomic_load(&engine.shards[0].old_table);
+	     i++)
+		put_key(&engine, i % id);
+	if (hash_engine_get_table_stats(&engine, 0, &stats) != 0
+	    || stats.resizing_shards != 0 || stats.resize_remaining != 0
+	    || stats.resize_progress != 1.0 || stats.entries != (uint64_t)id)
+		rc = TEST_FAILED;
+
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+int
+main(void)
+{
+	printf("===== Hash Table Stats Tests =====\n\n");
+
+	RUN_TEST(test_empty_engine);
+	RUN_TEST(test_full_walk_group);
+	RUN_TEST(test_full_walk_robin_hood);
+	RUN_TEST(test_sampled_walk);
+	RUN_TEST(test_resize_progress);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
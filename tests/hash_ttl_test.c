@@ -0,0 +1,578 @@
+/**
+ * @file hash_ttl_test.c
+ * @brief Tests for per-key TTLs and the expiry timer wheel
+ *
+ * Runs the engine on a test clock. Checks that the wheel fires every timer
+ * once and never early, at every level; that expired entries are hidden
+ * from lookups, deletes and scans at once and reclaimed by hash_expire()
+ * and by writers; that expiry survives resizes, Robin Hood shifts and a
+ * snapshot round trip; and that concurrent writers and expiry agree on the
+ * final count.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "storage/hash/ttl_wheel.h"
+#include "storage/hash_engine.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+#define TTL_KEYS 4000
+#define WHEEL_TIMERS 20000
+#define START_TIME 1000000
+#define SNAPSHOT_PATH "hash_ttl_test.snap"
+#define WRITER_THREADS 4
+#define WRITER_KEYS 20000
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+static _Atomic uint32_t test_now;
+
+static uint32_t
+test_clock(void *arg)
+{
+	return atomic_load(&test_now);
+}
+
+static int
+init_engine(struct hash_engine *engine, int probe_mode, uint32_t shards,
+	    uint64_t buckets)
+{
+	struct hash_engine_config config = {
+		.bucket_count = buckets,
+		.probe_mode = probe_mode,
+		.shard_count = shards,
+		.clock = test_clock,
+	};
+
+	atomic_store(&test_now, START_TIME);
+	return hash_engine_init_config(engine, &config);
+}
+
+static size_t
+make_key(char *buf, size_t len, int i)
+{
+	return (size_t)snprintf(buf, len, "ttl_key_%d", i);
+}
+
+static uint64_t
+item_count(struct hash_engine *engine)
+{
+	uint64_t items = 0;
+
+	hash_engine_get_stats(engine, &items, NULL, NULL);
+	return items;
+}
+
+/* Key i lives for 1 + i % span seconds; returns how many are due by now */
+static int
+put_ttl_keys(struct hash_engine *engine, int count, uint32_t span)
+{
+	char key[32];
+
+	for (int i = 0; i < count; i++) {
+		size_t key_len = make_key(key, sizeof(key), i);
+
+		if (hash_put_ttl(engine, key, key_len, &i, sizeof(i),
+				 1 + (uint32_t)i % span)
+		    != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Every key is present exactly when its TTL has not run out at now */
+static int
+check_ttl_keys(struct hash_engine *engine, int count, uint32_t span)
+{
+	uint32_t now = atomic_load(&test_now);
+	char key[32];
+
+	for (int i = 0; i < count; i++) {
+		size_t key_len = make_key(key, sizeof(key), i);
+		uint32_t expires = START_TIME + 1 + (uint32_t)i % span;
+		int value = -1;
+		int rc = hash_get_copy(engine, key, key_len, &value,
+				       sizeof(value), NULL);
+
+		if (expires <= now ? rc != -ENOENT : rc != 0 || value != i)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+test_wheel_fires_once_on_time(void)
+{
+	static struct ttl_timer out[WHEEL_TIMERS];
+	static uint32_t expires[WHEEL_TIMERS];
+	static int fired[WHEEL_TIMERS];
+	struct ttl_wheel wheel;
+	uint32_t now = START_TIME;
+	int rc = TEST_PASSED;
+	size_t total = 0;
+
+	srand(42);
+	ttl_wheel_init(&wheel, now);
+	for (int i = 0; i < WHEEL_TIMERS; i++) {
+		/* Spread over every level, plus some past the top one */
+		uint32_t span = i % 5 == 4 ? 1U << 26 : 1U << (6 * (i % 5));
+
+		expires[i] = now + (uint32_t)rand() % span;
+		fired[i] = 0;
+		if (ttl_wheel_add(&wheel, (uint64_t)i, expires[i]) != 0)
+			rc = TEST_FAILED;
+	}
+
+	while (total < WHEEL_TIMERS && rc == TEST_PASSED) {
+		size_t n;
+
+		/* Uneven steps, small batches, to stop mid-second often */
+		now += 1 + (uint32_t)rand() % 20000;
+		do {
+			n = ttl_wheel_expire(&wheel, now, out, 7);
+			for (size_t i = 0; i < n; i++) {
+				uint64_t t = out[i].hash;
+
+				if (t >= WHEEL_TIMERS || fired[t]++
+				    || expires[t] > now
+				    || out[i].expires != expires[t])
+					rc = TEST_FAILED;
+			}
+			total += n;
+		} while (n > 0);
+
+		for (int i = 0; i < WHEEL_TIMERS; i++) {
+			if (expires[i] <= now && !fired[i])
+				rc = TEST_FAILED;
+		}
+	}
+	if (wheel.count != 0)
+		rc = TEST_FAILED;
+	ttl_wheel_destroy(&wheel);
+	return rc;
+}
+
+static int
+test_ttl_lazy_expiry(void)
+{
+	struct hash_engine engine;
+	const char *key = "session";
+	uint64_t expired = 0;
+	int value = 7;
+	int rc = TEST_PASSED;
+
+	if (init_engine(&engine, HASH_PROBE_GROUP, 1, 64) != 0)
+		return TEST_FAILED;
+
+	if (hash_put_ttl(&engine, key, strlen(key), &value, sizeof(value), 10)
+	    != 0)
+		rc = TEST_FAILED;
+	atomic_store(&test_now, START_TIME + 9);
+	if (hash_get(&engine, key, strlen(key), NULL, NULL) != 0)
+		rc = TEST_FAILED;
+
+	/* Hidden the second it expires, but still counted until reclaimed */
+	atomic_store(&test_now, START_TIME + 10);
+	if (hash_get(&engine, key, strlen(key), NULL, NULL) != -ENOENT
+	    || hash_get_copy(&engine, key, strlen(key), &value, sizeof(value),
+			     NULL)
+		   != -ENOENT
+	    || item_count(&engine) != 1)
+		rc = TEST_FAILED;
+	if (hash_expire(&engine, 0, &expired) != 0 || expired != 1
+	    || item_count(&engine) != 0)
+		rc = TEST_FAILED;
+
+	/* A delete of an expired entry removes it but reports it missing */
+	hash_put_ttl(&engine, key, strlen(key), &value, sizeof(value), 5);
+	atomic_store(&test_now, START_TIME + 20);
+	if (hash_delete(&engine, key, strlen(key)) != -ENOENT
+	    || item_count(&engine) != 0)
+		rc = TEST_FAILED;
+	if (hash_expire(&engine, 0, &expired) != 0 || expired != 0)
+		rc = TEST_FAILED;
+
+	if (hash_expire(NULL, 0, NULL) != -EINVAL
+	    || hash_put_ttl(&engine, NULL, 1, &value, sizeof(value), 1)
+		   != -EINVAL)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+test_ttl_overwrite(void)
+{
+	struct hash_engine engine;
+	const char *plain = "plain";
+	const char *renewed = "renewed";
+	uint64_t expired = 0;
+	int value = 1;
+	int rc = TEST_PASSED;
+
+	if (init_engine(&engine, HASH_PROBE_GROUP, 1, 64) != 0)
+		return TEST_FAILED;
+
+	/* hash_put() clears the TTL; a later hash_put_ttl() replaces it */
+	hash_put_ttl(&engine, plain, strlen(plain), &value, sizeof(value), 5);
+	hash_put(&engine, plain, strlen(plain), &value, sizeof(value));
+	hash_put_ttl(&engine, renewed, strlen(renewed), &value, sizeof(value),
+		     5);
+	hash_put_ttl(&engine, renewed, strlen(renewed), &value, sizeof(value),
+		     50);
+
+	/* The stale timers fire and find nothing due */
+	atomic_store(&test_now, START_TIME + 10);
+	if (hash_expire(&engine, 0, &expired) != 0 || expired != 0
+	    || hash_get(&engine, plain, strlen(plain), NULL, NULL) != 0
+	    || hash_get(&engine, renewed, strlen(renewed), NULL, NULL) != 0)
+		rc = TEST_FAILED;
+
+	atomic_store(&test_now, START_TIME + 50);
+	if (hash_expire(&engine, 0, &expired) != 0 || expired != 1
+	    || hash_get(&engine, renewed, strlen(renewed), NULL, NULL)
+		   != -ENOENT
+	    || hash_get(&engine, plain, strlen(plain), NULL, NULL) != 0)
+		rc = TEST_FAILED;
+
+	/* An expired key put again is live under its new TTL */
+	hash_put_ttl(&engine, renewed, strlen(renewed), &value, sizeof(value),
+		     5);
+	atomic_store(&test_now, START_TIME + 60);
+	hash_put_ttl(&engine, renewed, strlen(renewed), &value, sizeof(value),
+		     5);
+	if (hash_get(&engine, renewed, strlen(renewed), NULL, NULL) != 0
+	    || item_count(&engine) != 2)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+test_ttl_refresh_keeps_one_timer(void)
+{
+	struct hash_engine engine;
+	const char *key = "session";
+	uint64_t expired = 0;
+	int value = 1;
+	int rc = TEST_PASSED;
+	int i;
+
+	if (init_engine(&engine, HASH_PROBE_GROUP, 1, 64) != 0)
+		return TEST_FAILED;
+
+	/* Pushing the expiry out adds no timer */
+	for (i = 0; i < 1000; i++)
+		hash_put_ttl(&engine, key, strlen(key), &value, sizeof(value),
+			     10 + i);
+	if (atomic_load(&engine.shards[0].timers) != 1)
+		rc = TEST_FAILED;
+
+	/* The timer fires early, finds the entry not due and is set again */
+	atomic_store(&test_now, START_TIME + 10);
+	if (hash_expire(&engine, 0, &expired) != 0 || expired != 0
+	    || hash_get(&engine, key, strlen(key), NULL, NULL) != 0
+	    || atomic_load(&engine.shards[0].timers) != 1)
+		rc = TEST_FAILED;
+
+	/* Pulling the expiry in adds a timer, which reclaims the entry */
+	hash_put_ttl(&engine, key, strlen(key), &value, sizeof(value), 10);
+	if (atomic_load(&engine.shards[0].timers) != 2)
+		rc = TEST_FAILED;
+	atomic_store(&test_now, START_TIME + 20);
+	if (hash_expire(&engine, 0, &expired) != 0 || expired != 1
+	    || hash_get(&engine, key, strlen(key), NULL, NULL) != -ENOENT
+	    || atomic_load(&engine.shards[0].timers) != 1)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+/* Steps the clock over keys spread across seconds and wheel levels */
+static int
+run_expiry_steps(int probe_mode, uint32_t shards)
+{
+	static const uint32_t steps[] = { 1, 30, 64, 500, 4096, 5000, 70000 };
+	struct hash_engine engine;
+	uint32_t span = 80000;
+	uint64_t reclaimed = 0;
+	int rc = TEST_PASSED;
+
+	/* Small start, so the puts grow every shard several times */
+	if (init_engine(&engine, probe_mode, shards, 16 * shards) != 0)
+		return TEST_FAILED;
+	if (put_ttl_keys(&engine, TTL_KEYS, span) != 0)
+		rc = TEST_FAILED;
+
+	for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+		uint32_t now = START_TIME + steps[s];
+		uint64_t expired = 0;
+		uint64_t due = 0;
+
+		atomic_store(&test_now, now);
+		for (int i = 0; i < TTL_KEYS; i++) {
+			if (START_TIME + 1 + (uint32_t)i % span <= now)
+				due++;
+		}
+		if (check_ttl_keys(&engine, TTL_KEYS, span) != 0
+		    || hash_expire(&engine, 0, &expired) != 0)
+			rc = TEST_FAILED;
+		reclaimed += expired;
+		if (reclaimed != due || item_count(&engine) != TTL_KEYS - due)
+			rc = TEST_FAILED;
+	}
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+test_ttl_expiry_steps(void)
+{
+	return run_expiry_steps(HASH_PROBE_GROUP, 1);
+}
+
+static int
+test_ttl_expiry_robin_hood_shards(void)
+{
+	return run_expiry_steps(HASH_PROBE_ROBIN_HOOD, 4);
+}
+
+static int
+test_ttl_budget_and_assist(void)
+{
+	struct hash_engine engine;
+	uint64_t expired = 0;
+	char key[32];
+	int rc = TEST_PASSED;
+
+	if (init_engine(&engine, HASH_PROBE_GROUP, 1, 4096) != 0)
+		return TEST_FAILED;
+	for (int i = 0; i < 1000; i++) {
+		size_t key_len = make_key(key, sizeof(key), i);
+
+		hash_put_ttl(&engine, key, key_len, &i, sizeof(i), 1);
+	}
+
+	atomic_store(&test_now, START_TIME + 1);
+	if (hash_expire(&engine, 100, &expired) != 0 || expired != 100
+	    || item_count(&engine) != 900)
+		rc = TEST_FAILED;
+
+	/* Each plain put now reclaims HASH_EXPIRE_ASSIST more */
+	for (int i = 0; i < 10; i++) {
+		size_t key_len = make_key(key, sizeof(key), 100000 + i);
+
+		hash_put(&engine, key, key_len, &i, sizeof(i));
+	}
+	if (item_count(&engine) != 900 + 10 - 10 * HASH_EXPIRE_ASSIST)
+		rc = TEST_FAILED;
+
+	if (hash_expire(&engine, 0, &expired) != 0
+	    || expired != 900 - 10 * HASH_EXPIRE_ASSIST
+	    || item_count(&engine) != 10)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+count_entry(void *arg, const void *key, size_t key_len, const void *value,
+	    size_t value_len)
+{
+	(*(int *)arg)++;
+	return 0;
+}
+
+static int
+test_ttl_scan_skips_expired(void)
+{
+	struct hash_engine engine;
+	uint64_t cursor = 0;
+	int seen = 0;
+	int rc = TEST_PASSED;
+
+	if (init_engine(&engine, HASH_PROBE_GROUP, 2, 256) != 0)
+		return TEST_FAILED;
+	if (put_ttl_keys(&engine, 1000, 10) != 0)
+		rc = TEST_FAILED;
+
+	/* Keys with i % 10 < 4 have run out */
+	atomic_store(&test_now, START_TIME + 4);
+	do {
+		if (hash_scan(&engine, cursor, 64, count_entry, &seen, &cursor)
+		    != 0)
+			rc = TEST_FAILED;
+	} while (cursor != 0 && rc == TEST_PASSED);
+	if (seen != 600)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+static int
+test_ttl_snapshot(void)
+{
+	struct hash_engine engine;
+	struct hash_engine loaded;
+	struct hash_engine_config config = { .clock = test_clock };
+	uint64_t expired = 0;
+	uint32_t span = 100;
+	int rc = TEST_PASSED;
+
+	if (init_engine(&engine, HASH_PROBE_GROUP, 2, 256) != 0)
+		return TEST_FAILED;
+	if (put_ttl_keys(&engine, TTL_KEYS, span) != 0
+	    || hash_engine_save(&engine, SNAPSHOT_PATH) != 0)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	if (rc != TEST_PASSED)
+		return rc;
+
+	if (hash_engine_load(&loaded, SNAPSHOT_PATH, &config, 0) != 0) {
+		unlink(SNAPSHOT_PATH);
+		return TEST_FAILED;
+	}
+
+	/* Expiry times and the wheels come back with the tables */
+	atomic_store(&test_now, START_TIME + 50);
+	if (check_ttl_keys(&loaded, TTL_KEYS, span) != 0
+	    || hash_expire(&loaded, 0, &expired) != 0
+	    || expired != TTL_KEYS / 2 || item_count(&loaded) != TTL_KEYS / 2)
+		rc = TEST_FAILED;
+	atomic_store(&test_now, START_TIME + span);
+	if (hash_expire(&loaded, 0, &expired) != 0
+	    || expired != TTL_KEYS / 2 || item_count(&loaded) != 0)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&loaded);
+	unlink(SNAPSHOT_PATH);
+	return rc;
+}
+
+struct writer_arg {
+	struct hash_engine *engine;
+	int id;
+	_Atomic int *stop;
+	int failed;
+};
+
+static void *
+ttl_writer(void *p)
+{
+	struct writer_arg *arg = p;
+	char key[32];
+
+	for (int i = 0; i < WRITER_KEYS; i++) {
+		size_t key_len = (size_t)snprintf(key, sizeof(key), "w%d_%d",
+						  arg->id, i % 5000);
+
+		if (hash_put_ttl(arg->engine, key, key_len, &i, sizeof(i),
+				 1 + (uint32_t)i % 3)
+		    != 0)
+			arg->failed = 1;
+		if (i % 7 == 0)
+			hash_delete(arg->engine, key, key_len);
+	}
+	return NULL;
+}
+
+static void *
+ttl_ticker(void *p)
+{
+	struct writer_arg *arg = p;
+
+	while (!atomic_load(arg->stop)) {
+		atomic_fetch_add(&test_now, 1);
+		if (hash_expire(arg->engine, 64, NULL) != 0)
+			arg->failed = 1;
+		usleep(100);
+	}
+	return NULL;
+}
+
+static int
+test_ttl_concurrent(void)
+{
+	struct writer_arg args[WRITER_THREADS + 1];
+	pthread_t threads[WRITER_THREADS + 1];
+	struct hash_engine engine;
+	_Atomic int stop = 0;
+	uint64_t expired = 0;
+	int rc = TEST_PASSED;
+	int i;
+
+	if (init_engine(&engine, HASH_PROBE_GROUP, 4, 64) != 0)
+		return TEST_FAILED;
+	for (i = 0; i <= WRITER_THREADS; i++) {
+		args[i].engine = &engine;
+		args[i].id = i;
+		args[i].stop = &stop;
+		args[i].failed = 0;
+		pthread_create(&threads[i], NULL,
+			       i < WRITER_THREADS ? ttl_writer : ttl_ticker,
+			       &args[i]);
+	}
+	for (i = 0; i < WRITER_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	atomic_store(&stop, 1);
+	pthread_join(threads[WRITER_THREADS], NULL);
+	for (i = 0; i <= WRITER_THREADS; i++) {
+		if (args[i].failed)
+			rc = TEST_FAILED;
+	}
+
+	/* Once everything has run out, the wheels account for every item */
+	atomic_fetch_add(&test_now, 10);
+	if (hash_expire(&engine, 0, &expired) != 0 || item_count(&engine) != 0)
+		rc = TEST_FAILED;
+	hash_engine_destroy(&engine);
+	return rc;
+}
+
+int
+main(void)
+{
+	printf("===== Hash TTL Tests =====\n\n");
+
+	RUN_TEST(test_wheel_fires_once_on_time);
+	RUN_TEST(test_ttl_lazy_expiry);
+	RUN_TEST(test_ttl_overwrite);
+	RUN_TEST(test_ttl_refresh_keeps_one_timer);
+	RUN_TEST(test_ttl_expiry_steps);
+	RUN_TEST(test_ttl_expiry_robin_hood_shards);
+	RUN_TEST(test_ttl_budget_and_assist);
+	RUN_TEST(test_ttl_scan_skips_expired);
+	RUN_TEST(test_ttl_snapshot);
+	RUN_TEST(test_ttl_concurrent);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,256 @@
+/**
+ * @file hasher_test.c
+ * @brief Tests for the selectable hash functions
+ *
+ * Checks CRC32C against reference vectors, hardware against table-driven
+ * CRC32C, multi-lane against scalar SipHash, basic sanity of every hasher,
+ * and engines built on each of them.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "storage/hash/hasher.h"
+#include "storage/hash/siphash.h"
+#include "storage/hash_engine.h"
+
+#define TEST_PASSED 0
+#define TEST_FAILED 1
+
+#define MAX_KEY_LEN 300
+#define LANE_ROUNDS 2000
+
+static int tests_run = 0;
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define RUN_TEST(test)                                                         \
+	do {                                                                   \
+		printf("Running %s...", #test);                                \
+		fflush(stdout);                                                \
+		tests_run++;                                                   \
+		if ((test)() == TEST_PASSED) {                                 \
+			printf(" PASSED\n");                                   \
+			tests_passed++;                                        \
+		} else {                                                       \
+			printf(" FAILED\n");                                   \
+			tests_failed++;                                        \
+		}                                                              \
+	} while (0)
+
+/* Test: CRC32C matches the RFC 3720 check values */
+static int
+test_crc32c_vectors(void)
+{
+	unsigned char zeros[32] = { 0 };
+	unsigned char ones[32];
+
+	memset(ones, 0xff, sizeof(ones));
+	if (crc32c(0, "123456789", 9) != 0xe3069283U)
+		return TEST_FAILED;
+	if (crc32c_sw(0, "123456789", 9) != 0xe3069283U)
+		return TEST_FAILED;
+	if (crc32c(0, zeros, sizeof(zeros)) != 0x8a9136aaU)
+		return TEST_FAILED;
+	if (crc32c(0, ones, sizeof(ones)) != 0x62a8ab43U)
+		return TEST_FAILED;
+	/* Checksums extend across calls */
+	if (crc32c(crc32c(0, "1234", 4), "56789", 5) != 0xe3069283U)
+		return TEST_FAILED;
+	return TEST_PASSED;
+}
+
+/* Test: The dispatched CRC32C agrees with the table at every length */
+static int
+test_crc32c_dispatch_matches_table(void)
+{
+	unsigned char buf[MAX_KEY_LEN + 8];
+	unsigned int seed = 3;
+	size_t len;
+	size_t off;
+
+	for (len = 0; len < sizeof(buf); len++)
+		buf[len] = (unsigned char)rand_r(&seed);
+
+	/* Odd offsets exercise unaligned word loads */
+	for (off = 0; off < 8; off++) {
+		for (len = 0; len <= MAX_KEY_LEN; len++) {
+			if (crc32c(0, buf + off, len)
+			    != crc32c_sw(0, buf + off, len)) {
+				fprintf(stderr, "mismatch at %zu+%zu\n", off,
+					len);
+				return TEST_FAILED;
+			}
+		}
+	}
+	return TEST_PASSED;
+}
+
+/* Test: Lane kernels match scalar SipHash for any mix of lengths */
+static int
+test_siphash_lanes_match_scalar(void)
+{
+	unsigned char buf[MAX_KEY_LEN + 64];
+	const void *data[40];
+	size_t len[40];
+	uint64_t out[40];
+	uint8_t key[16];
+	unsigned int seed = 5;
+	int round;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		key[i] = (uint8_t)i;
+	for (i = 0; i < 15; i++)
+		buf[i] = (unsigned char)i;
+	/* Reference vector from the SipHash paper */
+	if (siphash_key(buf, 15, key) != 0xa129ca6149be45e5ULL)
+		return TEST_FAILED;
+
+	for (i = 0; i < (int)sizeof(buf); i++)
+		buf[i] = (unsigned char)rand_r(&seed);
+
+	for (round = 0; round < LANE_ROUNDS; round++) {
+		int n = round % 41;
+		/* Every few rounds, equal lengths take the unmasked path */
+		int same = round % 4 == 0;
+
+		for (i = 0; i < n; i++) {
+			data[i] = buf + rand_r(&seed) % 64;
+			len[i] = same ? (size_t)round % MAX_KEY_LEN
+				      : (size_t)rand_r(&seed) % MAX_KEY_LEN;
+		}
+		siphash_batch(data, len, (size_t)n, 7, 9, out);
+		for (i = 0; i < n; i++) {
+			if (out[i] != siphash(data[i], len[i], 7, 9))
+				goto mismatch;
+		}
+		if (n >= 8) {
+			siphash_x8(data, len, 7, 9, out);
+			for (i = 0; i < 8; i++) {
+				if (out[i] != siphash(data[i], len[i], 7, 9))
+					goto mismatch;
+			}
+			siphash_x4(data, len, 7, 9, out);
+			for (i = 0; i < 4; i++) {
+				if (out[i] != siphash(data[i], len[i], 7, 9))
+					goto mismatch;
+			}
+		}
+	}
+	return TEST_PASSED;
+mismatch:
+	fprintf(stderr, "lane %d (len %zu) differs in round %d\n", i, len[i],
+		round);
+	return TEST_FAILED;
+}
+
+/*
+ * Test: Every hasher is deterministic, keyed, and separates keys that
+ * differ in one byte or only in length
+ */
+static int
+test_hasher_sanity(void)
+{
+	unsigned char buf[MAX_KEY_LEN];
+	hasher_fn fn;
+	size_t len;
+	int kind;
+
+	memset(buf, 0, sizeof(buf));
+	if (hasher_get(HASHER_COUNT) != NULL || hasher_get(-1) != NULL)
+		return TEST_FAILED;
+	if (hasher_name(HASHER_COUNT) != NULL)
+		return TEST_FAILED;
+
+	for (kind = 0; kind < HASHER_COUNT; kind++) {
+		fn = hasher_get(kind);
+		if (!fn || !hasher_name(kind))
+			return TEST_FAILED;
+
+		for (len = 1; len < MAX_KEY_LEN; len++) {
+			uint64_t h = fn(buf, len, 1, 2);
+
+			if (h != fn(buf, len, 1, 2))
+				return TEST_FAILED;
+			if (h == fn(buf, len, 3, 2)
+			    || h == fn(buf, len - 1, 1, 2))
+				goto collide;
+			buf[len / 2] ^= 0x40;
+			if (h == fn(buf, len, 1, 2))
+				goto collide;
+			buf[len / 2] ^= 0x40;
+		}
+	}
+	return TEST_PASSED;
+collide:
+	fprintf(stderr, "%s collided at length %zu\n", hasher_name(kind), len);
+	return TEST_FAILED;
+}
+
+/* Test: Engines work on every hasher and reject unknown ones */
+static int
+test_engine_hashers(void)
+{
+	struct hash_engine engine;
+	struct hash_engine_config config = {
+		.bucket_count = MIN_BUCKET_COUNT,
+		.hasher = HASHER_COUNT,
+	};
+	char key[32];
+	int stored;
+	size_t value_len;
+	int kind;
+	int i;
+
+	if (hash_engine_init_config(&engine, &config) != -EINVAL)
+		return TEST_FAILED;
+
+	for (kind = 0; kind < HASHER_COUNT; kind++) {
+		config.hasher = kind;
+		if (hash_engine_init_config(&engine, &config) != 0)
+			return TEST_FAILED;
+		for (i = 0; i < 2000; i++) {
+			snprintf(key, sizeof(key), "hasher_key_%d", i);
+			if (hash_put(&engine, key, strlen(key), &i, sizeof(i))
+			    != 0)
+				goto fail;
+		}
+		for (i = 0; i < 2000; i++) {
+			snprintf(key, sizeof(key), "hasher_key_%d", i);
+			if (hash_get_copy(&engine, key, strlen(key), &stored,
+					  sizeof(stored), &value_len)
+				    != 0
+			    || stored != i)
+				goto fail;
+		}
+		hash_engine_destroy(&engine);
+	}
+	return TEST_PASSED;
+fail:
+	fprintf(stderr, "%s lost key %d\n", hasher_name(kind), i);
+	hash_engine_destroy(&engine);
+	return TEST_FAILED;
+}
+
+int
+main(void)
+{
+	printf("===== Hasher Tests =====\n\n");
+
+	RUN_TEST(test_crc32c_vectors);
+	RUN_TEST(test_crc32c_dispatch_matches_table);
+	RUN_TEST(test_siphash_lanes_match_scalar);
+	RUN_TEST(test_hasher_sanity);
+	RUN_TEST(test_engine_hashers);
+
+	printf("\n========================================\n");
+	printf("Tests run: %d\n", tests_run);
+	printf("Tests passed: %d\n", tests_passed);
+	printf("Tests failed: %d\n", tests_failed);
+	printf("========================================\n");
+
+	return tests_failed > 0 ? 1 : 0;
+}
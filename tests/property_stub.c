@@ -31,7 +31,7 @@ run_trial(void)
 {
 	struct hash_engine engine;
 	struct oracle_slot slots[KEY_SPACE];
-	uint32_t item_count = 0;
+	uint64_t item_count = 0;
 	int expected = 0;
 	int op;
 	int i;
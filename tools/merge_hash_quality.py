@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+"""Store a hash_throughput_bench HASH_QUALITY_JSON file in metrics.json.
+
+Usage: merge_hash_quality.py <hash_quality.json>
+
+Its figures replace those under "sprint2_hash"/"hash_quality", and the run
+that produced them is kept beside them as "run". metrics.json is created
+from the template first if it does not exist yet, as generate_report.sh
+does.
+"""
+import json
+import os
+import shutil
+import sys
+
+ROOT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+JSON_FILE = os.path.join(ROOT_DIR, "metrics.json")
+TEMPLATE = os.path.join(ROOT_DIR, "tools", "metrics_template.json")
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("usage: merge_hash_quality.py <hash_quality.json>")
+    with open(sys.argv[1]) as f:
+        quality = json.load(f)
+    if not os.path.exists(JSON_FILE):
+        shutil.copy(TEMPLATE, JSON_FILE)
+    with open(JSON_FILE) as f:
+        metrics = json.load(f)
+    metrics.setdefault("sprint2_hash", {}).setdefault("hash_quality", {})
+    metrics["sprint2_hash"]["hash_quality"].update(quality)
+    with open(JSON_FILE, "w") as f:
+        json.dump(metrics, f, indent=2)
+        f.write("\n")
+    print("Merged %s into metrics.json (sprint2_hash.hash_quality)"
+          % sys.argv[1])
+
+
+if __name__ == "__main__":
+    main()
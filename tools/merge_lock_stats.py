@@ -0,0 +1,36 @@
+#!/usr/bin/env python3
+"""Store a futex_stats_dump_json() file under "lock_contention" in metrics.json.
+
+Usage: merge_lock_stats.py <lock_stats.json>
+
+metrics.json is created from the template first if it does not exist yet,
+as generate_report.sh does.
+"""
+import json
+import os
+import shutil
+import sys
+
+ROOT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+JSON_FILE = os.path.join(ROOT_DIR, "metrics.json")
+TEMPLATE = os.path.join(ROOT_DIR, "tools", "metrics_template.json")
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("usage: merge_lock_stats.py <lock_stats.json>")
+    with open(sys.argv[1]) as f:
+        stats = json.load(f)
+    if not os.path.exists(JSON_FILE):
+        shutil.copy(TEMPLATE, JSON_FILE)
+    with open(JSON_FILE) as f:
+        metrics = json.load(f)
+    metrics["lock_contention"] = stats
+    with open(JSON_FILE, "w") as f:
+        json.dump(metrics, f, indent=2)
+        f.write("\n")
+    print("Merged %s into metrics.json (lock_contention)" % sys.argv[1])
+
+
+if __name__ == "__main__":
+    main()